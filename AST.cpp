@@ -5,134 +5,227 @@
 #include <cmath>
 
 #include "AST.h"
+#include "ArrayOps.h"
+#include "Channel.h"
+#include "EvalStack.h"
+#include "Future.h"
+#include "Specializer.h"
+#include "ThreadPool.h"
 
 namespace DragonLisp {
 
-std::shared_ptr<Value> ArrayRefAST::eval(Context* parent) {
-	// Eval this->index
-	auto idx = std::dynamic_pointer_cast<SingleValue>(this->index->eval(parent));
-	if (!idx || !idx->isInt())
+Value ArrayRefAST::eval(Context* parent) {
+	return ArrayRefAST::load(parent, this->name, this->ref, this->index->eval(parent));
+}
+
+Value ArrayRefAST::set(Context* parent, Value value) {
+	return ArrayRefAST::store(parent, this->name, this->ref, this->index->eval(parent), std::move(value));
+}
+
+Value ArrayRefAST::load(Context* parent, const std::string& name, const VarRef& ref, const Value& index) {
+	if (!index.isInt())
 		throw std::runtime_error("Cannot eval index as integer");
+	auto idx = index.getInt();
 
-	auto var = parent->getVariable(this->name);
+	auto var = parent->getVariable(name, ref);
 	if (!var)
-		throw std::runtime_error("Variable not found: " + this->name);
-	auto varC = std::dynamic_pointer_cast<ArrayValue>(var);
-	if (!varC)
-		throw std::runtime_error("Cannot reference from non-array variable: " + this->name);
-	if (varC->getSize() <= idx->getInt())
-		throw std::runtime_error("Index out of range: " + std::to_string(idx->getInt()) + " >= " + std::to_string(varC->getSize()));
-	return std::make_shared<SingleValue>((*varC)[idx->getInt()]);
-}
-
-std::shared_ptr<Value> ArrayRefAST::set(Context* parent, std::shared_ptr<Value> value) {
-	// Eval this->index
-	auto idx = std::dynamic_pointer_cast<SingleValue>(this->index->eval(parent));
-	if (!idx || !idx->isInt())
+		throw std::runtime_error("Variable not found: " + name);
+	if (!var->isArray())
+		throw std::runtime_error("Cannot reference from non-array variable: " + name);
+	auto varC = var->getArray();
+	if (varC->getSize() <= static_cast<std::size_t>(idx))
+		throw std::runtime_error("Index out of range: " + std::to_string(idx) + " >= " + std::to_string(varC->getSize()));
+	if (auto w = LoopDoTimesAST::worker; w && !w->deferred.empty()) [[unlikely]] {
+		if (auto v = w->find(varC, idx))
+			return *v;
+	}
+	return varC->get(idx);
+}
+
+Value ArrayRefAST::store(Context* parent, const std::string& name, const VarRef& ref, const Value& index, Value value) {
+	if (!index.isInt())
 		throw std::runtime_error("Cannot eval index as integer");
+	auto idx = index.getInt();
 
-	auto var = parent->getVariable(this->name);
+	auto var = parent->getVariable(name, ref);
 	if (!var)
-		throw std::runtime_error("Variable not found: " + this->name);
-	auto varC = std::dynamic_pointer_cast<ArrayValue>(var);
-	if (!varC)
-		throw std::runtime_error("Cannot reference from non-array variable: " + this->name);
-	if (varC->getSize() <= idx->getInt())
-		throw std::runtime_error("Index out of range: " + std::to_string(idx->getInt()) + " >= " + std::to_string(varC->getSize()));
-
-	auto val = std::dynamic_pointer_cast<SingleValue>(value);
-	if (!val)
+		throw std::runtime_error("Variable not found: " + name);
+	if (!var->isArray())
+		throw std::runtime_error("Cannot reference from non-array variable: " + name);
+	auto varC = var->getArray();
+	if (varC->getSize() <= static_cast<std::size_t>(idx))
+		throw std::runtime_error("Index out of range: " + std::to_string(idx) + " >= " + std::to_string(varC->getSize()));
+
+	if (value.isArray())
 		throw std::runtime_error("Cannot set array element to another array");
-	varC->set(idx->getInt(), *val);
+	if (auto w = LoopDoTimesAST::worker) [[unlikely]] {
+		// Made unique before the parallel iterations started
+		w->store(varC, idx, value);
+		return value;
+	}
+	parent->getMutableVariable(name, ref)->getMutableArray()->set(idx, value);
 	return value;
 }
 
-std::shared_ptr<Value> IdentifierAST::eval(Context* parent) {
-	auto var = parent->getVariable(this->name);
+Value IdentifierAST::eval(Context* parent) {
+	auto var = parent->getVariable(this->name, this->ref);
 	if (!var)
 		throw std::runtime_error("Variable not found: " + this->name);
 	return var->copy();
 }
 
-std::shared_ptr<Value> IdentifierAST::set(Context* parent, std::shared_ptr<Value> value) {
-	parent->setVariable(this->name, value);
+Value IdentifierAST::set(Context* parent, Value value) {
+	parent->setVariable(this->name, this->storeRef, value);
 	return value;
 }
 
-std::shared_ptr<Value> FuncDefAST::eval(Context* parent, std::vector<std::shared_ptr<Value>> arg) {
-	// Create a new context
-	auto ctx = std::make_shared<Context>(parent);
-
-	// Set arguments
-	for (size_t i = 0; i < this->args.size(); i++) {
-		if (i >= arg.size())
-			throw std::runtime_error("Too few arguments");
-		ctx->setVariable(this->args[i], arg[i]);
-	}
-
-	// Eval body
-	std::shared_ptr<Value> ret = std::make_shared<SingleValue>(); // which is nil
-	for (auto& stmt : this->body) {
-		auto* ptr = stmt.get();
-		if (ptr->getType() == T_IfAST)
-			ptr = dynamic_cast<IfAST*>(ptr)->getResult(ctx.get()).get();
-		if (!ptr)
-			continue;
-		if (ptr->getType() == T_ReturnAST) {
-			auto retAST = dynamic_cast<ReturnAST*>(ptr);
-			if (this->name == retAST->getName())
-				return ptr->eval(ctx.get());
-			throw std::runtime_error("Return name mismatch. Closure is not implemented yet!");
+FuncDefAST::~FuncDefAST() {
+	for (auto spec : this->specs)
+		Specializer::release(spec);
+	for (auto spec : this->retired)
+		Specializer::release(spec);
+}
+
+void FuncDefAST::setMemo(std::size_t capacity) {
+	this->memo = std::make_unique<MemoCache>(capacity);
+}
+
+Value FuncDefAST::apply(Context* frame) {
+	MemoCache::Key key;
+	bool cached = this->memo && MemoCache::makeKey(frame, this->argSlots, key);
+	Value ret;
+	if (cached && this->memo->find(key, ret))
+		return ret;
+
+	if (!Specializer::call(this, frame, ret))
+		ret = this->call(frame);
+	if (cached)
+		this->memo->insert(std::move(key), ret.copy());
+	return ret;
+}
+
+Value FuncDefAST::call(Context* frame) {
+	// Arguments of tail calls, kept across iterations
+	std::vector<Value> args;
+
+	auto func = this;
+	while (true) {
+		// Eval body, up to a tail call if any
+		Value ret; // which is nil
+		FuncCallAST* tail = nullptr;
+		for (auto& stmt : func->body) {
+			auto* ptr = stmt;
+			if (ptr->getType() == T_IfAST)
+				ptr = dynamic_cast<IfAST*>(ptr)->getResult(frame);
+			if (!ptr)
+				continue;
+			if (ptr->getType() == T_ReturnAST) {
+				auto retAST = dynamic_cast<ReturnAST*>(ptr);
+				if (func->name != retAST->getName())
+					throw std::runtime_error("Return name mismatch. Closure is not implemented yet!");
+				ptr = retAST->getExpr();
+				if (ptr->getType() != T_FuncCallAST || !static_cast<FuncCallAST*>(ptr)->isTail())
+					return ptr->eval(frame);
+			}
+			if (ptr->getType() == T_FuncCallAST && static_cast<FuncCallAST*>(ptr)->isTail()) {
+				tail = static_cast<FuncCallAST*>(ptr);
+				break;
+			}
+			ret = ptr->eval(frame);
 		}
-		ret = ptr->eval(ctx.get());
+		if (!tail)
+			return ret;
+
+		func = tail->enter(frame, args);
+		if (func->getMemo())
+			return func->apply(frame);
+		if (Specializer::call(func, frame, ret))
+			return ret;
 	}
-	return ret;
 }
 
-std::shared_ptr<Value> FuncCallAST::eval(Context* parent) {
+Value FuncCallAST::eval(Context* parent) {
+	EvalStack::check();
+
 	// Get the function
-	auto func = parent->getFunc(this->name);
+	auto func = parent->getFunc(this->name, this->cache);
 	if (!func)
 		throw std::runtime_error("Function not defined: " + this->name);
 
-	// Eval arguments
-	std::vector<std::shared_ptr<Value>> arg;
-	for (const auto& a : this->args) {
-		arg.push_back(a->eval(parent));
+	// Eval arguments straight into a frame under the global context
+	Context ctx(parent->getRoot(), func->getSlots());
+	const auto& slots = func->getArgSlots();
+	for (std::size_t i = 0; i < this->args.size(); i++) {
+		auto v = this->args[i]->eval(parent);
+		if (i < slots.size())
+			ctx.setSlot(slots[i], std::move(v));
 	}
+	if (this->args.size() < slots.size())
+		throw std::runtime_error("Too few arguments");
 
-	// Get the global context
-	auto globalCtx = parent;
-	while (globalCtx->getParent())
-		globalCtx = globalCtx->getParent();
+	// Memoized results, or numeric functions unboxed when the argument
+	// types allow it
+	return func->apply(&ctx);
+}
 
-	// Eval under global context
-	return func->eval(globalCtx, arg);
+FuncDefAST* FuncCallAST::enter(Context* frame, std::vector<Value>& args) {
+	auto func = frame->getFunc(this->name, this->cache);
+	if (!func)
+		throw std::runtime_error("Function not defined: " + this->name);
+
+	args.clear();
+	for (const auto& a : this->args)
+		args.push_back(a->eval(frame));
+
+	// The caller's variables are dead from here on
+	frame->reframe(func->getSlots());
+	const auto& slots = func->getArgSlots();
+	for (std::size_t i = 0; i < args.size() && i < slots.size(); i++)
+		frame->setSlot(slots[i], std::move(args[i]));
+	if (args.size() < slots.size())
+		throw std::runtime_error("Too few arguments");
+	return func;
 }
 
+Value InlineCallAST::eval(Context* parent) {
+	if (parent->getFunc(this->call->getName(), this->cache) != this->callee)
+		return this->call->eval(parent);
 
-std::shared_ptr<ExprAST> IfAST::getResult(Context* parent) {
-	// Eval condition
-	auto c = this->cond->eval(parent);
-	bool ok = c->isArray();
-	if (!ok) {
-		auto cc = std::dynamic_pointer_cast<SingleValue>(c);
-		if (!cc)
-			throw std::runtime_error("Unexpected error");
-		if (!cc->isNil())
-			ok = true;
+	const auto& args = this->call->getArgs();
+	for (std::size_t i = 0; i < args.size(); i++) {
+		auto v = args[i]->eval(parent);
+		if (i < this->params.size())
+			parent->getSlot(this->params[i]) = std::move(v);
 	}
-	return ok ? this->then : this->els;
+	if (args.size() < this->params.size())
+		throw std::runtime_error("Too few arguments");
+
+	auto ret = this->body->eval(parent);
+
+	// Do not keep arrays shared past the call
+	for (const auto& p : this->params)
+		parent->getSlot(p) = Value::unbound();
+	return ret;
 }
 
 
-std::shared_ptr<Value> LoopForeverAST::eval(Context* parent) {
+ExprAST* IfAST::getResult(Context* parent) {
+	// Eval condition
+	return IfAST::isTrue(this->cond->eval(parent)) ? this->then : this->els;
+}
+
+bool IfAST::isTrue(const Value& c) {
+	return !c.isNil();
+}
+
+
+Value LoopForeverAST::eval(Context* parent) {
 	// No context is needed
 	while (true) {
 		for (auto& stmt : this->body) {
-			auto* ptr = stmt.get();
+			auto* ptr = stmt;
 			if (ptr->getType() == T_IfAST)
-				ptr = dynamic_cast<IfAST*>(ptr)->getResult(parent).get();
+				ptr = dynamic_cast<IfAST*>(ptr)->getResult(parent);
 			if (!ptr)
 				continue;
 			if (ptr->getType() == T_ReturnAST)
@@ -143,224 +236,593 @@ std::shared_ptr<Value> LoopForeverAST::eval(Context* parent) {
 	throw std::runtime_error("Unexpected error");
 }
 
-std::shared_ptr <Value> LoopForAST::eval(Context* parent) {
+Value LoopForAST::eval(Context* parent) {
 	// Create a new context
-	auto ctx = std::make_shared<Context>(parent);
+	Context ctx(parent, this->slots);
 
 	// Eval condition
-	auto s = std::dynamic_pointer_cast<SingleValue>(this->start->eval(parent)->copy());
-	auto e = std::dynamic_pointer_cast<SingleValue>(this->end->eval(parent));
+	auto s = this->start->eval(parent).copy();
+	auto e = this->end->eval(parent);
 
 	// Assert that s and e are numeric
-	if (!s || !e || (!s->isInt() && !s->isFloat()) || (!e->isInt() && !e->isFloat()))
+	if (!s.isNumber() || !e.isNumber())
 		throw std::runtime_error("LoopForAST: start and end must be numeric");
 
-	// Main loop
-	while (*s <= *e) {
-		// Set the variable
-		ctx->setVariable(this->name, s);
-
-		// Eval body
+	// Eval body, returns the statement that leaves the loop if any
+	auto run = [&]() -> ExprAST* {
 		for (auto& stmt : this->body) {
-			auto* ptr = stmt.get();
+			auto* ptr = stmt;
 			if (ptr->getType() == T_IfAST)
-				ptr = dynamic_cast<IfAST*>(ptr)->getResult(ctx.get()).get();
+				ptr = dynamic_cast<IfAST*>(ptr)->getResult(&ctx);
 			if (!ptr)
 				continue;
 			if (ptr->getType() == T_ReturnAST)
-				return ptr->eval(ctx.get());
-			ptr->eval(ctx.get());
+				return ptr;
+			ptr->eval(&ctx);
 		}
+		return nullptr;
+	};
+
+	// Integer bounds, the variable (slot 0) is only boxed if the body reads it
+	if (s.isInt() && e.isInt()) {
+		for (std::int64_t i = s.getInt(), n = e.getInt(); i <= n; ++i) {
+			if (this->varRead)
+				ctx.setSlot(0, Value(i));
+			if (auto ret = run())
+				return ret->eval(&ctx);
+			// The next step could be past the largest integer
+			if (i == n)
+				break;
+		}
+		return Value(false);
+	}
+
+	// Main loop
+	while (s <= e) {
+		// Set the variable, the Resolver puts it in slot 0
+		ctx.setSlot(0, s);
+
+		if (auto ret = run())
+			return ret->eval(&ctx);
 
 		// Increment
-		s->operator++();
+		++s;
 	}
 
 	// Return nil
-	return std::make_shared<SingleValue>(false);
+	return Value(false);
 }
 
-std::shared_ptr <Value> LoopDoTimesAST::eval(Context* parent) {
+Value LoopDoTimesAST::eval(Context* parent) {
 	// Create a new context
-	auto ctx = std::make_shared<Context>(parent);
+	Context ctx(parent, this->slots);
 
 	// Eval condition
-	auto terminate = std::dynamic_pointer_cast<SingleValue>(this->times->eval(parent)->copy());
-	if (!terminate || !terminate->isInt())
+	auto terminate = this->times->eval(parent);
+	if (!terminate.isInt())
 		throw std::runtime_error("DOTIMES: times must be an integer");
-	auto n = terminate->getInt();
+	auto n = terminate.getInt();
+
+	// Arrays written by a parallel body, made unique so that threads can
+	// store into them. Runs serially if one is not an array yet.
+	std::vector<ArrayValue*> arrays;
+	bool parallel = this->parallel && n >= PARALLEL_MIN && !ThreadPool::inWorker();
+	for (std::size_t j = 0; parallel && j < this->targets.size(); ++j) {
+		auto var = parent->getMutableVariable(this->targets[j].name, this->targets[j].ref);
+		if (!var || !var->isArray())
+			parallel = false;
+		else
+			arrays.push_back(var->getMutableArray());
+	}
 
 	// Main Loop
 	for (std::int64_t i = 0; i < n; ++i) {
-		// Set Variable
-		ctx->setVariable(this->name, std::make_shared<SingleValue>(i));
+		// Storage kinds are settled serially, the rest runs in parallel
+		if (parallel && std::none_of(arrays.begin(), arrays.end(), [](auto a) { return a->getKind() == ARRAY_EMPTY; })) {
+			if (n - i >= PARALLEL_MIN) {
+				this->runParallel(parent, ctx, i, n, arrays);
+				break;
+			}
+			parallel = false;
+		}
+
+		// Set Variable (slot 0), unless the body never reads it
+		if (this->varRead)
+			ctx.setSlot(0, Value(i));
 
 		// Eval Body
 		for (auto& stmt : this->body) {
-			auto* ptr = stmt.get();
+			auto* ptr = stmt;
 			if (ptr->getType() == T_IfAST)
-				ptr = dynamic_cast<IfAST*>(ptr)->getResult(ctx.get()).get();
+				ptr = dynamic_cast<IfAST*>(ptr)->getResult(&ctx);
 			if (!ptr)
 				continue;
 			if (ptr->getType() == T_ReturnAST)
-				return ptr->eval(ctx.get());
-			ptr->eval(ctx.get());
+				return ptr->eval(&ctx);
+			ptr->eval(&ctx);
 		}
 	}
 
 	// Return nil
-	return std::make_shared<SingleValue>(false);
+	return Value(false);
 }
 
-std::shared_ptr<Value> UnaryAST::eval(Context* parent) {
-	auto val = this->expr->eval(parent);
-	auto valS = std::dynamic_pointer_cast<SingleValue>(val);
-	switch (this->op) {
+void LoopDoTimesAST::runParallel(Context* parent, Context& ctx, std::int64_t begin, std::int64_t end, const std::vector<ArrayValue*>& arrays) {
+	auto& pool = ThreadPool::get();
+	std::vector<Worker> workers(pool.getWorkers());
+	std::vector<std::unique_ptr<Context>> frames(pool.getWorkers());
+	for (auto& w : workers) {
+		w.arrays = &arrays;
+		w.holes.assign(arrays.size(), 0);
+	}
+
+	// Pool threads keep a stack of their own for the frames they run
+	static thread_local FrameStack stack;
+
+	auto grain = std::clamp<std::int64_t>((end - begin) / (pool.getWorkers() * 64), 16, 4096);
+	pool.run(begin, end, grain, [&](std::int64_t lo, std::int64_t hi, unsigned id) {
+		auto frame = &ctx;
+		if (id) {
+			if (!frames[id])
+				frames[id] = std::make_unique<Context>(parent, this->slots, &stack);
+			frame = frames[id].get();
+		}
+
+		struct Scope {
+			Worker* outer;
+			~Scope() {
+				LoopDoTimesAST::worker = this->outer;
+			}
+		} scope{ std::exchange(LoopDoTimesAST::worker, &workers[id]) };
+
+		for (auto i = lo; i < hi; ++i) {
+			workers[id].iteration = i;
+			if (this->varRead)
+				frame->setSlot(0, Value(i));
+			for (auto& stmt : this->body) {
+				auto* ptr = stmt;
+				if (ptr->getType() == T_IfAST)
+					ptr = dynamic_cast<IfAST*>(ptr)->getResult(frame);
+				if (ptr)
+					ptr->eval(frame);
+			}
+		}
+	});
+
+	for (const auto& w : workers)
+		for (std::size_t j = 0; j < arrays.size(); ++j)
+			arrays[j]->addHoles(w.holes[j]);
+	for (const auto& w : workers)
+		for (const auto& d : w.deferred)
+			d.array->set(d.index, d.value);
+}
+
+void LoopDoTimesAST::Worker::store(ArrayValue* array, std::size_t index, const Value& value) {
+	auto j = std::find(this->arrays->begin(), this->arrays->end(), array) - this->arrays->begin();
+	if (j == static_cast<std::ptrdiff_t>(this->arrays->size()))
+		throw std::runtime_error("Unexpected error");
+
+	// Later stores of the element stay after the deferred one
+	if (this->find(array, index) || !array->setInPlace(index, value, this->holes[j]))
+		this->deferred.push_back({ array, index, value, this->iteration });
+}
+
+const Value* LoopDoTimesAST::Worker::find(const ArrayValue* array, std::size_t index) const {
+	for (auto it = this->deferred.rbegin(); it != this->deferred.rend() && it->iteration == this->iteration; ++it) {
+		if (it->array == array && it->index == index)
+			return &it->value;
+	}
+	return nullptr;
+}
+
+Value UnaryAST::eval(Context* parent) {
+	return UnaryAST::apply(this->op, this->expr->eval(parent), parent);
+}
+
+Value UnaryAST::apply(Token op, Value val, const Context* frame) {
+	switch (op) {
 		case NOT:
-			return std::make_shared<SingleValue>(!val->isArray() && valS && valS->isNil());
+			return Value(val.isNil());
 		case MAKE_ARRAY:
-			if (val->isArray() || (valS && !valS->isInt()))
+			if (!val.isInt())
 				throw std::runtime_error("Array size must be an integer");
-			return std::make_shared<ArrayValue>(valS->getInt());
+			return Value(new ArrayValue(val.getInt()));
 		case PRINT:
-			std::cout << val->toString() << std::endl;
+			// A single write, so that lines printed by futures do not mix
+			frame->getOutput()->write(val.toString() + '\n');
 			return val;
+		case TOUCH:
+			return Future::touch(val);
 		default:
 			throw std::runtime_error("Unexpected error");
 	}
 }
 
-std::shared_ptr<Value> BinaryAST::eval(Context* parent) {
+Value BinaryAST::eval(Context* parent) {
+	auto l = this->lhs->eval(parent);
+	auto r = this->rhs->eval(parent);
+	switch (this->spec.load(std::memory_order_relaxed)) {
+		case SPEC_INT:
+			if (l.isInt() && r.isInt())
+				return BinaryAST::applyInt(this->op, l.getInt(), r.getInt());
+			break;
+		case SPEC_FLOAT:
+			if (l.isFloat() && r.isFloat())
+				return BinaryAST::applyFloat(this->op, l.getFloat(), r.getFloat());
+			break;
+		case SPEC_MIXED:
+			if (l.isNumber() && r.isNumber() && l.isFloat() != r.isFloat())
+				return BinaryAST::applyFloat(this->op, l.getNumber(), r.getNumber());
+			break;
+		case SPEC_NONE:
+			if (l.isInt() && r.isInt())
+				this->spec.store(SPEC_INT, std::memory_order_relaxed);
+			else if (l.isFloat() && r.isFloat())
+				this->spec.store(SPEC_FLOAT, std::memory_order_relaxed);
+			else if (l.isNumber() && r.isNumber())
+				this->spec.store(SPEC_MIXED, std::memory_order_relaxed);
+			else
+				this->spec.store(SPEC_GENERIC, std::memory_order_relaxed);
+			return BinaryAST::apply(this->op, l, r);
+		default:
+			return BinaryAST::apply(this->op, l, r);
+	}
+
+	// Guard failed, deoptimize
+	this->spec.store(SPEC_GENERIC, std::memory_order_relaxed);
+	return BinaryAST::apply(this->op, l, r);
+}
+
+Value BinaryAST::apply(Token op, const Value& lv, const Value& rv) {
 	// All binary operators requires
 	// both operands to be int / float.
-	auto lv = std::dynamic_pointer_cast<SingleValue>(this->lhs->eval(parent));
-	auto rv = std::dynamic_pointer_cast<SingleValue>(this->rhs->eval(parent));
-	if (!lv || !rv || !(lv->isInt() || lv->isFloat()) || !(rv->isInt() || rv->isFloat()))
+	if (!lv.isNumber() || !rv.isNumber())
 		throw std::runtime_error("Both operands must be int or float");
-	if (lv->isFloat() || rv->isFloat()) {
-		double l = lv->isInt() ? lv->getInt() : lv->getFloat();
-		double r = rv->isInt() ? rv->getInt() : rv->getFloat();
+	if (lv.isFloat() || rv.isFloat())
+		return BinaryAST::applyFloat(op, lv.getNumber(), rv.getNumber());
+	return BinaryAST::applyInt(op, lv.getInt(), rv.getInt());
+}
+
+Value BinaryAST::applyFloat(Token op, double l, double r) {
+	switch (op) {
+		case LESS:
+			return Value(l < r);
+		case LESS_EQUAL:
+			return Value(l <= r);
+		case GREATER:
+			return Value(l > r);
+		case GREATER_EQUAL:
+			return Value(l >= r);
+		case MOD:
+		case REM:
+			return Value(std::fmod(l, r));
+		default:
+			throw std::runtime_error("This operator cannot be applied to float");
+	}
+}
+
+Value BinaryAST::applyInt(Token op, std::int64_t l, std::int64_t r) {
+	switch (op) {
+		case LESS:
+			return Value(l < r);
+		case LESS_EQUAL:
+			return Value(l <= r);
+		case GREATER:
+			return Value(l > r);
+		case GREATER_EQUAL:
+			return Value(l >= r);
+		case MOD:
+		case REM:
+			if (!r)
+				throw std::runtime_error("Division by zero");
+			return Value(BinaryAST::remainder(l, r));
+		case LOGNOR:
+			return Value(~(l | r));
+		default:
+			throw std::runtime_error("Unexpected error");
+	}
+}
+
+namespace {
+
+std::int64_t foldInt(Token op, std::int64_t x, std::int64_t y) {
+	switch (op) {
+		case PLUS:
+			return x + y;
+		case MINUS:
+			return x - y;
+		case MULTIPLY:
+			return x * y;
+		case DIVIDE:
+			return BinaryAST::quotient(x, y);
+		case LOGAND:
+			return x & y;
+		case LOGIOR:
+			return x | y;
+		case LOGXOR:
+			return x ^ y;
+		case LOGEQV:
+			return ~(x ^ y);
+		default:
+			throw std::runtime_error("Unexpected error");
+	}
+}
+
+double foldFloat(Token op, double x, double y) {
+	switch (op) {
+		case PLUS:
+			return x + y;
+		case MINUS:
+			return x - y;
+		case MULTIPLY:
+			return x * y;
+		case DIVIDE:
+			return x / y;
+		default:
+			throw std::runtime_error("Unexpected error");
+	}
+}
+
+bool isArithmetic(Token op) {
+	return op == PLUS || op == MINUS || op == MULTIPLY || op == DIVIDE;
+}
+
+/// Fold - Running result of a list operator, fed one operand at a time.
+/// Gives the same result and raises the same errors as ListAST::apply on
+/// the whole list; errors are only raised once every operand is evaluated.
+struct Fold {
+	Token op;
+	bool first = true;
+
+	// Integer result, valid while no float has been seen
+	std::int64_t i = 0;
+	bool divByZero = false;
+
+	// Result of the float path, which treats every operand as a float
+	double d = 0;
+
+	// MAX, MIN: best operand so far. EQUAL, NOT_EQUAL: the first operand
+	Value v;
+	bool equal = true;
+
+	bool hasFloat = false;
+	bool nonNumber = false;
+	bool allInt = true;
+	bool allFloat = true;
+
+	explicit Fold(Token op) : op(op) {}
+
+	inline void addInt(std::int64_t y) {
+		if (this->first) {
+			this->first = false;
+			this->i = y;
+			this->d = static_cast<double>(y);
+			return;
+		}
+		if (this->op == DIVIDE && !y)
+			this->divByZero = true;
+		else
+			this->i = foldInt(this->op, this->i, y);
+		if (isArithmetic(this->op))
+			this->d = foldFloat(this->op, this->d, static_cast<double>(y));
+	}
+
+	inline void addFloat(double y) {
+		this->hasFloat = true;
+		if (this->first) {
+			this->first = false;
+			this->d = y;
+			return;
+		}
+		this->d = foldFloat(this->op, this->d, y);
+	}
+
+	void add(const Value& y) {
+		this->allInt = this->allInt && y.isInt();
+		this->allFloat = this->allFloat && y.isFloat();
+		if (!y.isNumber())
+			this->nonNumber = true;
+		if (this->nonNumber)
+			return;
+
 		switch (this->op) {
-			case LESS:
-				return std::make_shared<SingleValue>(l < r);
-			case LESS_EQUAL:
-				return std::make_shared<SingleValue>(l <= r);
-			case GREATER:
-				return std::make_shared<SingleValue>(l > r);
-			case GREATER_EQUAL:
-				return std::make_shared<SingleValue>(l >= r);
-			case MOD:
-			case REM:
-				return std::make_shared<SingleValue>(std::fmod(l, r));
+			case MAX:
+				if (this->first || this->v.getNumber() < y.getNumber())
+					this->v = y;
+				break;
+			case MIN:
+				if (this->first || y.getNumber() < this->v.getNumber())
+					this->v = y;
+				break;
+			case EQUAL:
+			case NOT_EQUAL:
+				if (this->first)
+					this->v = y;
+				else if (!(y == this->v))
+					this->equal = false;
+				break;
 			default:
-				throw std::runtime_error("This operator cannot be applied to float");
+				if (y.isFloat()) {
+					if (isArithmetic(this->op))
+						this->addFloat(y.getFloat());
+					else
+						this->hasFloat = true;
+				} else if (!this->hasFloat)
+					this->addInt(y.getInt());
+				else if (isArithmetic(this->op))
+					this->d = foldFloat(this->op, this->d, static_cast<double>(y.getInt()));
+				break;
 		}
-	} else {
-		std::int64_t l = lv->getInt();
-		std::int64_t r = rv->getInt();
+		this->first = false;
+	}
+
+	Value result() const {
+		if (this->nonNumber)
+			throw std::runtime_error("All values must be int or float");
 		switch (this->op) {
-			case LESS:
-				return std::make_shared<SingleValue>(l < r);
-			case LESS_EQUAL:
-				return std::make_shared<SingleValue>(l <= r);
-			case GREATER:
-				return std::make_shared<SingleValue>(l > r);
-			case GREATER_EQUAL:
-				return std::make_shared<SingleValue>(l >= r);
-			case MOD:
-			case REM:
-				return std::make_shared<SingleValue>(l % r);
-			case LOGNOR:
-				return std::make_shared<SingleValue>(~(l | r));
+			case MAX:
+			case MIN:
+				return this->v;
+			case EQUAL:
+				return Value(this->equal);
+			case NOT_EQUAL:
+				return Value(!this->equal);
+			case LOGAND:
+			case LOGIOR:
+			case LOGXOR:
+			case LOGEQV:
+				if (this->hasFloat)
+					throw std::runtime_error("Cannot apply selected operator to non-integer");
+				return Value(this->i);
 			default:
-				throw std::runtime_error("Unexpected error");
+				if (this->hasFloat)
+					return Value(this->d);
+				if (this->divByZero)
+					throw std::runtime_error("Division by zero");
+				return Value(this->i);
 		}
 	}
+};
+
+} // namespace
+
+bool ListAST::folds(Token op) {
+	switch (op) {
+		case PLUS:
+		case MINUS:
+		case MULTIPLY:
+		case DIVIDE:
+		case LOGAND:
+		case LOGIOR:
+		case LOGXOR:
+		case LOGEQV:
+		case MAX:
+		case MIN:
+		case EQUAL:
+		case NOT_EQUAL:
+			return true;
+		default:
+			return false;
+	}
 }
 
-std::shared_ptr<Value> ListAST::eval(Context* parent) {
-	auto ret = this->exprs[0]->eval(parent);
-	auto retS = std::dynamic_pointer_cast<SingleValue>(ret);
-	if (this->exprs.size() == 1) {
-		switch (this->op) {
+Value ListAST::eval(Context* parent) {
+	if (ListAST::folds(this->op) && this->exprs.size() > 1)
+		return this->fold(parent);
+
+	// Transform #1: Eval all values.
+	std::vector<Value> vals;
+	vals.reserve(this->exprs.size());
+	std::transform(this->exprs.begin(), this->exprs.end(), std::back_inserter(vals), [&](ExprAST* ptr) {
+		return ptr->eval(parent);
+	});
+	return ListAST::apply(this->op, vals);
+}
+
+Value ListAST::fold(Context* parent) {
+	Fold f(this->op);
+	auto it = this->exprs.begin();
+	auto spec = this->spec.load(std::memory_order_relaxed);
+
+	// Specialized loops, left through the generic one when a guard fails
+	if (spec == SPEC_INT) {
+		for (; it != this->exprs.end(); ++it) {
+			auto v = (*it)->eval(parent);
+			if (!v.isInt()) {
+				this->spec.store(SPEC_GENERIC, std::memory_order_relaxed);
+				f.add(v);
+				++it;
+				break;
+			}
+			f.addInt(v.getInt());
+		}
+	} else if (spec == SPEC_FLOAT) {
+		for (; it != this->exprs.end(); ++it) {
+			auto v = (*it)->eval(parent);
+			if (!v.isFloat()) {
+				this->spec.store(SPEC_GENERIC, std::memory_order_relaxed);
+				f.add(v);
+				++it;
+				break;
+			}
+			f.addFloat(v.getFloat());
+		}
+	}
+
+	for (; it != this->exprs.end(); ++it)
+		f.add((*it)->eval(parent));
+
+	if (spec == SPEC_NONE) {
+		bool ints = f.allInt && (isArithmetic(this->op) || this->op == LOGAND || this->op == LOGIOR || this->op == LOGXOR || this->op == LOGEQV);
+		this->spec.store(ints ? SPEC_INT : f.allFloat && isArithmetic(this->op) ? SPEC_FLOAT : SPEC_GENERIC, std::memory_order_relaxed);
+	}
+	return f.result();
+}
+
+Value ListAST::apply(Token op, std::span<Value> vals) {
+	if (ArrayOps::handles(op))
+		return ArrayOps::apply(op, vals);
+	if (Channel::handles(op))
+		return Channel::apply(op, vals);
+
+	if (vals.size() == 1) {
+		auto& ret = vals[0];
+		switch (op) {
 			case LOGAND:
 			case LOGNOR:
 			case LOGXOR:
 			case LOGEQV:
-				if (ret->isArray() || (retS && !retS->isInt()))
+				if (!ret.isInt())
 					throw std::runtime_error("Cannot apply selected operator to non-integer");
 			case MAX:
 			case MIN:
 			case PLUS:
 			case MULTIPLY:
-				if (ret->isArray() || (retS && !retS->isInt() && !retS->isFloat()))
+				if (!ret.isNumber())
 					throw std::runtime_error("Cannot apply selected operator to non-integer or non-float");
 			case AND:
 			case OR:
 				return ret;
 			case EQUAL:
 			case NOT_EQUAL:
-				if (ret->isArray() || (retS && !retS->isInt() && !retS->isFloat()))
+				if (!ret.isNumber())
 					throw std::runtime_error("Cannot apply selected operator to non-integer or non-float");
-				return std::make_shared<SingleValue>(true);
+				return Value(true);
 			default:;
 		}
 		throw std::runtime_error("Invalid argument count for selected operator");
 	}
 
-	// Transform #1: Eval all values.
-	std::vector<std::shared_ptr<Value>> vals;
-	std::transform(this->exprs.begin(), this->exprs.end(), std::back_inserter(vals), [&](std::shared_ptr<ExprAST>& ptr) {
-		return ptr->eval(parent);
-	});
-
 	// For And, return NIL if any value is NIL. Otherwise, return the last value.
-	if (this->op == AND) {
-		if (std::any_of(vals.begin(), vals.end(), [](std::shared_ptr<Value>& ptr) {
-			auto val = std::dynamic_pointer_cast<SingleValue>(ptr);
-			return ptr->isArray() && val && val->isNil();
+	if (op == AND) {
+		if (std::any_of(vals.begin(), vals.end(), [](Value& v) {
+			return v.isArray() && v.isNil();
 		}))
-			return std::make_shared<SingleValue>(false);
+			return Value(false);
 		return vals.back();
 	}
 
 	// For Or, return the first non-NIL value or NIL if all values are NIL.
-	if (this->op == OR) {
-		auto it = std::find_if(vals.begin(), vals.end(), [](std::shared_ptr<Value>& ptr) {
-			auto val = std::dynamic_pointer_cast<SingleValue>(ptr);
-			return !ptr->isArray() || (val && !val->isNil());
+	if (op == OR) {
+		auto it = std::find_if(vals.begin(), vals.end(), [](Value& v) {
+			return !v.isArray();
 		});
 		if (it == vals.end())
-			return std::make_shared<SingleValue>(false);
+			return Value(false);
 		return *it;
 	}
 
 	// Now, all operators require all values to be int / float.
-	if (std::any_of(vals.begin(), vals.end(), [](std::shared_ptr<Value>& ptr) {
-		auto val = std::dynamic_pointer_cast<SingleValue>(ptr);
-		return ptr->isArray() || (val && !val->isInt() && !val->isFloat());
+	if (std::any_of(vals.begin(), vals.end(), [](Value& v) {
+		return !v.isNumber();
 	}))
 		throw std::runtime_error("All values must be int or float");
 
-	// Transform #2: Convert all values
-	std::vector<std::shared_ptr<SingleValue>> vals2;
-	std::transform(vals.begin(), vals.end(), std::back_inserter(vals2), [](std::shared_ptr<Value>& ptr) {
-		return std::dynamic_pointer_cast<SingleValue>(ptr);
-	});
-
-	// Assure that no value is nullptr.
-	if (std::any_of(vals2.begin(), vals2.end(), [](std::shared_ptr<SingleValue>& ptr) {
-		return ptr == nullptr;
-	}))
-		throw std::runtime_error("Unexpected error");
-
-	bool hasFloat = std::any_of(vals2.begin(), vals2.end(), [](std::shared_ptr<SingleValue>& ptr) {
-		return ptr->isFloat();
+	bool hasFloat = std::any_of(vals.begin(), vals.end(), [](Value& v) {
+		return v.isFloat();
 	});
 
-	std::vector<std::int64_t> intVal;
-	std::vector<double> floatVal;
-	switch (this->op) {
+	switch (op) {
 		default:
 			throw std::runtime_error("Unexpected error");
 		case LOGAND:
@@ -369,11 +831,9 @@ std::shared_ptr<Value> ListAST::eval(Context* parent) {
 		case LOGEQV:
 			if (hasFloat)
 				throw std::runtime_error("Cannot apply selected operator to non-integer");
-			std::transform(vals2.begin(), vals2.end(), std::back_inserter(intVal), [&](std::shared_ptr<SingleValue>& ptr) {
-				return ptr->getInt();
-			});
-			return std::make_shared<SingleValue>(std::accumulate(intVal.begin() + 1, intVal.end(), intVal[0], [this](std::int64_t x, std::int64_t y) {
-				switch (this->op) {
+			return Value(std::accumulate(vals.begin() + 1, vals.end(), vals[0].getInt(), [op](std::int64_t x, Value& v) {
+				auto y = v.getInt();
+				switch (op) {
 					case LOGAND:
 						return x & y;
 					case LOGIOR:
@@ -387,27 +847,27 @@ std::shared_ptr<Value> ListAST::eval(Context* parent) {
 				}
 			}));
 		case MAX:
-			return std::max_element(vals2.begin(), vals2.end(), [](std::shared_ptr<SingleValue>& x, std::shared_ptr<SingleValue>& y) {
-				return (x->isFloat() ? x->getFloat() : x->getInt()) < (y->isFloat() ? y->getFloat() : y->getInt());
-			})->operator->()->copy();
+			return *std::max_element(vals.begin(), vals.end(), [](Value& x, Value& y) {
+				return x.getNumber() < y.getNumber();
+			});
 		case MIN:
-			return std::min_element(vals2.begin(), vals2.end(), [](std::shared_ptr<SingleValue>& x, std::shared_ptr<SingleValue>& y) {
-				return (x->isFloat() ? x->getFloat() : x->getInt()) < (y->isFloat() ? y->getFloat() : y->getInt());
-			})->operator->()->copy();
+			return *std::min_element(vals.begin(), vals.end(), [](Value& x, Value& y) {
+				return x.getNumber() < y.getNumber();
+			});
 		case EQUAL:
-			return std::all_of(vals2.begin() + 1, vals2.end(), [&](std::shared_ptr<SingleValue>& ptr) {
-				return ptr->operator==(*vals2[0]);
-			}) ? std::make_shared<SingleValue>(true) : std::make_shared<SingleValue>(false);
+			return Value(std::all_of(vals.begin() + 1, vals.end(), [&](Value& v) {
+				return v == vals[0];
+			}));
 		case NOT_EQUAL:
-			return !std::all_of(vals2.begin() + 1, vals2.end(), [&](std::shared_ptr<SingleValue>& ptr) {
-				return ptr->operator==(*vals2[0]);
-			}) ? std::make_shared<SingleValue>(true) : std::make_shared<SingleValue>(false);
+			return Value(!std::all_of(vals.begin() + 1, vals.end(), [&](Value& v) {
+				return v == vals[0];
+			}));
 		case PLUS:
 		case MINUS:
 		case MULTIPLY:
 		case DIVIDE:
-			auto opFunc = [this](auto x, auto y) {
-				switch (this->op) {
+			auto opFunc = [op](auto x, auto y) {
+				switch (op) {
 					case PLUS:
 						return x + y;
 					case MINUS:
@@ -421,66 +881,98 @@ std::shared_ptr<Value> ListAST::eval(Context* parent) {
 				}
 			};
 			if (hasFloat) {
-				std::transform(vals2.begin(), vals2.end(), std::back_inserter(floatVal), [&](std::shared_ptr<SingleValue>& ptr) {
-					return (ptr->isFloat() ? ptr->getFloat() : ptr->getInt());
-				});
-				return std::make_shared<SingleValue>(std::accumulate(floatVal.begin() + 1, floatVal.end(), floatVal[0], opFunc));
+				return Value(std::accumulate(vals.begin() + 1, vals.end(), vals[0].getNumber(), [&](double x, Value& v) {
+					return opFunc(x, v.getNumber());
+				}));
 			} else {
-				std::transform(vals2.begin(), vals2.end(), std::back_inserter(intVal), [&](std::shared_ptr<SingleValue>& ptr) {
-					return ptr->getInt();
-				});
-				return std::make_shared<SingleValue>(std::accumulate(intVal.begin() + 1, intVal.end(), intVal[0], opFunc));
+				return Value(std::accumulate(vals.begin() + 1, vals.end(), vals[0].getInt(), [&](std::int64_t x, Value& v) {
+					if (op == DIVIDE) {
+						if (!v.getInt())
+							throw std::runtime_error("Division by zero");
+						return BinaryAST::quotient(x, v.getInt());
+					}
+					return opFunc(x, v.getInt());
+				}));
 			}
 	}
 
 }
 
-std::shared_ptr<Value> VarOpAST::eval(Context* parent) {
-	// DEFVAR || SETQ
-	if (this->op == SETQ && !parent->hasVariable(this->name)) {
+Value VarOpAST::eval(Context* parent) {
+	// DEFVAR || SETQ || DEFCONSTANT
+	if (this->op == SETQ && !parent->hasVariable(this->name, this->ref)) {
 		throw std::runtime_error("Variable not defined: " + this->name);
 	}
 
 	// Eval value
 	auto val = this->expr->eval(parent);
-	parent->setVariable(this->name, val->copy());
+	if (this->op == DEFCONSTANT)
+		parent->defineConstant(this->name, val.copy());
+	else
+		parent->setVariable(this->name, this->storeRef, val.copy());
 	return val;
 }
 
-std::shared_ptr<Value> LValOpAST::eval(Context* parent) {
+Value LValOpAST::eval(Context* parent) {
 	// Eval value
 	auto val = this->expr->eval(parent);
-	auto lv = std::dynamic_pointer_cast<LValueAST>(this->lval);
+	auto lv = dynamic_cast<LValueAST*>(this->lval);
 	if (!lv)
 		throw std::runtime_error("Unexpected error");
 
 	if (SETF == this->op)
 		return lv->set(parent, val);
 
-	auto original = lv->eval(parent);
-	auto originalVal = std::dynamic_pointer_cast<SingleValue>(original);
-	if (original->isArray() || !originalVal || !originalVal->isInt())
+	return lv->set(parent, LValOpAST::applyDelta(this->op, lv->eval(parent), val));
+}
+
+Value LValOpAST::applyDelta(Token op, const Value& original, const Value& val) {
+	if (!original.isInt())
 		throw std::runtime_error("Cannot apply INC or DEC to non-integer value");
-	auto base = originalVal->getInt();
+	auto base = original.getInt();
 
-	auto valVal = std::dynamic_pointer_cast<SingleValue>(val);
-	if (val->isArray() || !valVal || !valVal->isInt())
+	if (!val.isInt())
 		throw std::runtime_error("Cannot INC or DEC by non-integer value");
-	auto delta = valVal->getInt();
+	auto delta = val.getInt();
 
-	switch (this->op) {
+	switch (op) {
 		case DECF:
 			delta = -delta;
 		case INCF:
 			base += delta;
-			return lv->set(parent, std::make_shared<SingleValue>(base));
+			return Value(base);
 		default:;
 	}
 	throw std::runtime_error("Unexpected error");
 }
 
-std::shared_ptr<Value> ReturnAST::eval(Context* parent) {
+Value ReturnAST::eval(Context* parent) {
 	return this->expr->eval(parent);
 }
 
+Value FutureAST::eval(Context* parent) {
+	return this->spawn(parent);
+}
+
+Value FutureAST::spawn(Context* frame, const VarRef* refs) const {
+	Future::Captures captures;
+	for (std::size_t i = 0; i < this->captures.size(); i++) {
+		const auto& c = this->captures[i];
+		captures.emplace_back(c.index, FutureAST::capture(frame, c.name, refs ? refs[i] : c.ref));
+	}
+	auto expr = this->expr;
+	return Future::spawn(frame, this->slots, std::move(captures), [expr](Context* f) {
+		return expr->eval(f);
+	});
+}
+
+Value CachedAST::eval(Context* parent) {
+	const auto& cached = parent->getSlot(this->slot);
+	if (!cached.isUnbound())
+		return cached;
+	auto val = this->expr->eval(parent);
+	parent->getSlot(this->slot) = val;
+	return val;
+}
+
 } // end of namespace DragonLisp
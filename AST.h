@@ -1,13 +1,16 @@
 #ifndef __DRAGON_LISP_AST_H__
 #define __DRAGON_LISP_AST_H__
 
+#include <atomic>
 #include <memory>
+#include <span>
 #include <variant>
 #include <vector>
 
 #include "types.h"
 #include "token.h"
 #include "context.h"
+#include "MemoCache.h"
 
 namespace DragonLisp {
 
@@ -28,8 +31,25 @@ enum ASTType {
 	T_LValOpAST,
 	T_ReturnAST,
 	T_LiteralAST,
+	T_CachedAST,
+	T_InlineCallAST,
+	T_FutureAST,
 };
 
+/// Spec - Operand types an arithmetic node has specialized itself for.
+/// A node observes its operands on the first evaluation and falls back to
+/// SPEC_GENERIC for good once a guard fails. Threads of a parallel loop
+/// may update it at once, any state being valid.
+enum Spec {
+	SPEC_NONE,
+	SPEC_INT,
+	SPEC_FLOAT,
+	SPEC_MIXED,	// BinaryAST only: one int and one float
+	SPEC_GENERIC,
+};
+
+struct Specialization;
+
 /// BaseAST - Base class for all AST nodes.
 class BaseAST {
 public:
@@ -40,34 +60,61 @@ public:
 
 class ExprAST : public BaseAST {
 public:
-	virtual std::shared_ptr<Value> eval(Context* parent) = 0;
+	virtual Value eval(Context* parent) = 0;
 };
 
 class LValueAST : public ExprAST {
 public:
-	virtual std::shared_ptr<Value> set(Context* parent, std::shared_ptr<Value> value) = 0;
+	virtual Value set(Context* parent, Value value) = 0;
 };
 
 class ArrayRefAST : public LValueAST {
 private:
 	std::string name;
-	std::shared_ptr<ExprAST> index;
+	ExprAST* index;
+	VarRef ref;
 
 public:
-	ArrayRefAST(std::string name, std::shared_ptr<ExprAST> index) : name(std::move(name)), index(std::move(index)) {}
+	ArrayRefAST(std::string name, ExprAST* index) : name(std::move(name)), index(index) {}
 
 	ASTType getType() const override final {
 		return T_ArrayRefAST;
 	}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	inline const std::string& getName() const {
+		return this->name;
+	}
+
+	inline ExprAST* getIndex() const {
+		return this->index;
+	}
+
+	inline void setIndex(ExprAST* e) {
+		this->index = e;
+	}
+
+	inline const VarRef& getRef() const {
+		return this->ref;
+	}
+
+	inline void setRef(VarRef r) {
+		this->ref = std::move(r);
+	}
 
-	std::shared_ptr<Value> set(Context* parent, std::shared_ptr<Value> value) override final;
+	static Value load(Context* parent, const std::string& name, const VarRef& ref, const Value& index);
+
+	static Value store(Context* parent, const std::string& name, const VarRef& ref, const Value& index, Value value);
+
+	Value eval(Context* parent) override final;
+
+	Value set(Context* parent, Value value) override final;
 };
 
 class IdentifierAST : public LValueAST {
 private:
 	std::string name;
+	VarRef ref;
+	VarRef storeRef;
 
 public:
 	explicit IdentifierAST(std::string name) : name(std::move(name)) {}
@@ -76,21 +123,62 @@ public:
 		return T_IdentifierAST;
 	}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	inline const std::string& getName() const {
+		return this->name;
+	}
 
-	std::shared_ptr<Value> set(Context* parent, std::shared_ptr<Value> value) override final;
+	inline const VarRef& getRef() const {
+		return this->ref;
+	}
+
+	inline void setRef(VarRef r) {
+		this->ref = std::move(r);
+	}
+
+	inline const VarRef& getStoreRef() const {
+		return this->storeRef;
+	}
+
+	inline void setStoreRef(VarRef r) {
+		this->storeRef = std::move(r);
+	}
+
+	Value eval(Context* parent) override final;
+
+	Value set(Context* parent, Value value) override final;
 };
 
 class FuncDefAST : public BaseAST {
 private:
 	std::string name;
 	std::vector<std::string> args;
-	std::vector<std::shared_ptr<ExprAST>> body;
+	std::vector<ExprAST*> body;
+
+	// Frame layout, filled in by the Resolver
+	std::uint32_t slots = 0;
+	std::vector<std::uint32_t> argSlots;
+
+	// Unboxed versions by argument types, see Specializer, and those that
+	// later definitions made stale, which other threads may still run
+	std::vector<Specialization*> specs;
+	std::vector<Specialization*> retired;
+	std::atomic<bool> unboxable = true;
+
+	// Results by arguments, once declared with (declaim (memoize name))
+	std::unique_ptr<MemoCache> memo;
 
 public:
-	FuncDefAST(std::string name, std::vector<std::string> args, std::vector<std::shared_ptr<ExprAST>> body) : name(std::move(name)), args(std::move(args)), body(std::move(body)) {}
+	FuncDefAST(std::string name, std::vector<std::string> args, std::vector<ExprAST*> body) : name(std::move(name)), args(std::move(args)), body(std::move(body)) {}
+
+	~FuncDefAST() override;
 
-	std::shared_ptr<Value> eval(Context* parent, std::vector<std::shared_ptr<Value>> arg);
+	/// Run the body in a frame whose arguments are already bound. Tail
+	/// calls run in the same frame and loop instead of nesting.
+	Value call(Context* frame);
+
+	/// Call with the arguments bound in `frame`: from the memo cache if
+	/// any, else as specialized code or through call().
+	Value apply(Context* frame);
 
 	inline ASTType getType() const override final {
 		return T_FuncDefAST;
@@ -99,210 +187,754 @@ public:
 	inline const std::string& getName() const {
 		return this->name;
 	}
+
+	inline const std::vector<std::string>& getArgs() const {
+		return this->args;
+	}
+
+	inline const std::vector<ExprAST*>& getBody() const {
+		return this->body;
+	}
+
+	inline std::vector<ExprAST*>& getBody() {
+		return this->body;
+	}
+
+	inline std::uint32_t getSlots() const {
+		return this->slots;
+	}
+
+	inline void setSlots(std::uint32_t n) {
+		this->slots = n;
+	}
+
+	inline const std::vector<std::uint32_t>& getArgSlots() const {
+		return this->argSlots;
+	}
+
+	inline void setArgSlots(std::vector<std::uint32_t> s) {
+		this->argSlots = std::move(s);
+	}
+
+	inline std::vector<Specialization*>& getSpecs() {
+		return this->specs;
+	}
+
+	inline std::vector<Specialization*>& getRetiredSpecs() {
+		return this->retired;
+	}
+
+	inline bool isUnboxable() const {
+		return this->unboxable.load(std::memory_order_relaxed);
+	}
+
+	inline void setUnboxable(bool u) {
+		this->unboxable.store(u, std::memory_order_relaxed);
+	}
+
+	inline MemoCache* getMemo() const {
+		return this->memo.get();
+	}
+
+	void setMemo(std::size_t capacity);
 };
 
 class FuncCallAST : public ExprAST {
 private:
 	std::string name;
-	std::vector<std::shared_ptr<ExprAST>> args;
+	std::vector<ExprAST*> args;
+	FuncCache cache;
+
+	// Whether the enclosing function returns the value as is, set by the
+	// Resolver. Such calls reuse the caller's frame, see FuncDefAST::call.
+	bool tail = false;
 
 public:
-	FuncCallAST(std::string name, std::vector<std::shared_ptr<ExprAST>> args) : name(std::move(name)), args(std::move(args)) {}
+	FuncCallAST(std::string name, std::vector<ExprAST*> args) : name(std::move(name)), args(std::move(args)) {}
+
+	Value eval(Context* parent) override final;
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	/// Make the call in place of the function running in `frame`, which is
+	/// on top of the frame stack: the arguments are evaluated into `args`,
+	/// then bound in the same frame, resized for the callee. Returns the
+	/// callee.
+	FuncDefAST* enter(Context* frame, std::vector<Value>& args);
+
+	inline bool isTail() const {
+		return this->tail;
+	}
+
+	inline void setTail(bool t) {
+		this->tail = t;
+	}
 
 	inline ASTType getType() const override final {
 		return T_FuncCallAST;
 	}
+
+	inline const std::string& getName() const {
+		return this->name;
+	}
+
+	inline const std::vector<ExprAST*>& getArgs() const {
+		return this->args;
+	}
+
+	inline std::vector<ExprAST*>& getArgs() {
+		return this->args;
+	}
+};
+
+/// InlineCallAST - A call with a copy of the callee's body in the caller.
+/// The arguments go to temporary slots of the caller's frame, which the
+/// copy reads instead of the callee's parameters, so the evaluation order
+/// and errors are those of FuncCallAST. Once the name is bound to another
+/// function the original call is used instead.
+class InlineCallAST : public ExprAST {
+private:
+	FuncCallAST* call;
+	FuncDefAST* callee;
+	ExprAST* body;
+
+	// Temporary slot of each parameter
+	std::vector<VarSlot> params;
+
+	FuncCache cache;
+
+public:
+	InlineCallAST(FuncCallAST* call, FuncDefAST* callee, ExprAST* body, std::vector<VarSlot> params) : call(call), callee(callee), body(body), params(std::move(params)) {}
+
+	Value eval(Context* parent) override final;
+
+	inline ASTType getType() const override final {
+		return T_InlineCallAST;
+	}
+
+	inline FuncCallAST* getCall() const {
+		return this->call;
+	}
+
+	inline FuncDefAST* getCallee() const {
+		return this->callee;
+	}
+
+	inline ExprAST* getBody() const {
+		return this->body;
+	}
+
+	inline const std::vector<VarSlot>& getParams() const {
+		return this->params;
+	}
 };
 
 class IfAST : public ExprAST {
 private:
-	std::shared_ptr<ExprAST> cond;
-	std::shared_ptr<ExprAST> then;
-	std::shared_ptr<ExprAST> els;
+	ExprAST* cond;
+	ExprAST* then;
+	ExprAST* els;
 
 public:
-	IfAST(std::shared_ptr<ExprAST> cond, std::shared_ptr<ExprAST> then, std::shared_ptr<ExprAST> els) : cond(std::move(cond)), then(std::move(then)), els(std::move(els)) {}
+	IfAST(ExprAST* cond, ExprAST* then, ExprAST* els) : cond(cond), then(then), els(els) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final {
+	Value eval(Context* parent) override final {
 		throw std::runtime_error("You should use IfAST::getResult() instead of IfAST::eval()");
 	}
 
-	std::shared_ptr<ExprAST> getResult(Context* parent);
+	ExprAST* getResult(Context* parent);
+
+	static bool isTrue(const Value& cond);
 
 	inline ASTType getType() const override final {
 		return T_IfAST;
 	}
+
+	inline ExprAST* getCond() const {
+		return this->cond;
+	}
+
+	inline void setCond(ExprAST* e) {
+		this->cond = e;
+	}
+
+	inline ExprAST* getThen() const {
+		return this->then;
+	}
+
+	inline void setThen(ExprAST* e) {
+		this->then = e;
+	}
+
+	inline ExprAST* getElse() const {
+		return this->els;
+	}
+
+	inline void setElse(ExprAST* e) {
+		this->els = e;
+	}
 };
 
 class LoopAST : public ExprAST {};
 
 class LoopForeverAST : public LoopAST {
 private:
-	std::vector<std::shared_ptr<ExprAST>> body;
+	std::vector<ExprAST*> body;
 
 public:
-	explicit LoopForeverAST(std::vector<std::shared_ptr<ExprAST>> body) : body(std::move(body)) {}
+	explicit LoopForeverAST(std::vector<ExprAST*> body) : body(std::move(body)) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	Value eval(Context* parent) override final;
 
 	inline ASTType getType() const override final {
 		return T_LoopForeverAST;
 	}
+
+	inline const std::vector<ExprAST*>& getBody() const {
+		return this->body;
+	}
+
+	inline std::vector<ExprAST*>& getBody() {
+		return this->body;
+	}
 };
 
 class LoopForAST : public LoopAST {
 private:
 	std::string name;
-	std::shared_ptr<ExprAST> start;
-	std::shared_ptr<ExprAST> end;
-	std::vector<std::shared_ptr<ExprAST>> body;
+	ExprAST* start;
+	ExprAST* end;
+	std::vector<ExprAST*> body;
+	std::uint32_t slots = 0;
+
+	// Whether the body reads the induction variable, set by the Resolver
+	bool varRead = true;
 
 public:
-	LoopForAST(std::string name, std::shared_ptr<ExprAST> start, std::shared_ptr<ExprAST> end, std::vector<std::shared_ptr<ExprAST>> body) : name(std::move(name)), start(std::move(start)), end(std::move(end)), body(std::move(body)) {}
+	LoopForAST(std::string name, ExprAST* start, ExprAST* end, std::vector<ExprAST*> body) : name(std::move(name)), start(start), end(end), body(std::move(body)) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	Value eval(Context* parent) override final;
 
 	inline ASTType getType() const override final {
 		return T_LoopForAST;
 	}
+
+	inline const std::string& getName() const {
+		return this->name;
+	}
+
+	inline ExprAST* getStart() const {
+		return this->start;
+	}
+
+	inline void setStart(ExprAST* e) {
+		this->start = e;
+	}
+
+	inline ExprAST* getEnd() const {
+		return this->end;
+	}
+
+	inline void setEnd(ExprAST* e) {
+		this->end = e;
+	}
+
+	inline const std::vector<ExprAST*>& getBody() const {
+		return this->body;
+	}
+
+	inline std::vector<ExprAST*>& getBody() {
+		return this->body;
+	}
+
+	inline std::uint32_t getSlots() const {
+		return this->slots;
+	}
+
+	inline void setSlots(std::uint32_t n) {
+		this->slots = n;
+	}
+
+	inline bool isVarRead() const {
+		return this->varRead;
+	}
+
+	inline void setVarRead(bool r) {
+		this->varRead = r;
+	}
 };
 
+/// LoopDoTimesAST - dotimes, or pdotimes when `parallel` is set.
+///
+/// The iterations of a pdotimes are split across the ThreadPool, each
+/// thread running them in a frame of its own. The Resolver makes sure that
+/// iterations do not depend on each other: the body may only write
+/// (aref array i) with `i` the induction variable, and only read the
+/// arrays it writes in the same way.
 class LoopDoTimesAST : public LoopAST {
+public:
+	/// Target - An array written by a parallel body, as seen from the
+	/// frame the loop runs in.
+	struct Target {
+		std::string name;
+		VarRef ref;
+	};
+
+	/// Worker - Writes of a thread running parallel iterations.
+	///
+	/// Stores go straight to the array as long as its storage kind is kept,
+	/// with the change in holes counted here. Those that need another kind
+	/// are applied in order once every thread is done, and are seen by reads
+	/// of the same iteration until then.
+	struct Worker {
+		struct Store {
+			ArrayValue* array;
+			std::size_t index;
+			Value value;
+			std::int64_t iteration;
+		};
+
+		const std::vector<ArrayValue*>* arrays = nullptr;
+		std::vector<std::ptrdiff_t> holes;
+		std::vector<Store> deferred;
+		std::int64_t iteration = 0;
+
+		void store(ArrayValue* array, std::size_t index, const Value& value);
+
+		/// A deferred store of the current iteration, or nullptr.
+		const Value* find(const ArrayValue* array, std::size_t index) const;
+	};
+
+	/// The worker of this thread while it runs parallel iterations.
+	static thread_local inline Worker* worker = nullptr;
+
+	/// Fewest remaining iterations that are run in parallel.
+	static constexpr std::int64_t PARALLEL_MIN = 256;
+
 private:
 	std::string name;
-	std::shared_ptr<ExprAST> times;
-	std::vector<std::shared_ptr<ExprAST>> body;
+	ExprAST* times;
+	std::vector<ExprAST*> body;
+	std::uint32_t slots = 0;
+
+	// Whether the body reads the induction variable, set by the Resolver
+	bool varRead = true;
+
+	bool parallel = false;
+	std::vector<Target> targets;
+
+	void runParallel(Context* parent, Context& ctx, std::int64_t begin, std::int64_t end, const std::vector<ArrayValue*>& arrays);
 
 public:
-	LoopDoTimesAST(std::string name, std::shared_ptr<ExprAST> times, std::vector<std::shared_ptr<ExprAST>> body) : name(std::move(name)), times(std::move(times)), body(std::move(body)) {}
+	LoopDoTimesAST(std::string name, ExprAST* times, std::vector<ExprAST*> body, bool parallel = false) : name(std::move(name)), times(times), body(std::move(body)), parallel(parallel) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	Value eval(Context* parent) override final;
 
 	inline ASTType getType() const override final {
 		return T_LoopDoTimesAST;
 	}
+
+	inline const std::string& getName() const {
+		return this->name;
+	}
+
+	inline ExprAST* getTimes() const {
+		return this->times;
+	}
+
+	inline void setTimes(ExprAST* e) {
+		this->times = e;
+	}
+
+	inline const std::vector<ExprAST*>& getBody() const {
+		return this->body;
+	}
+
+	inline std::vector<ExprAST*>& getBody() {
+		return this->body;
+	}
+
+	inline std::uint32_t getSlots() const {
+		return this->slots;
+	}
+
+	inline void setSlots(std::uint32_t n) {
+		this->slots = n;
+	}
+
+	inline bool isVarRead() const {
+		return this->varRead;
+	}
+
+	inline void setVarRead(bool r) {
+		this->varRead = r;
+	}
+
+	inline bool isParallel() const {
+		return this->parallel;
+	}
+
+	inline const std::vector<Target>& getTargets() const {
+		return this->targets;
+	}
+
+	inline void setTargets(std::vector<Target> t) {
+		this->targets = std::move(t);
+	}
 };
 
 class UnaryAST : public ExprAST {
 private:
-	std::shared_ptr<ExprAST> expr;
+	ExprAST* expr;
 	Token op;
 
 public:
-	UnaryAST(std::shared_ptr<ExprAST> expr, Token op) : expr(std::move(expr)), op(std::move(op)) {}
+	UnaryAST(ExprAST* expr, Token op) : expr(expr), op(std::move(op)) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	Value eval(Context* parent) override final;
 
 	inline ASTType getType() const override final {
 		return T_UnaryAST;
 	}
+
+	inline ExprAST* getExpr() const {
+		return this->expr;
+	}
+
+	inline void setExpr(ExprAST* e) {
+		this->expr = e;
+	}
+
+	inline Token getOp() const {
+		return this->op;
+	}
+
+	/// `frame` is only used by PRINT, for the output of its global context.
+	static Value apply(Token op, Value val, const Context* frame);
 };
 
 class BinaryAST : public ExprAST {
 private:
-	std::shared_ptr<ExprAST> lhs;
-	std::shared_ptr<ExprAST> rhs;
+	ExprAST* lhs;
+	ExprAST* rhs;
 	Token op;
+	std::atomic<Spec> spec = SPEC_NONE;
 
 public:
-	BinaryAST(std::shared_ptr<ExprAST> lhs, std::shared_ptr<ExprAST> rhs, Token op) : lhs(std::move(lhs)), rhs(std::move(rhs)), op(std::move(op)) {}
+	BinaryAST(ExprAST* lhs, ExprAST* rhs, Token op) : lhs(lhs), rhs(rhs), op(std::move(op)) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	Value eval(Context* parent) override final;
 
 	inline ASTType getType() const override final {
 		return T_BinaryAST;
 	}
+
+	inline ExprAST* getLHS() const {
+		return this->lhs;
+	}
+
+	inline void setLHS(ExprAST* e) {
+		this->lhs = e;
+	}
+
+	inline ExprAST* getRHS() const {
+		return this->rhs;
+	}
+
+	inline void setRHS(ExprAST* e) {
+		this->rhs = e;
+	}
+
+	inline Token getOp() const {
+		return this->op;
+	}
+
+	static Value apply(Token op, const Value& lhs, const Value& rhs);
+
+	static Value applyInt(Token op, std::int64_t l, std::int64_t r);
+
+	/// Quotient and remainder of l by a nonzero r. Dividing the smallest
+	/// integer by -1 wraps around, as multiplying it by -1 does, instead of
+	/// trapping.
+	static std::int64_t quotient(std::int64_t l, std::int64_t r) {
+		return r == -1 ? static_cast<std::int64_t>(0 - static_cast<std::uint64_t>(l)) : l / r;
+	}
+
+	static std::int64_t remainder(std::int64_t l, std::int64_t r) {
+		return r == -1 ? 0 : l % r;
+	}
+
+	static Value applyFloat(Token op, double l, double r);
 };
 
 class ListAST : public ExprAST {
 private:
-	std::vector<std::shared_ptr<ExprAST>> exprs;
+	std::vector<ExprAST*> exprs;
 	Token op;
+	std::atomic<Spec> spec = SPEC_NONE;
+
+	Value fold(Context* parent);
 
 public:
-	ListAST(std::vector<std::shared_ptr<ExprAST>> exprs, Token op) : exprs(std::move(exprs)), op(std::move(op)) {}
+	ListAST(std::vector<ExprAST*> exprs, Token op) : exprs(std::move(exprs)), op(std::move(op)) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	Value eval(Context* parent) override final;
 
 	inline ASTType getType() const override final {
 		return T_ListAST;
 	}
+
+	inline const std::vector<ExprAST*>& getExprs() const {
+		return this->exprs;
+	}
+
+	inline std::vector<ExprAST*>& getExprs() {
+		return this->exprs;
+	}
+
+	inline Token getOp() const {
+		return this->op;
+	}
+
+	/// Apply `op` to the operands, which it may move from, such as those
+	/// left on the operand stack of the VM.
+	static Value apply(Token op, std::span<Value> vals);
+
+	/// Whether eval() folds the operands as they are evaluated.
+	static bool folds(Token op);
 };
 
 class VarOpAST : public ExprAST {
 private:
 	std::string name;
-	std::shared_ptr<ExprAST> expr;
+	ExprAST* expr;
 	Token op;
+	VarRef ref;
+	VarRef storeRef;
 
 public:
-	VarOpAST(std::string name, std::shared_ptr<ExprAST> expr, Token op) : name(std::move(name)), expr(std::move(expr)), op(std::move(op)) {}
+	VarOpAST(std::string name, ExprAST* expr, Token op) : name(std::move(name)), expr(expr), op(std::move(op)) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	Value eval(Context* parent) override final;
 
 	inline ASTType getType() const override final {
 		return T_VarOpAST;
 	}
+
+	inline const std::string& getName() const {
+		return this->name;
+	}
+
+	inline const VarRef& getRef() const {
+		return this->ref;
+	}
+
+	inline void setRef(VarRef r) {
+		this->ref = std::move(r);
+	}
+
+	inline const VarRef& getStoreRef() const {
+		return this->storeRef;
+	}
+
+	inline void setStoreRef(VarRef r) {
+		this->storeRef = std::move(r);
+	}
+
+	inline ExprAST* getExpr() const {
+		return this->expr;
+	}
+
+	inline void setExpr(ExprAST* e) {
+		this->expr = e;
+	}
+
+	inline Token getOp() const {
+		return this->op;
+	}
 };
 
 class LValOpAST : public ExprAST {
 private:
-	std::shared_ptr<ExprAST> lval;
-	std::shared_ptr<ExprAST> expr;
+	ExprAST* lval;
+	ExprAST* expr;
 	Token op;
 
 public:
-	LValOpAST(std::shared_ptr<ExprAST> lval, std::shared_ptr<ExprAST> expr, Token op) : lval(std::move(lval)), expr(std::move(expr)), op(std::move(op)) {}
+	LValOpAST(ExprAST* lval, ExprAST* expr, Token op) : lval(lval), expr(expr), op(std::move(op)) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	Value eval(Context* parent) override final;
 
 	inline ASTType getType() const override final {
 		return T_LValOpAST;
 	}
+
+	inline ExprAST* getLVal() const {
+		return this->lval;
+	}
+
+	inline ExprAST* getExpr() const {
+		return this->expr;
+	}
+
+	inline void setExpr(ExprAST* e) {
+		this->expr = e;
+	}
+
+	inline Token getOp() const {
+		return this->op;
+	}
+
+	static Value applyDelta(Token op, const Value& original, const Value& delta);
 };
 
 class ReturnAST : public ExprAST {
 private:
-	std::shared_ptr<ExprAST> expr;
+	ExprAST* expr;
 	std::string name;
 
 public:
-	explicit ReturnAST(std::shared_ptr<ExprAST> expr) : expr(std::move(expr)), name() {}
+	explicit ReturnAST(ExprAST* expr) : expr(expr), name() {}
 
-	ReturnAST(std::shared_ptr<ExprAST> expr, std::string name) : expr(std::move(expr)), name(std::move(name)) {}
+	ReturnAST(ExprAST* expr, std::string name) : expr(expr), name(std::move(name)) {}
 
-	std::shared_ptr<Value> eval(Context* parent) override final;
+	Value eval(Context* parent) override final;
 
 	std::string getName() const {
 		return name;
 	}
 
+	inline ExprAST* getExpr() const {
+		return this->expr;
+	}
+
+	inline void setExpr(ExprAST* e) {
+		this->expr = e;
+	}
+
 	inline ASTType getType() const override final {
 		return T_ReturnAST;
 	}
 };
 
+/// FutureAST - (future expr): evaluates `expr` on the Scheduler's threads
+/// and returns a Future at once, see Future.h.
+///
+/// The expression runs in a frame of its own under a snapshot of the global
+/// variables. Local variables of the enclosing frames that it reads are
+/// captured: the Resolver gives each a slot of that frame, which is set to
+/// the variable's value when the future is made.
+class FutureAST : public ExprAST {
+public:
+	struct Capture {
+		std::string name;
+
+		// From the frame the future is made in
+		VarRef ref;
+		std::uint32_t index;
+	};
+
+private:
+	ExprAST* expr;
+
+	// Frame layout, filled in by the Resolver
+	std::uint32_t slots = 0;
+	std::vector<Capture> captures;
+
+public:
+	explicit FutureAST(ExprAST* expr) : expr(expr) {}
+
+	Value eval(Context* parent) override final;
+
+	/// Make the future, capturing from `frame`, through `refs` if given,
+	/// one for each capture, such as those the VM lays out for its frames.
+	Value spawn(Context* frame, const VarRef* refs = nullptr) const;
+
+	/// Value of a captured variable in `frame`, unbound if it has none.
+	static Value capture(Context* frame, const std::string& name, const VarRef& ref) {
+		auto var = frame->getVariable(name, ref);
+		return var ? var->copy() : Value::unbound();
+	}
+
+	inline ASTType getType() const override final {
+		return T_FutureAST;
+	}
+
+	inline ExprAST* getExpr() const {
+		return this->expr;
+	}
+
+	inline void setExpr(ExprAST* e) {
+		this->expr = e;
+	}
+
+	inline std::uint32_t getSlots() const {
+		return this->slots;
+	}
+
+	inline void setSlots(std::uint32_t n) {
+		this->slots = n;
+	}
+
+	inline const std::vector<Capture>& getCaptures() const {
+		return this->captures;
+	}
+
+	inline void setCaptures(std::vector<Capture> c) {
+		this->captures = std::move(c);
+	}
+};
+
 class LiteralAST : public ExprAST {
 private:
-	std::shared_ptr<Value> val;
+	Value val;
 
 public:
-	explicit LiteralAST(bool val) : val(std::make_shared<SingleValue>(val)) {}
+	explicit LiteralAST(bool val) : val(val) {}
+
+	explicit LiteralAST(std::int64_t val) : val(val) {}
 
-	explicit LiteralAST(std::int64_t val) : val(std::make_shared<SingleValue>(val)) {}
+	explicit LiteralAST(double val) : val(val) {}
 
-	explicit LiteralAST(double val) : val(std::make_shared<SingleValue>(val)) {}
+	explicit LiteralAST(std::string val) : val(std::move(val)) {}
 
-	explicit LiteralAST(std::string val) : val(std::make_shared<SingleValue>(std::move(val))) {}
+	explicit LiteralAST(Value val) : val(std::move(val)) {}
 
 	inline ASTType getType() const override final {
 		return T_LiteralAST;
 	}
 
-	std::shared_ptr<Value> eval(Context* parent) override final {
-		return val->copy();
+	inline const Value& getValue() const {
+		return this->val;
+	}
+
+	Value eval(Context* parent) override final {
+		return this->val;
+	}
+};
+
+/// CachedAST - A pure subexpression evaluated at most once per frame.
+/// Placed by the Optimizer. The value is kept in a frame slot that stays
+/// unbound until the first evaluation, so an expression that throws is
+/// simply evaluated again the next time.
+class CachedAST : public ExprAST {
+private:
+	ExprAST* expr;
+	VarSlot slot;
+
+public:
+	CachedAST(ExprAST* expr, VarSlot slot) : expr(expr), slot(slot) {}
+
+	Value eval(Context* parent) override final;
+
+	inline ASTType getType() const override final {
+		return T_CachedAST;
+	}
+
+	inline ExprAST* getExpr() const {
+		return this->expr;
+	}
+
+	inline VarSlot getSlot() const {
+		return this->slot;
 	}
 };
 
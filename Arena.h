@@ -0,0 +1,74 @@
+#ifndef __DRAGON_LISP_ARENA_H__
+#define __DRAGON_LISP_ARENA_H__
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace DragonLisp {
+
+/// Arena - Bump allocator for objects that share one lifetime.
+/// Objects are packed into large blocks and destroyed together, in
+/// reverse order of creation, by clear() or the destructor.
+class Arena {
+private:
+	static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+	struct Finalizer {
+		void* object;
+		void (*destroy)(void*);
+	};
+
+	std::vector<char*> blocks;
+	std::size_t used = BLOCK_SIZE;
+
+	std::vector<Finalizer> finalizers;
+
+	void* allocate(std::size_t size, std::size_t align) {
+		this->used = (this->used + align - 1) & ~(align - 1);
+		if (this->blocks.empty() || this->used + size > BLOCK_SIZE) {
+			// Oversized requests get a block of their own
+			this->blocks.push_back(new char[size > BLOCK_SIZE ? size : BLOCK_SIZE]);
+			this->used = 0;
+		}
+		void* ret = this->blocks.back() + this->used;
+		this->used += size;
+		return ret;
+	}
+
+public:
+	Arena() = default;
+
+	Arena(const Arena&) = delete;
+
+	Arena& operator=(const Arena&) = delete;
+
+	~Arena() {
+		this->clear();
+	}
+
+	template <typename T, typename... Args>
+	T* make(Args&&... args) {
+		static_assert(alignof(T) <= alignof(std::max_align_t));
+		T* ret = new (this->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		if constexpr (!std::is_trivially_destructible_v<T>)
+			this->finalizers.push_back({ ret, [](void* p) { static_cast<T*>(p)->~T(); } });
+		return ret;
+	}
+
+	void clear() {
+		for (auto it = this->finalizers.rbegin(); it != this->finalizers.rend(); ++it)
+			it->destroy(it->object);
+		this->finalizers.clear();
+		for (auto b : this->blocks)
+			delete[] b;
+		this->blocks.clear();
+		this->used = BLOCK_SIZE;
+	}
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_ARENA_H__
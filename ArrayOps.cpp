@@ -0,0 +1,415 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DRAGON_LISP_X86_KERNELS
+#endif
+
+#include "ArrayOps.h"
+#include "AST.h"
+
+namespace DragonLisp {
+
+/// Kernels - Loops over dense packed storage.
+/// Integer arithmetic wraps around, like the list operators do in practice.
+struct Kernels {
+	std::int64_t (*sumInt)(const std::int64_t* a, std::size_t n);
+	double (*sumFloat)(const double* a, std::size_t n);
+	std::int64_t (*dotInt)(const std::int64_t* a, const std::int64_t* b, std::size_t n);
+	double (*dotFloat)(const double* a, const double* b, std::size_t n);
+	std::int64_t (*maxInt)(const std::int64_t* a, std::size_t n);
+	std::int64_t (*minInt)(const std::int64_t* a, std::size_t n);
+	double (*maxFloat)(const double* a, std::size_t n);
+	double (*minFloat)(const double* a, std::size_t n);
+	void (*addInt)(const std::int64_t* a, const std::int64_t* b, std::int64_t* out, std::size_t n);
+	void (*mulInt)(const std::int64_t* a, const std::int64_t* b, std::int64_t* out, std::size_t n);
+	void (*addFloat)(const double* a, const double* b, double* out, std::size_t n);
+	void (*mulFloat)(const double* a, const double* b, double* out, std::size_t n);
+	void (*scaleInt)(const std::int64_t* a, std::int64_t k, std::int64_t* out, std::size_t n);
+	void (*scaleFloat)(const double* a, double k, double* out, std::size_t n);
+};
+
+// Portable kernels, also the tail loops of the vector ones
+
+static std::int64_t sumIntScalar(const std::int64_t* a, std::size_t n) {
+	std::uint64_t r = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		r += static_cast<std::uint64_t>(a[i]);
+	return static_cast<std::int64_t>(r);
+}
+
+static double sumFloatScalar(const double* a, std::size_t n) {
+	double r = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		r += a[i];
+	return r;
+}
+
+static std::int64_t dotIntScalar(const std::int64_t* a, const std::int64_t* b, std::size_t n) {
+	std::uint64_t r = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		r += static_cast<std::uint64_t>(a[i]) * static_cast<std::uint64_t>(b[i]);
+	return static_cast<std::int64_t>(r);
+}
+
+static double dotFloatScalar(const double* a, const double* b, std::size_t n) {
+	double r = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		r += a[i] * b[i];
+	return r;
+}
+
+template <typename T>
+static T maxScalar(const T* a, std::size_t n) {
+	T r = a[0];
+	for (std::size_t i = 1; i < n; ++i)
+		if (r < a[i])
+			r = a[i];
+	return r;
+}
+
+template <typename T>
+static T minScalar(const T* a, std::size_t n) {
+	T r = a[0];
+	for (std::size_t i = 1; i < n; ++i)
+		if (a[i] < r)
+			r = a[i];
+	return r;
+}
+
+static void addIntScalar(const std::int64_t* a, const std::int64_t* b, std::int64_t* out, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = static_cast<std::int64_t>(static_cast<std::uint64_t>(a[i]) + static_cast<std::uint64_t>(b[i]));
+}
+
+static void mulIntScalar(const std::int64_t* a, const std::int64_t* b, std::int64_t* out, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = static_cast<std::int64_t>(static_cast<std::uint64_t>(a[i]) * static_cast<std::uint64_t>(b[i]));
+}
+
+static void addFloatScalar(const double* a, const double* b, double* out, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = a[i] + b[i];
+}
+
+static void mulFloatScalar(const double* a, const double* b, double* out, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = a[i] * b[i];
+}
+
+static void scaleIntScalar(const std::int64_t* a, std::int64_t k, std::int64_t* out, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = static_cast<std::int64_t>(static_cast<std::uint64_t>(a[i]) * static_cast<std::uint64_t>(k));
+}
+
+static void scaleFloatScalar(const double* a, double k, double* out, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = a[i] * k;
+}
+
+static const Kernels scalarKernels = {
+	sumIntScalar, sumFloatScalar, dotIntScalar, dotFloatScalar,
+	maxScalar<std::int64_t>, minScalar<std::int64_t>, maxScalar<double>, minScalar<double>,
+	addIntScalar, mulIntScalar, addFloatScalar, mulFloatScalar, scaleIntScalar, scaleFloatScalar,
+};
+
+#ifdef DRAGON_LISP_X86_KERNELS
+
+// AVX2 has no 64-bit multiply, so integer dot / mul / scale stay scalar.
+
+#define AVX2_KERNEL __attribute__((target("avx2,fma")))
+
+AVX2_KERNEL static std::int64_t sumIntAVX2(const std::int64_t* a, std::size_t n) {
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)));
+		acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 4)));
+	}
+	alignas(32) std::uint64_t lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(acc0, acc1));
+	std::uint64_t r = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	return static_cast<std::int64_t>(r + static_cast<std::uint64_t>(sumIntScalar(a + i, n - i)));
+}
+
+AVX2_KERNEL static double sumFloatAVX2(const double* a, std::size_t n) {
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+		acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+	}
+	alignas(32) double lanes[4];
+	_mm256_store_pd(lanes, _mm256_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumFloatScalar(a + i, n - i);
+}
+
+AVX2_KERNEL static double dotFloatAVX2(const double* a, const double* b, std::size_t n) {
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+		acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), acc1);
+	}
+	alignas(32) double lanes[4];
+	_mm256_store_pd(lanes, _mm256_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotFloatScalar(a + i, b + i, n - i);
+}
+
+template <bool Max>
+AVX2_KERNEL static std::int64_t extremeIntAVX2(const std::int64_t* a, std::size_t n) {
+	if (n < 4)
+		return Max ? maxScalar(a, n) : minScalar(a, n);
+	__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+	std::size_t i = 4;
+	for (; i + 4 <= n; i += 4) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+		__m256i take = Max ? _mm256_cmpgt_epi64(v, acc) : _mm256_cmpgt_epi64(acc, v);
+		acc = _mm256_blendv_epi8(acc, v, take);
+	}
+	alignas(32) std::int64_t lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+	auto r = Max ? maxScalar(lanes, 4) : minScalar(lanes, 4);
+	if (i < n) {
+		auto t = Max ? maxScalar(a + i, n - i) : minScalar(a + i, n - i);
+		r = Max ? (r < t ? t : r) : (t < r ? t : r);
+	}
+	return r;
+}
+
+template <bool Max>
+AVX2_KERNEL static double extremeFloatAVX2(const double* a, std::size_t n) {
+	if (n < 4)
+		return Max ? maxScalar(a, n) : minScalar(a, n);
+	__m256d acc = _mm256_loadu_pd(a);
+	std::size_t i = 4;
+	for (; i + 4 <= n; i += 4)
+		acc = Max ? _mm256_max_pd(acc, _mm256_loadu_pd(a + i)) : _mm256_min_pd(acc, _mm256_loadu_pd(a + i));
+	alignas(32) double lanes[4];
+	_mm256_store_pd(lanes, acc);
+	auto r = Max ? maxScalar(lanes, 4) : minScalar(lanes, 4);
+	if (i < n) {
+		auto t = Max ? maxScalar(a + i, n - i) : minScalar(a + i, n - i);
+		r = Max ? (r < t ? t : r) : (t < r ? t : r);
+	}
+	return r;
+}
+
+AVX2_KERNEL static void addIntAVX2(const std::int64_t* a, const std::int64_t* b, std::int64_t* out, std::size_t n) {
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+		__m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi64(x, y));
+	}
+	addIntScalar(a + i, b + i, out + i, n - i);
+}
+
+AVX2_KERNEL static void addFloatAVX2(const double* a, const double* b, double* out, std::size_t n) {
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+	addFloatScalar(a + i, b + i, out + i, n - i);
+}
+
+AVX2_KERNEL static void mulFloatAVX2(const double* a, const double* b, double* out, std::size_t n) {
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+	mulFloatScalar(a + i, b + i, out + i, n - i);
+}
+
+AVX2_KERNEL static void scaleFloatAVX2(const double* a, double k, double* out, std::size_t n) {
+	__m256d kv = _mm256_set1_pd(k);
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), kv));
+	scaleFloatScalar(a + i, k, out + i, n - i);
+}
+
+static const Kernels avx2Kernels = {
+	sumIntAVX2, sumFloatAVX2, dotIntScalar, dotFloatAVX2,
+	extremeIntAVX2<true>, extremeIntAVX2<false>, extremeFloatAVX2<true>, extremeFloatAVX2<false>,
+	addIntAVX2, mulIntScalar, addFloatAVX2, mulFloatAVX2, scaleIntScalar, scaleFloatAVX2,
+};
+
+#endif // DRAGON_LISP_X86_KERNELS
+
+static const Kernels& kernels() {
+#ifdef DRAGON_LISP_X86_KERNELS
+	static const Kernels& k = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? avx2Kernels : scalarKernels;
+	return k;
+#else
+	return scalarKernels;
+#endif
+}
+
+static std::vector<double> toFloats(const ArrayValue* a) {
+	if (a->getKind() == ARRAY_FLOAT)
+		return std::vector<double>(a->floatData(), a->floatData() + a->getSize());
+	std::vector<double> ret(a->getSize());
+	for (std::size_t i = 0; i < ret.size(); ++i)
+		ret[i] = static_cast<double>(a->intData()[i]);
+	return ret;
+}
+
+static std::vector<Value> elements(const ArrayValue* a) {
+	std::vector<Value> ret;
+	ret.reserve(a->getSize());
+	for (std::size_t i = 0; i < a->getSize(); ++i)
+		ret.push_back(a->get(i));
+	return ret;
+}
+
+static const ArrayValue* arrayArg(const Value& v) {
+	if (!v.isArray())
+		throw std::runtime_error("Cannot apply array operator to non-array value");
+	return v.getArray();
+}
+
+static void checkSizes(const ArrayValue* a, const ArrayValue* b) {
+	if (a->getSize() != b->getSize())
+		throw std::runtime_error("Array sizes do not match: " + std::to_string(a->getSize()) + " != " + std::to_string(b->getSize()));
+}
+
+bool ArrayOps::handles(Token op) {
+	switch (op) {
+		case ARRAY_SUM:
+		case ARRAY_DOT:
+		case ARRAY_FILL:
+		case ARRAY_MAX:
+		case ARRAY_MIN:
+		case ARRAY_ADD:
+		case ARRAY_MUL:
+		case ARRAY_SCALE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+Value ArrayOps::apply(Token op, std::span<Value> args) {
+	bool unary = op == ARRAY_SUM || op == ARRAY_MAX || op == ARRAY_MIN;
+	if (args.size() != (unary ? 1 : 2))
+		throw std::runtime_error("Invalid argument count for selected operator");
+
+	const auto& k = kernels();
+	auto a = arrayArg(args[0]);
+	auto n = a->getSize();
+
+	switch (op) {
+		case ARRAY_SUM: {
+			if (a->isDense())
+				return a->getKind() == ARRAY_INT ? Value(k.sumInt(a->intData(), n)) : Value(k.sumFloat(a->floatData(), n));
+			if (!n)
+				return Value(std::int64_t(0));
+			auto vals = elements(a);
+			return ListAST::apply(PLUS, vals);
+		}
+
+		case ARRAY_MAX:
+		case ARRAY_MIN: {
+			if (!n)
+				throw std::runtime_error("Cannot apply selected operator to an empty array");
+			bool max = op == ARRAY_MAX;
+			if (a->isDense() && a->getKind() == ARRAY_INT)
+				return Value(max ? k.maxInt(a->intData(), n) : k.minInt(a->intData(), n));
+			if (a->isDense())
+				return Value(max ? k.maxFloat(a->floatData(), n) : k.minFloat(a->floatData(), n));
+			auto vals = elements(a);
+			return ListAST::apply(max ? MAX : MIN, vals);
+		}
+
+		case ARRAY_DOT: {
+			auto b = arrayArg(args[1]);
+			checkSizes(a, b);
+			if (a->isDense() && b->isDense()) {
+				if (a->getKind() == ARRAY_INT && b->getKind() == ARRAY_INT)
+					return Value(k.dotInt(a->intData(), b->intData(), n));
+				auto x = toFloats(a), y = toFloats(b);
+				return Value(k.dotFloat(x.data(), y.data(), n));
+			}
+			if (!n)
+				return Value(std::int64_t(0));
+			std::vector<Value> products;
+			products.reserve(n);
+			for (std::size_t i = 0; i < n; ++i) {
+				std::vector<Value> pair = { a->get(i), b->get(i) };
+				products.push_back(ListAST::apply(MULTIPLY, pair));
+			}
+			return ListAST::apply(PLUS, products);
+		}
+
+		case ARRAY_ADD:
+		case ARRAY_MUL: {
+			auto b = arrayArg(args[1]);
+			checkSizes(a, b);
+			bool add = op == ARRAY_ADD;
+			if (a->isDense() && b->isDense()) {
+				if (a->getKind() == ARRAY_INT && b->getKind() == ARRAY_INT) {
+					std::vector<std::int64_t> out(n);
+					(add ? k.addInt : k.mulInt)(a->intData(), b->intData(), out.data(), n);
+					return Value(new ArrayValue(std::move(out)));
+				}
+				auto x = toFloats(a), y = toFloats(b);
+				std::vector<double> out(n);
+				(add ? k.addFloat : k.mulFloat)(x.data(), y.data(), out.data(), n);
+				return Value(new ArrayValue(std::move(out)));
+			}
+			auto ret = new ArrayValue(n);
+			Value holder(ret);
+			for (std::size_t i = 0; i < n; ++i) {
+				std::vector<Value> pair = { a->get(i), b->get(i) };
+				ret->set(i, ListAST::apply(add ? PLUS : MULTIPLY, pair));
+			}
+			return holder;
+		}
+
+		case ARRAY_SCALE: {
+			const auto& factor = args[1];
+			if (a->isDense() && factor.isNumber()) {
+				if (a->getKind() == ARRAY_INT && factor.isInt()) {
+					std::vector<std::int64_t> out(n);
+					k.scaleInt(a->intData(), factor.getInt(), out.data(), n);
+					return Value(new ArrayValue(std::move(out)));
+				}
+				auto x = toFloats(a);
+				std::vector<double> out(n);
+				k.scaleFloat(x.data(), factor.getNumber(), out.data(), n);
+				return Value(new ArrayValue(std::move(out)));
+			}
+			auto ret = new ArrayValue(n);
+			Value holder(ret);
+			for (std::size_t i = 0; i < n; ++i) {
+				std::vector<Value> pair = { a->get(i), factor };
+				ret->set(i, ListAST::apply(MULTIPLY, pair));
+			}
+			return holder;
+		}
+
+		case ARRAY_FILL: {
+			const auto& v = args[1];
+			if (v.isArray())
+				throw std::runtime_error("Cannot set array element to another array");
+			if (v.isInt())
+				return Value(new ArrayValue(std::vector<std::int64_t>(n, v.getInt())));
+			if (v.isFloat())
+				return Value(new ArrayValue(std::vector<double>(n, v.getFloat())));
+			auto ret = new ArrayValue(n);
+			Value holder(ret);
+			for (std::size_t i = 0; i < n; ++i)
+				ret->set(i, v);
+			return holder;
+		}
+
+		default:
+			throw std::runtime_error("Unexpected error");
+	}
+}
+
+} // namespace DragonLisp
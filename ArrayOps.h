@@ -0,0 +1,31 @@
+#ifndef __DRAGON_LISP_ARRAY_OPS_H__
+#define __DRAGON_LISP_ARRAY_OPS_H__
+
+#include <span>
+#include <vector>
+
+#include "token.h"
+#include "value.h"
+
+namespace DragonLisp {
+
+/// ArrayOps - Built-in bulk primitives over arrays.
+///
+///   (array-sum a)		(array-max a)		(array-min a)
+///   (array-dot a b)	(array-add a b)		(array-mul a b)
+///   (array-scale a k)	(array-fill a v)
+///
+/// None of them modify their arguments; array-add, array-mul, array-scale
+/// and array-fill return a new array of the same size. Dense packed arrays
+/// go through vector kernels picked at runtime from the CPU features, any
+/// other array behaves exactly as the element-wise list operators would.
+class ArrayOps {
+public:
+	static bool handles(Token op);
+
+	static Value apply(Token op, std::span<Value> args);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_ARRAY_OPS_H__
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Batch.h"
+
+namespace DragonLisp {
+
+Batch::Batch(unsigned jobs, Setup setup) : jobs(std::max(1u, jobs)), setup(std::move(setup)) {}
+
+void Batch::runJob(Job& job) {
+	int ret;
+	{
+		DLDriver driver;
+		this->setup(driver);
+		driver.setOutput(job.out, job.err);
+		try {
+			ret = driver.parse(job.path);
+		} catch (const std::exception& e) {
+			job.err << "Error: " << e.what() << "\n";
+			ret = 1;
+		}
+	}
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	job.ret = ret;
+	job.done = true;
+	this->finished.notify_all();
+}
+
+int Batch::run(const std::string& dir, std::ostream& out, std::ostream& err) {
+	std::vector<std::string> paths;
+	std::error_code ec;
+	for (std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+		std::error_code type;
+		if (it->is_regular_file(type) && it->path().extension() == ".lisp")
+			paths.push_back(it->path().string());
+	}
+	if (ec) {
+		err << "Could not read directory " << dir << std::endl;
+		return 1;
+	}
+	std::sort(paths.begin(), paths.end());
+
+	std::vector<Job> list(paths.size());
+	for (std::size_t i = 0; i < paths.size(); i++)
+		list[i].path = std::move(paths[i]);
+
+	std::atomic<std::size_t> next = 0;
+	std::vector<std::thread> threads;
+	auto n = std::min<std::size_t>(this->jobs, list.size());
+	for (std::size_t i = 0; i < n; i++) {
+		threads.emplace_back([&]() {
+			for (auto j = next.fetch_add(1); j < list.size(); j = next.fetch_add(1))
+				this->runJob(list[j]);
+		});
+	}
+
+	int ret = 0;
+	for (auto& job : list) {
+		{
+			std::unique_lock<std::mutex> guard(this->lock);
+			this->finished.wait(guard, [&] { return job.done; });
+		}
+		out << "==> " << job.path << " <==\n" << job.out.str() << std::flush;
+		err << job.err.str() << std::flush;
+		job.out.str({});
+		job.err.str({});
+		if (job.ret)
+			ret = 1;
+	}
+	for (auto& t : threads)
+		t.join();
+	return ret;
+}
+
+} // namespace DragonLisp
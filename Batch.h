@@ -0,0 +1,54 @@
+#ifndef __DRAGON_LISP_BATCH_H__
+#define __DRAGON_LISP_BATCH_H__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "DragonLispDriver.h"
+
+namespace DragonLisp {
+
+/// Batch - Scripts of a directory run concurrently in one process.
+///
+/// Every script is run by a DLDriver of its own, on one of `jobs` threads
+/// that each take the next script once they are done with one. What a
+/// script prints is held back until the scripts before it are done, so
+/// the output comes in the order of the file names, each script under a
+/// header line. An error raised by a script stops that script only.
+class Batch {
+public:
+	/// Applies the command line options to the driver of a script.
+	using Setup = std::function<void(DLDriver& driver)>;
+
+private:
+	struct Job {
+		std::string path;
+		std::ostringstream out;
+		std::ostringstream err;
+		int ret = 0;
+		bool done = false;
+	};
+
+	unsigned jobs;
+	Setup setup;
+
+	std::mutex lock;
+	std::condition_variable finished;
+
+	void runJob(Job& job);
+
+public:
+	Batch(unsigned jobs, Setup setup);
+
+	/// Run the .lisp files of `dir`, writing what they print to `out` and
+	/// their errors to `err`. Returns 0 if every script succeeded.
+	int run(const std::string& dir, std::ostream& out, std::ostream& err);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_BATCH_H__
@@ -0,0 +1,411 @@
+#include <stdexcept>
+
+#include "Bytecode.h"
+
+namespace DragonLisp {
+
+void BytecodeCompiler::emit(OpCode op) {
+	this->chunk->code.push_back(op);
+}
+
+void BytecodeCompiler::emit(OpCode op, std::uint32_t a) {
+	this->emit(op);
+	for (int i = 0; i < 4; ++i)
+		this->chunk->code.push_back(static_cast<std::uint8_t>(a >> (8 * i)));
+}
+
+void BytecodeCompiler::emit(OpCode op, std::uint32_t a, std::uint32_t b) {
+	this->emit(op, a);
+	for (int i = 0; i < 4; ++i)
+		this->chunk->code.push_back(static_cast<std::uint8_t>(b >> (8 * i)));
+}
+
+std::size_t BytecodeCompiler::emitJump(OpCode op) {
+	this->emit(op, 0);
+	return this->chunk->code.size() - 4;
+}
+
+std::size_t BytecodeCompiler::emitJump(OpCode op, std::uint32_t a) {
+	this->emit(op, a, 0);
+	return this->chunk->code.size() - 4;
+}
+
+void BytecodeCompiler::patch(std::size_t at, std::size_t target) {
+	for (int i = 0; i < 4; ++i)
+		this->chunk->code[at + i] = static_cast<std::uint8_t>(target >> (8 * i));
+}
+
+std::uint32_t BytecodeCompiler::name(const std::string& n) {
+	auto& names = this->chunk->names;
+	for (std::size_t i = 0; i < names.size(); ++i)
+		if (names[i] == n)
+			return i;
+	names.push_back(n);
+	return names.size() - 1;
+}
+
+std::uint32_t BytecodeCompiler::constant(Value v) {
+	this->chunk->constants.push_back(std::move(v));
+	return this->chunk->constants.size() - 1;
+}
+
+// The slots of the reference are made relative to the frame
+std::uint32_t BytecodeCompiler::ref(const VarRef& r) {
+	VarRef flat;
+	flat.global = r.global;
+	for (const auto& s : r.slots)
+		flat.slots.push_back({ 0, this->slot(s) });
+	this->chunk->refs.push_back(std::move(flat));
+	return this->chunk->refs.size() - 1;
+}
+
+std::uint32_t BytecodeCompiler::slot(VarSlot s) const {
+	if (s.depth >= this->scopes.size())
+		throw std::runtime_error("Unexpected error");
+	return this->scopes[this->scopes.size() - 1 - s.depth] + s.index;
+}
+
+std::uint32_t BytecodeCompiler::enterScope(std::uint32_t n) {
+	this->scopes.push_back(this->top);
+	this->top += n;
+	if (this->top > this->chunk->slots)
+		this->chunk->slots = this->top;
+	return this->scopes.back();
+}
+
+void BytecodeCompiler::leaveScope() {
+	this->top = this->scopes.back();
+	this->scopes.pop_back();
+}
+
+void BytecodeCompiler::emitLoad(const std::string& n, const VarRef& r) {
+	if (r.isDirect())
+		this->emit(OP_LOAD_SLOT, this->slot(r.slots.front()));
+	else
+		this->emit(OP_LOAD, this->name(n), this->ref(r));
+}
+
+void BytecodeCompiler::emitStore(const std::string& n, const VarRef& r, bool copy) {
+	if (r.slots.empty())
+		this->emit(copy ? OP_STORE_COPY : OP_STORE, this->name(n), this->ref(r));
+	else
+		this->emit(copy ? OP_STORE_COPY_SLOT : OP_STORE_SLOT, this->slot(r.slots.front()));
+}
+
+std::unique_ptr<Chunk> BytecodeCompiler::compile(const ExprAST* expr) {
+	auto ret = std::make_unique<Chunk>();
+	this->chunk = ret.get();
+	this->loops.clear();
+	this->scopes.clear();
+	this->top = 0;
+	this->inFunction = false;
+
+	this->compileExpr(expr);
+	this->emit(OP_HALT);
+
+	this->chunk = nullptr;
+	return ret;
+}
+
+std::unique_ptr<Chunk> BytecodeCompiler::compile(const FuncDefAST* func) {
+	auto ret = std::make_unique<Chunk>();
+	this->chunk = ret.get();
+	this->loops.clear();
+	this->scopes.clear();
+	this->top = 0;
+	this->inFunction = true;
+
+	ret->funcName = func->getName();
+	ret->params = func->getArgSlots();
+	for (std::size_t i = 0; i < ret->params.size(); i++)
+		ret->inOrder = ret->inOrder && ret->params[i] == i;
+	this->enterScope(func->getSlots());
+
+	// The value of the last evaluated statement is kept on the stack
+	this->emit(OP_NIL);
+	for (const auto& stmt : func->getBody())
+		this->compileStatement(stmt, true);
+	this->emit(OP_RETURN);
+
+	this->chunk = nullptr;
+	return ret;
+}
+
+void BytecodeCompiler::compileStatement(const ExprAST* stmt, bool keepResult) {
+	if (stmt->getType() != T_IfAST) {
+		this->compileBranch(stmt, keepResult);
+		return;
+	}
+
+	auto ifAST = static_cast<const IfAST*>(stmt);
+	this->compileExpr(ifAST->getCond());
+	auto toElse = this->emitJump(OP_JUMP_IF_NIL);
+	this->compileBranch(ifAST->getThen(), keepResult);
+	auto toEnd = this->emitJump(OP_JUMP);
+	this->patch(toElse, this->chunk->code.size());
+	this->compileBranch(ifAST->getElse(), keepResult);
+	this->patch(toEnd, this->chunk->code.size());
+}
+
+void BytecodeCompiler::compileBranch(const ExprAST* branch, bool keepResult) {
+	if (!branch)
+		return;
+	if (branch->getType() == T_ReturnAST) {
+		this->compileReturn(static_cast<const ReturnAST*>(branch));
+		return;
+	}
+	this->compileExpr(branch);
+	this->emit(keepResult ? OP_REPLACE : OP_POP);
+}
+
+void BytecodeCompiler::compileLoopBody(const std::vector<ExprAST*>& body) {
+	for (const auto& stmt : body)
+		this->compileStatement(stmt, false);
+}
+
+void BytecodeCompiler::finishCountedLoop(std::size_t toDone) {
+	// Normal termination drops the loop state and yields NIL
+	this->patch(toDone, this->chunk->code.size());
+	this->emit(OP_POP);
+	this->emit(OP_POP);
+	this->emit(OP_NIL);
+	this->emit(OP_UNBIND, this->loops.back().first, this->loops.back().slots);
+
+	for (auto at : this->loops.back().exits)
+		this->patch(at, this->chunk->code.size());
+	this->loops.pop_back();
+	this->leaveScope();
+}
+
+void BytecodeCompiler::compileReturn(const ReturnAST* ret) {
+	// Loops catch every return, named or not.
+	if (!this->loops.empty()) {
+		this->compileExpr(ret->getExpr());
+		auto& loop = this->loops.back();
+		if (loop.stateSlots)
+			this->emit(OP_SLIDE, loop.stateSlots);
+		if (loop.slots)
+			this->emit(OP_UNBIND, loop.first, loop.slots);
+		loop.exits.push_back(this->emitJump(OP_JUMP));
+		return;
+	}
+
+	if (this->inFunction && ret->getName() == this->chunk->funcName) {
+		this->compileExpr(ret->getExpr());
+		this->emit(OP_RETURN);
+		return;
+	}
+
+	if (this->inFunction)
+		this->emit(OP_THROW, this->name("Return name mismatch. Closure is not implemented yet!"));
+	else
+		this->emit(OP_THROW, this->name("Unexpected error"));
+}
+
+void BytecodeCompiler::compileLValOp(const LValOpAST* ast) {
+	auto lval = ast->getLVal();
+	if (lval->getType() != T_IdentifierAST && lval->getType() != T_ArrayRefAST) {
+		this->emit(OP_THROW, this->name("Unexpected error"));
+		return;
+	}
+
+	this->compileExpr(ast->getExpr());
+	if (lval->getType() == T_IdentifierAST) {
+		auto id = static_cast<const IdentifierAST*>(lval);
+		if (ast->getOp() != SETF) {
+			this->emitLoad(id->getName(), id->getRef());
+			this->emit(OP_INCDEC, ast->getOp());
+		}
+		this->emitStore(id->getName(), id->getStoreRef(), false);
+		return;
+	}
+
+	// The index expression is evaluated once for reading and once more for
+	// writing back, exactly like LValOpAST::eval does.
+	auto aref = static_cast<const ArrayRefAST*>(lval);
+	auto id = this->name(aref->getName());
+	auto r = this->ref(aref->getRef());
+	if (ast->getOp() != SETF) {
+		this->compileExpr(aref->getIndex());
+		this->emit(OP_AREF, id, r);
+		this->emit(OP_INCDEC, ast->getOp());
+	}
+	this->compileExpr(aref->getIndex());
+	this->emit(OP_ASET, id, r);
+}
+
+void BytecodeCompiler::compileExpr(const ExprAST* expr) {
+	switch (expr->getType()) {
+		case T_LiteralAST:
+			this->emit(OP_CONST, this->constant(static_cast<const LiteralAST*>(expr)->getValue()));
+			return;
+
+		case T_CachedAST: {
+			auto ast = static_cast<const CachedAST*>(expr);
+			auto s = this->slot(ast->getSlot());
+			auto toDone = this->emitJump(OP_CACHE_LOAD, s);
+			this->compileExpr(ast->getExpr());
+			this->emit(OP_CACHE_STORE, s);
+			this->patch(toDone, this->chunk->code.size());
+			return;
+		}
+
+		case T_IdentifierAST: {
+			auto ast = static_cast<const IdentifierAST*>(expr);
+			this->emitLoad(ast->getName(), ast->getRef());
+			return;
+		}
+
+		case T_ArrayRefAST: {
+			auto ast = static_cast<const ArrayRefAST*>(expr);
+			this->compileExpr(ast->getIndex());
+			this->emit(OP_AREF, this->name(ast->getName()), this->ref(ast->getRef()));
+			return;
+		}
+
+		case T_FuncCallAST: {
+			auto ast = static_cast<const FuncCallAST*>(expr);
+			this->chunk->calls.push_back({ this->name(ast->getName()) });
+			std::uint32_t id = this->chunk->calls.size() - 1;
+			this->emit(OP_CHECK_FUNC, id);
+			for (const auto& a : ast->getArgs())
+				this->compileExpr(a);
+			this->emit(ast->isTail() && this->inFunction ? OP_TAIL_CALL : OP_CALL, id, ast->getArgs().size());
+			return;
+		}
+
+		case T_InlineCallAST: {
+			// The body runs in the frame of the caller for as long as the
+			// name calls the function inlined, the call is made otherwise
+			auto ast = static_cast<const InlineCallAST*>(expr);
+			auto call = ast->getCall();
+			this->chunk->calls.push_back({ this->name(call->getName()) });
+			this->chunk->calls.back().inlined = ast->getCallee();
+			auto toCall = this->emitJump(OP_INLINE, this->chunk->calls.size() - 1);
+			const auto& args = call->getArgs();
+			const auto& params = ast->getParams();
+			for (std::size_t i = 0; i < args.size(); i++) {
+				this->compileExpr(args[i]);
+				if (i < params.size())
+					this->emit(OP_STORE_SLOT, this->slot(params[i]));
+				this->emit(OP_POP);
+			}
+			if (args.size() < params.size())
+				this->emit(OP_THROW, this->name("Too few arguments"));
+			this->compileExpr(ast->getBody());
+
+			// Do not keep arrays shared past the call
+			for (const auto& p : params)
+				this->emit(OP_UNBIND, this->slot(p), 1);
+			auto toEnd = this->emitJump(OP_JUMP);
+			this->patch(toCall, this->chunk->code.size());
+			this->compileExpr(call);
+			this->patch(toEnd, this->chunk->code.size());
+			return;
+		}
+
+		case T_IfAST:
+			this->emit(OP_THROW, this->name("You should use IfAST::getResult() instead of IfAST::eval()"));
+			return;
+
+		case T_LoopForeverAST: {
+			auto ast = static_cast<const LoopForeverAST*>(expr);
+			this->loops.push_back({ 0, 0, 0, {} });
+			auto head = this->chunk->code.size();
+			this->compileLoopBody(ast->getBody());
+			this->patch(this->emitJump(OP_JUMP), head);
+			for (auto at : this->loops.back().exits)
+				this->patch(at, this->chunk->code.size());
+			this->loops.pop_back();
+			return;
+		}
+
+		case T_LoopForAST: {
+			auto ast = static_cast<const LoopForAST*>(expr);
+			this->compileExpr(ast->getStart());
+			this->compileExpr(ast->getEnd());
+			this->emit(OP_FOR_INIT);
+			auto first = this->enterScope(ast->getSlots());
+			this->loops.push_back({ 2, first, ast->getSlots(), {} });
+			auto head = this->chunk->code.size();
+			auto toDone = this->emitJump(OP_FOR_TEST, first);
+			this->compileLoopBody(ast->getBody());
+			this->patch(this->emitJump(OP_FOR_STEP), head);
+			this->finishCountedLoop(toDone);
+			return;
+		}
+
+		case T_LoopDoTimesAST: {
+			auto ast = static_cast<const LoopDoTimesAST*>(expr);
+			this->compileExpr(ast->getTimes());
+			this->emit(OP_TIMES_INIT);
+			auto first = this->enterScope(ast->getSlots());
+			this->loops.push_back({ 2, first, ast->getSlots(), {} });
+			auto head = this->chunk->code.size();
+			auto toDone = this->emitJump(OP_TIMES_TEST, first);
+			this->compileLoopBody(ast->getBody());
+			this->patch(this->emitJump(OP_TIMES_STEP), head);
+			this->finishCountedLoop(toDone);
+			return;
+		}
+
+		case T_UnaryAST: {
+			auto ast = static_cast<const UnaryAST*>(expr);
+			this->compileExpr(ast->getExpr());
+			this->emit(OP_UNARY, ast->getOp());
+			return;
+		}
+
+		case T_BinaryAST: {
+			auto ast = static_cast<const BinaryAST*>(expr);
+			this->compileExpr(ast->getLHS());
+			this->compileExpr(ast->getRHS());
+			this->emit(OP_BINARY, ast->getOp());
+			return;
+		}
+
+		case T_ListAST: {
+			auto ast = static_cast<const ListAST*>(expr);
+			const auto& exprs = ast->getExprs();
+			for (const auto& e : exprs)
+				this->compileExpr(e);
+			this->emit(OP_LIST, ast->getOp(), exprs.size());
+			return;
+		}
+
+		case T_VarOpAST: {
+			auto ast = static_cast<const VarOpAST*>(expr);
+			if (ast->getOp() == SETQ)
+				this->emit(OP_CHECK_VAR, this->name(ast->getName()), this->ref(ast->getRef()));
+			this->compileExpr(ast->getExpr());
+			if (ast->getOp() == DEFCONSTANT)
+				this->emit(OP_DEFCONST, this->name(ast->getName()));
+			else
+				this->emitStore(ast->getName(), ast->getStoreRef(), true);
+			return;
+		}
+
+		case T_LValOpAST:
+			this->compileLValOp(static_cast<const LValOpAST*>(expr));
+			return;
+
+		case T_ReturnAST:
+			this->compileExpr(static_cast<const ReturnAST*>(expr)->getExpr());
+			return;
+
+		case T_FutureAST: {
+			auto ast = static_cast<const FutureAST*>(expr);
+			this->chunk->futures.push_back(ast);
+			std::uint32_t first = this->chunk->refs.size();
+			for (const auto& c : ast->getCaptures())
+				this->ref(c.ref);
+			this->emit(OP_FUTURE, this->chunk->futures.size() - 1, first);
+			return;
+		}
+
+		default:
+			throw std::runtime_error("Unexpected error");
+	}
+}
+
+} // namespace DragonLisp
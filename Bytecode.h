@@ -0,0 +1,158 @@
+#ifndef __DRAGON_LISP_BYTECODE_H__
+#define __DRAGON_LISP_BYTECODE_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AST.h"
+
+namespace DragonLisp {
+
+/// OpCode - Instructions of the stack VM.
+/// Operands follow the opcode as 32-bit little-endian words.
+enum OpCode : std::uint8_t {
+	OP_CONST,		// [k]		push constants[k]
+	OP_NIL,			//		push NIL
+	OP_POP,			//		drop top
+	OP_REPLACE,		//		pop top and overwrite the new top with it
+	OP_SLIDE,		// [n]		keep top, drop the n values below it
+	OP_LOAD,		// [name, ref]	push a copy of variable
+	OP_LOAD_SLOT,		// [slot]	push a copy of a slot that is always bound
+	OP_STORE,		// [name, ref]	store top into the global table, keep top
+	OP_STORE_COPY,		// [name, ref]	store a copy of top into the global table, keep top
+	OP_STORE_SLOT,		// [slot]	store top into a slot, keep top
+	OP_STORE_COPY_SLOT,	// [slot]	store a copy of top into a slot, keep top
+	OP_UNBIND,		// [slot, n]	unbind n slots from slot
+	OP_CACHE_LOAD,		// [slot, target]	push a cached slot and jump, fall through if unbound
+	OP_CACHE_STORE,		// [slot]	store top into a cache slot, keep top
+	OP_DEFCONST,		// [name]	define a copy of top as a global constant, keep top
+	OP_CHECK_VAR,		// [name, ref]	throw if variable is not visible
+	OP_AREF,		// [name, ref]	pop index, push element
+	OP_ASET,		// [name, ref]	pop index and value, store element, push value
+	OP_INCDEC,		// [op]		pop delta and original, push incremented / decremented value
+	OP_UNARY,		// [op]
+	OP_BINARY,		// [op]
+	OP_LIST,		// [op, n]	apply op to the top n values where they are
+	OP_JUMP,		// [target]
+	OP_JUMP_IF_NIL,		// [target]	pop condition
+	OP_CHECK_FUNC,		// [site]	throw if function is not defined
+	OP_CALL,		// [site, n]	call with n arguments on the stack
+	OP_TAIL_CALL,		// [site, n]	same, reusing the current function frame
+	OP_INLINE,		// [site, target]	jump unless the site still calls the function inlined
+	OP_RETURN,		//		return top from current function
+	OP_HALT,		//		finish top-level chunk with top
+	OP_THROW,		// [k]		throw runtime_error with names[k]
+	OP_FOR_INIT,		//		check numeric start / end, keep them as loop state
+	OP_FOR_TEST,		// [slot, target]	bind counter to slot or jump out
+	OP_FOR_STEP,		// [target]	increment counter and jump back
+	OP_TIMES_INIT,		//		check integer count, keep it as loop state
+	OP_TIMES_TEST,		// [slot, target]
+	OP_TIMES_STEP,		// [target]
+	OP_FUTURE,		// [k, ref]	push a future of futures[k], which runs on the tree engine,
+				//		capturing through the refs from ref on
+};
+
+/// Chunk - A compiled function body or top-level statement.
+struct Chunk;
+
+/// CallSite - A function call in a Chunk with its inline cache.
+struct CallSite {
+	std::uint32_t name;
+	FuncCache cache;
+
+	// Compiled body of cache.func, filled in by the VM
+	const Chunk* callee = nullptr;
+	const FuncDefAST* compiled = nullptr;
+
+	// Function whose body was compiled in place of the call, if any
+	const FuncDefAST* inlined = nullptr;
+};
+
+struct Chunk {
+	std::vector<std::uint8_t> code;
+	std::vector<Value> constants;
+	std::vector<std::string> names;
+	std::vector<VarRef> refs;
+	std::vector<const FutureAST*> futures;
+
+	// Updated by the VM while running
+	mutable std::vector<CallSite> calls;
+
+	// Slots of the frame: those of the function, if any, then those of
+	// the counted loops in it, each nested one after the loop around it
+	std::uint32_t slots = 0;
+
+	// Function chunks only
+	std::string funcName;
+	std::vector<std::uint32_t> params;	// slot of each argument
+	bool inOrder = true;			// whether argument i goes to slot i
+
+	inline std::uint32_t readOperand(std::size_t at) const {
+		return static_cast<std::uint32_t>(this->code[at])
+			| (static_cast<std::uint32_t>(this->code[at + 1]) << 8)
+			| (static_cast<std::uint32_t>(this->code[at + 2]) << 16)
+			| (static_cast<std::uint32_t>(this->code[at + 3]) << 24);
+	}
+};
+
+/// BytecodeCompiler - Lowers ExprAST / FuncDefAST trees into Chunks.
+/// The generated code follows the evaluation order of the tree-walking
+/// engine exactly, including the order in which errors are raised.
+class BytecodeCompiler {
+private:
+	Chunk* chunk = nullptr;
+
+	// Stack slots held by each enclosing counted loop, innermost last, and
+	// the slots of its scope. A return inside a loop body leaves only the
+	// innermost loop.
+	struct LoopInfo {
+		std::uint32_t stateSlots;
+		std::uint32_t first;
+		std::uint32_t slots;
+		std::vector<std::size_t> exits;
+	};
+	std::vector<LoopInfo> loops;
+
+	// First slot of each enclosing scope, innermost last, and the first one
+	// past them. The frame of a function is the outermost scope of its
+	// chunk, top-level chunks start with none.
+	std::vector<std::uint32_t> scopes;
+	std::uint32_t top = 0;
+
+	bool inFunction = false;
+
+	void emit(OpCode op);
+	void emit(OpCode op, std::uint32_t a);
+	void emit(OpCode op, std::uint32_t a, std::uint32_t b);
+	std::size_t emitJump(OpCode op);
+	std::size_t emitJump(OpCode op, std::uint32_t a);
+	void patch(std::size_t at, std::size_t target);
+	std::uint32_t name(const std::string& n);
+	std::uint32_t constant(Value v);
+	std::uint32_t ref(const VarRef& r);
+	std::uint32_t slot(VarSlot s) const;
+	std::uint32_t enterScope(std::uint32_t n);
+	void leaveScope();
+
+	void emitLoad(const std::string& n, const VarRef& r);
+	void emitStore(const std::string& n, const VarRef& r, bool copy);
+
+	void compileExpr(const ExprAST* expr);
+	void compileStatement(const ExprAST* stmt, bool keepResult);
+	void compileBranch(const ExprAST* branch, bool keepResult);
+	void compileLoopBody(const std::vector<ExprAST*>& body);
+	void finishCountedLoop(std::size_t toDone);
+	void compileReturn(const ReturnAST* ret);
+	void compileLValOp(const LValOpAST* ast);
+
+public:
+	std::unique_ptr<Chunk> compile(const ExprAST* expr);
+
+	std::unique_ptr<Chunk> compile(const FuncDefAST* func);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_BYTECODE_H__
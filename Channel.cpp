@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include "Channel.h"
+#include "Scheduler.h"
+
+namespace DragonLisp {
+
+namespace {
+
+inline void relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+} // namespace
+
+Channel::Channel(std::size_t capacity, Policy policy) : Object(TYPE_CHANNEL), capacity(capacity), policy(policy) {
+	// A single cell could not tell a full ring from an empty one
+	auto size = std::max<std::size_t>(2, std::bit_ceil(capacity));
+	this->cells = std::make_unique<Cell[]>(size);
+	this->mask = size - 1;
+	for (std::size_t i = 0; i < size; i++)
+		this->cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+bool Channel::isFull(std::size_t pos) const {
+	// The ring may be larger than the capacity asked for
+	if (static_cast<std::intptr_t>(pos - this->head.load(std::memory_order_acquire)) >= static_cast<std::intptr_t>(this->capacity))
+		return true;
+	return static_cast<std::intptr_t>(this->cells[pos & this->mask].seq.load(std::memory_order_acquire) - pos) < 0;
+}
+
+bool Channel::trySend(Value& v) {
+	auto pos = this->tail.load(std::memory_order_relaxed);
+	while (true) {
+		auto& cell = this->cells[pos & this->mask];
+		auto diff = static_cast<std::intptr_t>(cell.seq.load(std::memory_order_acquire) - pos);
+		if (!diff) {
+			if (static_cast<std::intptr_t>(pos - this->head.load(std::memory_order_acquire)) >= static_cast<std::intptr_t>(this->capacity))
+				return false;
+			if (this->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				cell.value = std::move(v);
+				cell.seq.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0)
+			return false;
+		else
+			pos = this->tail.load(std::memory_order_relaxed);
+	}
+}
+
+bool Channel::tryRecv(Value& v) {
+	auto pos = this->head.load(std::memory_order_relaxed);
+	while (true) {
+		auto& cell = this->cells[pos & this->mask];
+		auto diff = static_cast<std::intptr_t>(cell.seq.load(std::memory_order_acquire) - (pos + 1));
+		if (!diff) {
+			if (this->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				v = std::move(cell.value);
+				cell.seq.store(pos + this->mask + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0)
+			return false;
+		else
+			pos = this->head.load(std::memory_order_relaxed);
+	}
+}
+
+// A thread parks after counting itself as parked and checking the ring
+// again, the other side bumps the counter after changing the ring and
+// checking for parked threads. The fences between make sure that at least
+// one of them sees what the other did.
+
+bool Channel::send(Value v) {
+	for (unsigned spins = 0;; spins++) {
+		if (this->closed.load(std::memory_order_acquire))
+			throw std::runtime_error("Channel is closed");
+		if (this->trySend(v)) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (this->parkedReceivers.load(std::memory_order_relaxed)) {
+				this->sent.fetch_add(1, std::memory_order_release);
+				this->sent.notify_all();
+			}
+			return true;
+		}
+		if (this->policy == CHANNEL_DROP)
+			return false;
+		if (this->policy == CHANNEL_SPIN && spins < Channel::SPINS) {
+			relax();
+			continue;
+		}
+
+		this->parkedSenders.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto seen = this->received.load(std::memory_order_acquire);
+		bool stuck = false;
+		if (this->isFull(this->tail.load(std::memory_order_relaxed)) && !this->closed.load(std::memory_order_acquire)) {
+			Scheduler::block(this);
+			this->received.wait(seen, std::memory_order_acquire);
+			stuck = !Scheduler::unblock(this);
+		}
+		this->parkedSenders.fetch_sub(1, std::memory_order_relaxed);
+		if (stuck)
+			throw std::runtime_error("Deadlock: nothing is left to receive from the channel");
+	}
+}
+
+Value Channel::recv(const Value& end) {
+	Value ret;
+	for (unsigned spins = 0;; spins++) {
+		if (this->tryRecv(ret)) {
+			if (this->policy != CHANNEL_DROP) {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (this->parkedSenders.load(std::memory_order_relaxed)) {
+					this->received.fetch_add(1, std::memory_order_release);
+					this->received.notify_all();
+				}
+			}
+			return ret;
+		}
+		if (this->closed.load(std::memory_order_acquire)) {
+			// Values sent before the channel was closed are still received
+			if (this->tryRecv(ret))
+				return ret;
+			return end;
+		}
+		if (this->policy == CHANNEL_SPIN && spins < Channel::SPINS) {
+			relax();
+			continue;
+		}
+
+		this->parkedReceivers.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto seen = this->sent.load(std::memory_order_acquire);
+		auto pos = this->head.load(std::memory_order_relaxed);
+		bool empty = static_cast<std::intptr_t>(this->cells[pos & this->mask].seq.load(std::memory_order_acquire) - (pos + 1)) < 0;
+		bool stuck = false;
+		if (empty && !this->closed.load(std::memory_order_acquire)) {
+			Scheduler::block(this);
+			this->sent.wait(seen, std::memory_order_acquire);
+			stuck = !Scheduler::unblock(this);
+		}
+		this->parkedReceivers.fetch_sub(1, std::memory_order_relaxed);
+		if (stuck)
+			throw std::runtime_error("Deadlock: nothing is left to send to the channel");
+	}
+}
+
+void Channel::close() {
+	this->closed.store(true, std::memory_order_seq_cst);
+	this->wake();
+}
+
+void Channel::wake() {
+	this->sent.fetch_add(1, std::memory_order_release);
+	this->sent.notify_all();
+	this->received.fetch_add(1, std::memory_order_release);
+	this->received.notify_all();
+}
+
+bool Channel::isStuck() const {
+	if (this->closed.load(std::memory_order_acquire))
+		return false;
+	auto head = this->head.load(std::memory_order_acquire);
+	bool full = this->isFull(this->tail.load(std::memory_order_acquire));
+	bool empty = static_cast<std::intptr_t>(this->cells[head & this->mask].seq.load(std::memory_order_acquire) - (head + 1)) < 0;
+	return (empty || !this->parkedReceivers.load(std::memory_order_acquire)) && (full || !this->parkedSenders.load(std::memory_order_acquire));
+}
+
+bool Channel::handles(Token op) {
+	switch (op) {
+		case MAKE_CHANNEL:
+		case CHANNEL_SEND:
+		case CHANNEL_RECV:
+		case CHANNEL_CLOSE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+Value Channel::apply(Token op, std::span<Value> args) {
+	if (op == MAKE_CHANNEL) {
+		if (args.empty() || args.size() > 2)
+			throw std::runtime_error("Invalid argument count for selected operator");
+		if (!args[0].isInt() || args[0].getInt() < 1 || args[0].getInt() > std::int64_t(Channel::MAX_CAPACITY))
+			throw std::runtime_error("Channel capacity must be an integer in [1, " + std::to_string(Channel::MAX_CAPACITY) + "]");
+		auto policy = CHANNEL_BLOCK;
+		if (args.size() == 2) {
+			auto name = args[1].isString() ? args[1].getString() : std::string();
+			if (name == "spin")
+				policy = CHANNEL_SPIN;
+			else if (name == "drop")
+				policy = CHANNEL_DROP;
+			else if (name != "block")
+				throw std::runtime_error("Unknown channel policy: " + args[1].toString());
+		}
+		return Value(new Channel(args[0].getInt(), policy));
+	}
+
+	if (args.empty() || args.size() > (op == CHANNEL_CLOSE ? 1 : 2) || (op == CHANNEL_SEND && args.size() != 2))
+		throw std::runtime_error("Invalid argument count for selected operator");
+	if (!args[0].isChannel())
+		throw std::runtime_error("Not a channel: " + args[0].toString());
+	auto ch = Channel::get(args[0]);
+	switch (op) {
+		case CHANNEL_SEND:
+			return Value(ch->send(std::move(args[1])));
+		case CHANNEL_RECV:
+			return args.size() == 2 ? ch->recv(args[1]) : ch->recv();
+		default:
+			ch->close();
+			return Value(true);
+	}
+}
+
+} // namespace DragonLisp
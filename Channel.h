@@ -0,0 +1,111 @@
+#ifndef __DRAGON_LISP_CHANNEL_H__
+#define __DRAGON_LISP_CHANNEL_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "token.h"
+#include "value.h"
+
+namespace DragonLisp {
+
+/// Channel - Bounded queue of values between futures.
+///
+///   (make-channel capacity [policy])	(channel-send ch v)
+///   (channel-recv ch [end])		(channel-close ch)
+///
+/// Values sit in a ring of cells, each with a sequence number telling
+/// whether it is the turn of a sender or of a receiver, so that threads
+/// claim cells with a compare-and-swap on the head or the tail and never
+/// take a lock while there is room or something to receive. The policy
+/// says what a send into a full channel does: "block" parks the thread
+/// until a value is received, "spin" retries for a while before parking,
+/// and "drop" gives up and returns NIL. Receiving from an empty channel
+/// parks the same way, and returns `end`, NIL by default, once the
+/// channel is closed and drained, so that a stream that may hold NIL can
+/// end with a value of its own. Values move through the ring as they are,
+/// so arrays stay shared copy-on-write instead of being copied.
+class Channel : public Object {
+public:
+	enum Policy {
+		CHANNEL_BLOCK,
+		CHANNEL_SPIN,
+		CHANNEL_DROP,
+	};
+
+	/// Largest capacity. The ring is allocated up front, with its size
+	/// rounded up to a power of two and to at least 2.
+	static constexpr std::size_t MAX_CAPACITY = std::size_t(1) << 20;
+
+	/// Attempts of a "spin" channel before it parks.
+	static constexpr unsigned SPINS = 4096;
+
+private:
+	struct Cell {
+		std::atomic<std::size_t> seq;
+		Value value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	std::size_t mask;
+	std::size_t capacity;
+	Policy policy;
+
+	// Next cell to send into and to receive from, on cache lines of their own
+	alignas(64) std::atomic<std::size_t> tail = 0;
+	alignas(64) std::atomic<std::size_t> head = 0;
+
+	// Bumped to wake parked receivers and senders, when there are any
+	alignas(64) std::atomic<std::uint32_t> sent = 0;
+	std::atomic<std::uint32_t> received = 0;
+	std::atomic<std::uint32_t> parkedReceivers = 0;
+	std::atomic<std::uint32_t> parkedSenders = 0;
+	std::atomic<bool> closed = false;
+
+	bool trySend(Value& v);
+	bool tryRecv(Value& v);
+
+	// Whether a send into cell `pos` finds no room
+	bool isFull(std::size_t pos) const;
+
+	static Channel* get(const Value& v) {
+		return static_cast<Channel*>(v.getObject());
+	}
+
+public:
+	Channel(std::size_t capacity, Policy policy);
+
+	/// Send `v`, false if it was dropped. Raises an error once closed.
+	bool send(Value v);
+
+	/// The next value, or `end` once closed and empty.
+	Value recv(const Value& end = Value(false));
+
+	/// Wake every parked thread. Values already sent can still be received.
+	void close();
+
+	/// Wake every parked thread, which parks again unless it has a reason
+	/// not to, such as a FutureGroup telling it that it never would wake.
+	void wake();
+
+	/// Whether the threads parked on the channel, if any, have nothing to
+	/// wake up for: it is open and empty for receivers, full for senders.
+	bool isStuck() const;
+
+	static bool handles(Token op);
+
+	static Value apply(Token op, std::span<Value> args);
+
+	std::string toString() const override final {
+		return "#<CHANNEL>";
+	}
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_CHANNEL_H__
@@ -0,0 +1,542 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "CppEmitter.h"
+#include "Resolver.h"
+
+namespace DragonLisp {
+
+namespace {
+
+std::string token(Token op) {
+	return "static_cast<Token>(" + std::to_string(static_cast<int>(op)) + ")";
+}
+
+std::string quote(const std::string& s) {
+	std::string ret = "\"";
+	for (unsigned char ch : s) {
+		if (ch == '"' || ch == '\\') {
+			ret += '\\';
+			ret += static_cast<char>(ch);
+		} else if (ch < 0x20 || ch >= 0x7F) {
+			// Octal escapes take at most three digits, so none can run on
+			char buf[8];
+			std::snprintf(buf, sizeof(buf), "\\%03o", ch);
+			ret += buf;
+		} else
+			ret += static_cast<char>(ch);
+	}
+	return ret + "\"";
+}
+
+std::string literal(const Value& v) {
+	if (v.isFloat()) {
+		auto d = v.getFloat();
+		std::uint64_t bits;
+		std::memcpy(&bits, &d, sizeof(d));
+		char buf[64];
+
+		// Infinities have no literal; std::isfinite cannot tell under -ffast-math
+		if (((bits >> 52) & 0x7FF) != 0x7FF)
+			std::snprintf(buf, sizeof(buf), "Value(%a)", d);
+		else
+			std::snprintf(buf, sizeof(buf), "Value(std::bit_cast<double>(UINT64_C(0x%" PRIx64 ")))", bits);
+		return buf;
+	}
+	if (v.isInt()) {
+		auto i = v.getInt();
+		if (i == std::numeric_limits<std::int64_t>::min())
+			return "Value(std::numeric_limits<std::int64_t>::min())";
+		return "Value(std::int64_t(" + std::to_string(i) + "))";
+	}
+	if (v.isString())
+		return "Value(std::string(" + quote(v.getString()) + ", " + std::to_string(v.getString().size()) + "))";
+	if (v.isT())
+		return "Value(true)";
+	if (v.isNil())
+		return "Value()";
+	throw std::runtime_error("CppEmitter: unsupported literal");
+}
+
+} // namespace
+
+std::string CppEmitter::tabs() const {
+	return std::string(this->indent, '\t');
+}
+
+std::string CppEmitter::constant(const Value& v) {
+	this->constants.push_back(v);
+	return "K[" + std::to_string(this->constants.size() - 1) + "]";
+}
+
+std::string CppEmitter::name(const std::string& n) {
+	auto [it, inserted] = this->nameIndex.try_emplace(n, this->names.size());
+	if (inserted)
+		this->names.push_back(n);
+	return "S[" + std::to_string(it->second) + "]";
+}
+
+std::string CppEmitter::ref(const VarRef& r) {
+	this->refs.push_back(r);
+	return "R[" + std::to_string(this->refs.size() - 1) + "]";
+}
+
+std::string CppEmitter::temp(const char* prefix) {
+	return prefix + std::to_string(this->temps++);
+}
+
+std::string CppEmitter::lambda(const std::string& code) {
+	return "[&]() -> Value {\n" + code + this->tabs() + "}()";
+}
+
+std::string CppEmitter::emitLoad(const std::string& n, const VarRef& r) {
+	if (r.isDirect()) {
+		const auto& s = r.slots.front();
+		return "Runtime::get(" + this->frame + ", " + this->name(n) + ", VarSlot{ " + std::to_string(s.depth) + ", " + std::to_string(s.index) + " })";
+	}
+	return "Runtime::get(" + this->frame + ", " + this->name(n) + ", " + this->ref(r) + ")";
+}
+
+std::string CppEmitter::emitOperands(const std::vector<ExprAST*>& exprs) {
+	std::string ret = "{ ";
+	for (std::size_t i = 0; i < exprs.size(); i++) {
+		if (i)
+			ret += ", ";
+		ret += this->emitExpr(exprs[i]);
+	}
+	return ret + " }";
+}
+
+std::string CppEmitter::emitExpr(const ExprAST* expr) {
+	switch (expr->getType()) {
+		case T_LiteralAST:
+			return this->constant(static_cast<const LiteralAST*>(expr)->getValue());
+		case T_IdentifierAST: {
+			auto ast = static_cast<const IdentifierAST*>(expr);
+			return this->emitLoad(ast->getName(), ast->getRef());
+		}
+		case T_ArrayRefAST: {
+			auto ast = static_cast<const ArrayRefAST*>(expr);
+			return "ArrayRefAST::load(" + this->frame + ", " + this->name(ast->getName()) + ", " + this->ref(ast->getRef()) + ", " + this->emitExpr(ast->getIndex()) + ")";
+		}
+		case T_FuncCallAST:
+			return this->emitCall(static_cast<const FuncCallAST*>(expr));
+		case T_IfAST:
+			// Only statements of a body are evaluated as branches
+			return "Runtime::misplacedIf()";
+		case T_LoopForeverAST:
+		case T_LoopForAST:
+		case T_LoopDoTimesAST:
+			return this->emitLoop(static_cast<const LoopAST*>(expr));
+		case T_UnaryAST: {
+			auto ast = static_cast<const UnaryAST*>(expr);
+			return "UnaryAST::apply(" + token(ast->getOp()) + ", " + this->emitExpr(ast->getExpr()) + ", " + this->frame + ")";
+		}
+		case T_BinaryAST: {
+			auto ast = static_cast<const BinaryAST*>(expr);
+			return "Runtime::binary<" + token(ast->getOp()) + ">({ " + this->emitExpr(ast->getLHS()) + ", " + this->emitExpr(ast->getRHS()) + " })";
+		}
+		case T_ListAST: {
+			auto ast = static_cast<const ListAST*>(expr);
+			return "Runtime::list<" + token(ast->getOp()) + ">(" + this->emitOperands(ast->getExprs()) + ")";
+		}
+		case T_VarOpAST:
+			return this->emitVarOp(static_cast<const VarOpAST*>(expr));
+		case T_LValOpAST:
+			return this->emitLValOp(static_cast<const LValOpAST*>(expr));
+		case T_ReturnAST:
+			return this->emitExpr(static_cast<const ReturnAST*>(expr)->getExpr());
+		case T_CachedAST:
+			return this->emitCached(static_cast<const CachedAST*>(expr));
+		case T_InlineCallAST:
+			return this->emitInlineCall(static_cast<const InlineCallAST*>(expr));
+		case T_FutureAST:
+			return this->emitFuture(static_cast<const FutureAST*>(expr));
+		default:
+			throw std::runtime_error("CppEmitter: unsupported AST node");
+	}
+}
+
+std::string CppEmitter::emitCall(const FuncCallAST* ast) {
+	auto f = this->temp("f");
+	auto fr = this->temp("fr");
+	auto site = std::to_string(this->sites++);
+	const auto& args = ast->getArgs();
+
+	this->indent++;
+	auto t = this->tabs();
+	std::ostringstream out;
+	out << t << "auto " << f << " = Runtime::getFunc(" << this->name(ast->getName()) << ", F[" << site << "]);\n";
+	out << t << "Context " << fr << "(" << this->frame << "->getRoot(), " << f << "->slots);\n";
+	for (std::size_t i = 0; i < args.size(); i++)
+		out << t << "Runtime::bind(" << fr << ", " << f << ", " << i << ", " << this->emitExpr(args[i]) << ");\n";
+	out << t << "Runtime::checkArgs(" << f << ", " << args.size() << ");\n";
+	out << t << "return Runtime::call(" << f << ", &" << fr << ");\n";
+	this->indent--;
+	return this->lambda(out.str());
+}
+
+// The expression becomes a lambda without captures, over a frame of its own
+std::string CppEmitter::emitFuture(const FutureAST* ast) {
+	auto outer = this->frame;
+	auto outerFunc = this->func;
+	auto fc = this->temp("fc");
+	this->futures = true;
+
+	std::string captures = "{";
+	for (const auto& c : ast->getCaptures())
+		captures += " { " + std::to_string(c.index) + ", FutureAST::capture(" + outer + ", " + this->name(c.name) + ", " + this->ref(c.ref) + ") },";
+	if (captures.back() == ',')
+		captures.back() = ' ';
+	captures += "}";
+
+	this->frame = fc;
+	this->func = nullptr;
+	this->indent++;
+	auto body = this->tabs() + "return " + this->emitExpr(ast->getExpr()) + ";\n";
+	this->indent--;
+	this->frame = outer;
+	this->func = outerFunc;
+	return "Future::spawn(" + outer + ", " + std::to_string(ast->getSlots()) + ", " + captures + ", [](Context* " + fc + ") -> Value {\n" + body + this->tabs() + "})";
+}
+
+std::string CppEmitter::emitInlineCall(const InlineCallAST* ast) {
+	// The callee was defined, and so translated, before the call was inlined
+	auto id = std::to_string(this->funcIds.at(ast->getCallee()));
+	auto site = std::to_string(this->sites++);
+	auto r = this->temp("r");
+	const auto& args = ast->getCall()->getArgs();
+	const auto& params = ast->getParams();
+
+	this->indent++;
+	auto t = this->tabs();
+	std::ostringstream out;
+	out << t << "if (Runtime::findFunc(" << this->name(ast->getCall()->getName()) << ", F[" << site << "]) != &func" << id << ")\n";
+	this->indent++;
+	out << t << "\treturn " << this->emitCall(ast->getCall()) << ";\n";
+	this->indent--;
+	for (std::size_t i = 0; i < args.size(); i++) {
+		auto v = this->emitExpr(args[i]);
+		if (i < params.size())
+			out << t << this->frame << "->getSlot(VarSlot{ " << params[i].depth << ", " << params[i].index << " }) = " << v << ";\n";
+		else
+			out << t << v << ";\n";
+	}
+	if (args.size() < params.size())
+		out << t << "throw std::runtime_error(\"Too few arguments\");\n";
+	else {
+		out << t << "auto " << r << " = " << this->emitExpr(ast->getBody()) << ";\n";
+		for (const auto& p : params)
+			out << t << this->frame << "->getSlot(VarSlot{ " << p.depth << ", " << p.index << " }) = Value::unbound();\n";
+		out << t << "return " << r << ";\n";
+	}
+	this->indent--;
+	return this->lambda(out.str());
+}
+
+std::string CppEmitter::emitCached(const CachedAST* ast) {
+	auto v = this->temp("v");
+	auto s = this->temp("s");
+	auto slot = ast->getSlot();
+
+	this->indent++;
+	auto t = this->tabs();
+	std::ostringstream out;
+	out << t << "auto& " << s << " = " << this->frame << "->getSlot(VarSlot{ " << slot.depth << ", " << slot.index << " });\n";
+	out << t << "if (!" << s << ".isUnbound())\n";
+	out << t << "\treturn " << s << ";\n";
+	out << t << "auto " << v << " = " << this->emitExpr(ast->getExpr()) << ";\n";
+	out << t << this->frame << "->getSlot(VarSlot{ " << slot.depth << ", " << slot.index << " }) = " << v << ";\n";
+	out << t << "return " << v << ";\n";
+	this->indent--;
+	return this->lambda(out.str());
+}
+
+std::string CppEmitter::emitLoop(const LoopAST* ast) {
+	auto outer = this->frame;
+	auto outerFunc = this->func;
+	this->func = nullptr;
+
+	this->indent++;
+	auto t = this->tabs();
+	std::ostringstream out;
+	switch (ast->getType()) {
+		case T_LoopForeverAST: {
+			// No frame of its own
+			out << t << "while (true) {\n";
+			this->indent++;
+			this->emitBody(out, static_cast<const LoopForeverAST*>(ast)->getBody());
+			this->indent--;
+			out << t << "}\n";
+			break;
+		}
+		case T_LoopForAST: {
+			auto loop = static_cast<const LoopForAST*>(ast);
+			auto fr = this->temp("fr");
+			auto c = this->temp("c");
+			auto s = this->temp("s"), e = this->temp("e"), ints = this->temp("ints"), i = this->temp("i"), n = this->temp("n");
+			out << t << "Context " << fr << "(" << outer << ", " << loop->getSlots() << ");\n";
+			out << t << "Context* " << c << " = &" << fr << ";\n";
+			out << t << "auto " << s << " = (" << this->emitExpr(loop->getStart()) << ").copy();\n";
+			out << t << "auto " << e << " = " << this->emitExpr(loop->getEnd()) << ";\n";
+			out << t << "Runtime::checkBounds(" << s << ", " << e << ");\n";
+
+			// Integer bounds count in a native integer, others step the Value
+			out << t << "bool " << ints << " = " << s << ".isInt() && " << e << ".isInt();\n";
+			out << t << "std::int64_t " << i << " = " << ints << " ? " << s << ".getInt() : 0, " << n << " = " << ints << " ? " << e << ".getInt() : 0;\n";
+			// An integer stops at the end instead of stepping past it, which
+			// could be past the largest integer
+			auto go = this->temp("go");
+			out << t << "for (bool " << go << " = " << ints << " ? " << i << " <= " << n << " : " << s << " <= " << e << "; " << go << "; "
+				<< go << " = " << ints << " ? " << i << " != " << n << " && (++" << i << ", true) : ++" << s << " <= " << e << ") {\n";
+			this->indent++;
+			auto body = this->tabs();
+			if (loop->isVarRead())
+				out << body << "if (" << ints << ")\n" << body << "\t" << c << "->setSlot(0, Value(" << i << "));\n" << body << "else\n" << body << "\t" << c << "->setSlot(0, " << s << ");\n";
+			else
+				out << body << "if (!" << ints << ")\n" << body << "\t" << c << "->setSlot(0, " << s << ");\n";
+			this->frame = c;
+			this->emitBody(out, loop->getBody());
+			this->indent--;
+			out << t << "}\n";
+			out << t << "return Value(false);\n";
+			break;
+		}
+		case T_LoopDoTimesAST: {
+			auto loop = static_cast<const LoopDoTimesAST*>(ast);
+			auto fr = this->temp("fr");
+			auto c = this->temp("c");
+			auto i = this->temp("i"), n = this->temp("n");
+			out << t << "Context " << fr << "(" << outer << ", " << loop->getSlots() << ");\n";
+			out << t << "Context* " << c << " = &" << fr << ";\n";
+			out << t << "auto " << n << " = Runtime::times(" << this->emitExpr(loop->getTimes()) << ");\n";
+			out << t << "for (std::int64_t " << i << " = 0; " << i << " < " << n << "; ++" << i << ") {\n";
+			this->indent++;
+			if (loop->isVarRead())
+				out << this->tabs() << c << "->setSlot(0, Value(" << i << "));\n";
+			this->frame = c;
+			this->emitBody(out, loop->getBody());
+			this->indent--;
+			out << t << "}\n";
+			out << t << "return Value(false);\n";
+			break;
+		}
+		default:
+			throw std::runtime_error("CppEmitter: unsupported loop");
+	}
+	this->indent--;
+
+	this->frame = outer;
+	this->func = outerFunc;
+	return this->lambda(out.str());
+}
+
+std::string CppEmitter::emitVarOp(const VarOpAST* ast) {
+	auto v = this->temp("v");
+	auto n = this->name(ast->getName());
+
+	this->indent++;
+	auto t = this->tabs();
+	std::ostringstream out;
+	if (ast->getOp() == SETQ)
+		out << t << "Runtime::checkDefined(" << this->frame << ", " << n << ", " << this->ref(ast->getRef()) << ");\n";
+	out << t << "auto " << v << " = " << this->emitExpr(ast->getExpr()) << ";\n";
+	if (ast->getOp() == DEFCONSTANT)
+		out << t << this->frame << "->defineConstant(" << n << ", " << v << ".copy());\n";
+	else
+		out << t << this->frame << "->setVariable(" << n << ", " << this->ref(ast->getStoreRef()) << ", " << v << ".copy());\n";
+	out << t << "return " << v << ";\n";
+	this->indent--;
+	return this->lambda(out.str());
+}
+
+std::string CppEmitter::emitLValOp(const LValOpAST* ast) {
+	auto v = this->temp("v");
+	auto op = ast->getOp();
+
+	this->indent++;
+	auto t = this->tabs();
+	std::ostringstream out;
+	out << t << "auto " << v << " = " << this->emitExpr(ast->getExpr()) << ";\n";
+	if (ast->getLVal()->getType() == T_IdentifierAST) {
+		auto id = static_cast<const IdentifierAST*>(ast->getLVal());
+		auto n = this->name(id->getName());
+		if (op != SETF)
+			out << t << v << " = LValOpAST::applyDelta(" << token(op) << ", " << this->emitLoad(id->getName(), id->getRef()) << ", " << v << ");\n";
+		out << t << this->frame << "->setVariable(" << n << ", " << this->ref(id->getStoreRef()) << ", " << v << ");\n";
+		out << t << "return " << v << ";\n";
+	} else {
+		// The index is evaluated again for the store, as LValOpAST does
+		auto aref = static_cast<const ArrayRefAST*>(ast->getLVal());
+		auto n = this->name(aref->getName());
+		auto r = this->ref(aref->getRef());
+		if (op != SETF)
+			out << t << v << " = LValOpAST::applyDelta(" << token(op) << ", ArrayRefAST::load(" << this->frame << ", " << n << ", " << r << ", " << this->emitExpr(aref->getIndex()) << "), " << v << ");\n";
+		out << t << "return ArrayRefAST::store(" << this->frame << ", " << n << ", " << r << ", " << this->emitExpr(aref->getIndex()) << ", " << v << ");\n";
+	}
+	this->indent--;
+	return this->lambda(out.str());
+}
+
+void CppEmitter::emitBranch(std::ostringstream& out, const ExprAST* branch) {
+	if (!branch)
+		return;
+	auto t = this->tabs();
+	if (branch->getType() == T_ReturnAST) {
+		// A function only returns from itself, a loop from any return
+		auto ret = static_cast<const ReturnAST*>(branch);
+		if (this->func && this->func->getName() != ret->getName())
+			out << t << "Runtime::misplacedReturn();\n";
+		else if (this->func && Resolver::isTailCall(ret->getExpr()))
+			this->emitTailCall(out, static_cast<const FuncCallAST*>(ret->getExpr()));
+		else
+			out << t << "return " << this->emitExpr(ret->getExpr()) << ";\n";
+		return;
+	}
+	if (this->func && Resolver::isTailCall(branch))
+		this->emitTailCall(out, static_cast<const FuncCallAST*>(branch));
+	else
+		out << t << (this->func ? "ret = " : "") << this->emitExpr(branch) << ";\n";
+}
+
+// Rebinds the current frame for the callee and leaves it to Runtime::call
+void CppEmitter::emitTailCall(std::ostringstream& out, const FuncCallAST* ast) {
+	auto f = this->temp("f");
+	auto site = std::to_string(this->sites++);
+	const auto& args = ast->getArgs();
+	auto t = this->tabs();
+
+	out << t << "{\n";
+	this->indent++;
+	auto in = this->tabs();
+	out << in << "auto " << f << " = Runtime::getFunc(" << this->name(ast->getName()) << ", F[" << site << "]);\n";
+	std::vector<std::string> vals;
+	for (const auto& a : args) {
+		vals.push_back(this->temp("a"));
+		out << in << "auto " << vals.back() << " = " << this->emitExpr(a) << ";\n";
+	}
+	out << in << this->frame << "->reframe(" << f << "->slots);\n";
+	for (std::size_t i = 0; i < vals.size(); i++)
+		out << in << "Runtime::bind(*" << this->frame << ", " << f << ", " << i << ", std::move(" << vals[i] << "));\n";
+	out << in << "Runtime::checkArgs(" << f << ", " << args.size() << ");\n";
+	out << in << "*next = " << f << ";\n";
+	out << in << "return Value();\n";
+	this->indent--;
+	out << t << "}\n";
+}
+
+void CppEmitter::emitStatement(std::ostringstream& out, const ExprAST* stmt) {
+	if (stmt->getType() != T_IfAST) {
+		this->emitBranch(out, stmt);
+		return;
+	}
+	auto ast = static_cast<const IfAST*>(stmt);
+	auto t = this->tabs();
+	out << t << "if (IfAST::isTrue(" << this->emitExpr(ast->getCond()) << ")) {\n";
+	this->indent++;
+	this->emitBranch(out, ast->getThen());
+	this->indent--;
+	if (ast->getElse()) {
+		out << t << "} else {\n";
+		this->indent++;
+		this->emitBranch(out, ast->getElse());
+		this->indent--;
+	}
+	out << t << "}\n";
+}
+
+void CppEmitter::emitBody(std::ostringstream& out, const std::vector<ExprAST*>& stmts) {
+	for (auto stmt : stmts)
+		this->emitStatement(out, stmt);
+}
+
+void CppEmitter::add(std::variant<ExprAST*, FuncDefAST*> ast) {
+	if (ast.index() == 0) {
+		this->frame = "g";
+		this->func = nullptr;
+		this->indent = 1;
+		this->body << "\t" << this->emitExpr(std::get<0>(ast)) << ";\n";
+		return;
+	}
+
+	auto f = std::get<1>(ast);
+	auto n = static_cast<std::uint32_t>(this->funcIds.size());
+	this->funcIds[f] = n;
+	auto id = std::to_string(n);
+	this->frame = "c";
+	this->func = f;
+	this->indent = 1;
+	std::ostringstream out;
+	out << "// " << f->getName() << "\n";
+	out << "static Value fn" << id << "(Context* c, const Runtime::Func** next) {\n";
+	out << "\tValue ret;\n";
+	this->emitBody(out, f->getBody());
+	out << "\treturn ret;\n";
+	out << "}\n\n";
+	if (f->getMemo())
+		out << "static MemoCache memo" << id << "(" << f->getMemo()->getCapacity() << ");\n";
+	out << "static const Runtime::Func func" << id << "{ fn" << id << ", " << f->getSlots() << ", {";
+	for (std::size_t i = 0; i < f->getArgSlots().size(); i++)
+		out << (i ? ", " : " ") << f->getArgSlots()[i];
+	out << (f->getArgSlots().empty() ? "}" : " }");
+	if (f->getMemo())
+		out << ", &memo" << id;
+	out << " };\n\n";
+	this->funcs << out.str();
+	this->body << "\tRuntime::defun(" << this->name(f->getName()) << ", &func" << id << ");\n";
+	this->func = nullptr;
+}
+
+void CppEmitter::write(std::ostream& out) const {
+	out << "// Generated by DragonLisp --emit-cpp\n";
+	out << "#include <bit>\n";
+	out << "#include <cstdint>\n";
+	out << "#include <limits>\n";
+	out << "#include <string>\n\n";
+	out << "#include \"Runtime.h\"\n\n";
+	out << "using namespace DragonLisp;\n\n";
+
+	// Zero-sized arrays are not allowed
+	out << "static const std::string S[] = {\n";
+	for (const auto& n : this->names)
+		out << "\tstd::string(" << quote(n) << ", " << n.size() << "),\n";
+	out << "\t{},\n};\n\n";
+
+	out << "static const Value K[] = {\n";
+	for (const auto& v : this->constants)
+		out << "\t" << literal(v) << ",\n";
+	out << "\tValue(),\n};\n\n";
+
+	out << "static const VarRef R[] = {\n";
+	for (const auto& r : this->refs) {
+		out << "\t{ {";
+		for (std::size_t i = 0; i < r.slots.size(); i++)
+			out << (i ? ", " : " ") << "{ " << r.slots[i].depth << ", " << r.slots[i].index << " }";
+		out << (r.slots.empty() ? "}, " : " }, ") << (r.global ? "true" : "false") << " },\n";
+	}
+	out << "\t{},\n};\n\n";
+
+	out << "[[maybe_unused]] static Runtime::Site F[" << this->sites + 1 << "];\n\n";
+
+	out << this->funcs.str();
+
+	out << "static int run() {\n";
+	out << "\tContext root;\n";
+	out << "\tContext* g = &root;\n";
+	out << "\t(void) g;\n";
+	out << "\tg->getFutures()->attach();\n";
+	out << this->body.str();
+	if (this->futures)
+		out << "\tg->getFutures()->wait();\n";
+	out << "\treturn 0;\n";
+	out << "}\n\n";
+
+	out << "int main() {\n";
+	out << "\treturn EvalStack::run(EvalStack::DEFAULT_DEPTH, run);\n";
+	out << "}\n";
+}
+
+} // namespace DragonLisp
@@ -0,0 +1,91 @@
+#ifndef __DRAGON_LISP_CPP_EMITTER_H__
+#define __DRAGON_LISP_CPP_EMITTER_H__
+
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "AST.h"
+
+namespace DragonLisp {
+
+/// CppEmitter - Translates a resolved program into a C++20 translation unit.
+///
+/// Every top-level statement becomes a statement of main() and every
+/// function a C++ function over the interpreter's frames, so variables,
+/// errors and the evaluation order are those of the tree-walking engine.
+/// Operands are evaluated left to right: expressions that need statements,
+/// such as calls and loops, become immediately invoked lambdas, and
+/// operators take their operands as a braced list. The program is
+/// translated after the Optimizer has run, constants defined at top level
+/// by literals being folded as they would have been. The expression of a
+/// future becomes a lambda of its own frame. The unit includes Runtime.h
+/// and links against the objects of `make runtime`.
+///
+/// This is a translation onto the interpreter library, not a standalone
+/// runtime: values stay boxed, and no type is inferred to emit int64_t or
+/// double arithmetic, which only the Specializer does for the engines.
+class CppEmitter {
+private:
+	// Tables emitted at the top of the unit
+	std::vector<Value> constants;
+	std::vector<std::string> names;
+	std::unordered_map<std::string, std::uint32_t> nameIndex;
+	std::vector<VarRef> refs;
+	std::uint32_t sites = 0;
+
+	std::ostringstream funcs;
+	std::ostringstream body;
+
+	// Translated function of each definition, by number
+	std::unordered_map<const FuncDefAST*, std::uint32_t> funcIds;
+
+	// Unique suffix of the locals of each lambda
+	std::uint32_t temps = 0;
+
+	// Current frame and indentation
+	std::string frame;
+	int indent = 0;
+
+	// Function whose body is being emitted, nullptr at top level or in a loop
+	const FuncDefAST* func = nullptr;
+
+	// Whether the program makes futures, which it then waits for
+	bool futures = false;
+
+	std::string tabs() const;
+	std::string constant(const Value& v);
+	std::string name(const std::string& n);
+	std::string ref(const VarRef& r);
+	std::string temp(const char* prefix);
+
+	std::string emitLoad(const std::string& n, const VarRef& r);
+	std::string emitExpr(const ExprAST* expr);
+	std::string emitCall(const FuncCallAST* ast);
+	std::string emitFuture(const FutureAST* ast);
+	std::string emitInlineCall(const InlineCallAST* ast);
+	std::string emitCached(const CachedAST* ast);
+	std::string emitLoop(const LoopAST* ast);
+	std::string emitVarOp(const VarOpAST* ast);
+	std::string emitLValOp(const LValOpAST* ast);
+	std::string emitOperands(const std::vector<ExprAST*>& exprs);
+	std::string lambda(const std::string& code);
+
+	void emitStatement(std::ostringstream& out, const ExprAST* stmt);
+	void emitBranch(std::ostringstream& out, const ExprAST* branch);
+	void emitTailCall(std::ostringstream& out, const FuncCallAST* ast);
+	void emitBody(std::ostringstream& out, const std::vector<ExprAST*>& stmts);
+
+public:
+	void add(std::variant<ExprAST*, FuncDefAST*> ast);
+
+	void write(std::ostream& out) const;
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_CPP_EMITTER_H__
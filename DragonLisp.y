@@ -49,6 +49,7 @@ void printNothing(T _ign1) { ; }
 %locations
 %define api.token.prefix {TOKEN_}
 %define api.value.type variant
+%define api.value.automove
 %define parse.assert
 
 %token
@@ -101,6 +102,23 @@ void printNothing(T _ign1) { ; }
     RETURN_FROM		"return-from"
     MAKE_ARRAY		"make-array"
     DEFCONSTANT		"defconstant"
+    ARRAY_SUM		"array-sum"
+    ARRAY_DOT		"array-dot"
+    ARRAY_FILL		"array-fill"
+    ARRAY_MAX		"array-max"
+    ARRAY_MIN		"array-min"
+    ARRAY_ADD		"array-add"
+    ARRAY_MUL		"array-mul"
+    ARRAY_SCALE		"array-scale"
+    DECLAIM		"declaim"
+    MEMOIZE		"memoize"
+    PDOTIMES		"pdotimes"
+    FUTURE		"future"
+    TOUCH		"touch"
+    MAKE_CHANNEL	"make-channel"
+    CHANNEL_SEND	"channel-send"
+    CHANNEL_RECV	"channel-recv"
+    CHANNEL_CLOSE	"channel-close"
 ;
 
 %token END              0 "EOF"
@@ -115,33 +133,34 @@ void printNothing(T _ign1) { ; }
 %type <DragonLisp::Token>	binary-tokens
 %type <DragonLisp::Token>	list-tokens
 
-%type <std::shared_ptr<DragonLisp::LValueAST>>	L-Value
-%type <std::shared_ptr<DragonLisp::LValueAST>>	array-ref
-%type <std::shared_ptr<DragonLisp::FuncDefAST>>	func-def
+%type <DragonLisp::LValueAST*>	L-Value
+%type <DragonLisp::LValueAST*>	array-ref
+%type <DragonLisp::FuncDefAST*>	func-def
 
-%type <std::shared_ptr<DragonLisp::ExprAST>>	R-Value
-%type <std::shared_ptr<DragonLisp::ExprAST>>	S-Expr
-%type <std::shared_ptr<DragonLisp::ExprAST>>	S-Expr-helper
+%type <DragonLisp::ExprAST*>	R-Value
+%type <DragonLisp::ExprAST*>	S-Expr
+%type <DragonLisp::ExprAST*>	S-Expr-helper
 
-%type <std::vector<std::shared_ptr<DragonLisp::ExprAST>>>	R-Value-list
+%type <std::vector<DragonLisp::ExprAST*>>	R-Value-list
 
 %type <std::vector<std::string>>				identifier-list
 %type <std::vector<std::string>>				func-arg-list
-%type <std::vector<std::shared_ptr<DragonLisp::ExprAST>>>	func-body
-%type <std::shared_ptr<DragonLisp::ExprAST>>			func-body-expr
+%type <std::vector<DragonLisp::ExprAST*>>	func-body
+%type <DragonLisp::ExprAST*>			func-body-expr
 
-%type <std::shared_ptr<DragonLisp::ReturnAST>>	return-expr
-%type <std::shared_ptr<DragonLisp::BinaryAST>>	S-Expr-binary
-%type <std::shared_ptr<DragonLisp::UnaryAST>>	S-Expr-unary
-%type <std::shared_ptr<DragonLisp::ListAST>>	S-Expr-list
-%type <std::shared_ptr<DragonLisp::IfAST>>	S-Expr-if
-%type <std::shared_ptr<DragonLisp::VarOpAST>>	S-Expr-var-op
-%type <std::shared_ptr<DragonLisp::LValOpAST>>	S-Expr-Lval-op
-%type <std::shared_ptr<DragonLisp::LoopAST>>	S-Expr-loop
-%type <std::shared_ptr<DragonLisp::FuncCallAST>>	S-Expr-func-call
+%type <DragonLisp::ReturnAST*>	return-expr
+%type <DragonLisp::BinaryAST*>	S-Expr-binary
+%type <DragonLisp::UnaryAST*>	S-Expr-unary
+%type <DragonLisp::ListAST*>	S-Expr-list
+%type <DragonLisp::IfAST*>	S-Expr-if
+%type <DragonLisp::VarOpAST*>	S-Expr-var-op
+%type <DragonLisp::LValOpAST*>	S-Expr-Lval-op
+%type <DragonLisp::LoopAST*>	S-Expr-loop
+%type <DragonLisp::FuncCallAST*>	S-Expr-func-call
+%type <DragonLisp::FutureAST*>	S-Expr-future
 
 
-%type <std::variant<std::shared_ptr<DragonLisp::ExprAST>, std::shared_ptr<DragonLisp::FuncDefAST>>>			statement
+%type <std::variant<DragonLisp::ExprAST*, DragonLisp::FuncDefAST*>>			statement
 
 %define parse.error verbose
 
@@ -156,7 +175,14 @@ S
 
 statements
 	: statement		{ PRINT_FUNC("Parsed statements -> statement\n"); drv.execute($1); }
+	| declaration		{ PRINT_FUNC("Parsed statements -> declaration\n"); }
 	| statements statement	{ PRINT_FUNC("Parsed statements -> statements statement\n"); drv.execute($2); }
+	| statements declaration	{ PRINT_FUNC("Parsed statements -> statements declaration\n"); }
+;
+
+declaration
+	: LPAREN DECLAIM LPAREN MEMOIZE IDENTIFIER RPAREN RPAREN	{ PRINT_FUNC("Parsed declaration -> ( DECLAIM ( MEMOIZE IDENTIFIER ) )\n"); drv.declaimMemoize($5, 0); }
+	| LPAREN DECLAIM LPAREN MEMOIZE IDENTIFIER INTEGER RPAREN RPAREN	{ PRINT_FUNC("Parsed declaration -> ( DECLAIM ( MEMOIZE IDENTIFIER INTEGER ) )\n"); drv.declaimMemoize($5, $6); }
 ;
 
 statement
@@ -180,7 +206,7 @@ func-body-expr
 
 func-body
 	: func-body-expr		{ PRINT_FUNC("Parsed func-body -> func-body-expr\n"); $$ = { $1 }; }
-	| func-body func-body-expr	{ PRINT_FUNC("Parsed func-body -> func-body func-body-expr\n"); $1.push_back($2); $$ = $1; }
+	| func-body func-body-expr	{ PRINT_FUNC("Parsed func-body -> func-body func-body-expr\n"); $$ = $1; $$.push_back($2); }
 ;
 
 L-Value
@@ -201,7 +227,7 @@ R-Value
 
 R-Value-list
 	: R-Value		{ PRINT_FUNC("Parsed R-Value-list -> R-Value\n"); $$ = { $1 }; }
-	| R-Value-list R-Value	{ PRINT_FUNC("Parsed R-Value-list -> R-Value-list R-Value\n"); $1.push_back($2); $$ = $1; }
+	| R-Value-list R-Value	{ PRINT_FUNC("Parsed R-Value-list -> R-Value-list R-Value\n"); $$ = $1; $$.push_back($2); }
 ;
 
 S-Expr
@@ -218,6 +244,7 @@ S-Expr-helper
 	| S-Expr-if		{ PRINT_FUNC("Parsed S-Expr-helper -> S-Expr-if\n"); $$ = $1; }
 	| S-Expr-loop		{ PRINT_FUNC("Parsed S-Expr-helper -> S-Expr-loop\n"); $$ = $1; }
 	| S-Expr-func-call	{ PRINT_FUNC("Parsed S-Expr-helper -> S-Expr-func-call\n"); $$ = $1; }
+	| S-Expr-future		{ PRINT_FUNC("Parsed S-Expr-helper -> S-Expr-future\n"); $$ = $1; }
 ;
 
 S-Expr-var-op
@@ -227,6 +254,7 @@ S-Expr-var-op
 var-op-tokens
 	: DEFVAR	{ PRINT_FUNC("Parsed var-op-tokens -> DEFVAR\n"); $$ = DragonLisp::Token::DEFVAR; }
 	| SETQ		{ PRINT_FUNC("Parsed var-op-tokens -> SETQ\n"); $$ = DragonLisp::Token::SETQ; }
+	| DEFCONSTANT	{ PRINT_FUNC("Parsed var-op-tokens -> DEFCONSTANT\n"); $$ = DragonLisp::Token::DEFCONSTANT; }
 ;
 
 S-Expr-Lval-op
@@ -247,6 +275,7 @@ unary-tokens
 	: NOT		{ PRINT_FUNC("Parsed unary-tokens -> NOT\n"); $$ = DragonLisp::Token::NOT; }
 	| PRINT		{ PRINT_FUNC("Parsed unary-tokens -> PRINT\n"); $$ = DragonLisp::Token::PRINT; }
 	| MAKE_ARRAY	{ PRINT_FUNC("Parsed unary-tokens -> MAKE_ARRAY\n"); $$ = DragonLisp::Token::MAKE_ARRAY; }
+	| TOUCH		{ PRINT_FUNC("Parsed unary-tokens -> TOUCH\n"); $$ = DragonLisp::Token::TOUCH; }
 ;
 
 S-Expr-binary
@@ -282,6 +311,18 @@ list-tokens
 	| MINUS		{ PRINT_FUNC("Parsed list-tokens -> MINUS\n"); $$ = DragonLisp::Token::MINUS; }
 	| MULTIPLY	{ PRINT_FUNC("Parsed list-tokens -> MULTIPLY\n"); $$ = DragonLisp::Token::MULTIPLY; }
 	| DIVIDE	{ PRINT_FUNC("Parsed list-tokens -> DIVIDE\n"); $$ = DragonLisp::Token::DIVIDE; }
+	| ARRAY_SUM	{ PRINT_FUNC("Parsed list-tokens -> ARRAY_SUM\n"); $$ = DragonLisp::Token::ARRAY_SUM; }
+	| ARRAY_DOT	{ PRINT_FUNC("Parsed list-tokens -> ARRAY_DOT\n"); $$ = DragonLisp::Token::ARRAY_DOT; }
+	| ARRAY_FILL	{ PRINT_FUNC("Parsed list-tokens -> ARRAY_FILL\n"); $$ = DragonLisp::Token::ARRAY_FILL; }
+	| ARRAY_MAX	{ PRINT_FUNC("Parsed list-tokens -> ARRAY_MAX\n"); $$ = DragonLisp::Token::ARRAY_MAX; }
+	| ARRAY_MIN	{ PRINT_FUNC("Parsed list-tokens -> ARRAY_MIN\n"); $$ = DragonLisp::Token::ARRAY_MIN; }
+	| ARRAY_ADD	{ PRINT_FUNC("Parsed list-tokens -> ARRAY_ADD\n"); $$ = DragonLisp::Token::ARRAY_ADD; }
+	| ARRAY_MUL	{ PRINT_FUNC("Parsed list-tokens -> ARRAY_MUL\n"); $$ = DragonLisp::Token::ARRAY_MUL; }
+	| ARRAY_SCALE	{ PRINT_FUNC("Parsed list-tokens -> ARRAY_SCALE\n"); $$ = DragonLisp::Token::ARRAY_SCALE; }
+	| MAKE_CHANNEL	{ PRINT_FUNC("Parsed list-tokens -> MAKE_CHANNEL\n"); $$ = DragonLisp::Token::MAKE_CHANNEL; }
+	| CHANNEL_SEND	{ PRINT_FUNC("Parsed list-tokens -> CHANNEL_SEND\n"); $$ = DragonLisp::Token::CHANNEL_SEND; }
+	| CHANNEL_RECV	{ PRINT_FUNC("Parsed list-tokens -> CHANNEL_RECV\n"); $$ = DragonLisp::Token::CHANNEL_RECV; }
+	| CHANNEL_CLOSE	{ PRINT_FUNC("Parsed list-tokens -> CHANNEL_CLOSE\n"); $$ = DragonLisp::Token::CHANNEL_CLOSE; }
 ;
 
 S-Expr-if
@@ -293,6 +334,7 @@ S-Expr-loop
 	: LOOP func-body						{ PRINT_FUNC("Parsed S-Expr-loop -> LOOP func-body\n"); $$ = drv.constructLoopAST($2); }
 	| LOOP FOR IDENTIFIER FROM R-Value TO R-Value DO func-body	{ PRINT_FUNC("Parsed S-Expr-loop -> LOOP FOR IDENTIFIER FROM R-Value TO R-Value DO func-body\n"); $$ = drv.constructLoopAST($3, $5, $7, $9); }
 	| DOTIMES LPAREN IDENTIFIER R-Value RPAREN func-body		{ PRINT_FUNC("Parsed S-Expr-loop -> DOTIMES LPAREN IDENTIFIER R-Value RPAREN func-body\n"); $$ = drv.constructLoopAST($3, $4, $6); }
+	| PDOTIMES LPAREN IDENTIFIER R-Value RPAREN func-body		{ PRINT_FUNC("Parsed S-Expr-loop -> PDOTIMES LPAREN IDENTIFIER R-Value RPAREN func-body\n"); $$ = drv.constructLoopAST($3, $4, $6, true); }
 ;
 
 func-def
@@ -304,7 +346,7 @@ func-arg-list
 	| LPAREN identifier-list RPAREN	{ PRINT_FUNC("Parsed func-arg-list -> ( identifier-list )\n"); $$ = $2; }
 
 identifier-list
-	: identifier-list IDENTIFIER	{ PRINT_FUNC("Parsed identifier-list -> identifier-list IDENTIFIER\n"); $1.push_back($2); $$ = $1; }
+	: identifier-list IDENTIFIER	{ PRINT_FUNC("Parsed identifier-list -> identifier-list IDENTIFIER\n"); $$ = $1; $$.push_back($2); }
 	| IDENTIFIER			{ PRINT_FUNC("Parsed identifier-list -> IDENTIFIER\n"); $$ = { $1 }; }
 ;
 
@@ -313,8 +355,12 @@ S-Expr-func-call
 	| IDENTIFIER			{ PRINT_FUNC("Parsed S-Expr-func-call -> IDENTIFIER\n"); $$ = drv.constructFuncCallAST($1, {}); }
 ;
 
+S-Expr-future
+	: FUTURE R-Value	{ PRINT_FUNC("Parsed S-Expr-future -> FUTURE R-Value\n"); $$ = drv.constructFutureAST($2); }
+;
+
 %%
 
 void DragonLisp::DLParser::error(const location_type& l, const std::string& msg) {
-    std::cerr << "Error: " << msg << " at " << l << "\n";
+    drv.error(l, msg);
 }
@@ -1,21 +1,72 @@
 #include <fstream>
+#include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include "DragonLispDriver.h"
 
 namespace DragonLisp {
 
 DLDriver::~DLDriver() {
+	// Futures may still run code from the arena
+	if (this->futures)
+		this->futures->wait();
 	delete (this->scanner);
 	this->scanner = nullptr;
 	delete (this->parser);
 	this->parser = nullptr;
+	delete (this->vm);
+	this->vm = nullptr;
+	delete (this->context);
+	this->context = nullptr;
+	delete (this->arena);
+	this->arena = nullptr;
+	delete (this->rewrites);
+	this->rewrites = nullptr;
+	delete (this->jit);
+	this->jit = nullptr;
+	delete (this->emitter);
+	this->emitter = nullptr;
+	delete (this->output);
+	this->output = nullptr;
+	delete (this->futures);
+	this->futures = nullptr;
+}
+
+void DLDriver::setEngine(Engine e) {
+	this->engine = e;
+}
+
+void DLDriver::setJit(bool enabled) {
+	this->useJit = enabled;
+}
+
+void DLDriver::setEmitCpp(bool enabled) {
+	this->emitCpp = enabled;
+}
+
+void DLDriver::setMaxDepth(std::size_t depth) {
+	this->maxDepth = depth;
+}
+
+void DLDriver::setMemoStats(bool enabled) {
+	this->memoStats = enabled;
+}
+
+void DLDriver::setPipeline(bool enabled) {
+	this->pipelined = enabled;
+}
+
+void DLDriver::setOutput(std::ostream& o, std::ostream& e) {
+	this->out = &o;
+	this->err = &e;
 }
 
 int DLDriver::parse(const std::string& f) {
 	std::ifstream in(f);
 	if (!in.good()) {
-		std::printf("Could not open file %s\n", f.c_str());
+		*this->out << "Could not open file " << f << std::endl;
 		return 1;
 	}
 	return this->parse(in, f);
@@ -30,9 +81,32 @@ int DLDriver::parse(std::istream& in, const std::string& s) {
 	delete this->parser;
 	this->parser = new DLParser(*this->scanner, *this);
 
-	// Execution Context
+	// Execution Context, once the futures of a previous run are done with it
+	if (this->futures)
+		this->futures->wait();
+	delete this->vm;
+	this->vm = nullptr;
 	delete this->context;
 	this->context = new Context(nullptr);
+	delete this->arena;
+	this->arena = new Arena;
+	delete this->rewrites;
+	this->rewrites = new Arena;
+	delete this->jit;
+	this->jit = this->useJit ? new Jit : nullptr;
+	this->context->setJit(this->jit);
+	delete this->output;
+	this->output = new Output(*this->out);
+	this->context->setOutput(this->output);
+	delete this->futures;
+	this->futures = new FutureGroup;
+	this->context->setFutures(this->futures);
+	if (this->engine == ENGINE_VM)
+		this->vm = new VM(this->context, this->maxDepth);
+	delete this->emitter;
+	this->emitter = this->emitCpp ? new CppEmitter : nullptr;
+	this->memoized.clear();
+	this->memoFuncs.clear();
 
 	this->parser->set_debug_level(
 #ifdef DLDEBUG
@@ -41,104 +115,234 @@ int DLDriver::parse(std::istream& in, const std::string& s) {
 	0
 #endif
 	);
-	return this->parser->parse();
+	// Statements run as they are parsed, so the parser runs on the segment
+	// unless it has a thread of its own
+	auto ret = EvalStack::run(this->maxDepth, [this]() {
+		this->futures->attach();
+		try {
+			auto ret = this->pipelined ? this->runPipeline() : this->parser->parse();
+			this->futures->wait();
+			FutureGroup::detach();
+			return ret;
+		} catch (...) {
+			FutureGroup::detach();
+			throw;
+		}
+	});
+
+	// A program with syntax errors is not translated at all
+	if (this->emitter && !ret)
+		this->emitter->write(*this->out);
+
+	if (this->memoStats) {
+		for (auto func : this->memoFuncs) {
+			auto memo = func->getMemo();
+			*this->err << "memoize " << func->getName() << ": "
+				<< memo->getHits() << " hits, "
+				<< memo->getMisses() << " misses, "
+				<< memo->getEvictions() << " evictions, "
+				<< memo->getSize() << "/" << memo->getCapacity() << " entries" << std::endl;
+		}
+	}
+	return ret;
 }
 
-std::shared_ptr<LValueAST> DLDriver::constructLValueAST(std::string name) {
-	return std::make_shared<IdentifierAST>(std::move(name));
+int DLDriver::runPipeline() {
+	Pipeline pipeline;
+	this->pipeline = &pipeline;
+	std::thread parsing([this, &pipeline]() {
+		int ret = 1;
+		std::exception_ptr error;
+		try {
+			ret = this->parser->parse();
+		} catch (const Pipeline::Stopped&) {
+		} catch (...) {
+			error = std::current_exception();
+		}
+		pipeline.finish(ret, error);
+	});
+
+	try {
+		std::vector<Pipeline::Statement> statements;
+		while (pipeline.take(statements))
+			for (auto s : statements)
+				this->evaluate(s);
+	} catch (...) {
+		// Nothing parsed after the statement that failed is reported
+		pipeline.stop();
+		parsing.join();
+		this->pipeline = nullptr;
+		throw;
+	}
+	parsing.join();
+	this->pipeline = nullptr;
+
+	if (pipeline.getError())
+		std::rethrow_exception(pipeline.getError());
+	*this->err << pipeline.getErrors();
+	return pipeline.getResult();
+}
+
+void DLDriver::error(const DLParser::location_type& l, const std::string& m) {
+	std::ostringstream message;
+	message << "Error: " << m << " at " << l << "\n";
+	if (this->pipeline)
+		this->pipeline->report(message.str());
+	else
+		*this->err << message.str();
+}
+
+void DLDriver::error(const std::string& m) {
+	if (this->pipeline)
+		this->pipeline->report("Error: " + m + "\n");
+	else
+		*this->err << "Error: " << m << "\n";
 }
 
-std::shared_ptr<LValueAST> DLDriver::constructLValueAST(std::string name, std::shared_ptr<ExprAST> index) {
-	return std::make_shared<ArrayRefAST>(std::move(name), std::move(index));
+LValueAST* DLDriver::constructLValueAST(std::string name) {
+	return this->arena->make<IdentifierAST>(std::move(name));
 }
 
-std::shared_ptr<FuncDefAST> DLDriver::constructFuncDefAST(std::string name, std::vector<std::string> args, std::vector<std::shared_ptr<ExprAST>> body) {
-	return std::make_shared<FuncDefAST>(std::move(name), std::move(args), std::move(body));
+LValueAST* DLDriver::constructLValueAST(std::string name, ExprAST* index) {
+	return this->arena->make<ArrayRefAST>(std::move(name), index);
 }
 
-std::shared_ptr<ExprAST> DLDriver::constructLiteralAST(bool value) {
-	return std::make_shared<LiteralAST>(value);
+FuncDefAST* DLDriver::constructFuncDefAST(std::string name, std::vector<std::string> args, std::vector<ExprAST*> body) {
+	return this->arena->make<FuncDefAST>(std::move(name), std::move(args), std::move(body));
 }
 
-std::shared_ptr<ExprAST> DLDriver::constructLiteralAST(std::int64_t value) {
-	return std::make_shared<LiteralAST>(value);
+ExprAST* DLDriver::constructLiteralAST(bool value) {
+	return this->arena->make<LiteralAST>(value);
 }
 
-std::shared_ptr<ExprAST> DLDriver::constructLiteralAST(double value) {
-	return std::make_shared<LiteralAST>(value);
+ExprAST* DLDriver::constructLiteralAST(std::int64_t value) {
+	return this->arena->make<LiteralAST>(value);
 }
 
-std::shared_ptr<ExprAST> DLDriver::constructLiteralAST(std::string value) {
-	return std::make_shared<LiteralAST>(std::move(value));
+ExprAST* DLDriver::constructLiteralAST(double value) {
+	return this->arena->make<LiteralAST>(value);
 }
 
-std::shared_ptr<BinaryAST> DLDriver::constructBinaryExprAST(std::shared_ptr<ExprAST> lhs, std::shared_ptr<ExprAST> rhs, Token op) {
-	return std::make_shared<BinaryAST>(std::move(lhs), std::move(rhs), op);
+ExprAST* DLDriver::constructLiteralAST(std::string value) {
+	return this->arena->make<LiteralAST>(std::move(value));
 }
 
-std::shared_ptr<UnaryAST> DLDriver::constructUnaryExprAST(std::shared_ptr<ExprAST> expr, Token op) {
-	return std::make_shared<UnaryAST>(std::move(expr), op);
+BinaryAST* DLDriver::constructBinaryExprAST(ExprAST* lhs, ExprAST* rhs, Token op) {
+	return this->arena->make<BinaryAST>(lhs, rhs, op);
 }
 
-std::shared_ptr<ListAST> DLDriver::constructListExprAST(std::vector<std::shared_ptr<ExprAST>> exprs, Token op) {
-	return std::make_shared<ListAST>(std::move(exprs), op);
+UnaryAST* DLDriver::constructUnaryExprAST(ExprAST* expr, Token op) {
+	return this->arena->make<UnaryAST>(expr, op);
 }
 
-std::shared_ptr<IfAST> DLDriver::constructIfAST(std::shared_ptr<ExprAST> cond, std::shared_ptr<ExprAST> then, std::shared_ptr<ExprAST> els) {
-	return std::make_shared<IfAST>(std::move(cond), std::move(then), std::move(els));
+ListAST* DLDriver::constructListExprAST(std::vector<ExprAST*> exprs, Token op) {
+	return this->arena->make<ListAST>(std::move(exprs), op);
 }
 
-std::shared_ptr<FuncCallAST> DLDriver::constructFuncCallAST(std::string name, std::vector<std::shared_ptr<ExprAST>> args) {
-	return std::make_shared<FuncCallAST>(std::move(name), std::move(args));
+IfAST* DLDriver::constructIfAST(ExprAST* cond, ExprAST* then, ExprAST* els) {
+	return this->arena->make<IfAST>(cond, then, els);
 }
 
-std::shared_ptr<VarOpAST> DLDriver::constructVarOpAST(std::string name, std::shared_ptr<ExprAST> value, Token op) {
-	return std::make_shared<VarOpAST>(std::move(name), std::move(value), op);
+FuncCallAST* DLDriver::constructFuncCallAST(std::string name, std::vector<ExprAST*> args) {
+	return this->arena->make<FuncCallAST>(std::move(name), std::move(args));
 }
 
-std::shared_ptr<LValOpAST> DLDriver::constructLValOpAST(std::shared_ptr<LValueAST> lval, std::shared_ptr<ExprAST> value, Token op) {
-	return std::make_shared<LValOpAST>(std::move(lval), std::move(value), op);
+VarOpAST* DLDriver::constructVarOpAST(std::string name, ExprAST* value, Token op) {
+	return this->arena->make<VarOpAST>(std::move(name), value, op);
 }
 
-std::shared_ptr<ReturnAST> DLDriver::constructReturnAST(std::shared_ptr<ExprAST> value) {
-	return std::make_shared<ReturnAST>(std::move(value));
+LValOpAST* DLDriver::constructLValOpAST(LValueAST* lval, ExprAST* value, Token op) {
+	return this->arena->make<LValOpAST>(lval, value, op);
 }
 
-std::shared_ptr <ReturnAST> DLDriver::constructReturnAST(std::shared_ptr <ExprAST> value, std::string name) {
-	return std::make_shared<ReturnAST>(std::move(value), std::move(name));
+ReturnAST* DLDriver::constructReturnAST(ExprAST* value) {
+	return this->arena->make<ReturnAST>(value);
 }
 
-std::shared_ptr<LoopAST> DLDriver::constructLoopAST(std::vector<std::shared_ptr<ExprAST>> body) {
-	return std::make_shared<LoopForeverAST>(
+ReturnAST* DLDriver::constructReturnAST(ExprAST* value, std::string name) {
+	return this->arena->make<ReturnAST>(value, std::move(name));
+}
+
+LoopAST* DLDriver::constructLoopAST(std::vector<ExprAST*> body) {
+	return this->arena->make<LoopForeverAST>(
 		std::move(body)
 	);
 }
 
-std::shared_ptr<LoopAST> DLDriver::constructLoopAST(std::string id, std::shared_ptr<ExprAST> to, std::vector<std::shared_ptr<ExprAST>> body) {
-	return std::make_shared<LoopDoTimesAST>(
+LoopAST* DLDriver::constructLoopAST(std::string id, ExprAST* to, std::vector<ExprAST*> body, bool parallel) {
+	return this->arena->make<LoopDoTimesAST>(
 		std::move(id),
-		std::move(to),
-		std::move(body)
+		to,
+		std::move(body),
+		parallel
 	);
 }
 
-std::shared_ptr<LoopAST> DLDriver::constructLoopAST(std::string id, std::shared_ptr<ExprAST> from, std::shared_ptr<ExprAST> to, std::vector<std::shared_ptr<ExprAST>> body) {
-	return std::make_shared<LoopForAST>(
+LoopAST* DLDriver::constructLoopAST(std::string id, ExprAST* from, ExprAST* to, std::vector<ExprAST*> body) {
+	return this->arena->make<LoopForAST>(
 		std::move(id),
-		std::move(from),
-		std::move(to),
+		from,
+		to,
 		std::move(body)
 	);
 }
 
-void DLDriver::execute(std::variant <std::shared_ptr<DragonLisp::ExprAST>, std::shared_ptr<DragonLisp::FuncDefAST>> ast) {
+FutureAST* DLDriver::constructFutureAST(ExprAST* expr) {
+	return this->arena->make<FutureAST>(expr);
+}
+
+void DLDriver::execute(std::variant<ExprAST*, FuncDefAST*> ast) {
+	// Declarations are made as they are parsed, so memoization is settled here
+	if (ast.index() == 1) {
+		auto func = std::get<1>(ast);
+		if (auto it = this->memoized.find(func->getName()); it != this->memoized.end()) {
+			func->setMemo(it->second);
+			this->memoFuncs.push_back(func);
+		}
+	}
+	if (this->pipeline)
+		this->pipeline->push(ast);
+	else
+		this->evaluate(ast);
+}
+
+void DLDriver::evaluate(std::variant<ExprAST*, FuncDefAST*> ast) {
 	if (ast.index() == 0) { // ExprAST
 		auto expr = std::get<0>(ast);
-		expr->eval(this->context);
+		this->resolver.resolve(expr, this->context);
+		expr = this->optimizer.optimize(expr, this->rewrites, this->context);
+		if (this->emitter) {
+			this->emitter->add(expr);
+
+			// Nothing runs, but the statements that follow are still resolved
+			// and folded knowing the constants defined at top level
+			if (expr->getType() == T_VarOpAST) {
+				auto def = static_cast<VarOpAST*>(expr);
+				if (def->getOp() == DEFCONSTANT && !this->context->isConstant(def->getName())) {
+					auto value = def->getExpr()->getType() == T_LiteralAST ? static_cast<LiteralAST*>(def->getExpr())->getValue() : Value::unbound();
+					this->context->defineConstant(def->getName(), value);
+				}
+			}
+		} else if (this->vm)
+			this->vm->execute(expr);
+		else
+			expr->eval(this->context);
 	} else { // ast.index() == 1, FuncDefAST
 		auto func = std::get<1>(ast);
+		this->resolver.resolve(func, this->context);
+		this->optimizer.optimize(func, this->rewrites, this->context);
+
+		// Published while futures may still call into the table, see FuncTable
 		this->context->setFunc(func->getName(), func);
+		if (this->emitter)
+			this->emitter->add(func);
 	}
 }
 
+void DLDriver::declaimMemoize(std::string name, std::int64_t size) {
+	if (size < 0)
+		throw std::runtime_error("Invalid memoize size: " + std::to_string(size));
+	this->memoized[std::move(name)] = size ? size : MemoCache::DEFAULT_CAPACITY;
+}
+
 } // end namespace DragonLisp
@@ -3,77 +3,167 @@
 
 #include <string>
 #include <istream>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
 
 #include "DragonLispScanner.h"
 #include "DragonLisp.tab.hh"
+#include "Arena.h"
 #include "AST.h"
+#include "Resolver.h"
+#include "Optimizer.h"
+#include "CppEmitter.h"
+#include "EvalStack.h"
+#include "Jit.h"
+#include "Pipeline.h"
+#include "Scheduler.h"
+#include "VM.h"
 
 namespace DragonLisp {
 
+enum Engine {
+	ENGINE_TREE,	// ExprAST::eval, the reference engine
+	ENGINE_VM,	// BytecodeCompiler + VM
+};
+
 class DLDriver {
 private:
 	DLParser* parser = nullptr;
 	DLScanner* scanner = nullptr;
 	DragonLisp::location location;
 
+	// Every AST node of the current parse, and those the Optimizer makes,
+	// apart so that the parser can run ahead on a thread of its own
+	Arena* arena = nullptr;
+	Arena* rewrites = nullptr;
+
+	// Parse on another thread than the one running the statements, and
+	// the statements parsed but not run yet while a parse is under way
+	bool pipelined = false;
+	Pipeline* pipeline = nullptr;
+
 	Context* context = nullptr;
 
+	// Where the program prints, and where errors and --memo-stats go
+	std::ostream* out = &std::cout;
+	std::ostream* err = &std::cerr;
+	Output* output = nullptr;
+
+	// Futures of the program, which it waits for on its own
+	FutureGroup* futures = nullptr;
+
+	Resolver resolver;
+
+	Optimizer optimizer;
+
+	Engine engine = ENGINE_TREE;
+	VM* vm = nullptr;
+
+	// Calls a program may nest, see EvalStack
+	std::size_t maxDepth = EvalStack::DEFAULT_DEPTH;
+
+	// Native code for hot specialized functions, tree engine only
+	bool useJit = false;
+	Jit* jit = nullptr;
+
+	// Translate to C++ instead of running, see CppEmitter
+	bool emitCpp = false;
+	CppEmitter* emitter = nullptr;
+
+	// Cache sizes declared by (declaim (memoize name)), and the definitions
+	// made since, whose counters --memo-stats prints
+	std::unordered_map<std::string, std::size_t> memoized;
+	std::vector<FuncDefAST*> memoFuncs;
+	bool memoStats = false;
+
+	// Resolve, optimize and run a statement
+	void evaluate(std::variant<ExprAST*, FuncDefAST*> ast);
+
+	// Run the statements the parser thread hands over, see setPipeline
+	int runPipeline();
+
 public:
 	DLDriver() = default;
 	virtual ~DLDriver();
 
+	void setEngine(Engine e);
+
+	void setJit(bool enabled);
+
+	void setEmitCpp(bool enabled);
+
+	void setMaxDepth(std::size_t depth);
+
+	void setMemoStats(bool enabled);
+
+	// Scan and parse on a thread of their own while the statements parsed
+	// so far run. Output and errors come in the same order either way.
+	void setPipeline(bool enabled);
+
+	// Drivers share nothing a program can write but these streams, so
+	// several may run programs at the same time on different threads,
+	// each waiting for its own futures only
+	void setOutput(std::ostream& o, std::ostream& e);
+
 	int parse(const std::string& f);
 	int parse(std::istream& in, const std::string& s = "stream input");
 
 	void error(const DLParser::location_type& l, const std::string& m);
 	void error(const std::string& m);
 
-	void execute(std::variant<std::shared_ptr<DragonLisp::ExprAST>, std::shared_ptr<DragonLisp::FuncDefAST>> ast);
+	void execute(std::variant<ExprAST*, FuncDefAST*> ast);
+
+	// (declaim (memoize name size)), for the definitions that follow
+	void declaimMemoize(std::string name, std::int64_t size);
 
 	// Identifier AST
-	static std::shared_ptr<LValueAST> constructLValueAST(std::string name);
+	LValueAST* constructLValueAST(std::string name);
 
 	// ArrayRef AST
-	static std::shared_ptr<LValueAST> constructLValueAST(std::string name, std::shared_ptr<ExprAST> index);
+	LValueAST* constructLValueAST(std::string name, ExprAST* index);
 
 	// FuncDef AST
-	static std::shared_ptr<FuncDefAST> constructFuncDefAST(std::string name, std::vector<std::string> args, std::vector<std::shared_ptr<ExprAST>> body);
+	FuncDefAST* constructFuncDefAST(std::string name, std::vector<std::string> args, std::vector<ExprAST*> body);
 
 	// Literal AST
-	static std::shared_ptr<ExprAST> constructLiteralAST(bool value);
-	static std::shared_ptr<ExprAST> constructLiteralAST(std::int64_t value);
-	static std::shared_ptr<ExprAST> constructLiteralAST(double value);
-	static std::shared_ptr<ExprAST> constructLiteralAST(std::string value);
+	ExprAST* constructLiteralAST(bool value);
+	ExprAST* constructLiteralAST(std::int64_t value);
+	ExprAST* constructLiteralAST(double value);
+	ExprAST* constructLiteralAST(std::string value);
 
 	// BinaryExpr AST
-	static std::shared_ptr<BinaryAST> constructBinaryExprAST(std::shared_ptr<ExprAST> lhs, std::shared_ptr<ExprAST> rhs, Token op);
+	BinaryAST* constructBinaryExprAST(ExprAST* lhs, ExprAST* rhs, Token op);
 
 	// UnaryExpr AST
-	static std::shared_ptr<UnaryAST> constructUnaryExprAST(std::shared_ptr<ExprAST> expr, Token op);
+	UnaryAST* constructUnaryExprAST(ExprAST* expr, Token op);
 
 	// ListExpr AST
-	static std::shared_ptr<ListAST> constructListExprAST(std::vector<std::shared_ptr<ExprAST>> exprs, Token op);
+	ListAST* constructListExprAST(std::vector<ExprAST*> exprs, Token op);
 
 	// If AST
-	static std::shared_ptr<IfAST> constructIfAST(std::shared_ptr<ExprAST> cond, std::shared_ptr<ExprAST> then, std::shared_ptr<ExprAST> els);
+	IfAST* constructIfAST(ExprAST* cond, ExprAST* then, ExprAST* els);
 
 	// Func Call AST
-	static std::shared_ptr<FuncCallAST> constructFuncCallAST(std::string name, std::vector<std::shared_ptr<ExprAST>> args);
+	FuncCallAST* constructFuncCallAST(std::string name, std::vector<ExprAST*> args);
 
 	// Var Op AST
-	static std::shared_ptr<VarOpAST> constructVarOpAST(std::string name, std::shared_ptr<ExprAST> value, Token op);
+	VarOpAST* constructVarOpAST(std::string name, ExprAST* value, Token op);
 
 	// LVal Op AST
-	static std::shared_ptr<LValOpAST> constructLValOpAST(std::shared_ptr<LValueAST> lval, std::shared_ptr<ExprAST> value, Token op);
+	LValOpAST* constructLValOpAST(LValueAST* lval, ExprAST* value, Token op);
 
 	// Return AST
-	static std::shared_ptr<ReturnAST> constructReturnAST(std::shared_ptr<ExprAST> value);
-	static std::shared_ptr<ReturnAST> constructReturnAST(std::shared_ptr<ExprAST> value, std::string name);
+	ReturnAST* constructReturnAST(ExprAST* value);
+	ReturnAST* constructReturnAST(ExprAST* value, std::string name);
 
 	// Loop AST
-	static std::shared_ptr<LoopAST> constructLoopAST(std::vector<std::shared_ptr<ExprAST>> body);
-	static std::shared_ptr<LoopAST> constructLoopAST(std::string id, std::shared_ptr<ExprAST> from, std::shared_ptr<ExprAST> to, std::vector<std::shared_ptr<ExprAST>> body);
-	static std::shared_ptr<LoopAST> constructLoopAST(std::string id, std::shared_ptr<ExprAST> to, std::vector<std::shared_ptr<ExprAST>> body);
+	LoopAST* constructLoopAST(std::vector<ExprAST*> body);
+	LoopAST* constructLoopAST(std::string id, ExprAST* from, ExprAST* to, std::vector<ExprAST*> body);
+	LoopAST* constructLoopAST(std::string id, ExprAST* to, std::vector<ExprAST*> body, bool parallel = false);
+
+	// Future AST
+	FutureAST* constructFutureAST(ExprAST* expr);
 };
 
 } // end namespace DragonLisp
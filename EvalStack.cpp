@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "EvalStack.h"
+
+namespace DragonLisp {
+
+namespace {
+
+struct Task {
+	const std::function<int()>* f;
+	const char* limit;
+	std::size_t depth;
+	int ret = 0;
+	std::exception_ptr error;
+};
+
+struct Segment {
+	char* base;
+	std::size_t size;
+};
+
+// Segments of threads that are done
+std::mutex spareLock;
+std::vector<Segment> spare;
+
+Segment acquire(std::size_t size, std::size_t depth) {
+	{
+		std::lock_guard<std::mutex> guard(spareLock);
+		auto it = std::find_if(spare.begin(), spare.end(), [&](const Segment& s) { return s.size == size; });
+		if (it != spare.end()) {
+			auto ret = *it;
+			spare.erase(it);
+			return ret;
+		}
+	}
+
+	void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (base == MAP_FAILED)
+		throw std::runtime_error("Cannot reserve a stack for " + std::to_string(depth) + " calls, try a lower --max-depth");
+
+	// Overflowing the headroom faults instead of writing past the segment
+	mprotect(base, sysconf(_SC_PAGESIZE), PROT_NONE);
+	return { static_cast<char*>(base), size };
+}
+
+void release(Segment s) {
+	// What recursion committed goes back to the kernel, the reservation stays
+	auto page = sysconf(_SC_PAGESIZE);
+	madvise(s.base + page, s.size - page, MADV_DONTNEED);
+	{
+		std::lock_guard<std::mutex> guard(spareLock);
+		if (spare.size() < EvalStack::SPARE_SEGMENTS) {
+			spare.push_back(s);
+			return;
+		}
+	}
+	munmap(s.base, s.size);
+}
+
+} // namespace
+
+void* EvalStack::start(void* arg) {
+	auto task = static_cast<Task*>(arg);
+	EvalStack::limit = task->limit;
+	EvalStack::depth = task->depth;
+	try {
+		task->ret = (*task->f)();
+	} catch (...) {
+		task->error = std::current_exception();
+	}
+	return nullptr;
+}
+
+int EvalStack::run(std::size_t depth, const std::function<int()>& f) {
+	depth = std::min(depth, EvalStack::MAX_DEPTH);
+	auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+	auto size = (depth * EvalStack::FRAME_BYTES + EvalStack::HEADROOM + page - 1) / page * page;
+	auto segment = acquire(size, depth);
+
+	Task task{ &f, segment.base + EvalStack::HEADROOM, depth };
+	pthread_attr_t attr;
+	pthread_t thread;
+	pthread_attr_init(&attr);
+	bool ok = !pthread_attr_setstack(&attr, segment.base, size);
+	if (ok)
+		ok = !pthread_create(&thread, &attr, EvalStack::start, &task);
+	pthread_attr_destroy(&attr);
+	if (ok)
+		pthread_join(thread, nullptr);
+	release(segment);
+	if (!ok)
+		throw std::runtime_error("Cannot start a thread to evaluate on");
+
+	if (task.error)
+		std::rethrow_exception(task.error);
+	return task.ret;
+}
+
+void EvalStack::overflow() {
+	EvalStack::overflowed = true;
+	throw std::runtime_error("Maximum recursion depth exceeded");
+}
+
+void EvalStack::markOverflow() noexcept {
+	EvalStack::overflowed = true;
+}
+
+std::int32_t EvalStack::limitOffset() {
+	return static_cast<std::int32_t>(reinterpret_cast<const char*>(&EvalStack::limit) - static_cast<const char*>(__builtin_thread_pointer()));
+}
+
+} // namespace DragonLisp
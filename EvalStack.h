@@ -0,0 +1,84 @@
+#ifndef __DRAGON_LISP_EVAL_STACK_H__
+#define __DRAGON_LISP_EVAL_STACK_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+namespace DragonLisp {
+
+/// EvalStack - Native stack segment that programs are evaluated on.
+///
+/// Calls of the tree engine, of specialized and of compiled code nest on
+/// the native stack. run() reserves a segment with room for `depth` calls
+/// and evaluates on it: pages are committed by the kernel as recursion
+/// reaches them, so a program only uses the memory its depth needs. Calls
+/// past the cap raise a runtime_error instead of overflowing the segment.
+/// Segments are kept once their thread is done, with their pages handed
+/// back, for the next thread to run on instead of reserving its own.
+class EvalStack {
+public:
+	/// Calls the segment has room for, unless set with --max-depth.
+	static constexpr std::size_t DEFAULT_DEPTH = 4 * 1000 * 1000;
+
+	/// Largest depth, a segment of about 16 GiB of address space.
+	static constexpr std::size_t MAX_DEPTH = 16 * 1000 * 1000;
+
+	/// Segments kept for reuse.
+	static constexpr std::size_t SPARE_SEGMENTS = 16;
+
+	/// Native stack budgeted per call.
+	static constexpr std::size_t FRAME_BYTES = 1024;
+
+	/// Kept under the limit for raising the error, and for compiled code
+	/// and library calls running between two checks.
+	static constexpr std::size_t HEADROOM = 1024 * 1024;
+
+private:
+	// Lowest address calls may reach on this thread, nullptr outside run()
+	static thread_local inline const char* limit = nullptr;
+
+	// Set once the limit was hit on this thread
+	static thread_local inline bool overflowed = false;
+
+	// Calls the segment of this thread has room for
+	static thread_local inline std::size_t depth = DEFAULT_DEPTH;
+
+	static void* start(void* task);
+
+public:
+	/// Run `f` on a segment for `depth` calls, at most MAX_DEPTH. Exceptions
+	/// are rethrown on the calling thread. Raises an error if no segment can
+	/// be reserved, rather than running `f` without a limit.
+	static int run(std::size_t depth, const std::function<int()>& f);
+
+	/// Depth given to run() on this thread, for threads it starts to run
+	/// code with the same limit.
+	static std::size_t getDepth() {
+		return EvalStack::depth;
+	}
+
+	/// Raise the error past the limit. Called on entry of every call.
+	static void check() {
+		if (static_cast<const char*>(__builtin_frame_address(0)) < EvalStack::limit)
+			EvalStack::overflow();
+	}
+
+	[[noreturn]] static void overflow();
+
+	/// Whether a compiled call bailed out at the limit.
+	static bool hasOverflowed() {
+		return EvalStack::overflowed;
+	}
+
+	/// Called from compiled code at the limit, before it bails out.
+	static void markOverflow() noexcept;
+
+	/// Offset of the limit from the thread pointer (fs), for compiled code.
+	static std::int32_t limitOffset();
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_EVAL_STACK_H__
@@ -0,0 +1,79 @@
+#include "Future.h"
+#include "Scheduler.h"
+
+namespace DragonLisp {
+
+Future::Future(Body body, std::unique_ptr<Context> globals, std::uint32_t slots, Captures captures, FutureGroup* group)
+	: Object(TYPE_FUTURE), body(std::move(body)), globals(std::move(globals)), slots(slots), captures(std::move(captures)), group(group) {}
+
+Value Future::spawn(Context* frame, std::uint32_t slots, Captures captures, Body body) {
+	auto group = frame->getFutures();
+	group->add();
+	Value ret(new Future(std::move(body), Context::snapshot(frame), slots, std::move(captures), group));
+	Scheduler::get().submit(ret);
+	return ret;
+}
+
+bool Future::claim() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (this->state != FUTURE_PENDING)
+		return false;
+	this->state = FUTURE_RUNNING;
+	return true;
+}
+
+void Future::execute() {
+	Value ret;
+	std::exception_ptr err;
+	auto group = this->group;
+	group->enter();
+	{
+		Context frame(this->globals.get(), this->slots);
+		for (auto& [index, value] : this->captures)
+			frame.setSlot(index, std::move(value));
+		try {
+			ret = this->body(&frame);
+		} catch (...) {
+			err = std::current_exception();
+		}
+	}
+	this->body = nullptr;
+	this->globals.reset();
+	this->captures.clear();
+	group->leave();
+
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->result = std::move(ret);
+		this->error = err;
+		this->state = FUTURE_DONE;
+	}
+	this->done.notify_all();
+	group->finish();
+}
+
+void Future::run(const Value& f) {
+	auto future = Future::get(f);
+	if (future->claim())
+		future->execute();
+}
+
+Value Future::touch(const Value& f) {
+	if (!f.isFuture())
+		return f;
+	auto future = Future::get(f);
+	if (future->claim())
+		future->execute();
+
+	std::unique_lock<std::mutex> guard(future->lock);
+	if (future->state != FUTURE_DONE) {
+		Scheduler::block(nullptr);
+		future->done.wait(guard, [&] { return future->state == FUTURE_DONE; });
+		Scheduler::unblock(nullptr);
+	}
+	if (future->error)
+		std::rethrow_exception(future->error);
+	return future->result;
+}
+
+} // namespace DragonLisp
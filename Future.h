@@ -0,0 +1,88 @@
+#ifndef __DRAGON_LISP_FUTURE_H__
+#define __DRAGON_LISP_FUTURE_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "context.h"
+
+namespace DragonLisp {
+
+/// Future - Value of (future expr), read with (touch f).
+///
+/// The expression runs under a snapshot of the global variables taken when
+/// the future is made, and in a frame of its own whose captured slots are
+/// set then too, so it shares nothing it could write with the code that
+/// made it. The snapshot shares the globals until either side assigns one
+/// (see Globals), so making a future does not depend on how many there
+/// are. Whichever thread gets to a pending future first runs it: a
+/// thread of the Scheduler, or one touching it, which then does not wait.
+class Future : public Object {
+public:
+	/// Evaluates the expression in the frame of the future.
+	using Body = std::function<Value(Context* frame)>;
+
+	/// Slot of the frame and value of each captured variable.
+	using Captures = std::vector<std::pair<std::uint32_t, Value>>;
+
+private:
+	enum State {
+		FUTURE_PENDING,
+		FUTURE_RUNNING,
+		FUTURE_DONE,
+	};
+
+	// Released once the future has run
+	Body body;
+	std::unique_ptr<Context> globals;
+	std::uint32_t slots;
+	Captures captures;
+
+	// Counts the future until it has run
+	FutureGroup* group;
+
+	std::mutex lock;
+	std::condition_variable done;
+	State state = FUTURE_PENDING;
+	Value result;
+	std::exception_ptr error;
+
+	Future(Body body, std::unique_ptr<Context> globals, std::uint32_t slots, Captures captures, FutureGroup* group);
+
+	// Move from pending to running, false if another thread got there first
+	bool claim();
+
+	void execute();
+
+	static Future* get(const Value& v) {
+		return static_cast<Future*>(v.getObject());
+	}
+
+public:
+	/// Schedule `body` in a frame of `slots` slots under a snapshot of the
+	/// globals `frame` runs under, in the FutureGroup of its context.
+	static Value spawn(Context* frame, std::uint32_t slots, Captures captures, Body body);
+
+	/// Run future `f` unless a thread already has. Called by the Scheduler.
+	static void run(const Value& f);
+
+	/// The result of future `f`, running it on this thread if none has
+	/// started it and waiting for it otherwise. An error raised by the
+	/// expression is raised again. Other values are returned as they are.
+	static Value touch(const Value& f);
+
+	std::string toString() const override final {
+		return "#<FUTURE>";
+	}
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_FUTURE_H__
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <utility>
+
+#include "Channel.h"
+#include "FutureGroup.h"
+
+namespace DragonLisp {
+
+void FutureGroup::attach() {
+	FutureGroup::program = this;
+}
+
+void FutureGroup::detach() {
+	FutureGroup::program = nullptr;
+}
+
+void FutureGroup::add() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->pending++;
+}
+
+void FutureGroup::enter() {
+	FutureGroup::current = this;
+	FutureGroup::nested++;
+}
+
+void FutureGroup::leave() {
+	if (!--FutureGroup::nested)
+		FutureGroup::current = nullptr;
+}
+
+void FutureGroup::finish() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->pending--;
+	this->settle();
+	this->changed.notify_all();
+}
+
+void FutureGroup::park(Channel* ch) {
+	if (auto group = FutureGroup::current) {
+		std::lock_guard<std::mutex> guard(group->lock);
+		group->parked += FutureGroup::nested;
+		if (ch)
+			group->channels.push_back(ch);
+		group->settle();
+		group->changed.notify_all();
+	} else if (auto group = FutureGroup::program) {
+		std::lock_guard<std::mutex> guard(group->lock);
+		if (ch)
+			group->blocked = ch;
+		else
+			group->waiting = true;
+		group->settle();
+	}
+}
+
+bool FutureGroup::unpark(Channel* ch) {
+	if (auto group = FutureGroup::current) {
+		std::lock_guard<std::mutex> guard(group->lock);
+		group->parked -= FutureGroup::nested;
+		if (ch)
+			group->channels.erase(std::find(group->channels.begin(), group->channels.end(), ch));
+	} else if (auto group = FutureGroup::program) {
+		std::lock_guard<std::mutex> guard(group->lock);
+		group->blocked = nullptr;
+		group->waiting = false;
+		return !std::exchange(group->stuck, false);
+	}
+	return true;
+}
+
+bool FutureGroup::deadlocked() const {
+	if (this->parked != this->pending)
+		return false;
+	if (this->blocked) {
+		if (!this->blocked->isStuck())
+			return false;
+	} else if (!this->waiting || !this->pending || this->channels.empty())
+		return false;
+	// A thread that was just woken is still counted until it runs again
+	return std::all_of(this->channels.begin(), this->channels.end(), [](Channel* ch) { return ch->isStuck(); });
+}
+
+void FutureGroup::settle() {
+	if (!this->deadlocked())
+		return;
+	if (this->blocked) {
+		this->stuck = true;
+		this->blocked->wake();
+	} else
+		for (auto ch : this->channels)
+			ch->close();
+}
+
+void FutureGroup::wait() {
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->waiting = true;
+	while (this->pending) {
+		this->settle();
+		this->changed.wait(guard);
+	}
+	this->waiting = false;
+}
+
+} // namespace DragonLisp
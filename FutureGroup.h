@@ -0,0 +1,97 @@
+#ifndef __DRAGON_LISP_FUTURE_GROUP_H__
+#define __DRAGON_LISP_FUTURE_GROUP_H__
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace DragonLisp {
+
+class Channel;
+
+/// FutureGroup - The futures made by one program, and those they make.
+///
+/// Programs run side by side by a Batch share the Scheduler, so each one
+/// waits on its own group instead of on every future in the process. A
+/// future counts as parked while the thread running it waits on a channel
+/// or on another future. Once the program waits for its group and every
+/// future left is parked, with nothing to receive from or room to send
+/// into on the channels they wait on, none of them can ever go on: the
+/// group closes those channels, so that they finish. The thread running
+/// the program itself, once attached, is watched the same way: parked on
+/// a channel that none of the futures can feed any more, it is woken and
+/// told so, for it to raise an error rather than wait forever.
+class FutureGroup {
+private:
+	std::mutex lock;
+	std::condition_variable changed;
+
+	// Futures made and not finished, and those of them that are parked
+	std::size_t pending = 0;
+	std::size_t parked = 0;
+
+	// Channel each parked thread waits on, if it waits on one
+	std::vector<Channel*> channels;
+
+	// Channel the program thread is parked on, whether it waits for the
+	// futures instead, and whether it was woken as it never would be else
+	Channel* blocked = nullptr;
+	bool waiting = false;
+	bool stuck = false;
+
+	// Group of the futures this thread is running, and how many of them,
+	// as touching a future may run it inside another one
+	static thread_local inline FutureGroup* current = nullptr;
+	static thread_local inline unsigned nested = 0;
+
+	// Group of the program this thread runs, if attached to one
+	static thread_local inline FutureGroup* program = nullptr;
+
+	// With the lock held: nothing left to run can wake a parked thread
+	bool deadlocked() const;
+
+	// With the lock held: wake the waiting program thread on a deadlock
+	void settle();
+
+public:
+	FutureGroup() = default;
+
+	FutureGroup(const FutureGroup&) = delete;
+
+	FutureGroup& operator=(const FutureGroup&) = delete;
+
+	/// Group of contexts that were given no other.
+	static FutureGroup& standard() {
+		static FutureGroup group;
+		return group;
+	}
+
+	/// This thread starts and stops running the program of the group.
+	void attach();
+	static void detach();
+
+	/// A future of the group was made.
+	void add();
+
+	/// This thread starts and stops running a future of the group.
+	void enter();
+	void leave();
+
+	/// A future of the group is done. Last use of the group by the future.
+	void finish();
+
+	/// Called by a thread before and after it waits on channel `ch`, or on
+	/// a future if `ch` is null. Only threads running futures or attached
+	/// to a program are counted. unpark() is false when the program thread
+	/// was woken as nothing was left that could wake it.
+	static void park(Channel* ch);
+	static bool unpark(Channel* ch);
+
+	/// Wait until every future of the group has finished.
+	void wait();
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_FUTURE_GROUP_H__
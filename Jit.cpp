@@ -0,0 +1,319 @@
+#include <cstring>
+#include <limits>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Jit.h"
+
+namespace DragonLisp {
+
+Assembler::Label Assembler::newLabel() {
+	this->labels.push_back(std::numeric_limits<std::size_t>::max());
+	return this->labels.size() - 1;
+}
+
+void Assembler::bind(Label l) {
+	this->labels[l] = this->code.size();
+}
+
+void Assembler::finish() {
+	for (const auto& [at, l] : this->fixups) {
+		auto rel = static_cast<std::int32_t>(this->labels[l] - (at + 4));
+		std::memcpy(&this->code[at], &rel, sizeof(rel));
+	}
+	this->fixups.clear();
+}
+
+void Assembler::push(Reg r) {
+	this->rex(false, 0, r);
+	this->byte(0x50 | (r & 7));
+}
+
+void Assembler::pop(Reg r) {
+	this->rex(false, 0, r);
+	this->byte(0x58 | (r & 7));
+}
+
+void Assembler::ret() {
+	this->byte(0xC3);
+}
+
+void Assembler::movImm(Reg dst, std::uint64_t imm) {
+	this->rex(true, 0, dst);
+	this->byte(0xB8 | (dst & 7));
+	this->imm32(static_cast<std::uint32_t>(imm));
+	this->imm32(static_cast<std::uint32_t>(imm >> 32));
+}
+
+void Assembler::mov(Reg dst, Reg src) {
+	this->rex(true, src, dst);
+	this->byte(0x89);
+	this->modrm(src, dst);
+}
+
+void Assembler::load(Reg dst, Reg base, std::int32_t disp) {
+	this->rex(true, dst, base);
+	this->byte(0x8B);
+	this->mem(dst, base, disp);
+}
+
+void Assembler::loadFs(Reg dst, std::int32_t disp) {
+	this->byte(0x64);
+	this->rex(true, dst, 0);
+	this->byte(0x8B);
+	// No base nor index, an absolute disp32
+	this->byte(((dst & 7) << 3) | RSP);
+	this->byte(0x25);
+	this->imm32(static_cast<std::uint32_t>(disp));
+}
+
+void Assembler::loadByte(Reg dst, Reg base, std::int32_t disp) {
+	this->rex(true, dst, base);
+	this->byte(0x0F);
+	this->byte(0xB6);
+	this->mem(dst, base, disp);
+}
+
+void Assembler::store(Reg base, std::int32_t disp, Reg src) {
+	this->rex(true, src, base);
+	this->byte(0x89);
+	this->mem(src, base, disp);
+}
+
+void Assembler::lea(Reg dst, Reg base, std::int32_t disp) {
+	this->rex(true, dst, base);
+	this->byte(0x8D);
+	this->mem(dst, base, disp);
+}
+
+void Assembler::add(Reg dst, Reg src) {
+	this->rex(true, src, dst);
+	this->byte(0x01);
+	this->modrm(src, dst);
+}
+
+void Assembler::sub(Reg dst, Reg src) {
+	this->rex(true, src, dst);
+	this->byte(0x29);
+	this->modrm(src, dst);
+}
+
+void Assembler::imul(Reg dst, Reg src) {
+	this->rex(true, dst, src);
+	this->byte(0x0F);
+	this->byte(0xAF);
+	this->modrm(dst, src);
+}
+
+void Assembler::and_(Reg dst, Reg src) {
+	this->rex(true, src, dst);
+	this->byte(0x21);
+	this->modrm(src, dst);
+}
+
+void Assembler::or_(Reg dst, Reg src) {
+	this->rex(true, src, dst);
+	this->byte(0x09);
+	this->modrm(src, dst);
+}
+
+void Assembler::xor_(Reg dst, Reg src) {
+	this->rex(true, src, dst);
+	this->byte(0x31);
+	this->modrm(src, dst);
+}
+
+void Assembler::cmp(Reg a, Reg b) {
+	this->rex(true, b, a);
+	this->byte(0x39);
+	this->modrm(b, a);
+}
+
+void Assembler::test(Reg a, Reg b) {
+	this->rex(true, b, a);
+	this->byte(0x85);
+	this->modrm(b, a);
+}
+
+void Assembler::testByte(Reg r) {
+	this->rex(false, r, r);
+	if (r >= RSP && r < R8)
+		this->byte(0x40);
+	this->byte(0x84);
+	this->modrm(r, r);
+}
+
+void Assembler::not_(Reg r) {
+	this->rex(true, 0, r);
+	this->byte(0xF7);
+	this->modrm(2, r);
+}
+
+void Assembler::neg(Reg r) {
+	this->rex(true, 0, r);
+	this->byte(0xF7);
+	this->modrm(3, r);
+}
+
+void Assembler::cqo() {
+	this->byte(0x48);
+	this->byte(0x99);
+}
+
+void Assembler::idiv(Reg r) {
+	this->rex(true, 0, r);
+	this->byte(0xF7);
+	this->modrm(7, r);
+}
+
+void Assembler::addRsp(std::int32_t n) {
+	this->byte(0x48);
+	this->byte(0x81);
+	this->modrm(0, RSP);
+	this->imm32(static_cast<std::uint32_t>(n));
+}
+
+void Assembler::subRsp(std::int32_t n) {
+	this->byte(0x48);
+	this->byte(0x81);
+	this->modrm(5, RSP);
+	this->imm32(static_cast<std::uint32_t>(n));
+}
+
+void Assembler::setcc(Cond cc, Reg dst) {
+	// setcc r8, then movzx r64, r8
+	this->rex(false, 0, dst);
+	if (dst >= RSP && dst < R8)
+		this->byte(0x40);
+	this->byte(0x0F);
+	this->byte(0x90 | cc);
+	this->modrm(0, dst);
+	this->rex(true, dst, dst);
+	this->byte(0x0F);
+	this->byte(0xB6);
+	this->modrm(dst, dst);
+}
+
+void Assembler::jcc(Cond cc, Label l) {
+	this->byte(0x0F);
+	this->byte(0x80 | cc);
+	this->rel32(l);
+}
+
+void Assembler::jmp(Label l) {
+	this->byte(0xE9);
+	this->rel32(l);
+}
+
+void Assembler::call(Reg target) {
+	this->rex(false, 0, target);
+	this->byte(0xFF);
+	this->modrm(2, target);
+}
+
+void Assembler::movqToXmm(Reg xmm, Reg src) {
+	this->byte(0x66);
+	this->rex(true, xmm, src);
+	this->byte(0x0F);
+	this->byte(0x6E);
+	this->modrm(xmm, src);
+}
+
+void Assembler::movqFromXmm(Reg dst, Reg xmm) {
+	this->byte(0x66);
+	this->rex(true, xmm, dst);
+	this->byte(0x0F);
+	this->byte(0x7E);
+	this->modrm(xmm, dst);
+}
+
+void Assembler::movapd(Reg dst, Reg src) {
+	this->byte(0x66);
+	this->rex(false, dst, src);
+	this->byte(0x0F);
+	this->byte(0x28);
+	this->modrm(dst, src);
+}
+
+void Assembler::addsd(Reg dst, Reg src) {
+	this->byte(0xF2);
+	this->rex(false, dst, src);
+	this->byte(0x0F);
+	this->byte(0x58);
+	this->modrm(dst, src);
+}
+
+void Assembler::subsd(Reg dst, Reg src) {
+	this->byte(0xF2);
+	this->rex(false, dst, src);
+	this->byte(0x0F);
+	this->byte(0x5C);
+	this->modrm(dst, src);
+}
+
+void Assembler::mulsd(Reg dst, Reg src) {
+	this->byte(0xF2);
+	this->rex(false, dst, src);
+	this->byte(0x0F);
+	this->byte(0x59);
+	this->modrm(dst, src);
+}
+
+void Assembler::divsd(Reg dst, Reg src) {
+	this->byte(0xF2);
+	this->rex(false, dst, src);
+	this->byte(0x0F);
+	this->byte(0x5E);
+	this->modrm(dst, src);
+}
+
+void Assembler::ucomisd(Reg a, Reg b) {
+	this->byte(0x66);
+	this->rex(false, a, b);
+	this->byte(0x0F);
+	this->byte(0x2E);
+	this->modrm(a, b);
+}
+
+void Assembler::cvtsi2sd(Reg xmm, Reg src) {
+	this->byte(0xF2);
+	this->rex(true, xmm, src);
+	this->byte(0x0F);
+	this->byte(0x2A);
+	this->modrm(xmm, src);
+}
+
+Jit::~Jit() {
+	for (const auto& [p, size] : this->pages)
+		munmap(p, size);
+	if (this->perfMap)
+		std::fclose(this->perfMap);
+}
+
+void* Jit::install(const std::vector<std::uint8_t>& code, const std::string& name) {
+	auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+	auto size = (code.size() + page - 1) / page * page;
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return nullptr;
+	std::memcpy(p, code.data(), code.size());
+	if (mprotect(p, size, PROT_READ | PROT_EXEC)) {
+		munmap(p, size);
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->pages.emplace_back(p, size);
+
+	if (!this->perfMap) {
+		auto path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+		this->perfMap = std::fopen(path.c_str(), "a");
+	}
+	if (this->perfMap) {
+		std::fprintf(this->perfMap, "%lx %zx %s\n", reinterpret_cast<unsigned long>(p), code.size(), name.c_str());
+		std::fflush(this->perfMap);
+	}
+	return p;
+}
+
+} // namespace DragonLisp
@@ -0,0 +1,180 @@
+#ifndef __DRAGON_LISP_JIT_H__
+#define __DRAGON_LISP_JIT_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace DragonLisp {
+
+/// Reg - x86-64 general purpose registers, or SSE registers where an
+/// instruction takes those.
+enum Reg : std::uint8_t {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+constexpr Reg XMM0 = RAX;
+constexpr Reg XMM1 = RCX;
+
+/// Cond - Condition codes of jcc / setcc.
+enum Cond : std::uint8_t {
+	CC_B = 0x2,
+	CC_AE = 0x3,
+	CC_E = 0x4,
+	CC_NE = 0x5,
+	CC_BE = 0x6,
+	CC_A = 0x7,
+	CC_L = 0xC,
+	CC_GE = 0xD,
+	CC_LE = 0xE,
+	CC_G = 0xF,
+};
+
+/// Assembler - Encodes the x86-64 instructions the JIT needs into a buffer.
+/// Memory operands are always [base + disp32]. Jumps go to labels that
+/// may be bound later; they are patched when the label is bound.
+class Assembler {
+public:
+	using Label = std::size_t;
+
+private:
+	std::vector<std::uint8_t> code;
+
+	// Bound offset of each label, or SIZE_MAX
+	std::vector<std::size_t> labels;
+
+	// Offsets of rel32 fields and the label they refer to
+	std::vector<std::pair<std::size_t, Label>> fixups;
+
+	void byte(std::uint8_t b) {
+		this->code.push_back(b);
+	}
+
+	void imm32(std::uint32_t v) {
+		for (int i = 0; i < 4; i++)
+			this->byte(static_cast<std::uint8_t>(v >> (8 * i)));
+	}
+
+	void rex(bool w, std::uint8_t reg, std::uint8_t rm) {
+		std::uint8_t r = 0x40 | (w ? 8 : 0) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+		if (r != 0x40)
+			this->byte(r);
+	}
+
+	void modrm(std::uint8_t reg, std::uint8_t rm) {
+		this->byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+
+	void mem(std::uint8_t reg, Reg base, std::int32_t disp) {
+		this->byte(0x80 | ((reg & 7) << 3) | (base & 7));
+		if ((base & 7) == RSP)
+			this->byte(0x24);
+		this->imm32(static_cast<std::uint32_t>(disp));
+	}
+
+	void rel32(Label l) {
+		this->fixups.emplace_back(this->code.size(), l);
+		this->imm32(0);
+	}
+
+public:
+	const std::vector<std::uint8_t>& getCode() const {
+		return this->code;
+	}
+
+	Label newLabel();
+	void bind(Label l);
+
+	/// Resolve every jump, once all labels are bound.
+	void finish();
+
+	void push(Reg r);
+	void pop(Reg r);
+	void ret();
+
+	void movImm(Reg dst, std::uint64_t imm);
+	void mov(Reg dst, Reg src);
+	void load(Reg dst, Reg base, std::int32_t disp);
+	/// dst = fs:[disp], a thread-local variable
+	void loadFs(Reg dst, std::int32_t disp);
+	void loadByte(Reg dst, Reg base, std::int32_t disp);
+	void store(Reg base, std::int32_t disp, Reg src);
+	void lea(Reg dst, Reg base, std::int32_t disp);
+
+	// dst = dst op src
+	void add(Reg dst, Reg src);
+	void sub(Reg dst, Reg src);
+	void imul(Reg dst, Reg src);
+	void and_(Reg dst, Reg src);
+	void or_(Reg dst, Reg src);
+	void xor_(Reg dst, Reg src);
+	void cmp(Reg a, Reg b);
+	void test(Reg a, Reg b);
+	void testByte(Reg r);
+	void not_(Reg r);
+	void neg(Reg r);
+
+	// rdx:rax / r, remainder in rdx
+	void cqo();
+	void idiv(Reg r);
+
+	void addRsp(std::int32_t n);
+	void subRsp(std::int32_t n);
+
+	/// dst = cond ? 1 : 0
+	void setcc(Cond cc, Reg dst);
+
+	void jcc(Cond cc, Label l);
+	void jmp(Label l);
+	void call(Reg target);
+
+	// SSE2, registers are xmm0 - xmm15
+	void movqToXmm(Reg xmm, Reg src);
+	void movqFromXmm(Reg dst, Reg xmm);
+	void movapd(Reg dst, Reg src);
+	void addsd(Reg dst, Reg src);
+	void subsd(Reg dst, Reg src);
+	void mulsd(Reg dst, Reg src);
+	void divsd(Reg dst, Reg src);
+	void ucomisd(Reg a, Reg b);
+	void cvtsi2sd(Reg xmm, Reg src);
+};
+
+/// Jit - Executable memory for compiled functions.
+///
+/// Code is copied into pages of its own that are made read-only and
+/// executable. Each function is also listed in /tmp/perf-<pid>.map, so
+/// that perf can name it in profiles. Futures may install code at the same
+/// time, so the list and the map file are kept under a lock. Drivers
+/// running in the same process each have a Jit, which append to the map.
+class Jit {
+private:
+	std::mutex lock;
+
+	std::vector<std::pair<void*, std::size_t>> pages;
+
+	std::FILE* perfMap = nullptr;
+
+public:
+	/// Calls or loop iterations after which a specialization is compiled to
+	/// native code.
+	static constexpr std::uint32_t HOT_CALLS = 1000;
+
+	Jit() = default;
+
+	Jit(const Jit&) = delete;
+
+	Jit& operator=(const Jit&) = delete;
+
+	~Jit();
+
+	/// Returns the address of the installed code, or nullptr on failure.
+	void* install(const std::vector<std::uint8_t>& code, const std::string& name);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_JIT_H__
@@ -0,0 +1,101 @@
+#include <functional>
+#include <string>
+
+#include "MemoCache.h"
+#include "Scheduler.h"
+
+namespace DragonLisp {
+
+namespace {
+
+bool same(const Value& l, const Value& r) {
+	if (l.isFloat() || r.isFloat()) {
+		if (!l.isFloat() || !r.isFloat())
+			return false;
+		auto a = l.getFloat(), b = r.getFloat();
+		return std::memcmp(&a, &b, sizeof(double)) == 0;
+	}
+	return l == r;
+}
+
+} // namespace
+
+bool MemoCache::Key::operator==(const Key& rhs) const {
+	if (this->hash != rhs.hash || this->args.size() != rhs.args.size())
+		return false;
+	for (std::size_t i = 0; i < this->args.size(); i++)
+		if (!same(this->args[i], rhs.args[i]))
+			return false;
+	return true;
+}
+
+bool MemoCache::makeKey(Context* frame, const std::vector<std::uint32_t>& argSlots, Key& key) {
+	key.args.clear();
+	key.hash = argSlots.size();
+	for (auto s : argSlots) {
+		const auto& v = frame->getSlot({ 0, s });
+		std::size_t h;
+		switch (v.getType()) {
+			case TYPE_INTEGER:
+				h = std::hash<std::int64_t>()(v.getInt());
+				break;
+			case TYPE_FLOAT: {
+				auto d = v.getFloat();
+				std::uint64_t bits;
+				std::memcpy(&bits, &d, sizeof(bits));
+				h = std::hash<std::uint64_t>()(bits) ^ 0x9E3779B97F4A7C15ull;
+				break;
+			}
+			case TYPE_STRING:
+				h = std::hash<std::string>()(v.getString());
+				break;
+			case TYPE_ARRAY:
+			case TYPE_FUTURE:
+			case TYPE_CHANNEL:
+				return false;
+			default:
+				h = v.isT();
+				break;
+		}
+		key.hash ^= h + 0x9E3779B97F4A7C15ull + (key.hash << 6) + (key.hash >> 2);
+		key.args.push_back(v.copy());
+	}
+	return true;
+}
+
+bool MemoCache::find(const Key& key, Value& ret) {
+	std::unique_lock<std::mutex> guard(this->lock, std::defer_lock);
+	if (Scheduler::isStarted())
+		guard.lock();
+	auto it = this->index.find(key);
+	if (it == this->index.end()) {
+		this->misses++;
+		return false;
+	}
+	this->hits++;
+	this->entries.splice(this->entries.begin(), this->entries, it->second);
+	ret = it->second->value;
+	return true;
+}
+
+void MemoCache::insert(Key key, Value value) {
+	std::unique_lock<std::mutex> guard(this->lock, std::defer_lock);
+	if (Scheduler::isStarted())
+		guard.lock();
+	auto [it, fresh] = this->index.try_emplace(std::move(key));
+	if (!fresh) {
+		it->second->value = std::move(value);
+		this->entries.splice(this->entries.begin(), this->entries, it->second);
+		return;
+	}
+	this->entries.push_front({ &it->first, std::move(value) });
+	it->second = this->entries.begin();
+
+	if (this->index.size() > this->capacity) {
+		this->index.erase(*this->entries.back().key);
+		this->entries.pop_back();
+		this->evictions++;
+	}
+}
+
+} // namespace DragonLisp
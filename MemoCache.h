@@ -0,0 +1,100 @@
+#ifndef __DRAGON_LISP_MEMO_CACHE_H__
+#define __DRAGON_LISP_MEMO_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "context.h"
+
+namespace DragonLisp {
+
+/// MemoCache - Results of a function declared with (declaim (memoize f)),
+/// by arguments.
+///
+/// Integers, floats, strings, T and NIL are keys; a call with an array
+/// argument is not cached. Floats match by their bits, so 0.0 and -0.0 are
+/// different arguments. At most `capacity` results are kept, the least
+/// recently used one being evicted first. Futures may share a cache, so
+/// lookups and inserts take a lock once the Scheduler has started.
+class MemoCache {
+public:
+	/// Key - Arguments of a call, with their hash.
+	struct Key {
+		std::vector<Value> args;
+		std::size_t hash = 0;
+
+		bool operator==(const Key& rhs) const;
+	};
+
+	/// Results kept unless a size is declared.
+	static constexpr std::size_t DEFAULT_CAPACITY = 64 * 1024;
+
+private:
+	struct KeyHash {
+		std::size_t operator()(const Key& k) const {
+			return k.hash;
+		}
+	};
+
+	struct Entry {
+		const Key* key;
+		Value value;
+	};
+
+	std::size_t capacity;
+
+	std::mutex lock;
+
+	// Most recently used first, keys are owned by the index
+	std::list<Entry> entries;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+
+	std::uint64_t hits = 0;
+	std::uint64_t misses = 0;
+	std::uint64_t evictions = 0;
+
+public:
+	explicit MemoCache(std::size_t capacity = DEFAULT_CAPACITY) : capacity(capacity ? capacity : 1) {}
+
+	MemoCache(const MemoCache&) = delete;
+
+	MemoCache& operator=(const MemoCache&) = delete;
+
+	/// Key of a call whose arguments are bound in `frame`. Returns false
+	/// if an argument cannot be part of a key.
+	static bool makeKey(Context* frame, const std::vector<std::uint32_t>& argSlots, Key& key);
+
+	/// Copy the cached result to `ret` if there is one. Counts a hit or a
+	/// miss.
+	bool find(const Key& key, Value& ret);
+
+	void insert(Key key, Value value);
+
+	inline std::size_t getCapacity() const {
+		return this->capacity;
+	}
+
+	inline std::size_t getSize() const {
+		return this->index.size();
+	}
+
+	inline std::uint64_t getHits() const {
+		return this->hits;
+	}
+
+	inline std::uint64_t getMisses() const {
+		return this->misses;
+	}
+
+	inline std::uint64_t getEvictions() const {
+		return this->evictions;
+	}
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_MEMO_CACHE_H__
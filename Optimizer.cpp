@@ -0,0 +1,934 @@
+#include <bit>
+#include <limits>
+#include <stdexcept>
+
+#include "Optimizer.h"
+#include "ArrayOps.h"
+#include "Channel.h"
+
+namespace DragonLisp {
+
+// Only immutable values are folded, arrays and strings are objects that
+// every evaluation must see fresh.
+bool Optimizer::isConstant(const ExprAST* expr) {
+	if (!expr || expr->getType() != T_LiteralAST)
+		return false;
+	const auto& v = static_cast<const LiteralAST*>(expr)->getValue();
+	return v.isNumber() || v.isT() || v.isNil();
+}
+
+void Optimizer::foldBody(std::vector<ExprAST*>& body) {
+	for (auto it = body.begin(); it != body.end();) {
+		if ((*it)->getType() != T_IfAST) {
+			*it = this->fold(*it);
+			++it;
+			continue;
+		}
+
+		auto ast = static_cast<IfAST*>(*it);
+		ast->setCond(this->fold(ast->getCond()));
+		ast->setThen(this->fold(ast->getThen()));
+		ast->setElse(this->fold(ast->getElse()));
+		if (!Optimizer::isConstant(ast->getCond())) {
+			++it;
+			continue;
+		}
+
+		// A statement-level if runs the branch it takes as a statement,
+		// except a nested if, which only works in that position
+		auto taken = IfAST::isTrue(static_cast<LiteralAST*>(ast->getCond())->getValue()) ? ast->getThen() : ast->getElse();
+		if (!taken)
+			it = body.erase(it);
+		else if (taken->getType() != T_IfAST)
+			*it++ = taken;
+		else
+			++it;
+	}
+}
+
+ExprAST* Optimizer::fold(ExprAST* expr) {
+	if (!expr)
+		return expr;
+
+	switch (expr->getType()) {
+		case T_IdentifierAST: {
+			auto ast = static_cast<IdentifierAST*>(expr);
+			if (!ast->getRef().slots.empty())
+				return expr;
+			auto c = this->globals->getConstant(ast->getName());
+			if (!c || !(c->isNumber() || c->isT() || c->isNil()))
+				return expr;
+			return this->arena->make<LiteralAST>(*c);
+		}
+
+		case T_ArrayRefAST: {
+			auto ast = static_cast<ArrayRefAST*>(expr);
+			ast->setIndex(this->fold(ast->getIndex()));
+			return expr;
+		}
+
+		case T_FuncCallAST:
+			for (auto& a : static_cast<FuncCallAST*>(expr)->getArgs())
+				a = this->fold(a);
+			return expr;
+
+		case T_IfAST: {
+			// Outside of a body an if is never run, leave it alone
+			auto ast = static_cast<IfAST*>(expr);
+			ast->setCond(this->fold(ast->getCond()));
+			ast->setThen(this->fold(ast->getThen()));
+			ast->setElse(this->fold(ast->getElse()));
+			return expr;
+		}
+
+		case T_LoopForeverAST:
+			this->foldBody(static_cast<LoopForeverAST*>(expr)->getBody());
+			return expr;
+
+		case T_LoopForAST: {
+			auto ast = static_cast<LoopForAST*>(expr);
+			ast->setStart(this->fold(ast->getStart()));
+			ast->setEnd(this->fold(ast->getEnd()));
+			this->foldBody(ast->getBody());
+			return expr;
+		}
+
+		case T_LoopDoTimesAST: {
+			auto ast = static_cast<LoopDoTimesAST*>(expr);
+			ast->setTimes(this->fold(ast->getTimes()));
+			this->foldBody(ast->getBody());
+			return expr;
+		}
+
+		case T_UnaryAST: {
+			auto ast = static_cast<UnaryAST*>(expr);
+			ast->setExpr(this->fold(ast->getExpr()));
+			if (ast->getOp() != NOT || !Optimizer::isConstant(ast->getExpr()))
+				return expr;
+			return this->arena->make<LiteralAST>(UnaryAST::apply(NOT, static_cast<LiteralAST*>(ast->getExpr())->getValue(), this->globals));
+		}
+
+		case T_BinaryAST: {
+			auto ast = static_cast<BinaryAST*>(expr);
+			ast->setLHS(this->fold(ast->getLHS()));
+			ast->setRHS(this->fold(ast->getRHS()));
+			if (!Optimizer::isConstant(ast->getLHS()) || !Optimizer::isConstant(ast->getRHS()))
+				return expr;
+			try {
+				return this->arena->make<LiteralAST>(BinaryAST::apply(
+					ast->getOp(),
+					static_cast<LiteralAST*>(ast->getLHS())->getValue(),
+					static_cast<LiteralAST*>(ast->getRHS())->getValue()
+				));
+			} catch (const std::runtime_error&) {
+				return expr;
+			}
+		}
+
+		case T_ListAST: {
+			auto ast = static_cast<ListAST*>(expr);
+			bool constant = !ArrayOps::handles(ast->getOp()) && !Channel::handles(ast->getOp());
+			for (auto& e : ast->getExprs()) {
+				e = this->fold(e);
+				constant = constant && Optimizer::isConstant(e);
+			}
+			if (!constant)
+				return expr;
+			std::vector<Value> vals;
+			for (const auto& e : ast->getExprs())
+				vals.push_back(static_cast<LiteralAST*>(e)->getValue());
+			try {
+				return this->arena->make<LiteralAST>(ListAST::apply(ast->getOp(), vals));
+			} catch (const std::runtime_error&) {
+				return expr;
+			}
+		}
+
+		case T_VarOpAST: {
+			auto ast = static_cast<VarOpAST*>(expr);
+			ast->setExpr(this->fold(ast->getExpr()));
+			return expr;
+		}
+
+		case T_LValOpAST: {
+			auto ast = static_cast<LValOpAST*>(expr);
+			if (ast->getLVal()->getType() == T_ArrayRefAST)
+				this->fold(ast->getLVal());
+			ast->setExpr(this->fold(ast->getExpr()));
+			return expr;
+		}
+
+		case T_FutureAST: {
+			auto ast = static_cast<FutureAST*>(expr);
+			ast->setExpr(this->fold(ast->getExpr()));
+			return expr;
+		}
+
+		case T_ReturnAST: {
+			auto ast = static_cast<ReturnAST*>(expr);
+			ast->setExpr(this->fold(ast->getExpr()));
+			return expr;
+		}
+
+		default:
+			return expr;
+	}
+}
+
+// Size of an expression that can be copied into a caller, or the maximum
+// size_t if it cannot be.
+std::size_t Optimizer::inlineCost(const ExprAST* expr, const FuncDefAST* callee) {
+	constexpr auto NEVER = std::numeric_limits<std::size_t>::max();
+	std::size_t ret = 1;
+
+	auto add = [&](const ExprAST* e) {
+		auto c = Optimizer::inlineCost(e, callee);
+		ret = c == NEVER || ret == NEVER ? NEVER : ret + c;
+	};
+
+	switch (expr->getType()) {
+		case T_LiteralAST:
+			return ret;
+
+		case T_IdentifierAST: {
+			// Only parameters live in the callee's frame
+			const auto& slots = static_cast<const IdentifierAST*>(expr)->getRef().slots;
+			return slots.empty() ? ret : slots.size() == 1 && slots.front().depth == 0 ? ret : NEVER;
+		}
+
+		case T_ArrayRefAST: {
+			auto ast = static_cast<const ArrayRefAST*>(expr);
+			const auto& slots = ast->getRef().slots;
+			if (!slots.empty() && (slots.size() != 1 || slots.front().depth))
+				return NEVER;
+			add(ast->getIndex());
+			return ret;
+		}
+
+		case T_FuncCallAST: {
+			auto ast = static_cast<const FuncCallAST*>(expr);
+			if (ast->getName() == callee->getName())
+				return NEVER;
+			for (const auto& a : ast->getArgs())
+				add(a);
+			return ret;
+		}
+
+		case T_UnaryAST:
+			add(static_cast<const UnaryAST*>(expr)->getExpr());
+			return ret;
+
+		case T_BinaryAST:
+			add(static_cast<const BinaryAST*>(expr)->getLHS());
+			add(static_cast<const BinaryAST*>(expr)->getRHS());
+			return ret;
+
+		case T_ListAST:
+			for (const auto& e : static_cast<const ListAST*>(expr)->getExprs())
+				add(e);
+			return ret;
+
+		case T_CachedAST:
+			return Optimizer::inlineCost(static_cast<const CachedAST*>(expr)->getExpr(), callee);
+
+		default:
+			return NEVER;
+	}
+}
+
+// The expression a call to `callee` evaluates to, if it can be inlined.
+const ExprAST* Optimizer::inlineBody(const FuncDefAST* callee) {
+	if (callee->getBody().size() != 1 || callee->getMemo())
+		return nullptr;
+	const ExprAST* expr = callee->getBody().front();
+	if (expr->getType() == T_ReturnAST) {
+		auto ret = static_cast<const ReturnAST*>(expr);
+		if (ret->getName() != callee->getName())
+			return nullptr;
+		expr = ret->getExpr();
+	}
+	if (Optimizer::inlineCost(expr, callee) > Optimizer::INLINE_BUDGET)
+		return nullptr;
+	return expr;
+}
+
+// Copy an inlinable body, moving reads of parameters to the caller's slots.
+ExprAST* Optimizer::clone(const ExprAST* expr, const std::vector<std::uint32_t>& temps) {
+	auto move = [&](VarRef ref) {
+		for (auto& s : ref.slots)
+			s.index = temps[s.index];
+		return ref;
+	};
+
+	switch (expr->getType()) {
+		case T_IdentifierAST: {
+			auto ast = static_cast<const IdentifierAST*>(expr);
+			auto ret = this->arena->make<IdentifierAST>(ast->getName());
+			ret->setRef(move(ast->getRef()));
+			return ret;
+		}
+
+		case T_ArrayRefAST: {
+			auto ast = static_cast<const ArrayRefAST*>(expr);
+			auto ret = this->arena->make<ArrayRefAST>(ast->getName(), this->clone(ast->getIndex(), temps));
+			ret->setRef(move(ast->getRef()));
+			return ret;
+		}
+
+		case T_FuncCallAST: {
+			auto ast = static_cast<const FuncCallAST*>(expr);
+			std::vector<ExprAST*> args;
+			for (const auto& a : ast->getArgs())
+				args.push_back(this->clone(a, temps));
+			return this->arena->make<FuncCallAST>(ast->getName(), std::move(args));
+		}
+
+		case T_UnaryAST: {
+			auto ast = static_cast<const UnaryAST*>(expr);
+			return this->arena->make<UnaryAST>(this->clone(ast->getExpr(), temps), ast->getOp());
+		}
+
+		case T_BinaryAST: {
+			auto ast = static_cast<const BinaryAST*>(expr);
+			return this->arena->make<BinaryAST>(this->clone(ast->getLHS(), temps), this->clone(ast->getRHS(), temps), ast->getOp());
+		}
+
+		case T_ListAST: {
+			auto ast = static_cast<const ListAST*>(expr);
+			std::vector<ExprAST*> exprs;
+			for (const auto& e : ast->getExprs())
+				exprs.push_back(this->clone(e, temps));
+			return this->arena->make<ListAST>(std::move(exprs), ast->getOp());
+		}
+
+		case T_CachedAST:
+			return this->clone(static_cast<const CachedAST*>(expr)->getExpr(), temps);
+
+		default:
+			// Literals are never modified and can be shared
+			return const_cast<ExprAST*>(expr);
+	}
+}
+
+void Optimizer::inlineCalls(std::vector<ExprAST*>& body, std::uint32_t* slots) {
+	for (auto& stmt : body)
+		stmt = this->inlineCalls(stmt, slots);
+}
+
+ExprAST* Optimizer::inlineCalls(ExprAST* expr, std::uint32_t* slots) {
+	if (!expr)
+		return expr;
+
+	switch (expr->getType()) {
+		case T_ArrayRefAST: {
+			auto ast = static_cast<ArrayRefAST*>(expr);
+			ast->setIndex(this->inlineCalls(ast->getIndex(), slots));
+			return expr;
+		}
+
+		case T_FuncCallAST: {
+			auto ast = static_cast<FuncCallAST*>(expr);
+			this->inlineCalls(ast->getArgs(), slots);
+			auto callee = this->globals->getFunc(ast->getName());
+			if (!slots || !callee)
+				return expr;
+			auto body = Optimizer::inlineBody(callee);
+			if (!body)
+				return expr;
+
+			// Parameters sharing a name share a slot, and so a temporary
+			std::vector<std::uint32_t> temps(callee->getSlots());
+			std::vector<bool> taken(callee->getSlots());
+			std::vector<VarSlot> params;
+			for (auto s : callee->getArgSlots()) {
+				if (!taken[s]) {
+					temps[s] = (*slots)++;
+					taken[s] = true;
+				}
+				params.push_back({ 0, temps[s] });
+			}
+			return this->arena->make<InlineCallAST>(ast, callee, this->clone(body, temps), std::move(params));
+		}
+
+		case T_IfAST: {
+			auto ast = static_cast<IfAST*>(expr);
+			ast->setCond(this->inlineCalls(ast->getCond(), slots));
+			ast->setThen(this->inlineCalls(ast->getThen(), slots));
+			ast->setElse(this->inlineCalls(ast->getElse(), slots));
+			return expr;
+		}
+
+		case T_LoopForeverAST:
+			this->inlineCalls(static_cast<LoopForeverAST*>(expr)->getBody(), slots);
+			return expr;
+
+		case T_LoopForAST: {
+			auto ast = static_cast<LoopForAST*>(expr);
+			ast->setStart(this->inlineCalls(ast->getStart(), slots));
+			ast->setEnd(this->inlineCalls(ast->getEnd(), slots));
+			std::uint32_t n = ast->getSlots();
+			this->inlineCalls(ast->getBody(), &n);
+			ast->setSlots(n);
+			return expr;
+		}
+
+		case T_LoopDoTimesAST: {
+			auto ast = static_cast<LoopDoTimesAST*>(expr);
+			ast->setTimes(this->inlineCalls(ast->getTimes(), slots));
+			std::uint32_t n = ast->getSlots();
+			this->inlineCalls(ast->getBody(), &n);
+			ast->setSlots(n);
+			return expr;
+		}
+
+		case T_UnaryAST: {
+			auto ast = static_cast<UnaryAST*>(expr);
+			ast->setExpr(this->inlineCalls(ast->getExpr(), slots));
+			return expr;
+		}
+
+		case T_BinaryAST: {
+			auto ast = static_cast<BinaryAST*>(expr);
+			ast->setLHS(this->inlineCalls(ast->getLHS(), slots));
+			ast->setRHS(this->inlineCalls(ast->getRHS(), slots));
+			return expr;
+		}
+
+		case T_ListAST:
+			this->inlineCalls(static_cast<ListAST*>(expr)->getExprs(), slots);
+			return expr;
+
+		case T_VarOpAST: {
+			auto ast = static_cast<VarOpAST*>(expr);
+			ast->setExpr(this->inlineCalls(ast->getExpr(), slots));
+			return expr;
+		}
+
+		case T_LValOpAST: {
+			auto ast = static_cast<LValOpAST*>(expr);
+			if (ast->getLVal()->getType() == T_ArrayRefAST)
+				this->inlineCalls(ast->getLVal(), slots);
+			ast->setExpr(this->inlineCalls(ast->getExpr(), slots));
+			return expr;
+		}
+
+		case T_ReturnAST: {
+			auto ast = static_cast<ReturnAST*>(expr);
+			ast->setExpr(this->inlineCalls(ast->getExpr(), slots));
+			return expr;
+		}
+
+		case T_FutureAST: {
+			// Temporaries live in the frame of the future
+			auto ast = static_cast<FutureAST*>(expr);
+			std::uint32_t n = ast->getSlots();
+			ast->setExpr(this->inlineCalls(ast->getExpr(), &n));
+			ast->setSlots(n);
+			return expr;
+		}
+
+		default:
+			return expr;
+	}
+}
+
+void Optimizer::effects(const ExprAST* expr, Effects& fx) {
+	if (!expr)
+		return;
+
+	switch (expr->getType()) {
+		case T_ArrayRefAST:
+			Optimizer::effects(static_cast<const ArrayRefAST*>(expr)->getIndex(), fx);
+			return;
+
+		case T_FuncCallAST:
+			fx.calls = true;
+			for (const auto& a : static_cast<const FuncCallAST*>(expr)->getArgs())
+				Optimizer::effects(a, fx);
+			return;
+
+		case T_InlineCallAST:
+			Optimizer::effects(static_cast<const InlineCallAST*>(expr)->getCall(), fx);
+			return;
+
+		case T_IfAST: {
+			auto ast = static_cast<const IfAST*>(expr);
+			Optimizer::effects(ast->getCond(), fx);
+			Optimizer::effects(ast->getThen(), fx);
+			Optimizer::effects(ast->getElse(), fx);
+			return;
+		}
+
+		case T_LoopForeverAST:
+			for (const auto& stmt : static_cast<const LoopForeverAST*>(expr)->getBody())
+				Optimizer::effects(stmt, fx);
+			return;
+
+		case T_LoopForAST: {
+			auto ast = static_cast<const LoopForAST*>(expr);
+			fx.writes.insert(ast->getName());
+			Optimizer::effects(ast->getStart(), fx);
+			Optimizer::effects(ast->getEnd(), fx);
+			for (const auto& stmt : ast->getBody())
+				Optimizer::effects(stmt, fx);
+			return;
+		}
+
+		case T_LoopDoTimesAST: {
+			auto ast = static_cast<const LoopDoTimesAST*>(expr);
+			fx.writes.insert(ast->getName());
+			Optimizer::effects(ast->getTimes(), fx);
+			for (const auto& stmt : ast->getBody())
+				Optimizer::effects(stmt, fx);
+			return;
+		}
+
+		case T_UnaryAST:
+			Optimizer::effects(static_cast<const UnaryAST*>(expr)->getExpr(), fx);
+			return;
+
+		case T_BinaryAST: {
+			auto ast = static_cast<const BinaryAST*>(expr);
+			Optimizer::effects(ast->getLHS(), fx);
+			Optimizer::effects(ast->getRHS(), fx);
+			return;
+		}
+
+		case T_ListAST:
+			for (const auto& e : static_cast<const ListAST*>(expr)->getExprs())
+				Optimizer::effects(e, fx);
+			return;
+
+		case T_VarOpAST: {
+			auto ast = static_cast<const VarOpAST*>(expr);
+			fx.writes.insert(ast->getName());
+			Optimizer::effects(ast->getExpr(), fx);
+			return;
+		}
+
+		case T_LValOpAST: {
+			auto ast = static_cast<const LValOpAST*>(expr);
+			auto lval = ast->getLVal();
+			if (lval->getType() == T_IdentifierAST)
+				fx.writes.insert(static_cast<const IdentifierAST*>(lval)->getName());
+			else {
+				fx.writes.insert(static_cast<const ArrayRefAST*>(lval)->getName());
+				Optimizer::effects(static_cast<const ArrayRefAST*>(lval)->getIndex(), fx);
+			}
+			Optimizer::effects(ast->getExpr(), fx);
+			return;
+		}
+
+		case T_ReturnAST:
+			Optimizer::effects(static_cast<const ReturnAST*>(expr)->getExpr(), fx);
+			return;
+
+		case T_CachedAST:
+			Optimizer::effects(static_cast<const CachedAST*>(expr)->getExpr(), fx);
+			return;
+
+		default:
+			return;
+	}
+}
+
+// Whether evaluating the expression has no effect besides its value or an
+// error. Operators that return a new array are left out as well.
+bool Optimizer::isPure(const ExprAST* expr) {
+	switch (expr->getType()) {
+		case T_LiteralAST:
+		case T_IdentifierAST:
+		case T_CachedAST:
+			return true;
+
+		case T_ArrayRefAST:
+			return Optimizer::isPure(static_cast<const ArrayRefAST*>(expr)->getIndex());
+
+		case T_UnaryAST: {
+			auto ast = static_cast<const UnaryAST*>(expr);
+			return ast->getOp() == NOT && Optimizer::isPure(ast->getExpr());
+		}
+
+		case T_BinaryAST: {
+			auto ast = static_cast<const BinaryAST*>(expr);
+			return Optimizer::isPure(ast->getLHS()) && Optimizer::isPure(ast->getRHS());
+		}
+
+		case T_ListAST: {
+			auto ast = static_cast<const ListAST*>(expr);
+			switch (ast->getOp()) {
+				case ARRAY_ADD:
+				case ARRAY_MUL:
+				case ARRAY_SCALE:
+				case ARRAY_FILL:
+				case MAKE_CHANNEL:
+				case CHANNEL_SEND:
+				case CHANNEL_RECV:
+				case CHANNEL_CLOSE:
+					return false;
+				default:;
+			}
+			for (const auto& e : ast->getExprs())
+				if (!Optimizer::isPure(e))
+					return false;
+			return true;
+		}
+
+		default:
+			return false;
+	}
+}
+
+// Whether a pure expression reads anything the effects may modify.
+bool Optimizer::isClobbered(const ExprAST* expr, const Effects& fx) {
+	switch (expr->getType()) {
+		case T_IdentifierAST: {
+			auto ast = static_cast<const IdentifierAST*>(expr);
+			return fx.writes.contains(ast->getName()) || (fx.calls && ast->getRef().global);
+		}
+
+		case T_ArrayRefAST: {
+			auto ast = static_cast<const ArrayRefAST*>(expr);
+			if (fx.writes.contains(ast->getName()) || (fx.calls && ast->getRef().global))
+				return true;
+			return Optimizer::isClobbered(ast->getIndex(), fx);
+		}
+
+		case T_CachedAST:
+			return Optimizer::isClobbered(static_cast<const CachedAST*>(expr)->getExpr(), fx);
+
+		case T_UnaryAST:
+			return Optimizer::isClobbered(static_cast<const UnaryAST*>(expr)->getExpr(), fx);
+
+		case T_BinaryAST: {
+			auto ast = static_cast<const BinaryAST*>(expr);
+			return Optimizer::isClobbered(ast->getLHS(), fx) || Optimizer::isClobbered(ast->getRHS(), fx);
+		}
+
+		case T_ListAST:
+			for (const auto& e : static_cast<const ListAST*>(expr)->getExprs())
+				if (Optimizer::isClobbered(e, fx))
+					return true;
+			return false;
+
+		default:
+			return false;
+	}
+}
+
+// Structural key of a pure expression, equal keys give equal values.
+std::string Optimizer::key(const ExprAST* expr) {
+	switch (expr->getType()) {
+		case T_LiteralAST: {
+			const auto& v = static_cast<const LiteralAST*>(expr)->getValue();
+			if (v.isInt())
+				return "#i" + std::to_string(v.getInt());
+			if (v.isFloat())
+				return "#f" + std::to_string(std::bit_cast<std::uint64_t>(v.getFloat()));
+			return v.isNil() ? "#nil" : "#t";
+		}
+
+		case T_IdentifierAST:
+			return static_cast<const IdentifierAST*>(expr)->getName();
+
+		case T_CachedAST:
+			return Optimizer::key(static_cast<const CachedAST*>(expr)->getExpr());
+
+		case T_ArrayRefAST: {
+			auto ast = static_cast<const ArrayRefAST*>(expr);
+			return "(aref " + ast->getName() + " " + Optimizer::key(ast->getIndex()) + ")";
+		}
+
+		case T_UnaryAST: {
+			auto ast = static_cast<const UnaryAST*>(expr);
+			return "(u" + std::to_string(ast->getOp()) + " " + Optimizer::key(ast->getExpr()) + ")";
+		}
+
+		case T_BinaryAST: {
+			auto ast = static_cast<const BinaryAST*>(expr);
+			return "(b" + std::to_string(ast->getOp()) + " " + Optimizer::key(ast->getLHS()) + " " + Optimizer::key(ast->getRHS()) + ")";
+		}
+
+		case T_ListAST: {
+			auto ast = static_cast<const ListAST*>(expr);
+			std::string ret = "(l" + std::to_string(ast->getOp());
+			for (const auto& e : ast->getExprs())
+				ret += " " + Optimizer::key(e);
+			return ret + ")";
+		}
+
+		default:
+			throw std::runtime_error("Unexpected error");
+	}
+}
+
+void Optimizer::hoistBody(std::vector<ExprAST*>& body, Hoist& h, std::uint32_t depth) {
+	for (auto& stmt : body)
+		stmt = this->hoist(stmt, h, depth);
+}
+
+// Replace the largest cacheable subexpressions by CachedASTs on slots of
+// the frame `depth` counted loops above.
+ExprAST* Optimizer::hoist(ExprAST* expr, Hoist& h, std::uint32_t depth) {
+	if (!expr)
+		return expr;
+
+	switch (expr->getType()) {
+		case T_ArrayRefAST:
+		case T_UnaryAST:
+		case T_BinaryAST:
+		case T_ListAST: {
+			if (!Optimizer::isPure(expr) || Optimizer::isClobbered(expr, h.fx))
+				break;
+			auto k = Optimizer::key(expr);
+			if (h.counting) {
+				h.counts[k]++;
+				return expr;
+			}
+			if (h.minCount > 1 && h.counts[k] < h.minCount)
+				return expr;
+			auto it = h.cached.find(k);
+			if (it == h.cached.end())
+				it = h.cached.emplace(k, h.slots++).first;
+			return this->arena->make<CachedAST>(expr, VarSlot{ depth, it->second });
+		}
+
+		default:
+			break;
+	}
+
+	switch (expr->getType()) {
+		case T_ArrayRefAST: {
+			auto ast = static_cast<ArrayRefAST*>(expr);
+			ast->setIndex(this->hoist(ast->getIndex(), h, depth));
+			return expr;
+		}
+
+		case T_FuncCallAST:
+			this->hoistBody(static_cast<FuncCallAST*>(expr)->getArgs(), h, depth);
+			return expr;
+
+		case T_InlineCallAST:
+			// The copied body reads temporaries and is left alone
+			this->hoistBody(static_cast<InlineCallAST*>(expr)->getCall()->getArgs(), h, depth);
+			return expr;
+
+		case T_IfAST: {
+			auto ast = static_cast<IfAST*>(expr);
+			ast->setCond(this->hoist(ast->getCond(), h, depth));
+			ast->setThen(this->hoist(ast->getThen(), h, depth));
+			ast->setElse(this->hoist(ast->getElse(), h, depth));
+			return expr;
+		}
+
+		case T_LoopForeverAST:
+			this->hoistBody(static_cast<LoopForeverAST*>(expr)->getBody(), h, depth);
+			return expr;
+
+		case T_LoopForAST: {
+			auto ast = static_cast<LoopForAST*>(expr);
+			ast->setStart(this->hoist(ast->getStart(), h, depth));
+			ast->setEnd(this->hoist(ast->getEnd(), h, depth));
+			this->hoistBody(ast->getBody(), h, depth + 1);
+			return expr;
+		}
+
+		case T_LoopDoTimesAST: {
+			auto ast = static_cast<LoopDoTimesAST*>(expr);
+			ast->setTimes(this->hoist(ast->getTimes(), h, depth));
+			// Threads of a parallel body would all fill the outer slots
+			if (!ast->isParallel())
+				this->hoistBody(ast->getBody(), h, depth + 1);
+			return expr;
+		}
+
+		case T_UnaryAST: {
+			auto ast = static_cast<UnaryAST*>(expr);
+			ast->setExpr(this->hoist(ast->getExpr(), h, depth));
+			return expr;
+		}
+
+		case T_BinaryAST: {
+			auto ast = static_cast<BinaryAST*>(expr);
+			ast->setLHS(this->hoist(ast->getLHS(), h, depth));
+			ast->setRHS(this->hoist(ast->getRHS(), h, depth));
+			return expr;
+		}
+
+		case T_ListAST:
+			this->hoistBody(static_cast<ListAST*>(expr)->getExprs(), h, depth);
+			return expr;
+
+		case T_VarOpAST: {
+			auto ast = static_cast<VarOpAST*>(expr);
+			ast->setExpr(this->hoist(ast->getExpr(), h, depth));
+			return expr;
+		}
+
+		case T_LValOpAST: {
+			// The place itself is never replaced, only its index
+			auto ast = static_cast<LValOpAST*>(expr);
+			if (ast->getLVal()->getType() == T_ArrayRefAST) {
+				auto aref = static_cast<ArrayRefAST*>(ast->getLVal());
+				aref->setIndex(this->hoist(aref->getIndex(), h, depth));
+			}
+			ast->setExpr(this->hoist(ast->getExpr(), h, depth));
+			return expr;
+		}
+
+		case T_ReturnAST: {
+			auto ast = static_cast<ReturnAST*>(expr);
+			ast->setExpr(this->hoist(ast->getExpr(), h, depth));
+			return expr;
+		}
+
+		case T_FutureAST:
+			// Runs in a frame of its own, later
+			return expr;
+
+		default:
+			return expr;
+	}
+}
+
+template <typename Loop>
+void Optimizer::hoistLoop(Loop* loop) {
+	Hoist h;
+	h.slots = loop->getSlots();
+	h.fx.writes.insert(loop->getName());
+	for (const auto& stmt : loop->getBody())
+		Optimizer::effects(stmt, h.fx);
+	this->hoistBody(loop->getBody(), h, 0);
+	loop->setSlots(h.slots);
+}
+
+// Cache the invariants of every counted loop in the tree, outermost first.
+void Optimizer::hoistLoops(ExprAST* expr) {
+	if (!expr)
+		return;
+
+	switch (expr->getType()) {
+		case T_ArrayRefAST:
+			this->hoistLoops(static_cast<ArrayRefAST*>(expr)->getIndex());
+			return;
+
+		case T_FuncCallAST:
+			for (const auto& a : static_cast<FuncCallAST*>(expr)->getArgs())
+				this->hoistLoops(a);
+			return;
+
+		case T_InlineCallAST:
+			this->hoistLoops(static_cast<InlineCallAST*>(expr)->getCall());
+			return;
+
+		case T_IfAST: {
+			auto ast = static_cast<IfAST*>(expr);
+			this->hoistLoops(ast->getCond());
+			this->hoistLoops(ast->getThen());
+			this->hoistLoops(ast->getElse());
+			return;
+		}
+
+		case T_LoopForeverAST:
+			for (const auto& stmt : static_cast<LoopForeverAST*>(expr)->getBody())
+				this->hoistLoops(stmt);
+			return;
+
+		case T_LoopForAST: {
+			auto ast = static_cast<LoopForAST*>(expr);
+			this->hoistLoops(ast->getStart());
+			this->hoistLoops(ast->getEnd());
+			this->hoistLoop(ast);
+			for (const auto& stmt : ast->getBody())
+				this->hoistLoops(stmt);
+			return;
+		}
+
+		case T_LoopDoTimesAST: {
+			auto ast = static_cast<LoopDoTimesAST*>(expr);
+			this->hoistLoops(ast->getTimes());
+			this->hoistLoop(ast);
+			for (const auto& stmt : ast->getBody())
+				this->hoistLoops(stmt);
+			return;
+		}
+
+		case T_UnaryAST:
+			this->hoistLoops(static_cast<UnaryAST*>(expr)->getExpr());
+			return;
+
+		case T_BinaryAST: {
+			auto ast = static_cast<BinaryAST*>(expr);
+			this->hoistLoops(ast->getLHS());
+			this->hoistLoops(ast->getRHS());
+			return;
+		}
+
+		case T_ListAST:
+			for (const auto& e : static_cast<ListAST*>(expr)->getExprs())
+				this->hoistLoops(e);
+			return;
+
+		case T_VarOpAST:
+			this->hoistLoops(static_cast<VarOpAST*>(expr)->getExpr());
+			return;
+
+		case T_LValOpAST: {
+			auto ast = static_cast<LValOpAST*>(expr);
+			this->hoistLoops(ast->getLVal());
+			this->hoistLoops(ast->getExpr());
+			return;
+		}
+
+		case T_ReturnAST:
+			this->hoistLoops(static_cast<ReturnAST*>(expr)->getExpr());
+			return;
+
+		case T_FutureAST:
+			this->hoistLoops(static_cast<FutureAST*>(expr)->getExpr());
+			return;
+
+		case T_CachedAST:
+			this->hoistLoops(static_cast<CachedAST*>(expr)->getExpr());
+			return;
+
+		default:
+			return;
+	}
+}
+
+ExprAST* Optimizer::optimize(ExprAST* expr, Arena* arena, const Context* globals) {
+	this->arena = arena;
+	this->globals = globals;
+	expr = this->fold(expr);
+	expr = this->inlineCalls(expr, nullptr);
+	this->hoistLoops(expr);
+	return expr;
+}
+
+void Optimizer::optimize(FuncDefAST* func, Arena* arena, const Context* globals) {
+	this->arena = arena;
+	this->globals = globals;
+	this->foldBody(func->getBody());
+
+	std::uint32_t slots = func->getSlots();
+	this->inlineCalls(func->getBody(), &slots);
+	func->setSlots(slots);
+
+	// Share repeated subexpressions across the whole call
+	Hoist h;
+	h.slots = func->getSlots();
+	for (const auto& stmt : func->getBody())
+		Optimizer::effects(stmt, h.fx);
+	h.counting = true;
+	this->hoistBody(func->getBody(), h, 0);
+	h.counting = false;
+	h.minCount = 2;
+	this->hoistBody(func->getBody(), h, 0);
+	func->setSlots(h.slots);
+
+	for (const auto& stmt : func->getBody())
+		this->hoistLoops(stmt);
+}
+
+} // namespace DragonLisp
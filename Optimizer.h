@@ -0,0 +1,95 @@
+#ifndef __DRAGON_LISP_OPTIMIZER_H__
+#define __DRAGON_LISP_OPTIMIZER_H__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Arena.h"
+#include "AST.h"
+
+namespace DragonLisp {
+
+/// Optimizer - Simplifies resolved ASTs before they run.
+///
+/// Pure UnaryAST, BinaryAST and ListAST subtrees whose operands are all
+/// literals or global constants are replaced by a literal of their value,
+/// and an IfAST statement whose condition folds is replaced by the branch it
+/// takes. Subtrees that would raise an error are left for the engine to
+/// report at runtime.
+///
+/// Pure subexpressions that a counted loop body cannot change are then
+/// cached in a slot of the loop's frame, and pure subexpressions repeated
+/// in a function body that it cannot change share a slot of the function's
+/// frame. Cached values are computed on first use (see CachedAST).
+///
+/// Before that, calls inside function and counted loop bodies to a function
+/// already defined whose body is one small expression without assignments,
+/// loops or calls to itself are replaced by an InlineCallAST.
+class Optimizer {
+private:
+	// Holds the nodes created by the passes
+	Arena* arena = nullptr;
+
+	const Context* globals = nullptr;
+
+	static bool isConstant(const ExprAST* expr);
+
+	ExprAST* fold(ExprAST* expr);
+	void foldBody(std::vector<ExprAST*>& body);
+
+	// Largest callee body that is inlined, in nodes
+	static constexpr std::size_t INLINE_BUDGET = 24;
+
+	static std::size_t inlineCost(const ExprAST* expr, const FuncDefAST* callee);
+	static const ExprAST* inlineBody(const FuncDefAST* callee);
+	ExprAST* clone(const ExprAST* expr, const std::vector<std::uint32_t>& temps);
+
+	// `slots` counts the slots of the innermost frame, null at top level
+	ExprAST* inlineCalls(ExprAST* expr, std::uint32_t* slots);
+	void inlineCalls(std::vector<ExprAST*>& body, std::uint32_t* slots);
+
+	// Variables a piece of code may modify, array contents included
+	struct Effects {
+		std::unordered_set<std::string> writes;
+
+		// Called functions may modify the contents of global arrays
+		bool calls = false;
+	};
+
+	// One caching walk over the body of a frame
+	struct Hoist {
+		Effects fx;
+		std::uint32_t slots;
+		std::unordered_map<std::string, std::uint32_t> cached;
+
+		// Function bodies first count occurrences, then cache the repeated ones
+		bool counting = false;
+		std::uint32_t minCount = 1;
+		std::unordered_map<std::string, std::uint32_t> counts;
+	};
+
+	static void effects(const ExprAST* expr, Effects& fx);
+	static bool isPure(const ExprAST* expr);
+	static bool isClobbered(const ExprAST* expr, const Effects& fx);
+	static std::string key(const ExprAST* expr);
+
+	ExprAST* hoist(ExprAST* expr, Hoist& h, std::uint32_t depth);
+	void hoistBody(std::vector<ExprAST*>& body, Hoist& h, std::uint32_t depth);
+
+	template <typename Loop>
+	void hoistLoop(Loop* loop);
+	void hoistLoops(ExprAST* expr);
+
+public:
+	/// Returns the node that replaces `expr`.
+	ExprAST* optimize(ExprAST* expr, Arena* arena, const Context* globals);
+
+	void optimize(FuncDefAST* func, Arena* arena, const Context* globals);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_OPTIMIZER_H__
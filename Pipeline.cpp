@@ -0,0 +1,44 @@
+#include <utility>
+
+#include "Pipeline.h"
+
+namespace DragonLisp {
+
+void Pipeline::push(Statement s) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (this->stopped)
+		throw Stopped();
+	this->queue.push_back(s);
+	if (this->waiting)
+		this->changed.notify_one();
+}
+
+void Pipeline::report(const std::string& message) {
+	// Only read once finish() has been called
+	this->errors += message;
+}
+
+void Pipeline::finish(int ret, std::exception_ptr e) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->result = ret;
+	this->error = std::move(e);
+	this->finished = true;
+	this->changed.notify_one();
+}
+
+bool Pipeline::take(std::vector<Statement>& out) {
+	out.clear();
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->waiting = true;
+	this->changed.wait(guard, [this] { return !this->queue.empty() || this->finished; });
+	this->waiting = false;
+	out.swap(this->queue);
+	return !out.empty();
+}
+
+void Pipeline::stop() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->stopped = true;
+}
+
+} // namespace DragonLisp
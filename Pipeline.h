@@ -0,0 +1,83 @@
+#ifndef __DRAGON_LISP_PIPELINE_H__
+#define __DRAGON_LISP_PIPELINE_H__
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "AST.h"
+
+namespace DragonLisp {
+
+/// Pipeline - Top-level statements handed from the parser to evaluation.
+///
+/// The scanner and the parser run on a thread of their own, ahead of the
+/// thread evaluating what they parsed. Statements come out in the order
+/// they were parsed. How the parse ended comes out after them: its result,
+/// the syntax errors reported and any error raised by the parser, so that
+/// they surface where they would when statements run as they are parsed.
+class Pipeline {
+public:
+	using Statement = std::variant<ExprAST*, FuncDefAST*>;
+
+	/// Thrown on the parser thread once evaluation has given up.
+	struct Stopped {};
+
+private:
+	std::mutex lock;
+	std::condition_variable changed;
+	std::vector<Statement> queue;
+	bool finished = false;
+	bool stopped = false;
+
+	// Evaluation is waiting for a statement, so a push has to wake it
+	bool waiting = false;
+
+	// How the parse ended, set by finish()
+	int result = 0;
+	std::string errors;
+	std::exception_ptr error;
+
+public:
+	Pipeline() = default;
+
+	Pipeline(const Pipeline&) = delete;
+
+	Pipeline& operator=(const Pipeline&) = delete;
+
+	/// Parser thread: hand over a statement. Throws Stopped once stop() was called.
+	void push(Statement s);
+
+	/// Parser thread: a syntax error, surfaced after the statements pushed so far.
+	void report(const std::string& message);
+
+	/// Parser thread: the parse is over.
+	void finish(int ret, std::exception_ptr e);
+
+	/// Move every statement parsed so far to `out`, waiting for one if
+	/// there are none. False once the parse is over and all were taken.
+	bool take(std::vector<Statement>& out);
+
+	/// Evaluation failed, the parser thread stops at its next statement.
+	void stop();
+
+	/// After take() returned false.
+	int getResult() const {
+		return this->result;
+	}
+
+	const std::string& getErrors() const {
+		return this->errors;
+	}
+
+	std::exception_ptr getError() const {
+		return this->error;
+	}
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_PIPELINE_H__
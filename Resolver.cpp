@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "Channel.h"
+#include "Resolver.h"
+
+namespace DragonLisp {
+
+std::uint32_t Resolver::Scope::declare(const std::string& name, bool definite) {
+	auto it = this->names.find(name);
+	if (it == this->names.end())
+		it = this->names.emplace(name, Binding{ static_cast<std::uint32_t>(this->names.size()), false }).first;
+	if (definite)
+		it->second.definite = true;
+	return it->second.index;
+}
+
+void Resolver::collectBody(const std::vector<ExprAST*>& body) {
+	for (const auto& stmt : body)
+		this->collect(stmt);
+}
+
+// Declare every name that the code assigns in the innermost frame.
+// Bodies of counted loops and futures run in a frame of their own and are
+// skipped.
+void Resolver::collect(const ExprAST* expr) {
+	if (!expr)
+		return;
+
+	switch (expr->getType()) {
+		case T_ArrayRefAST:
+			this->collect(static_cast<const ArrayRefAST*>(expr)->getIndex());
+			return;
+
+		case T_FuncCallAST:
+			this->collectBody(static_cast<const FuncCallAST*>(expr)->getArgs());
+			return;
+
+		case T_IfAST: {
+			auto ast = static_cast<const IfAST*>(expr);
+			this->collect(ast->getCond());
+			this->collect(ast->getThen());
+			this->collect(ast->getElse());
+			return;
+		}
+
+		case T_LoopForeverAST:
+			this->collectBody(static_cast<const LoopForeverAST*>(expr)->getBody());
+			return;
+
+		case T_LoopForAST: {
+			auto ast = static_cast<const LoopForAST*>(expr);
+			this->collect(ast->getStart());
+			this->collect(ast->getEnd());
+			return;
+		}
+
+		case T_LoopDoTimesAST:
+			this->collect(static_cast<const LoopDoTimesAST*>(expr)->getTimes());
+			return;
+
+		case T_UnaryAST:
+			this->collect(static_cast<const UnaryAST*>(expr)->getExpr());
+			return;
+
+		case T_BinaryAST: {
+			auto ast = static_cast<const BinaryAST*>(expr);
+			this->collect(ast->getLHS());
+			this->collect(ast->getRHS());
+			return;
+		}
+
+		case T_ListAST:
+			this->collectBody(static_cast<const ListAST*>(expr)->getExprs());
+			return;
+
+		case T_VarOpAST: {
+			auto ast = static_cast<const VarOpAST*>(expr);
+			if (ast->getOp() != DEFCONSTANT && !this->globals->isConstant(ast->getName()))
+				this->scopes.back().declare(ast->getName(), false);
+			this->collect(ast->getExpr());
+			return;
+		}
+
+		case T_LValOpAST: {
+			auto ast = static_cast<const LValOpAST*>(expr);
+			auto lval = ast->getLVal();
+			if (lval->getType() == T_IdentifierAST) {
+				const auto& name = static_cast<const IdentifierAST*>(lval)->getName();
+				if (!this->globals->isConstant(name))
+					this->scopes.back().declare(name, false);
+			} else
+				this->collect(lval);
+			this->collect(ast->getExpr());
+			return;
+		}
+
+		case T_ReturnAST:
+			this->collect(static_cast<const ReturnAST*>(expr)->getExpr());
+			return;
+
+		default:
+			return;
+	}
+}
+
+VarRef Resolver::lookup(const std::string& name) {
+	return this->lookup(name, this->scopes.size());
+}
+
+// Look a name up in the outermost `n` scopes. Past the frame of a future
+// only globals are reachable, so a name bound further out is captured.
+VarRef Resolver::lookup(const std::string& name, std::size_t n) {
+	VarRef ref;
+	std::uint32_t depth = 0;
+	for (auto i = n; i--; depth++) {
+		auto& scope = this->scopes[i];
+		auto b = scope.names.find(name);
+		if (b == scope.names.end() && scope.future) {
+			auto outer = this->lookup(name, i);
+			if (!outer.slots.empty()) {
+				auto index = scope.declare(name, false);
+				scope.captures.push_back({ name, std::move(outer), index });
+				b = scope.names.find(name);
+			}
+		}
+		if (b == scope.names.end()) {
+			if (scope.future)
+				break;
+			continue;
+		}
+		if (scope.loop && b->second.index == 0)
+			scope.varRead = true;
+		ref.slots.push_back({ depth, b->second.index });
+		if (b->second.definite) {
+			ref.global = false;
+			break;
+		}
+		if (scope.future)
+			break;
+	}
+	return ref;
+}
+
+VarRef Resolver::store(const std::string& name) const {
+	// Assignments always target the innermost frame
+	VarRef ref;
+	if (this->scopes.empty() || this->globals->isConstant(name))
+		return ref;
+	auto b = this->scopes.back().names.find(name);
+	if (b == this->scopes.back().names.end())
+		throw std::runtime_error("Unexpected error");
+	ref.slots.push_back({ 0, b->second.index });
+	ref.global = false;
+	return ref;
+}
+
+void Resolver::resolveBody(const std::vector<ExprAST*>& body) {
+	for (const auto& stmt : body)
+		this->resolveExpr(stmt);
+}
+
+std::uint32_t Resolver::resolveLoop(const std::string& var, const std::vector<ExprAST*>& body, bool& varRead) {
+	this->scopes.emplace_back();
+	this->scopes.back().loop = true;
+	this->scopes.back().declare(var, true);
+	this->collectBody(body);
+	this->resolveBody(body);
+	varRead = this->scopes.back().varRead;
+	std::uint32_t slots = this->scopes.back().names.size();
+	this->scopes.pop_back();
+	return slots;
+}
+
+void Resolver::resolveExpr(ExprAST* expr) {
+	if (!expr)
+		return;
+
+	switch (expr->getType()) {
+		case T_ArrayRefAST: {
+			auto ast = static_cast<ArrayRefAST*>(expr);
+			this->resolveExpr(ast->getIndex());
+			ast->setRef(this->lookup(ast->getName()));
+			return;
+		}
+
+		case T_IdentifierAST: {
+			auto ast = static_cast<IdentifierAST*>(expr);
+			ast->setRef(this->lookup(ast->getName()));
+			return;
+		}
+
+		case T_FuncCallAST:
+			this->resolveBody(static_cast<FuncCallAST*>(expr)->getArgs());
+			return;
+
+		case T_IfAST: {
+			auto ast = static_cast<IfAST*>(expr);
+			this->resolveExpr(ast->getCond());
+			this->resolveExpr(ast->getThen());
+			this->resolveExpr(ast->getElse());
+			return;
+		}
+
+		case T_LoopForeverAST:
+			this->resolveBody(static_cast<LoopForeverAST*>(expr)->getBody());
+			return;
+
+		case T_LoopForAST: {
+			auto ast = static_cast<LoopForAST*>(expr);
+			this->resolveExpr(ast->getStart());
+			this->resolveExpr(ast->getEnd());
+			bool varRead;
+			ast->setSlots(this->resolveLoop(ast->getName(), ast->getBody(), varRead));
+			ast->setVarRead(varRead);
+			return;
+		}
+
+		case T_LoopDoTimesAST: {
+			auto ast = static_cast<LoopDoTimesAST*>(expr);
+			this->resolveExpr(ast->getTimes());
+			bool varRead;
+			ast->setSlots(this->resolveLoop(ast->getName(), ast->getBody(), varRead));
+			ast->setVarRead(varRead);
+			if (ast->isParallel()) {
+				std::vector<std::string> writes;
+				for (const auto& stmt : ast->getBody())
+					Resolver::checkParallel(stmt, ast->getName(), writes, false);
+				for (const auto& stmt : ast->getBody())
+					Resolver::checkParallel(stmt, ast->getName(), writes, true);
+				std::vector<LoopDoTimesAST::Target> targets;
+				for (const auto& w : writes)
+					targets.push_back({ w, this->lookup(w) });
+				ast->setTargets(std::move(targets));
+			}
+			return;
+		}
+
+		case T_UnaryAST:
+			this->resolveExpr(static_cast<UnaryAST*>(expr)->getExpr());
+			return;
+
+		case T_BinaryAST: {
+			auto ast = static_cast<BinaryAST*>(expr);
+			this->resolveExpr(ast->getLHS());
+			this->resolveExpr(ast->getRHS());
+			return;
+		}
+
+		case T_ListAST:
+			this->resolveBody(static_cast<ListAST*>(expr)->getExprs());
+			return;
+
+		case T_VarOpAST: {
+			auto ast = static_cast<VarOpAST*>(expr);
+			ast->setRef(this->lookup(ast->getName()));
+			if (ast->getOp() != DEFCONSTANT)
+				ast->setStoreRef(this->store(ast->getName()));
+			this->resolveExpr(ast->getExpr());
+			return;
+		}
+
+		case T_LValOpAST: {
+			auto ast = static_cast<LValOpAST*>(expr);
+			auto lval = ast->getLVal();
+			this->resolveExpr(lval);
+			if (lval->getType() == T_IdentifierAST) {
+				auto id = static_cast<IdentifierAST*>(lval);
+				id->setStoreRef(this->store(id->getName()));
+			}
+			this->resolveExpr(ast->getExpr());
+			return;
+		}
+
+		case T_ReturnAST:
+			this->resolveExpr(static_cast<ReturnAST*>(expr)->getExpr());
+			return;
+
+		case T_FutureAST: {
+			auto ast = static_cast<FutureAST*>(expr);
+			this->scopes.emplace_back();
+			this->scopes.back().future = true;
+			this->collect(ast->getExpr());
+
+			// What it assigns starts out as the enclosing frames have it
+			auto n = this->scopes.size() - 1;
+			for (const auto& [name, b] : this->scopes.back().names) {
+				auto outer = this->lookup(name, n);
+				if (!outer.slots.empty())
+					this->scopes.back().captures.push_back({ name, std::move(outer), b.index });
+			}
+			this->resolveExpr(ast->getExpr());
+			ast->setSlots(this->scopes.back().names.size());
+			ast->setCaptures(std::move(this->scopes.back().captures));
+			this->scopes.pop_back();
+			return;
+		}
+
+		default:
+			return;
+	}
+}
+
+void Resolver::resolve(ExprAST* expr, const Context* globals) {
+	this->globals = globals;
+	this->scopes.clear();
+	this->resolveExpr(expr);
+}
+
+void Resolver::resolve(FuncDefAST* func, const Context* globals) {
+	this->globals = globals;
+	this->scopes.clear();
+	this->scopes.emplace_back();
+
+	std::vector<std::uint32_t> argSlots;
+	for (const auto& a : func->getArgs())
+		argSlots.push_back(this->scopes.back().declare(a, true));
+	this->collectBody(func->getBody());
+	this->resolveBody(func->getBody());
+
+	func->setSlots(this->scopes.back().names.size());
+	func->setArgSlots(std::move(argSlots));
+	this->scopes.clear();
+
+	const auto& body = func->getBody();
+	for (std::size_t i = 0; i < body.size(); i++) {
+		bool last = i + 1 == body.size();
+		if (body[i]->getType() == T_IfAST) {
+			auto ast = static_cast<IfAST*>(body[i]);
+			Resolver::markTail(func, ast->getThen(), last);
+			Resolver::markTail(func, ast->getElse(), last);
+		} else
+			Resolver::markTail(func, body[i], last);
+	}
+}
+
+void Resolver::checkParallel(const ExprAST* expr, const std::string& var, std::vector<std::string>& writes, bool written) {
+	if (!expr)
+		return;
+
+	auto isWritten = [&](const std::string& name) {
+		return written && std::find(writes.begin(), writes.end(), name) != writes.end();
+	};
+	auto isVar = [&](const ExprAST* index) {
+		return index->getType() == T_IdentifierAST && static_cast<const IdentifierAST*>(index)->getName() == var;
+	};
+	auto checkBody = [&](const std::vector<ExprAST*>& body) {
+		for (const auto& e : body)
+			Resolver::checkParallel(e, var, writes, written);
+	};
+	auto checkLoop = [&](const std::string& name) {
+		if (name == var || isWritten(name))
+			throw std::runtime_error("PDOTIMES: nested loop cannot rebind " + name);
+	};
+
+	switch (expr->getType()) {
+		case T_ArrayRefAST: {
+			auto ast = static_cast<const ArrayRefAST*>(expr);
+			if (isWritten(ast->getName()) && !isVar(ast->getIndex()))
+				throw std::runtime_error("PDOTIMES: " + ast->getName() + " is written by the body and can only be read at index " + var);
+			Resolver::checkParallel(ast->getIndex(), var, writes, written);
+			return;
+		}
+
+		case T_IdentifierAST: {
+			const auto& name = static_cast<const IdentifierAST*>(expr)->getName();
+			if (isWritten(name))
+				throw std::runtime_error("PDOTIMES: " + name + " is written by the body and can only be read at index " + var);
+			return;
+		}
+
+		case T_FuncCallAST:
+			throw std::runtime_error("PDOTIMES: body cannot call " + static_cast<const FuncCallAST*>(expr)->getName());
+
+		case T_IfAST: {
+			auto ast = static_cast<const IfAST*>(expr);
+			Resolver::checkParallel(ast->getCond(), var, writes, written);
+			Resolver::checkParallel(ast->getThen(), var, writes, written);
+			Resolver::checkParallel(ast->getElse(), var, writes, written);
+			return;
+		}
+
+		case T_LoopForeverAST:
+			checkBody(static_cast<const LoopForeverAST*>(expr)->getBody());
+			return;
+
+		case T_LoopForAST: {
+			auto ast = static_cast<const LoopForAST*>(expr);
+			checkLoop(ast->getName());
+			Resolver::checkParallel(ast->getStart(), var, writes, written);
+			Resolver::checkParallel(ast->getEnd(), var, writes, written);
+			checkBody(ast->getBody());
+			return;
+		}
+
+		case T_LoopDoTimesAST: {
+			auto ast = static_cast<const LoopDoTimesAST*>(expr);
+			checkLoop(ast->getName());
+			Resolver::checkParallel(ast->getTimes(), var, writes, written);
+			checkBody(ast->getBody());
+			return;
+		}
+
+		case T_UnaryAST: {
+			auto ast = static_cast<const UnaryAST*>(expr);
+			if (ast->getOp() == PRINT)
+				throw std::runtime_error("PDOTIMES: body cannot print");
+			Resolver::checkParallel(ast->getExpr(), var, writes, written);
+			return;
+		}
+
+		case T_BinaryAST: {
+			auto ast = static_cast<const BinaryAST*>(expr);
+			Resolver::checkParallel(ast->getLHS(), var, writes, written);
+			Resolver::checkParallel(ast->getRHS(), var, writes, written);
+			return;
+		}
+
+		case T_ListAST: {
+			auto ast = static_cast<const ListAST*>(expr);
+			if (Channel::handles(ast->getOp()))
+				throw std::runtime_error("PDOTIMES: body cannot use channels");
+			checkBody(ast->getExprs());
+			return;
+		}
+
+		case T_VarOpAST:
+			throw std::runtime_error("PDOTIMES: body can only assign (aref array " + var + ")");
+
+		case T_LValOpAST: {
+			auto ast = static_cast<const LValOpAST*>(expr);
+			auto lval = ast->getLVal();
+			if (lval->getType() != T_ArrayRefAST || !isVar(static_cast<const ArrayRefAST*>(lval)->getIndex()))
+				throw std::runtime_error("PDOTIMES: body can only assign (aref array " + var + ")");
+			const auto& name = static_cast<const ArrayRefAST*>(lval)->getName();
+			if (name == var)
+				throw std::runtime_error("PDOTIMES: body can only assign (aref array " + var + ")");
+			if (std::find(writes.begin(), writes.end(), name) == writes.end())
+				writes.push_back(name);
+			Resolver::checkParallel(ast->getExpr(), var, writes, written);
+			return;
+		}
+
+		case T_ReturnAST:
+			throw std::runtime_error("PDOTIMES: body cannot return");
+
+		case T_FutureAST:
+			throw std::runtime_error("PDOTIMES: body cannot make futures");
+
+		default:
+			return;
+	}
+}
+
+// A statement of a function body or a branch of one
+void Resolver::markTail(const FuncDefAST* func, ExprAST* branch, bool last) {
+	if (!branch)
+		return;
+	if (branch->getType() == T_ReturnAST) {
+		auto ret = static_cast<ReturnAST*>(branch);
+		if (ret->getName() != func->getName())
+			return;
+		branch = ret->getExpr();
+		last = true;
+	}
+	if (last && branch->getType() == T_FuncCallAST)
+		static_cast<FuncCallAST*>(branch)->setTail(true);
+}
+
+} // namespace DragonLisp
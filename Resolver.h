@@ -0,0 +1,90 @@
+#ifndef __DRAGON_LISP_RESOLVER_H__
+#define __DRAGON_LISP_RESOLVER_H__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AST.h"
+
+namespace DragonLisp {
+
+/// Resolver - Assigns lexical addresses to variables after parsing.
+///
+/// Function calls and counted loops get a frame of slots holding every name
+/// that is bound or assigned directly in them; the induction variable of a
+/// loop is always slot 0. Top-level code outside of loops keeps using the
+/// name-keyed global table, as do global constants.
+///
+/// Calls whose value a function returns as is are marked as tail calls:
+/// the last statement, either branch of a last IfAST statement, and the
+/// value of a return-from the function anywhere in its body.
+///
+/// The body of a pdotimes may only assign (aref array i), `i` being its
+/// induction variable, and read those arrays only that way. It may not
+/// print, return or call functions, which could do any of these.
+///
+/// The expression of a future gets a frame too, the last one it can reach:
+/// a variable of an enclosing frame that it uses is given a slot of it, to
+/// which the value is copied when the future is made.
+class Resolver {
+private:
+	struct Scope {
+		struct Binding {
+			std::uint32_t index;
+
+			// Arguments and induction variables are bound before the body runs
+			bool definite;
+		};
+		std::unordered_map<std::string, Binding> names;
+
+		// Counted loops only: whether slot 0 is ever read
+		bool loop = false;
+		bool varRead = false;
+
+		// Futures only: variables copied from the enclosing frames
+		bool future = false;
+		std::vector<FutureAST::Capture> captures;
+
+		std::uint32_t declare(const std::string& name, bool definite);
+	};
+
+	// Enclosing frames, innermost last. Empty at top level.
+	std::vector<Scope> scopes;
+
+	// Constants already defined there are never bound in a frame
+	const Context* globals = nullptr;
+
+	void collect(const ExprAST* expr);
+	void collectBody(const std::vector<ExprAST*>& body);
+
+	VarRef lookup(const std::string& name);
+	VarRef lookup(const std::string& name, std::size_t depth);
+	VarRef store(const std::string& name) const;
+
+	void resolveExpr(ExprAST* expr);
+	void resolveBody(const std::vector<ExprAST*>& body);
+	std::uint32_t resolveLoop(const std::string& var, const std::vector<ExprAST*>& body, bool& varRead);
+
+	static void markTail(const FuncDefAST* func, ExprAST* branch, bool last);
+
+	// Reject what would make the iterations of a pdotimes depend on each
+	// other. Collects the arrays written into `writes`, then checks reads of
+	// them once `written` is set.
+	static void checkParallel(const ExprAST* expr, const std::string& var, std::vector<std::string>& writes, bool written);
+
+public:
+	/// Whether a statement of a function body is a call marked as a tail call.
+	static bool isTailCall(const ExprAST* expr) {
+		return expr->getType() == T_FuncCallAST && static_cast<const FuncCallAST*>(expr)->isTail();
+	}
+
+	void resolve(ExprAST* expr, const Context* globals);
+
+	void resolve(FuncDefAST* func, const Context* globals);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_RESOLVER_H__
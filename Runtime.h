@@ -0,0 +1,220 @@
+#ifndef __DRAGON_LISP_RUNTIME_H__
+#define __DRAGON_LISP_RUNTIME_H__
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AST.h"
+#include "EvalStack.h"
+#include "Future.h"
+
+namespace DragonLisp {
+
+/// Runtime - Support code of programs translated to C++ by CppEmitter.
+///
+/// Variables and frames are those of the interpreter (value.h, context.h),
+/// and every operator that is not inlined here is the AST's own static
+/// apply function, so a translated program prints exactly what the
+/// interpreter would. It links against the objects of `make runtime`.
+class Runtime {
+public:
+	/// Func - A translated function and its frame layout. A tail call
+	/// rebinds the frame for the callee, stores it in `next` and returns.
+	struct Func {
+		Value (*body)(Context* frame, const Func** next);
+		std::uint32_t slots;
+		std::vector<std::uint32_t> argSlots;
+
+		// Results by arguments, for memoized functions
+		MemoCache* memo = nullptr;
+	};
+
+	/// Site - Inline cache of a function lookup at a single call site,
+	/// filled in by futures too, one at a time as a FuncCache is.
+	struct Site {
+		static constexpr std::uint64_t FILLING = ~std::uint64_t(0);
+
+		std::atomic<std::uint64_t> epoch = 0;
+		std::atomic<const Func*> func = nullptr;
+	};
+
+private:
+	static inline std::unordered_map<std::string, const Func*> funcs;
+	static inline std::shared_mutex lock;
+
+	// Bumped by every definition, starts past the epoch of a fresh Site
+	static inline std::atomic<std::uint64_t> epoch = 1;
+
+public:
+	/// Define a function, while futures may still be calling the previous
+	/// definition.
+	static void defun(const std::string& name, const Func* func) {
+		{
+			std::unique_lock<std::shared_mutex> guard(Runtime::lock);
+			Runtime::funcs[name] = func;
+		}
+		Runtime::epoch.fetch_add(1, std::memory_order_release);
+	}
+
+	/// The function bound to `name`, or nullptr.
+	static const Func* findFunc(const std::string& name, Site& site) {
+		auto epoch = site.epoch.load(std::memory_order_acquire);
+		auto current = Runtime::epoch.load(std::memory_order_acquire);
+		if (epoch != current) {
+			const Func* func = nullptr;
+			{
+				std::shared_lock<std::shared_mutex> guard(Runtime::lock);
+				auto it = Runtime::funcs.find(name);
+				if (it != Runtime::funcs.end())
+					func = it->second;
+			}
+			if (epoch != Site::FILLING && site.epoch.compare_exchange_strong(epoch, Site::FILLING, std::memory_order_acquire)) {
+				site.func.store(func, std::memory_order_relaxed);
+				site.epoch.store(current, std::memory_order_release);
+			}
+			return func;
+		}
+		return site.func.load(std::memory_order_relaxed);
+	}
+
+	static const Func* getFunc(const std::string& name, Site& site) {
+		auto func = Runtime::findFunc(name, site);
+		if (!func)
+			throw std::runtime_error("Function not defined: " + name);
+		return func;
+	}
+
+	/// Run a function and the tail calls it ends with, in the same frame.
+	/// Memoized functions are looked up first, and tail calls to them are
+	/// made as regular calls.
+	static Value call(const Func* func, Context* frame) {
+		EvalStack::check();
+		MemoCache::Key key;
+		auto memo = func->memo;
+		if (memo && !MemoCache::makeKey(frame, func->argSlots, key))
+			memo = nullptr;
+		if (memo) {
+			Value hit;
+			if (memo->find(key, hit))
+				return hit;
+		}
+
+		Value ret;
+		while (true) {
+			const Func* next = nullptr;
+			ret = func->body(frame, &next);
+			if (!next)
+				break;
+			if (next->memo) {
+				ret = Runtime::call(next, frame);
+				break;
+			}
+			func = next;
+		}
+		if (memo)
+			memo->insert(std::move(key), ret.copy());
+		return ret;
+	}
+
+	/// Bind the i-th argument of a call; extra arguments are dropped.
+	static void bind(Context& frame, const Func* func, std::size_t i, Value v) {
+		if (i < func->argSlots.size())
+			frame.setSlot(func->argSlots[i], std::move(v));
+	}
+
+	static void checkArgs(const Func* func, std::size_t n) {
+		if (n < func->argSlots.size())
+			throw std::runtime_error("Too few arguments");
+	}
+
+	static Value get(Context* c, const std::string& name, const VarRef& ref) {
+		auto var = c->getVariable(name, ref);
+		if (!var)
+			throw std::runtime_error("Variable not found: " + name);
+		return var->copy();
+	}
+
+	/// Read a reference that always hits a single slot.
+	static Value get(Context* c, const std::string& name, VarSlot s) {
+		const auto& var = c->getSlot(s);
+		if (var.isUnbound())
+			throw std::runtime_error("Variable not found: " + name);
+		return var.copy();
+	}
+
+	static void checkDefined(Context* c, const std::string& name, const VarRef& ref) {
+		if (!c->hasVariable(name, ref))
+			throw std::runtime_error("Variable not defined: " + name);
+	}
+
+	static void checkBounds(const Value& s, const Value& e) {
+		if (!s.isNumber() || !e.isNumber())
+			throw std::runtime_error("LoopForAST: start and end must be numeric");
+	}
+
+	static std::int64_t times(const Value& t) {
+		if (!t.isInt())
+			throw std::runtime_error("DOTIMES: times must be an integer");
+		return t.getInt();
+	}
+
+	/// An if that is not a statement of a function or loop body.
+	static Value misplacedIf() {
+		throw std::runtime_error("You should use IfAST::getResult() instead of IfAST::eval()");
+	}
+
+	static void misplacedReturn() {
+		throw std::runtime_error("Return name mismatch. Closure is not implemented yet!");
+	}
+
+	/// BinaryAST, operands in evaluation order.
+	template <Token op>
+	static Value binary(std::initializer_list<Value> args) {
+		const auto& l = args.begin()[0];
+		const auto& r = args.begin()[1];
+		if (l.isInt() && r.isInt())
+			return BinaryAST::applyInt(op, l.getInt(), r.getInt());
+		return BinaryAST::apply(op, l, r);
+	}
+
+	/// ListAST, operands in evaluation order. Two integers are combined
+	/// inline, as ListAST's own fold would.
+	template <Token op>
+	static Value list(std::initializer_list<Value> args) {
+		constexpr bool ints = op == PLUS || op == MINUS || op == MULTIPLY || op == LOGAND || op == LOGIOR || op == LOGXOR || op == LOGEQV;
+		if constexpr (ints) {
+			auto x = args.begin();
+			if (args.size() == 2 && x[0].isInt() && x[1].isInt()) {
+				auto l = x[0].getInt(), r = x[1].getInt();
+				switch (op) {
+					case PLUS:
+						return Value(l + r);
+					case MINUS:
+						return Value(l - r);
+					case MULTIPLY:
+						return Value(l * r);
+					case LOGAND:
+						return Value(l & r);
+					case LOGIOR:
+						return Value(l | r);
+					case LOGXOR:
+						return Value(l ^ r);
+					default:
+						return Value(~(l ^ r));
+				}
+			}
+		}
+		std::vector<Value> vals(args);
+		return ListAST::apply(op, vals);
+	}
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_RUNTIME_H__
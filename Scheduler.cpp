@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <utility>
+
+#include "EvalStack.h"
+#include "Future.h"
+#include "Scheduler.h"
+
+namespace DragonLisp {
+
+Scheduler::Scheduler() : depth(EvalStack::getDepth()) {
+	Scheduler::started.store(true, std::memory_order_release);
+	auto n = std::max(1u, std::thread::hardware_concurrency());
+	std::lock_guard<std::mutex> guard(this->lock);
+	for (unsigned i = 0; i < n; i++)
+		this->start();
+}
+
+void Scheduler::start() {
+	this->starting++;
+	this->threads.emplace_back([this]() {
+		try {
+			EvalStack::run(this->depth, [this]() {
+				Scheduler::worker = true;
+				this->loop();
+				return 0;
+			});
+		} catch (const std::exception& e) {
+			// Without a stack, futures are left to the other threads and to
+			// those touching them
+			std::lock_guard<std::mutex> guard(this->lock);
+			this->starting--;
+			std::cerr << "Error: " << e.what() << std::endl;
+		}
+	});
+}
+
+Scheduler::~Scheduler() {
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->shutdown = true;
+	}
+	this->wake.notify_all();
+	for (auto& t : this->threads)
+		t.join();
+}
+
+Scheduler& Scheduler::get() {
+	static Scheduler scheduler;
+	return scheduler;
+}
+
+void Scheduler::loop() {
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->starting--;
+	while (true) {
+		this->waiting++;
+		this->wake.wait(guard, [&] { return this->shutdown || !this->queue.empty(); });
+		this->waiting--;
+		if (this->shutdown)
+			return;
+		this->runNext(guard);
+	}
+}
+
+void Scheduler::runNext(std::unique_lock<std::mutex>& guard) {
+	auto future = std::move(this->queue.front());
+	this->queue.pop_front();
+	guard.unlock();
+	Future::run(future);
+	future = Value();
+	guard.lock();
+}
+
+void Scheduler::compensate() {
+	if (this->blocked && !this->shutdown && !this->queue.empty() && !this->waiting && !this->starting)
+		this->start();
+}
+
+void Scheduler::submit(Value future) {
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->queue.push_back(std::move(future));
+		this->compensate();
+	}
+	this->wake.notify_one();
+}
+
+void Scheduler::block(Channel* ch) {
+	FutureGroup::park(ch);
+	if (!Scheduler::worker)
+		return;
+	auto& s = Scheduler::get();
+	std::lock_guard<std::mutex> guard(s.lock);
+	s.blocked++;
+	s.compensate();
+}
+
+bool Scheduler::unblock(Channel* ch) {
+	auto ret = FutureGroup::unpark(ch);
+	if (!Scheduler::worker)
+		return ret;
+	auto& s = Scheduler::get();
+	std::lock_guard<std::mutex> guard(s.lock);
+	s.blocked--;
+	return ret;
+}
+
+} // namespace DragonLisp
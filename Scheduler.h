@@ -0,0 +1,86 @@
+#ifndef __DRAGON_LISP_SCHEDULER_H__
+#define __DRAGON_LISP_SCHEDULER_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FutureGroup.h"
+#include "value.h"
+
+namespace DragonLisp {
+
+/// Scheduler - Threads running futures, in the order they are made.
+///
+/// There is a thread per hardware thread, each evaluating on a stack
+/// segment as deep as the one of the thread that made the first future
+/// (see EvalStack). Futures that are touched before a thread takes them
+/// are run by the toucher instead, and skipped here. While threads are
+/// parked inside futures, waiting on a channel, futures that no other
+/// thread is free to take start another thread instead of waiting for
+/// them, so that the future they wait for gets to run.
+class Scheduler {
+private:
+	std::vector<std::thread> threads;
+	std::size_t depth;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<Value> queue;
+	bool shutdown = false;
+
+	// Threads waiting for a future, threads started but not waiting yet,
+	// and threads parked inside a future
+	unsigned waiting = 0;
+	unsigned starting = 0;
+	unsigned blocked = 0;
+
+	static inline std::atomic<bool> started = false;
+
+	static thread_local inline bool worker = false;
+
+	Scheduler();
+
+	// Start a thread, with the lock held
+	void start();
+
+	// Start a thread if futures are queued and every thread is parked
+	void compensate();
+
+	void loop();
+
+	// Run the next queued future with the lock held around it
+	void runNext(std::unique_lock<std::mutex>& guard);
+
+public:
+	~Scheduler();
+
+	Scheduler(const Scheduler&) = delete;
+
+	Scheduler& operator=(const Scheduler&) = delete;
+
+	/// The scheduler, started on first use.
+	static Scheduler& get();
+
+	/// Whether a future was ever made. Shared state that is only touched by
+	/// the main thread before that is left unlocked until then.
+	static bool isStarted() {
+		return Scheduler::started.load(std::memory_order_acquire);
+	}
+
+	void submit(Value future);
+
+	/// Called by a thread before and after it parks on channel `ch`, or on
+	/// a future if `ch` is null. Only threads of the scheduler are counted
+	/// here, the others by their FutureGroup. unblock() is false when the
+	/// thread was woken as nothing was left that could wake it.
+	static void block(Channel* ch);
+	static bool unblock(Channel* ch);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_SCHEDULER_H__
@@ -0,0 +1,1711 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+#include "EvalStack.h"
+#include "Jit.h"
+#include "Scheduler.h"
+#include "Specializer.h"
+
+namespace DragonLisp {
+
+namespace {
+
+/// Unboxed - Raw storage of a value whose StaticType is known.
+union Unboxed {
+	std::int64_t i;
+	double d;
+	bool b;
+	const Value* a;
+};
+
+// Thrown when a guard fails, caught where generic code entered. A guard on
+// the data of the call alone keeps the specialization for other calls.
+struct Deopt {
+	bool keep = false;
+};
+
+struct Frame {
+	Unboxed* slots;
+	Context* root;
+};
+
+class NativeCompiler;
+
+class Node {
+public:
+	const StaticType type;
+
+	explicit Node(StaticType t) : type(t) {}
+
+	virtual ~Node() = default;
+
+	virtual Unboxed eval(Frame& f) const = 0;
+
+	/// Emit native code leaving the value in rax. Nodes that return false
+	/// are evaluated by calling back into eval().
+	virtual bool emit(NativeCompiler&) const {
+		return false;
+	}
+};
+
+inline bool isNumeric(StaticType t) {
+	return t == ST_INT || t == ST_FLOAT;
+}
+
+inline bool isArray(StaticType t) {
+	return t == ST_INT_ARRAY || t == ST_FLOAT_ARRAY;
+}
+
+inline double number(const Node* n, Frame& f) {
+	auto v = n->eval(f);
+	return n->type == ST_INT ? static_cast<double>(v.i) : v.d;
+}
+
+StaticType typeOf(const Value& v) {
+	if (v.isInt())
+		return ST_INT;
+	if (v.isFloat())
+		return ST_FLOAT;
+	if (v.isT() || v.isNil())
+		return ST_BOOL;
+	if (v.isArray()) {
+		switch (v.getArray()->getKind()) {
+			case ARRAY_INT:
+				return ST_INT_ARRAY;
+			case ARRAY_FLOAT:
+				return ST_FLOAT_ARRAY;
+			default:
+				break;
+		}
+	}
+	return ST_NONE;
+}
+
+inline Unboxed unbox(const Value& v, StaticType t) {
+	if (typeOf(v) != t)
+		throw Deopt();
+	Unboxed ret;
+	switch (t) {
+		case ST_INT:
+			ret.i = v.getInt();
+			break;
+		case ST_FLOAT:
+			ret.d = v.getFloat();
+			break;
+		case ST_BOOL:
+			ret.b = v.isT();
+			break;
+		default:
+			ret.a = &v;
+			break;
+	}
+	return ret;
+}
+
+inline Value box(Unboxed v, StaticType t) {
+	switch (t) {
+		case ST_INT:
+			return Value(v.i);
+		case ST_FLOAT:
+			return Value(v.d);
+		default:
+			return Value(v.b);
+	}
+}
+
+/// Branch - What a statement evaluates, and whether it returns the value.
+/// A tail call of the specialization itself jumps back to the start of the
+/// body instead, with the arguments as the new parameters.
+struct Branch {
+	const Node* expr = nullptr;
+	bool ret = false;
+	bool tail = false;
+};
+
+/// Stmt - A statement of a function body. Statements other than IfAST
+/// have no condition and always take `then`.
+struct Stmt {
+	const Node* cond = nullptr;
+	Branch then;
+	Branch els;
+};
+
+bool interpret(Unboxed* slots, Unboxed* ret, Context* root, Specialization* self) noexcept;
+
+} // namespace
+
+struct Specialization {
+	static constexpr std::size_t MAX_SLOTS = 16;
+
+	// Limits the number of type combinations compiled per function
+	static constexpr std::size_t MAX_PER_FUNC = 4;
+
+	enum State {
+		SPEC_BUILDING,
+		SPEC_READY,
+		SPEC_FAILED,
+	};
+
+	const FuncDefAST* func;
+
+	// Type of each frame slot, ST_NONE for slots that are not parameters
+	std::array<StaticType, MAX_SLOTS> params{};
+
+	State state = SPEC_BUILDING;
+	StaticType result = ST_NONE;
+
+	// Whether the body assigns a parameter, which native code that bails out
+	// may have done before the interpreter runs the call again
+	bool writes = false;
+
+	// Function definitions the body was compiled against
+	const FuncTable* table = nullptr;
+	std::uint64_t epoch = 0;
+
+	Arena nodes;
+	std::vector<Stmt> body;
+
+	// Native code, once hot. Compiled code calls `entry`, which stays the
+	// interpreter until the callee is compiled too. Returns false to have
+	// the call redone by the interpreter. Futures may run and compile the
+	// same specialization, hence the atomics; `entry` is loaded as a plain
+	// pointer by compiled code. `calls` counts loop iterations as well.
+	using NativeFn = bool (*)(Unboxed* slots, Unboxed* ret, Context* root, Specialization* self);
+	std::atomic<NativeFn> native = nullptr;
+	std::atomic<NativeFn> entry = interpret;
+	std::atomic<std::uint32_t> calls = 0;
+
+	explicit Specialization(const FuncDefAST* func) : func(func) {}
+
+	// Same rules as FuncDefAST::call
+	Unboxed run(Frame& f) const;
+};
+
+namespace {
+
+/// NativeCompiler - Compiles a specialization to x86-64 code, a
+/// NativeFn following the System V calling convention.
+///
+/// rbx points to the slots, r12 is the root context, r13 where the result
+/// goes and r14 the value of the last statement. Every value is computed
+/// into rax, floats as their bits, and temporaries are pushed. Errors and
+/// failed guards return false instead of throwing, so that no exception
+/// ever unwinds through generated code: the interpreter then runs the call
+/// again and raises them, which is safe as specialized code writes nothing
+/// but its own slots, and parameters are restored first.
+class NativeCompiler {
+public:
+	Assembler as;
+	Assembler::Label bail = 0;
+
+	// Quadwords pushed since the frame was set up, to align calls
+	std::int32_t depth = 0;
+
+	void push() {
+		this->as.push(RAX);
+		this->depth++;
+	}
+
+	void pop(Reg r) {
+		this->as.pop(r);
+		this->depth--;
+	}
+
+	// Unboxed value of type `t` at [base + disp] into rax
+	void load(StaticType t, Reg base, std::int32_t disp) {
+		if (t == ST_BOOL)
+			this->as.loadByte(RAX, base, disp);
+		else
+			this->as.load(RAX, base, disp);
+	}
+
+	// Value of `n`, just computed into rax, into xmm0 as a double
+	void toDouble(const Node* n) {
+		if (n->type == ST_INT)
+			this->as.cvtsi2sd(XMM0, RAX);
+		else
+			this->as.movqToXmm(XMM0, RAX);
+	}
+
+	// rax divided by rcx, or the remainder, into rax, as BinaryAST::quotient
+	// and remainder do. A zero divisor bails out.
+	void divide(bool remainder) {
+		auto idiv = this->as.newLabel();
+		auto done = this->as.newLabel();
+		this->as.test(RCX, RCX);
+		this->as.jcc(CC_E, this->bail);
+		this->as.movImm(RDX, static_cast<std::uint64_t>(-1));
+		this->as.cmp(RCX, RDX);
+		this->as.jcc(CC_NE, idiv);
+		if (remainder)
+			this->as.xor_(RAX, RAX);
+		else
+			this->as.neg(RAX);
+		this->as.jmp(done);
+		this->as.bind(idiv);
+		this->as.cqo();
+		this->as.idiv(RCX);
+		if (remainder)
+			this->as.mov(RAX, RDX);
+		this->as.bind(done);
+	}
+
+	void expr(const Node* n);
+
+	void function(const Specialization* spec);
+};
+
+class Const : public Node {
+private:
+	Unboxed val;
+
+public:
+	Const(StaticType t, Unboxed v) : Node(t), val(v) {}
+
+	Unboxed eval(Frame&) const override final {
+		return this->val;
+	}
+
+	bool emit(NativeCompiler& c) const override final {
+		c.as.movImm(RAX, this->type == ST_BOOL ? this->val.b : this->val.i);
+		return true;
+	}
+};
+
+/// Local - A parameter or local variable, read from its slot.
+class Local : public Node {
+private:
+	std::uint32_t index;
+
+public:
+	Local(StaticType t, std::uint32_t index) : Node(t), index(index) {}
+
+	Unboxed eval(Frame& f) const override final {
+		return f.slots[this->index];
+	}
+
+	bool emit(NativeCompiler& c) const override final {
+		c.load(this->type, RBX, 8 * this->index);
+		return true;
+	}
+};
+
+class Global : public Node {
+private:
+	std::string name;
+	VarRef ref;
+
+public:
+	Global(StaticType t, std::string name) : Node(t), name(std::move(name)) {}
+
+	Unboxed eval(Frame& f) const override final {
+		auto var = f.root->getVariable(this->name, this->ref);
+		if (!var)
+			throw Deopt();
+		return unbox(*var, this->type);
+	}
+};
+
+class ARef : public Node {
+private:
+	const Node* array;
+	const Node* index;
+
+public:
+	ARef(StaticType t, const Node* array, const Node* index) : Node(t), array(array), index(index) {}
+
+	Unboxed eval(Frame& f) const override final {
+		auto idx = this->index->eval(f).i;
+		auto arr = this->array->eval(f).a->getArray();
+		if (arr->getSize() <= static_cast<std::size_t>(idx))
+			throw std::runtime_error("Index out of range: " + std::to_string(idx) + " >= " + std::to_string(arr->getSize()));
+		// Holes read as NIL
+		return unbox(arr->get(idx), this->type);
+	}
+};
+
+Unboxed invoke(Specialization* spec, Unboxed* slots, Context* root);
+
+class Call : public Node {
+private:
+	Specialization* target;
+	std::vector<const Node*> args;
+
+public:
+	Call(Specialization* target, std::vector<const Node*> args) : Node(target->result), target(target), args(std::move(args)) {}
+
+	inline const Specialization* getTarget() const {
+		return this->target;
+	}
+
+	/// Evaluate the arguments into the parameters of the target.
+	void bind(Frame& f, Unboxed* slots) const {
+		const auto& argSlots = this->target->func->getArgSlots();
+		for (std::size_t i = 0; i < this->args.size(); i++) {
+			auto v = this->args[i]->eval(f);
+			if (i < argSlots.size())
+				slots[argSlots[i]] = v;
+		}
+	}
+
+	Unboxed eval(Frame& f) const override final {
+		Unboxed slots[Specialization::MAX_SLOTS];
+		this->bind(f, slots);
+		return invoke(this->target, slots, f.root);
+	}
+
+	/// Tail call of the function itself: the arguments replace the
+	/// parameters in place, once they have all been evaluated.
+	void emitTail(NativeCompiler& c) const {
+		for (const auto& a : this->args) {
+			c.expr(a);
+			c.push();
+		}
+		const auto& argSlots = this->target->func->getArgSlots();
+		for (auto i = this->args.size(); i--;) {
+			c.pop(RAX);
+			if (i < argSlots.size())
+				c.as.store(RBX, 8 * argSlots[i], RAX);
+		}
+	}
+
+	bool emit(NativeCompiler& c) const override final {
+		auto n = static_cast<std::int32_t>(this->args.size());
+		for (const auto& a : this->args) {
+			c.expr(a);
+			c.push();
+		}
+
+		// Slots of the callee and its result, rsp aligned at the call
+		std::int32_t room = 8 * (Specialization::MAX_SLOTS + 1);
+		if ((c.depth + room / 8) % 2)
+			room += 8;
+		c.as.subRsp(room);
+		const auto& argSlots = this->target->func->getArgSlots();
+		for (std::int32_t i = 0; i < n && static_cast<std::size_t>(i) < argSlots.size(); i++) {
+			c.as.load(RAX, RSP, room + 8 * (n - 1 - i));
+			c.as.store(RSP, 8 * argSlots[i], RAX);
+		}
+
+		c.as.mov(RDI, RSP);
+		c.as.lea(RSI, RSP, 8 * Specialization::MAX_SLOTS);
+		c.as.mov(RDX, R12);
+		c.as.movImm(RCX, reinterpret_cast<std::uint64_t>(this->target));
+		c.as.movImm(RAX, reinterpret_cast<std::uint64_t>(&this->target->entry));
+		c.as.load(RAX, RAX, 0);
+		c.as.call(RAX);
+		c.as.testByte(RAX);
+		c.as.jcc(CC_E, c.bail);
+
+		c.load(this->type, RSP, 8 * Specialization::MAX_SLOTS);
+		c.as.addRsp(room + 8 * n);
+		c.depth -= n;
+		return true;
+	}
+};
+
+class Not : public Node {
+private:
+	const Node* expr;
+
+public:
+	explicit Not(const Node* expr) : Node(ST_BOOL), expr(expr) {}
+
+	Unboxed eval(Frame& f) const override final {
+		auto v = this->expr->eval(f);
+		Unboxed ret;
+		ret.b = this->expr->type == ST_BOOL && !v.b;
+		return ret;
+	}
+
+	bool emit(NativeCompiler& c) const override final {
+		c.expr(this->expr);
+		if (this->expr->type == ST_BOOL) {
+			c.as.movImm(RCX, 1);
+			c.as.xor_(RAX, RCX);
+		} else
+			c.as.movImm(RAX, 0);
+		return true;
+	}
+};
+
+/// Binary - BinaryAST on two numbers. Floats are set when either is one.
+class Binary : public Node {
+private:
+	Token op;
+	const Node* lhs;
+	const Node* rhs;
+
+public:
+	Binary(StaticType t, Token op, const Node* lhs, const Node* rhs) : Node(t), op(op), lhs(lhs), rhs(rhs) {}
+
+	Unboxed eval(Frame& f) const override final {
+		Unboxed ret;
+		if (this->lhs->type == ST_INT && this->rhs->type == ST_INT) {
+			auto l = this->lhs->eval(f).i;
+			auto r = this->rhs->eval(f).i;
+			switch (this->op) {
+				case LESS:
+					ret.b = l < r;
+					break;
+				case LESS_EQUAL:
+					ret.b = l <= r;
+					break;
+				case GREATER:
+					ret.b = l > r;
+					break;
+				case GREATER_EQUAL:
+					ret.b = l >= r;
+					break;
+				case MOD:
+				case REM:
+					if (!r)
+						throw std::runtime_error("Division by zero");
+					ret.i = BinaryAST::remainder(l, r);
+					break;
+				default:
+					ret.i = ~(l | r);
+					break;
+			}
+			return ret;
+		}
+
+		auto l = number(this->lhs, f);
+		auto r = number(this->rhs, f);
+		switch (this->op) {
+			case LESS:
+				ret.b = l < r;
+				break;
+			case LESS_EQUAL:
+				ret.b = l <= r;
+				break;
+			case GREATER:
+				ret.b = l > r;
+				break;
+			case GREATER_EQUAL:
+				ret.b = l >= r;
+				break;
+			default:
+				ret.d = std::fmod(l, r);
+				break;
+		}
+		return ret;
+	}
+
+	bool emit(NativeCompiler& c) const override final {
+		if (this->lhs->type == ST_INT && this->rhs->type == ST_INT) {
+			c.expr(this->lhs);
+			c.push();
+			c.expr(this->rhs);
+			c.as.mov(RCX, RAX);
+			c.pop(RAX);
+			switch (this->op) {
+				case LESS:
+				case LESS_EQUAL:
+				case GREATER:
+				case GREATER_EQUAL:
+					c.as.cmp(RAX, RCX);
+					c.as.setcc(this->op == LESS ? CC_L : this->op == LESS_EQUAL ? CC_LE : this->op == GREATER ? CC_G : CC_GE, RAX);
+					break;
+				case MOD:
+				case REM:
+					c.divide(true);
+					break;
+				default:
+					c.as.or_(RAX, RCX);
+					c.as.not_(RAX);
+					break;
+			}
+			return true;
+		}
+
+		// fmod is left to the interpreter
+		if (this->op == MOD || this->op == REM)
+			return false;
+		c.expr(this->lhs);
+		c.toDouble(this->lhs);
+		c.as.movqFromXmm(RAX, XMM0);
+		c.push();
+		c.expr(this->rhs);
+		c.toDouble(this->rhs);
+		c.as.movapd(XMM1, XMM0);
+		c.pop(RAX);
+		c.as.movqToXmm(XMM0, RAX);
+
+		// Unordered compares are false, as in C++
+		if (this->op == LESS || this->op == LESS_EQUAL)
+			c.as.ucomisd(XMM1, XMM0);
+		else
+			c.as.ucomisd(XMM0, XMM1);
+		c.as.setcc(this->op == LESS || this->op == GREATER ? CC_A : CC_AE, RAX);
+		return true;
+	}
+};
+
+/// IntFold - Arithmetic and bitwise list operators on integers.
+class IntFold : public Node {
+private:
+	Token op;
+	std::vector<const Node*> exprs;
+
+public:
+	IntFold(Token op, std::vector<const Node*> exprs) : Node(ST_INT), op(op), exprs(std::move(exprs)) {}
+
+	Unboxed eval(Frame& f) const override final {
+		auto x = this->exprs.front()->eval(f).i;
+
+		// Raised once every operand is evaluated, as ListAST does
+		bool divByZero = false;
+		for (auto it = this->exprs.begin() + 1; it != this->exprs.end(); ++it) {
+			auto y = (*it)->eval(f).i;
+			switch (this->op) {
+				case PLUS:
+					x += y;
+					break;
+				case MINUS:
+					x -= y;
+					break;
+				case MULTIPLY:
+					x *= y;
+					break;
+				case DIVIDE:
+					if (y)
+						x = BinaryAST::quotient(x, y);
+					else
+						divByZero = true;
+					break;
+				case LOGAND:
+					x &= y;
+					break;
+				case LOGIOR:
+					x |= y;
+					break;
+				case LOGXOR:
+					x ^= y;
+					break;
+				default:
+					x = ~(x ^ y);
+					break;
+			}
+		}
+		if (divByZero)
+			throw std::runtime_error("Division by zero");
+		Unboxed ret;
+		ret.i = x;
+		return ret;
+	}
+
+	bool emit(NativeCompiler& c) const override final {
+		c.expr(this->exprs.front());
+		for (auto it = this->exprs.begin() + 1; it != this->exprs.end(); ++it) {
+			c.push();
+			c.expr(*it);
+			c.as.mov(RCX, RAX);
+			c.pop(RAX);
+			switch (this->op) {
+				case PLUS:
+					c.as.add(RAX, RCX);
+					break;
+				case MINUS:
+					c.as.sub(RAX, RCX);
+					break;
+				case MULTIPLY:
+					c.as.imul(RAX, RCX);
+					break;
+				case DIVIDE:
+					c.divide(false);
+					break;
+				case LOGAND:
+					c.as.and_(RAX, RCX);
+					break;
+				case LOGIOR:
+					c.as.or_(RAX, RCX);
+					break;
+				case LOGXOR:
+					c.as.xor_(RAX, RCX);
+					break;
+				default:
+					c.as.xor_(RAX, RCX);
+					c.as.not_(RAX);
+					break;
+			}
+		}
+		return true;
+	}
+};
+
+/// FloatFold - Arithmetic list operators with at least one float operand.
+class FloatFold : public Node {
+private:
+	Token op;
+	std::vector<const Node*> exprs;
+
+public:
+	FloatFold(Token op, std::vector<const Node*> exprs) : Node(ST_FLOAT), op(op), exprs(std::move(exprs)) {}
+
+	Unboxed eval(Frame& f) const override final {
+		auto x = number(this->exprs.front(), f);
+		for (auto it = this->exprs.begin() + 1; it != this->exprs.end(); ++it) {
+			auto y = number(*it, f);
+			switch (this->op) {
+				case PLUS:
+					x += y;
+					break;
+				case MINUS:
+					x -= y;
+					break;
+				case MULTIPLY:
+					x *= y;
+					break;
+				default:
+					x /= y;
+					break;
+			}
+		}
+		Unboxed ret;
+		ret.d = x;
+		return ret;
+	}
+
+	bool emit(NativeCompiler& c) const override final {
+		c.expr(this->exprs.front());
+		c.toDouble(this->exprs.front());
+		c.as.movqFromXmm(RAX, XMM0);
+		for (auto it = this->exprs.begin() + 1; it != this->exprs.end(); ++it) {
+			c.push();
+			c.expr(*it);
+			c.toDouble(*it);
+			c.as.movapd(XMM1, XMM0);
+			c.pop(RAX);
+			c.as.movqToXmm(XMM0, RAX);
+			switch (this->op) {
+				case PLUS:
+					c.as.addsd(XMM0, XMM1);
+					break;
+				case MINUS:
+					c.as.subsd(XMM0, XMM1);
+					break;
+				case MULTIPLY:
+					c.as.mulsd(XMM0, XMM1);
+					break;
+				default:
+					c.as.divsd(XMM0, XMM1);
+					break;
+			}
+			c.as.movqFromXmm(RAX, XMM0);
+		}
+		return true;
+	}
+};
+
+/// Extremum - MAX and MIN on operands of one type, compared as doubles.
+class Extremum : public Node {
+private:
+	Token op;
+	std::vector<const Node*> exprs;
+
+public:
+	Extremum(StaticType t, Token op, std::vector<const Node*> exprs) : Node(t), op(op), exprs(std::move(exprs)) {}
+
+	Unboxed eval(Frame& f) const override final {
+		auto best = this->exprs.front()->eval(f);
+		auto n = this->type == ST_INT ? static_cast<double>(best.i) : best.d;
+		for (auto it = this->exprs.begin() + 1; it != this->exprs.end(); ++it) {
+			auto v = (*it)->eval(f);
+			auto m = this->type == ST_INT ? static_cast<double>(v.i) : v.d;
+			if (this->op == MAX ? n < m : m < n) {
+				best = v;
+				n = m;
+			}
+		}
+		return best;
+	}
+};
+
+/// Equal - EQUAL and NOT_EQUAL. An int never equals a float.
+class Equal : public Node {
+private:
+	Token op;
+	std::vector<const Node*> exprs;
+
+public:
+	Equal(Token op, std::vector<const Node*> exprs) : Node(ST_BOOL), op(op), exprs(std::move(exprs)) {}
+
+	Unboxed eval(Frame& f) const override final {
+		auto first = this->exprs.front();
+		auto x = first->eval(f);
+		bool equal = true;
+		for (auto it = this->exprs.begin() + 1; it != this->exprs.end(); ++it) {
+			auto y = (*it)->eval(f);
+			if ((*it)->type != first->type)
+				equal = false;
+			else if (first->type == ST_INT ? x.i != y.i : x.d != y.d)
+				equal = false;
+		}
+		Unboxed ret;
+		ret.b = this->op == EQUAL ? equal : !equal;
+		return ret;
+	}
+};
+
+/// Pick - AND and OR on scalars evaluate every operand and yield one.
+class Pick : public Node {
+private:
+	std::vector<const Node*> exprs;
+	std::size_t index;
+
+public:
+	Pick(std::vector<const Node*> exprs, std::size_t index) : Node(exprs[index]->type), exprs(std::move(exprs)), index(index) {}
+
+	Unboxed eval(Frame& f) const override final {
+		Unboxed ret;
+		for (std::size_t i = 0; i < this->exprs.size(); i++) {
+			auto v = this->exprs[i]->eval(f);
+			if (i == this->index)
+				ret = v;
+		}
+		return ret;
+	}
+};
+
+/// Store - SETQ, SETF, INCF and DECF of a local variable. Only ever writes
+/// a slot of the specialization, never a frame of the generic engine.
+class Store : public Node {
+private:
+	Token op;
+	std::uint32_t index;
+	const Node* expr;
+
+public:
+	Store(Token op, std::uint32_t index, const Node* expr) : Node(expr->type), op(op), index(index), expr(expr) {}
+
+	Unboxed eval(Frame& f) const override final {
+		auto v = this->expr->eval(f);
+		if (this->op == INCF)
+			v.i = f.slots[this->index].i + v.i;
+		else if (this->op == DECF)
+			v.i = f.slots[this->index].i - v.i;
+		f.slots[this->index] = v;
+		return v;
+	}
+
+	bool emit(NativeCompiler& c) const override final {
+		c.expr(this->expr);
+		if (this->op == INCF || this->op == DECF) {
+			c.as.mov(RCX, RAX);
+			c.as.load(RAX, RBX, 8 * this->index);
+			if (this->op == INCF)
+				c.as.add(RAX, RCX);
+			else
+				c.as.sub(RAX, RCX);
+		}
+		c.as.store(RBX, 8 * this->index, RAX);
+		return true;
+	}
+};
+
+void warm(Specialization* spec, Context* root, std::uint32_t n);
+
+/// Loop - dotimes, or loop for on integers. The induction variable is
+/// counted apart and copied to slot `var` for each iteration. A return
+/// leaves the loop with its value, and running to the end yields NIL: if
+/// the loop is typed otherwise, that call deoptimizes.
+///
+/// Each iteration counts as a call of the specialization towards
+/// compiling it, so that a function spending its time in one loop does
+/// not have to be called as often to be compiled.
+class Loop : public Node {
+private:
+	// No start for dotimes, which counts from 0 and stops before `end`
+	const Node* start;
+	const Node* end;
+	std::uint32_t var;
+	std::vector<Stmt> body;
+	Specialization* spec;
+
+public:
+	Loop(StaticType t, const Node* start, const Node* end, std::uint32_t var, std::vector<Stmt> body, Specialization* spec) : Node(t), start(start), end(end), var(var), body(std::move(body)), spec(spec) {}
+
+	Unboxed eval(Frame& f) const override final {
+		std::int64_t i = this->start ? this->start->eval(f).i : 0;
+		auto last = this->end->eval(f).i;
+		if (!this->start && last-- <= 0)
+			return this->exit();
+		for (; i <= last; ++i, warm(this->spec, f.root, 1)) {
+			f.slots[this->var].i = i;
+			for (const auto& s : this->body) {
+				const Branch* b = &s.then;
+				if (s.cond) {
+					auto c = s.cond->eval(f);
+					if (s.cond->type == ST_BOOL && !c.b)
+						b = &s.els;
+				}
+				if (!b->expr)
+					continue;
+				auto v = b->expr->eval(f);
+				if (b->ret)
+					return v;
+			}
+			// The next step could be past the largest integer
+			if (i == last)
+				break;
+		}
+		return this->exit();
+	}
+
+	Unboxed exit() const {
+		if (this->type != ST_BOOL)
+			throw Deopt{ true };
+		Unboxed ret;
+		ret.b = false;
+		return ret;
+	}
+
+	/// The counter and the bound are kept on the stack, the counter stored
+	/// to the slot of the variable for each iteration. Running to the end
+	/// of a loop that is not typed NIL bails out.
+	bool emit(NativeCompiler& c) const override final {
+		auto& as = c.as;
+		auto head = as.newLabel();
+		auto exit = as.newLabel();
+		auto done = as.newLabel();
+		if (this->start)
+			c.expr(this->start);
+		else
+			as.movImm(RAX, 0);
+		c.push();
+		c.expr(this->end);
+		c.push();
+
+		// dotimes stops before its bound, the counter of loop for stops at
+		// it, as the next step could be past the largest integer
+		as.bind(head);
+		as.load(RAX, RSP, 8);
+		as.load(RCX, RSP, 0);
+		as.cmp(RAX, RCX);
+		as.jcc(this->start ? CC_G : CC_GE, exit);
+		as.store(RBX, 8 * this->var, RAX);
+
+		auto branch = [&](const Branch& b) {
+			if (!b.expr)
+				return;
+			c.expr(b.expr);
+			if (b.ret)
+				as.jmp(done);
+		};
+		for (const auto& s : this->body) {
+			auto els = as.newLabel();
+			auto next = as.newLabel();
+			if (s.cond) {
+				c.expr(s.cond);
+				if (s.cond->type == ST_BOOL) {
+					as.test(RAX, RAX);
+					as.jcc(CC_E, els);
+				}
+			}
+			branch(s.then);
+			as.jmp(next);
+			as.bind(els);
+			branch(s.els);
+			as.bind(next);
+		}
+
+		as.load(RAX, RSP, 8);
+		if (this->start) {
+			as.load(RCX, RSP, 0);
+			as.cmp(RAX, RCX);
+			as.jcc(CC_E, exit);
+		}
+		as.movImm(RCX, 1);
+		as.add(RAX, RCX);
+		as.store(RSP, 8, RAX);
+		as.jmp(head);
+
+		as.bind(exit);
+		if (this->type != ST_BOOL)
+			as.jmp(c.bail);
+		as.movImm(RAX, 0);
+		as.bind(done);
+		as.addRsp(16);
+		c.depth -= 2;
+		return true;
+	}
+};
+
+/// Builder - Infers the types of one function body and compiles it.
+/// Anything it cannot handle makes it return nullptr.
+class Builder {
+private:
+	Specialization* spec;
+	Context* root;
+
+	// Whether some type depends on a result that is not inferred yet
+	bool incomplete = false;
+
+	// Whether the body itself has code that is never specialized
+	bool unsupported = false;
+
+	// First slot of each scope the code is in, the function frame and then
+	// the loops around it, which follow one another as in the VM
+	std::vector<std::uint32_t> scopes;
+	std::uint32_t top = 0;
+
+	// Type of each slot, fixed by the first assignment, and whether it is
+	// bound for sure at this point of the body
+	std::array<StaticType, Specialization::MAX_SLOTS> types{};
+	std::array<bool, Specialization::MAX_SLOTS> bound{};
+
+	template <typename T, typename... Args>
+	const Node* make(Args&&... args) {
+		return this->spec->nodes.make<T>(std::forward<Args>(args)...);
+	}
+
+	const Node* unknown() {
+		this->incomplete = true;
+		return this->make<Const>(ST_NONE, Unboxed{});
+	}
+
+	const Node* reject() {
+		this->unsupported = true;
+		return nullptr;
+	}
+
+	// Arrays are only accepted as arguments of a call
+	bool exprs(const std::vector<ExprAST*>& in, std::vector<const Node*>& out, bool& known, bool arrays = false) {
+		known = true;
+		for (const auto& e : in) {
+			auto n = this->expr(e);
+			if (!n)
+				return false;
+			if (n->type == ST_NONE)
+				known = false;
+			else if (isArray(n->type) && !arrays)
+				return false;
+			out.push_back(n);
+		}
+		return true;
+	}
+
+	// Slot of the specialization that `s` is in
+	bool slot(VarSlot s, std::uint32_t& index) const {
+		if (s.depth >= this->scopes.size())
+			return false;
+		index = this->scopes[this->scopes.size() - 1 - s.depth] + s.index;
+		return index < Specialization::MAX_SLOTS;
+	}
+
+	const Node* variable(const std::string& name, const VarRef& ref) {
+		// The innermost slot is always read once it is bound for sure
+		if (!ref.slots.empty()) {
+			std::uint32_t index;
+			if (!this->slot(ref.slots.front(), index) || !this->bound[index])
+				return this->reject();
+			if (this->types[index] == ST_NONE)
+				return this->unknown();
+			return this->make<Local>(this->types[index], index);
+		}
+
+		// Typed by its current value, guarded on every read
+		auto var = this->root->getVariable(name);
+		auto t = var ? typeOf(*var) : ST_NONE;
+		return t == ST_NONE ? nullptr : this->make<Global>(t, name);
+	}
+
+	const Node* call(const FuncCallAST* ast);
+
+	// Assignment of the variable found through `ref` in the slot of `store`
+	const Node* assign(const std::string& name, const VarRef& ref, const VarRef& store, Token op, const ExprAST* ast) {
+		std::uint32_t index;
+		if (store.slots.empty() || !this->slot(store.slots.front(), index))
+			return this->reject();
+		auto value = this->expr(ast);
+		if (!value || isArray(value->type))
+			return nullptr;
+
+		// SETQ raises an error on a variable that is not defined yet, and
+		// INCF and DECF on one that does not hold an integer
+		if (op == SETQ && !this->bound[index]) {
+			bool defined = ref.global && this->root->getVariable(name);
+			for (const auto& s : ref.slots) {
+				std::uint32_t i;
+				defined = defined || (this->slot(s, i) && this->bound[i]);
+			}
+			if (!defined)
+				return nullptr;
+		}
+		if ((op == INCF || op == DECF) && (!this->bound[index] || (this->types[index] != ST_INT && this->types[index] != ST_NONE)))
+			return nullptr;
+
+		if (value->type == ST_NONE) {
+			this->bound[index] = true;
+			return value;
+		}
+		if ((op == INCF || op == DECF) && value->type != ST_INT)
+			return nullptr;
+		if (this->types[index] != ST_NONE && this->types[index] != value->type)
+			return nullptr;
+		this->types[index] = value->type;
+		this->bound[index] = true;
+		if (this->spec->params[index] != ST_NONE && this->scopes.size() == 1)
+			this->spec->writes = true;
+		return this->make<Store>(op, index, value);
+	}
+
+	const Node* loop(const ExprAST* ast);
+
+	const Node* list(const ListAST* ast) {
+		auto op = ast->getOp();
+		std::vector<const Node*> ops;
+		bool known;
+		if (!this->exprs(ast->getExprs(), ops, known))
+			return nullptr;
+		if (!known)
+			return this->unknown();
+
+		if (op == AND || op == OR)
+			return this->make<Pick>(std::move(ops), op == AND ? ops.size() - 1 : 0);
+		if (!ListAST::folds(op))
+			return this->reject();
+		if (ops.size() < 2)
+			return nullptr;
+
+		bool allInt = true, allFloat = true;
+		for (const auto& n : ops) {
+			if (!isNumeric(n->type))
+				return nullptr;
+			allInt = allInt && n->type == ST_INT;
+			allFloat = allFloat && n->type == ST_FLOAT;
+		}
+
+		switch (op) {
+			case PLUS:
+			case MINUS:
+			case MULTIPLY:
+			case DIVIDE:
+				if (allInt)
+					return this->make<IntFold>(op, std::move(ops));
+				return this->make<FloatFold>(op, std::move(ops));
+			case LOGAND:
+			case LOGIOR:
+			case LOGXOR:
+			case LOGEQV:
+				return allInt ? this->make<IntFold>(op, std::move(ops)) : nullptr;
+			case MAX:
+			case MIN:
+				if (!allInt && !allFloat)
+					return nullptr;
+				return this->make<Extremum>(allInt ? ST_INT : ST_FLOAT, op, std::move(ops));
+			default:
+				return this->make<Equal>(op, std::move(ops));
+		}
+	}
+
+	const Node* expr(const ExprAST* ast) {
+		switch (ast->getType()) {
+			case T_LiteralAST: {
+				const auto& v = static_cast<const LiteralAST*>(ast)->getValue();
+				auto t = typeOf(v);
+				if (t == ST_NONE || isArray(t))
+					return this->reject();
+				return this->make<Const>(t, unbox(v, t));
+			}
+
+			case T_IdentifierAST: {
+				auto id = static_cast<const IdentifierAST*>(ast);
+				return this->variable(id->getName(), id->getRef());
+			}
+
+			case T_ArrayRefAST: {
+				auto aref = static_cast<const ArrayRefAST*>(ast);
+				auto index = this->expr(aref->getIndex());
+				if (!index)
+					return nullptr;
+				auto array = this->variable(aref->getName(), aref->getRef());
+				if (!array)
+					return nullptr;
+				if (index->type == ST_NONE)
+					return this->unknown();
+				if (index->type != ST_INT || !isArray(array->type))
+					return nullptr;
+				return this->make<ARef>(array->type == ST_INT_ARRAY ? ST_INT : ST_FLOAT, array, index);
+			}
+
+			case T_FuncCallAST:
+				return this->call(static_cast<const FuncCallAST*>(ast));
+
+			case T_InlineCallAST:
+				return this->call(static_cast<const InlineCallAST*>(ast)->getCall());
+
+			case T_CachedAST:
+				return this->expr(static_cast<const CachedAST*>(ast)->getExpr());
+
+			case T_UnaryAST: {
+				auto unary = static_cast<const UnaryAST*>(ast);
+				if (unary->getOp() != NOT)
+					return this->reject();
+				auto e = this->expr(unary->getExpr());
+				if (!e || isArray(e->type))
+					return nullptr;
+				return e->type == ST_NONE ? this->unknown() : this->make<Not>(e);
+			}
+
+			case T_BinaryAST: {
+				auto binary = static_cast<const BinaryAST*>(ast);
+				auto op = binary->getOp();
+				if (op != LESS && op != LESS_EQUAL && op != GREATER && op != GREATER_EQUAL && op != MOD && op != REM && op != LOGNOR)
+					return this->reject();
+				auto l = this->expr(binary->getLHS());
+				auto r = l ? this->expr(binary->getRHS()) : nullptr;
+				if (!r)
+					return nullptr;
+				if (l->type == ST_NONE || r->type == ST_NONE)
+					return this->unknown();
+				if (!isNumeric(l->type) || !isNumeric(r->type))
+					return nullptr;
+				bool ints = l->type == ST_INT && r->type == ST_INT;
+				if (op == LOGNOR)
+					return ints ? this->make<Binary>(ST_INT, op, l, r) : nullptr;
+				if (op == MOD || op == REM)
+					return this->make<Binary>(ints ? ST_INT : ST_FLOAT, op, l, r);
+				return this->make<Binary>(ST_BOOL, op, l, r);
+			}
+
+			case T_ListAST:
+				return this->list(static_cast<const ListAST*>(ast));
+
+			case T_VarOpAST: {
+				auto var = static_cast<const VarOpAST*>(ast);
+				if (var->getOp() != SETQ)
+					return this->reject();
+				return this->assign(var->getName(), var->getRef(), var->getStoreRef(), SETQ, var->getExpr());
+			}
+
+			case T_LValOpAST: {
+				auto lvop = static_cast<const LValOpAST*>(ast);
+				if (lvop->getLVal()->getType() != T_IdentifierAST)
+					return this->reject();
+				auto id = static_cast<const IdentifierAST*>(lvop->getLVal());
+				return this->assign(id->getName(), id->getRef(), id->getStoreRef(), lvop->getOp(), lvop->getExpr());
+			}
+
+			case T_LoopForAST:
+			case T_LoopDoTimesAST:
+				return this->loop(ast);
+
+			default:
+				return this->reject();
+		}
+	}
+
+	// A statement or the branch of an IfAST statement. In a loop, `top` is
+	// not set: any return only leaves the loop, and there are no tail calls.
+	bool branch(const ExprAST* ast, Branch& out, bool top) {
+		if (!ast)
+			return true;
+		if (ast->getType() == T_IfAST)
+			return this->reject();
+		if (ast->getType() == T_ReturnAST) {
+			auto ret = static_cast<const ReturnAST*>(ast);
+			if (top && ret->getName() != this->spec->func->getName())
+				return this->reject();
+			ast = ret->getExpr();
+			out.ret = true;
+		}
+		out.expr = this->expr(ast);
+		if (!out.expr || isArray(out.expr->type))
+			return false;
+		if (top && ast->getType() == T_FuncCallAST && static_cast<const FuncCallAST*>(ast)->isTail()) {
+			auto call = dynamic_cast<const Call*>(out.expr);
+			out.tail = call && call->getTarget() == this->spec;
+		}
+		return true;
+	}
+
+	bool statements(const std::vector<ExprAST*>& in, std::vector<Stmt>& out, bool top) {
+		for (const auto& ast : in) {
+			Stmt s;
+			if (ast->getType() == T_IfAST) {
+				auto stmt = static_cast<const IfAST*>(ast);
+				s.cond = this->expr(stmt->getCond());
+				if (!s.cond || isArray(s.cond->type))
+					return false;
+
+				// What either branch binds is not bound for sure after it
+				auto bound = this->bound;
+				if (!this->branch(stmt->getThen(), s.then, top))
+					return false;
+				this->bound = bound;
+				if (!this->branch(stmt->getElse(), s.els, top))
+					return false;
+				this->bound = bound;
+			} else if (!this->branch(ast, s.then, top))
+				return false;
+			out.push_back(s);
+		}
+		return true;
+	}
+
+public:
+	Builder(Specialization* spec, Context* root) : spec(spec), root(root) {
+		this->scopes.push_back(0);
+		this->top = spec->func->getSlots();
+		this->types = spec->params;
+		for (auto s : spec->func->getArgSlots())
+			this->bound[s] = true;
+	}
+
+	inline bool isIncomplete() const {
+		return this->incomplete;
+	}
+
+	inline bool isUnsupported() const {
+		return this->unsupported;
+	}
+
+	/// Compile the body, returns its result type or ST_NONE.
+	StaticType build() {
+		if (!this->statements(this->spec->func->getBody(), this->spec->body, true))
+			return ST_NONE;
+
+		// Values the call may end with: returned ones, the last statement
+		// that is evaluated, or NIL if none is
+		std::vector<StaticType> results;
+		bool covered = false;
+		for (const auto& s : this->spec->body) {
+			for (const auto b : { &s.then, &s.els })
+				if (b->expr && b->ret)
+					results.push_back(b->expr->type);
+		}
+		for (auto it = this->spec->body.rbegin(); it != this->spec->body.rend() && !covered; ++it) {
+			for (const auto b : { &it->then, &it->els })
+				if (b->expr && !b->ret)
+					results.push_back(b->expr->type);
+			covered = !it->cond || (it->then.expr && it->els.expr);
+		}
+		if (!covered)
+			results.push_back(ST_BOOL);
+
+		// Results of the recursion itself are left out until they are known
+		StaticType ret = ST_NONE;
+		for (auto t : results) {
+			if (t == ST_NONE)
+				continue;
+			if (ret != ST_NONE && ret != t)
+				return ST_NONE;
+			ret = t;
+		}
+		return ret;
+	}
+};
+
+Specialization* find(FuncDefAST* func, const std::array<StaticType, Specialization::MAX_SLOTS>& params, const FuncTable* table) {
+	for (auto spec : func->getSpecs())
+		if (spec->params == params && spec->table == table)
+			return spec;
+	return nullptr;
+}
+
+// Specialization of `func` for the given parameter types, compiled against
+// the current definitions of every function it calls
+Specialization* specialize(FuncDefAST* func, const std::array<StaticType, Specialization::MAX_SLOTS>& params, Context* root) {
+	const FuncTable* table = root->getFuncTable();
+	auto epoch = table->epoch.load(std::memory_order_acquire);
+	auto spec = find(func, params, table);
+	if (spec && spec->epoch == epoch)
+		return spec->state == Specialization::SPEC_FAILED ? nullptr : spec;
+	auto& specs = func->getSpecs();
+	if (spec) {
+		// Compiled against older definitions. Futures may still be running
+		// it, unless there are none, so it is replaced rather than rebuilt.
+		specs.erase(std::find(specs.begin(), specs.end(), spec));
+		if (Scheduler::isStarted())
+			func->getRetiredSpecs().push_back(spec);
+		else
+			Specializer::release(spec);
+	} else if (specs.size() >= Specialization::MAX_PER_FUNC)
+		return nullptr;
+	spec = new Specialization(func);
+	spec->params = params;
+	spec->table = table;
+	spec->epoch = epoch;
+	specs.push_back(spec);
+
+	// Assume a result type for recursive calls until it stops changing
+	for (int round = 0; round < 3; round++) {
+		spec->nodes.clear();
+		spec->body.clear();
+		spec->writes = false;
+		Builder b(spec, root);
+		auto result = b.build();
+		if (b.isUnsupported())
+			func->setUnboxable(false);
+		if (result == ST_NONE)
+			break;
+		if (result == spec->result && !b.isIncomplete()) {
+			spec->state = Specialization::SPEC_READY;
+			return spec;
+		}
+		spec->result = result;
+	}
+
+	spec->nodes.clear();
+	spec->body.clear();
+	spec->state = Specialization::SPEC_FAILED;
+	return nullptr;
+}
+
+const Node* Builder::loop(const ExprAST* ast) {
+	const Node* start = nullptr;
+	const Node* end = nullptr;
+	const std::vector<ExprAST*>* in;
+	std::uint32_t slots;
+	if (ast->getType() == T_LoopForAST) {
+		auto loop = static_cast<const LoopForAST*>(ast);
+		start = this->expr(loop->getStart());
+		end = start ? this->expr(loop->getEnd()) : nullptr;
+		in = &loop->getBody();
+		slots = loop->getSlots();
+		if (!end)
+			return nullptr;
+		if (start->type == ST_NONE || end->type == ST_NONE)
+			return this->unknown();
+		// Float bounds step a boxed number, and others raise an error
+		if (start->type != ST_INT || end->type != ST_INT)
+			return nullptr;
+	} else {
+		// Parallel iterations write arrays
+		auto loop = static_cast<const LoopDoTimesAST*>(ast);
+		if (loop->isParallel())
+			return this->reject();
+		end = this->expr(loop->getTimes());
+		in = &loop->getBody();
+		slots = loop->getSlots();
+		if (!end)
+			return nullptr;
+		if (end->type == ST_NONE)
+			return this->unknown();
+		if (end->type != ST_INT)
+			return nullptr;
+	}
+
+	// The scope of the loop, with the induction variable in its first slot
+	auto base = this->top;
+	if (base + slots > Specialization::MAX_SLOTS)
+		return this->reject();
+	this->scopes.push_back(base);
+	this->top += slots;
+	for (auto i = base; i < this->top; i++) {
+		this->types[i] = ST_NONE;
+		this->bound[i] = false;
+	}
+	this->types[base] = ST_INT;
+	this->bound[base] = true;
+	std::vector<Stmt> body;
+	bool built = this->statements(*in, body, false);
+	this->scopes.pop_back();
+	this->top = base;
+	if (!built)
+		return nullptr;
+
+	// Typed by the values it returns, NIL if it returns none
+	StaticType t = ST_NONE;
+	bool known = true;
+	for (const auto& s : body) {
+		for (const auto b : { &s.then, &s.els }) {
+			if (!b->expr || !b->ret)
+				continue;
+			if (b->expr->type == ST_NONE)
+				known = false;
+			else if (t != ST_NONE && t != b->expr->type)
+				return nullptr;
+			else
+				t = b->expr->type;
+		}
+	}
+	if (!known)
+		return this->unknown();
+	return this->make<Loop>(t == ST_NONE ? ST_BOOL : t, start, end, base, std::move(body), this->spec);
+}
+
+const Node* Builder::call(const FuncCallAST* ast) {
+	// Memoized callees are only called through their cache
+	auto func = this->root->getFunc(ast->getName());
+	if (!func || func->getMemo() || func->getSlots() > Specialization::MAX_SLOTS)
+		return nullptr;
+	const auto& argSlots = func->getArgSlots();
+	if (ast->getArgs().size() < argSlots.size())
+		return nullptr;
+
+	std::vector<const Node*> args;
+	bool known;
+	if (!this->exprs(ast->getArgs(), args, known, true))
+		return nullptr;
+	if (!known)
+		return this->unknown();
+
+	std::array<StaticType, Specialization::MAX_SLOTS> params{};
+	for (std::size_t i = 0; i < argSlots.size(); i++)
+		params[argSlots[i]] = args[i]->type;
+
+	// Recursion while this body is built, with the result assumed so far
+	auto self = find(func, params, this->root->getFuncTable());
+	if (self == this->spec) {
+		if (self->result == ST_NONE)
+			return this->unknown();
+		return this->make<Call>(self, std::move(args));
+	}
+	if (self && self->state == Specialization::SPEC_BUILDING)
+		return nullptr;
+
+	auto target = specialize(func, params, this->root);
+	return target ? this->make<Call>(target, std::move(args)) : nullptr;
+}
+
+// Called from native code for nodes it does not compile
+bool evaluate(const Node* n, Unboxed* slots, Context* root, Unboxed* ret) noexcept {
+	try {
+		Frame f{ slots, root };
+		*ret = n->eval(f);
+		return true;
+	} catch (...) {
+		return false;
+	}
+}
+
+bool interpret(Unboxed* slots, Unboxed* ret, Context* root, Specialization* self) noexcept {
+	try {
+		*ret = invoke(self, slots, root);
+		return true;
+	} catch (...) {
+		return false;
+	}
+}
+
+void NativeCompiler::expr(const Node* n) {
+	if (n->emit(*this))
+		return;
+
+	// Room for the result, rsp aligned at the call
+	std::int32_t room = this->depth % 2 ? 8 : 16;
+	this->as.subRsp(room);
+	this->as.movImm(RDI, reinterpret_cast<std::uint64_t>(n));
+	this->as.mov(RSI, RBX);
+	this->as.mov(RDX, R12);
+	this->as.mov(RCX, RSP);
+	this->as.movImm(RAX, reinterpret_cast<std::uint64_t>(&evaluate));
+	this->as.call(RAX);
+	this->as.testByte(RAX);
+	this->as.jcc(CC_E, this->bail);
+	this->load(n->type, RSP, 0);
+	this->as.addRsp(room);
+}
+
+void NativeCompiler::function(const Specialization* spec) {
+	auto& as = this->as;
+	as.push(RBP);
+	as.mov(RBP, RSP);
+	as.push(RBX);
+	as.push(R12);
+	as.push(R13);
+	as.push(R14);
+	as.mov(RBX, RDI);
+	as.mov(R13, RSI);
+	as.mov(R12, RDX);
+
+	// Bail out past the limit of the EvalStack, rsp is aligned here
+	auto deep = as.newLabel();
+	as.loadFs(RAX, EvalStack::limitOffset());
+	as.cmp(RSP, RAX);
+	as.jcc(CC_B, deep);
+
+	auto top = as.newLabel();
+	as.bind(top);
+	as.movImm(R14, 0);
+
+	this->bail = as.newLabel();
+	auto done = as.newLabel();
+	auto branch = [&](const Branch& b) {
+		if (!b.expr)
+			return;
+		if (b.tail) {
+			static_cast<const Call*>(b.expr)->emitTail(*this);
+			as.jmp(top);
+			return;
+		}
+		this->expr(b.expr);
+		if (b.ret)
+			as.jmp(done);
+		else
+			as.mov(R14, RAX);
+	};
+	for (const auto& s : spec->body) {
+		auto els = as.newLabel();
+		auto next = as.newLabel();
+		if (s.cond) {
+			this->expr(s.cond);
+			if (s.cond->type == ST_BOOL) {
+				as.test(RAX, RAX);
+				as.jcc(CC_E, els);
+			}
+		}
+		branch(s.then);
+		as.jmp(next);
+		as.bind(els);
+		branch(s.els);
+		as.bind(next);
+	}
+	as.mov(RAX, R14);
+
+	auto leave = [&]() {
+		as.lea(RSP, RBP, -32);
+		as.pop(R14);
+		as.pop(R13);
+		as.pop(R12);
+		as.pop(RBX);
+		as.pop(RBP);
+		as.ret();
+	};
+	as.bind(done);
+	as.store(R13, 0, RAX);
+	as.movImm(RAX, 1);
+	leave();
+	as.bind(deep);
+	as.movImm(RAX, reinterpret_cast<std::uint64_t>(&EvalStack::markOverflow));
+	as.call(RAX);
+	as.bind(this->bail);
+	as.movImm(RAX, 0);
+	leave();
+	as.finish();
+}
+
+void compile(Specialization* spec, Jit* jit) {
+	NativeCompiler c;
+	c.function(spec);
+
+	static const char* const names[] = { "?", "int", "float", "bool", "int[]", "float[]" };
+	std::string name = "lisp::" + spec->func->getName() + "(";
+	for (auto s : spec->func->getArgSlots())
+		name.append(names[spec->params[s]]).append(",");
+	if (name.back() == ',')
+		name.pop_back();
+	name += ")";
+
+	if (auto code = jit->install(c.as.getCode(), name))
+		spec->native = spec->entry = reinterpret_cast<Specialization::NativeFn>(code);
+}
+
+// Count `n` calls or loop iterations of `spec`, compiling it once hot
+void warm(Specialization* spec, Context* root, std::uint32_t n) {
+	auto jit = root->getJit();
+	if (!jit || spec->calls.load(std::memory_order_relaxed) >= Jit::HOT_CALLS)
+		return;
+	auto calls = spec->calls.fetch_add(n, std::memory_order_relaxed);
+	if (calls < Jit::HOT_CALLS && calls + n >= Jit::HOT_CALLS)
+		compile(spec, jit);
+}
+
+Unboxed invoke(Specialization* spec, Unboxed* slots, Context* root) {
+	EvalStack::check();
+	if (auto native = spec->native.load(std::memory_order_acquire)) {
+		Unboxed saved[Specialization::MAX_SLOTS];
+		if (spec->writes)
+			std::copy(slots, slots + Specialization::MAX_SLOTS, saved);
+		Unboxed ret;
+		if (native(slots, &ret, root, spec))
+			return ret;
+		if (spec->writes)
+			std::copy(saved, saved + Specialization::MAX_SLOTS, slots);
+		// Bailed out, the interpreter raises the error or deoptimizes. Past
+		// the stack limit, running it again would only go as deep.
+		if (EvalStack::hasOverflowed())
+			EvalStack::overflow();
+	} else
+		warm(spec, root, 1);
+	Frame f{ slots, root };
+	return spec->run(f);
+}
+
+} // namespace
+
+Unboxed Specialization::run(Frame& f) const {
+	while (true) {
+		Unboxed ret;
+		ret.b = false;
+		const Branch* tail = nullptr;
+		for (const auto& s : this->body) {
+			const Branch* b = &s.then;
+			if (s.cond) {
+				auto c = s.cond->eval(f);
+				if (s.cond->type == ST_BOOL && !c.b)
+					b = &s.els;
+			}
+			if (!b->expr)
+				continue;
+			if (b->tail) {
+				tail = b;
+				break;
+			}
+			auto v = b->expr->eval(f);
+			if (b->ret)
+				return v;
+			ret = v;
+		}
+		if (!tail)
+			return ret;
+
+		Unboxed slots[MAX_SLOTS];
+		static_cast<const Call*>(tail->expr)->bind(f, slots);
+		for (auto s : this->func->getArgSlots())
+			f.slots[s] = slots[s];
+	}
+}
+
+bool Specializer::call(FuncDefAST* func, Context* frame, Value& ret) {
+	if (!func->isUnboxable() || func->getSlots() > Specialization::MAX_SLOTS)
+		return false;
+
+	std::array<StaticType, Specialization::MAX_SLOTS> params{};
+	for (auto s : func->getArgSlots()) {
+		params[s] = typeOf(frame->getSlot({ 0, s }));
+		if (params[s] == ST_NONE)
+			return false;
+	}
+
+	auto root = frame->getRoot();
+	std::unique_lock<std::mutex> guard(root->getFuncTable()->specializing, std::defer_lock);
+	if (Scheduler::isStarted())
+		guard.lock();
+	auto spec = specialize(func, params, root);
+	if (guard.owns_lock())
+		guard.unlock();
+	if (!spec)
+		return false;
+
+	Unboxed slots[Specialization::MAX_SLOTS];
+	for (auto s : func->getArgSlots())
+		slots[s] = unbox(frame->getSlot({ 0, s }), params[s]);
+	try {
+		ret = box(invoke(spec, slots, root), spec->result);
+	} catch (const Deopt& d) {
+		if (d.keep)
+			return false;
+		if (Scheduler::isStarted())
+			guard.lock();
+		spec->state = Specialization::SPEC_FAILED;
+		return false;
+	}
+	return true;
+}
+
+void Specializer::release(Specialization* spec) {
+	delete spec;
+}
+
+} // namespace DragonLisp
@@ -0,0 +1,56 @@
+#ifndef __DRAGON_LISP_SPECIALIZER_H__
+#define __DRAGON_LISP_SPECIALIZER_H__
+
+#include <cstdint>
+
+#include "AST.h"
+
+namespace DragonLisp {
+
+/// StaticType - Type of a value known before the code runs.
+enum StaticType : std::uint8_t {
+	ST_NONE,	// not known, or not known yet while a recursive function is inferred
+	ST_INT,
+	ST_FLOAT,
+	ST_BOOL,	// T or NIL
+	ST_INT_ARRAY,	// array with packed int storage, only indexed or passed on
+	ST_FLOAT_ARRAY,	// array with packed float storage, only indexed or passed on
+};
+
+/// Specialization - A function compiled for one set of argument types.
+/// Defined in Specializer.cpp.
+struct Specialization;
+
+/// Specializer - Runs numeric functions on unboxed values.
+///
+/// The first call of a function with a given set of argument types infers
+/// the type of every expression of its body, starting from the arguments
+/// and literals; calls to other functions are inferred the same way with
+/// their argument types. If every type is known, the body is compiled into
+/// a tree of typed nodes that work on raw int64_t, double and bool values,
+/// and that call each other's specializations directly.
+///
+/// The body may read parameters, local and global variables and array
+/// elements, assign local variables, do arithmetic and comparisons, call
+/// qualifying functions, run counted loops on integers and branch or return
+/// at statement level. Local variables live in slots of the specialization
+/// alone, each with a single type, and are only read where they are bound
+/// for sure. Types that depend on the data, those of global variables and
+/// array elements, are guarded. As nothing outside those slots has been
+/// modified when a guard fails, the call is then simply made again with
+/// the generic engine, which is used for those argument types from then
+/// on. A loop typed by the values it returns that runs to its end instead
+/// only has that one call made again.
+class Specializer {
+public:
+	/// Call `func` with the arguments bound in `frame`, unboxed. Returns
+	/// false if there is no specialization for their types, in which case
+	/// the frame is left untouched for the generic call.
+	static bool call(FuncDefAST* func, Context* frame, Value& ret);
+
+	static void release(Specialization* spec);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_SPECIALIZER_H__
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <utility>
+
+#include "ThreadPool.h"
+
+namespace DragonLisp {
+
+ThreadPool::ThreadPool() : shares(std::max(1u, std::thread::hardware_concurrency())) {
+	for (unsigned i = 1; i < this->shares.size(); i++)
+		this->threads.emplace_back(&ThreadPool::loop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->shutdown = true;
+	}
+	this->wake.notify_all();
+	for (auto& t : this->threads)
+		t.join();
+}
+
+ThreadPool& ThreadPool::get() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::loop(unsigned worker) {
+	std::uint64_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(this->lock);
+			this->wake.wait(guard, [&] { return this->shutdown || this->generation != seen; });
+			if (this->shutdown)
+				return;
+			seen = this->generation;
+		}
+		this->participate(worker);
+		std::lock_guard<std::mutex> guard(this->lock);
+		if (!--this->pending)
+			this->done.notify_one();
+	}
+}
+
+// Next chunk of a participant, from its own share or stolen from another.
+bool ThreadPool::take(unsigned worker, std::int64_t& begin, std::int64_t& end) {
+	auto& own = this->shares[worker];
+	{
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (own.begin < own.end) {
+			begin = own.begin;
+			end = std::min(own.end, own.begin + this->grain);
+			own.begin = end;
+			return true;
+		}
+	}
+
+	auto n = this->shares.size();
+	for (unsigned k = 1; k < n; k++) {
+		auto& victim = this->shares[(worker + k) % n];
+		std::int64_t lo, hi;
+		{
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (victim.begin >= victim.end)
+				continue;
+			lo = victim.begin + (victim.end - victim.begin) / 2;
+			hi = victim.end;
+			victim.end = lo;
+		}
+		begin = lo;
+		end = std::min(hi, lo + this->grain);
+		std::lock_guard<std::mutex> guard(own.lock);
+		own.begin = end;
+		own.end = hi;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::participate(unsigned worker) {
+	ThreadPool::inside = true;
+	std::int64_t begin, end;
+	while (this->take(worker, begin, end)) {
+		if (this->failed.load(std::memory_order_relaxed))
+			break;
+		try {
+			(*this->chunk)(begin, end, worker);
+		} catch (...) {
+			std::lock_guard<std::mutex> guard(this->lock);
+			if (!this->failed.exchange(true))
+				this->error = std::current_exception();
+			break;
+		}
+	}
+	ThreadPool::inside = false;
+}
+
+void ThreadPool::run(std::int64_t begin, std::int64_t end, std::int64_t grain, const Chunk& f) {
+	std::unique_lock<std::mutex> job(this->busy, std::try_to_lock);
+	if (!job.owns_lock() || this->shares.size() == 1 || ThreadPool::inside) {
+		auto outer = std::exchange(ThreadPool::inside, true);
+		try {
+			f(begin, end, 0);
+		} catch (...) {
+			ThreadPool::inside = outer;
+			throw;
+		}
+		ThreadPool::inside = outer;
+		return;
+	}
+
+	// Equal shares to start with
+	auto n = static_cast<std::int64_t>(this->shares.size());
+	auto total = end - begin;
+	for (std::int64_t i = 0; i < n; i++) {
+		auto& share = this->shares[i];
+		std::lock_guard<std::mutex> guard(share.lock);
+		share.begin = begin + total * i / n;
+		share.end = begin + total * (i + 1) / n;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->chunk = &f;
+		this->grain = std::max<std::int64_t>(grain, 1);
+		this->failed = false;
+		this->error = nullptr;
+		this->pending = this->threads.size();
+		this->generation++;
+	}
+	this->wake.notify_all();
+
+	this->participate(0);
+
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->done.wait(guard, [&] { return !this->pending; });
+	this->chunk = nullptr;
+	if (this->failed)
+		std::rethrow_exception(std::exchange(this->error, nullptr));
+}
+
+} // namespace DragonLisp
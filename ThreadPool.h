@@ -0,0 +1,91 @@
+#ifndef __DRAGON_LISP_THREAD_POOL_H__
+#define __DRAGON_LISP_THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DragonLisp {
+
+/// ThreadPool - Threads splitting the iterations of a parallel loop.
+///
+/// Every participant, the calling thread included, starts with an equal
+/// share of the range and runs it in chunks of `grain` iterations. One that
+/// runs out steals the upper half of what is left to another, so uneven
+/// iterations still keep every thread busy until the end.
+class ThreadPool {
+public:
+	/// Runs the iterations [begin, end) on participant `worker`, which is 0
+	/// for the calling thread.
+	using Chunk = std::function<void(std::int64_t begin, std::int64_t end, unsigned worker)>;
+
+private:
+	// Remaining iterations of a participant, on a cache line of its own
+	struct alignas(64) Share {
+		std::mutex lock;
+		std::int64_t begin = 0;
+		std::int64_t end = 0;
+	};
+
+	std::vector<std::thread> threads;
+	std::vector<Share> shares;
+
+	// Held by the thread running a job
+	std::mutex busy;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::uint64_t generation = 0;
+	unsigned pending = 0;
+	bool shutdown = false;
+
+	// The current job
+	const Chunk* chunk = nullptr;
+	std::int64_t grain = 1;
+	std::atomic<bool> failed = false;
+	std::exception_ptr error;
+
+	static thread_local inline bool inside = false;
+
+	ThreadPool();
+
+	void loop(unsigned worker);
+	void participate(unsigned worker);
+	bool take(unsigned worker, std::int64_t& begin, std::int64_t& end);
+
+public:
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/// The pool, with a thread per hardware thread, started on first use.
+	static ThreadPool& get();
+
+	/// Participants of a job, the calling thread included.
+	unsigned getWorkers() const {
+		return this->shares.size();
+	}
+
+	/// Whether this thread is running a chunk. Loops nested in a chunk run
+	/// serially.
+	static bool inWorker() {
+		return ThreadPool::inside;
+	}
+
+	/// Run `f` over [begin, end) and wait for it. After an exception no new
+	/// chunks are started, and the first one is rethrown here. A job started
+	/// while another thread runs one is run by the calling thread alone.
+	void run(std::int64_t begin, std::int64_t end, std::int64_t grain, const Chunk& f);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_THREAD_POOL_H__
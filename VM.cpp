@@ -0,0 +1,422 @@
+#include <stdexcept>
+
+#include "Specializer.h"
+#include "VM.h"
+
+namespace DragonLisp {
+
+const Chunk* VM::getChunk(const FuncDefAST* func) {
+	auto it = this->funcs.find(func);
+	if (it == this->funcs.end())
+		it = this->funcs.emplace(func, this->compiler.compile(func)).first;
+	return it->second.get();
+}
+
+Value VM::execute(const ExprAST* expr) {
+	auto chunk = this->compiler.compile(expr);
+	auto base = this->stack.size();
+	this->stack.resize(base + chunk->slots, Value::unbound());
+	this->frames.push_back({ chunk.get(), 0, base });
+	try {
+		return this->run();
+	} catch (...) {
+		this->frames.clear();
+		this->stack.clear();
+		throw;
+	}
+}
+
+Value VM::run() {
+	auto& stack = this->stack;
+	auto pop = [&stack]() {
+		auto v = std::move(stack.back());
+		stack.pop_back();
+		return v;
+	};
+
+	auto* frame = &this->frames.back();
+	auto* chunk = frame->chunk;
+	auto ip = frame->ip;
+
+	auto slot = [&](std::uint32_t index) -> Value& {
+		return stack[frame->base + index];
+	};
+
+	// The frame the code shared with the tree engine sees, valid until the
+	// operand stack grows
+	auto ctx = [&](std::size_t base) {
+		this->view.borrow(stack.data() + base);
+		return &this->view;
+	};
+
+	// Return from the function frame on top
+	auto leave = [&](Value v) {
+		if (frame->memo)
+			frame->memo->insert(std::move(frame->key), v.copy());
+		stack.resize(frame->base);
+		stack.push_back(std::move(v));
+		this->frames.pop_back();
+		frame = &this->frames.back();
+		chunk = frame->chunk;
+		ip = frame->ip;
+	};
+
+	while (true) {
+		auto op = static_cast<OpCode>(chunk->code[ip++]);
+		switch (op) {
+			case OP_CONST:
+				stack.push_back(chunk->constants[chunk->readOperand(ip)]);
+				ip += 4;
+				break;
+
+			case OP_NIL:
+				stack.emplace_back();
+				break;
+
+			case OP_POP:
+				stack.pop_back();
+				break;
+
+			case OP_REPLACE: {
+				auto v = pop();
+				stack.back() = std::move(v);
+				break;
+			}
+
+			case OP_SLIDE: {
+				auto n = chunk->readOperand(ip);
+				ip += 4;
+				auto v = pop();
+				stack.resize(stack.size() - n);
+				stack.push_back(std::move(v));
+				break;
+			}
+
+			case OP_LOAD: {
+				const auto& name = chunk->names[chunk->readOperand(ip)];
+				const auto& ref = chunk->refs[chunk->readOperand(ip + 4)];
+				ip += 8;
+				auto var = ctx(frame->base)->getVariable(name, ref);
+				if (!var)
+					throw std::runtime_error("Variable not found: " + name);
+				stack.push_back(var->copy());
+				break;
+			}
+
+			case OP_LOAD_SLOT:
+				stack.push_back(slot(chunk->readOperand(ip)).copy());
+				ip += 4;
+				break;
+
+			case OP_STORE:
+				this->global->setVariable(chunk->names[chunk->readOperand(ip)], chunk->refs[chunk->readOperand(ip + 4)], stack.back());
+				ip += 8;
+				break;
+
+			case OP_STORE_COPY:
+				this->global->setVariable(chunk->names[chunk->readOperand(ip)], chunk->refs[chunk->readOperand(ip + 4)], stack.back().copy());
+				ip += 8;
+				break;
+
+			case OP_STORE_SLOT:
+				slot(chunk->readOperand(ip)) = stack.back();
+				ip += 4;
+				break;
+
+			case OP_STORE_COPY_SLOT:
+				slot(chunk->readOperand(ip)) = stack.back().copy();
+				ip += 4;
+				break;
+
+			case OP_UNBIND: {
+				auto first = chunk->readOperand(ip);
+				auto n = chunk->readOperand(ip + 4);
+				ip += 8;
+				for (std::uint32_t i = 0; i < n; i++)
+					slot(first + i) = Value::unbound();
+				break;
+			}
+
+			case OP_CACHE_LOAD: {
+				const auto& cached = slot(chunk->readOperand(ip));
+				if (cached.isUnbound()) {
+					ip += 8;
+					break;
+				}
+				stack.push_back(cached);
+				ip = chunk->readOperand(ip + 4);
+				break;
+			}
+
+			case OP_CACHE_STORE:
+				slot(chunk->readOperand(ip)) = stack.back();
+				ip += 4;
+				break;
+
+			case OP_DEFCONST:
+				this->global->defineConstant(chunk->names[chunk->readOperand(ip)], stack.back().copy());
+				ip += 4;
+				break;
+
+			case OP_CHECK_VAR: {
+				const auto& name = chunk->names[chunk->readOperand(ip)];
+				const auto& ref = chunk->refs[chunk->readOperand(ip + 4)];
+				ip += 8;
+				if (!ctx(frame->base)->hasVariable(name, ref))
+					throw std::runtime_error("Variable not defined: " + name);
+				break;
+			}
+
+			case OP_AREF: {
+				const auto& name = chunk->names[chunk->readOperand(ip)];
+				const auto& ref = chunk->refs[chunk->readOperand(ip + 4)];
+				ip += 8;
+				stack.back() = ArrayRefAST::load(ctx(frame->base), name, ref, stack.back());
+				break;
+			}
+
+			case OP_ASET: {
+				const auto& name = chunk->names[chunk->readOperand(ip)];
+				const auto& ref = chunk->refs[chunk->readOperand(ip + 4)];
+				ip += 8;
+				auto idx = pop();
+				stack.back() = ArrayRefAST::store(ctx(frame->base), name, ref, idx, stack.back());
+				break;
+			}
+
+			case OP_INCDEC: {
+				auto op = static_cast<Token>(chunk->readOperand(ip));
+				ip += 4;
+				auto original = pop();
+				stack.back() = LValOpAST::applyDelta(op, original, stack.back());
+				break;
+			}
+
+			case OP_FUTURE: {
+				auto future = chunk->futures[chunk->readOperand(ip)];
+				auto refs = chunk->refs.data() + chunk->readOperand(ip + 4);
+				ip += 8;
+				auto v = future->spawn(ctx(frame->base), refs);
+				stack.push_back(std::move(v));
+				break;
+			}
+
+			case OP_UNARY: {
+				auto op = static_cast<Token>(chunk->readOperand(ip));
+				ip += 4;
+				stack.back() = UnaryAST::apply(op, stack.back(), this->global);
+				break;
+			}
+
+			case OP_BINARY: {
+				auto op = static_cast<Token>(chunk->readOperand(ip));
+				ip += 4;
+				auto rhs = pop();
+				stack.back() = BinaryAST::apply(op, stack.back(), rhs);
+				break;
+			}
+
+			case OP_LIST: {
+				auto op = static_cast<Token>(chunk->readOperand(ip));
+				auto n = chunk->readOperand(ip + 4);
+				ip += 8;
+				auto v = ListAST::apply(op, std::span<Value>(stack.data() + stack.size() - n, n));
+				stack.resize(stack.size() - n);
+				stack.push_back(std::move(v));
+				break;
+			}
+
+			case OP_JUMP:
+				ip = chunk->readOperand(ip);
+				break;
+
+			case OP_JUMP_IF_NIL:
+				if (IfAST::isTrue(pop()))
+					ip += 4;
+				else
+					ip = chunk->readOperand(ip);
+				break;
+
+			case OP_CHECK_FUNC: {
+				auto& site = chunk->calls[chunk->readOperand(ip)];
+				ip += 4;
+				const auto& name = chunk->names[site.name];
+				if (!this->global->getFunc(name, site.cache))
+					throw std::runtime_error("Function not defined: " + name);
+				break;
+			}
+
+			case OP_INLINE: {
+				auto& site = chunk->calls[chunk->readOperand(ip)];
+				if (this->global->getFunc(chunk->names[site.name], site.cache) == site.inlined)
+					ip += 8;
+				else
+					ip = chunk->readOperand(ip + 4);
+				break;
+			}
+
+			case OP_CALL:
+			case OP_TAIL_CALL: {
+				auto& site = chunk->calls[chunk->readOperand(ip)];
+				std::size_t n = chunk->readOperand(ip + 4);
+				ip += 8;
+				auto func = this->global->getFunc(chunk->names[site.name], site.cache);
+				if (site.compiled != func) {
+					site.callee = this->getChunk(func);
+					site.compiled = func;
+				}
+				auto callee = site.callee;
+				auto args = stack.size() - n;
+
+				// A memoized callee is called through its cache instead
+				if (op == OP_TAIL_CALL && !func->getMemo()) {
+					// Lay out the caller's frame again, which is a function
+					// frame as a tail call is never inside a loop
+					if (callee->params.size() > n)
+						throw std::runtime_error("Too few arguments");
+					this->args.assign(std::make_move_iterator(stack.begin() + args), std::make_move_iterator(stack.end()));
+					stack.resize(frame->base);
+					stack.resize(frame->base + callee->slots, Value::unbound());
+					for (std::size_t i = 0; i < callee->params.size(); i++)
+						slot(callee->params[i]) = std::move(this->args[i]);
+					this->args.clear();
+
+					frame->chunk = callee;
+					chunk = callee;
+					ip = 0;
+
+					Value ret;
+					if (Specializer::call(func, ctx(frame->base), ret))
+						leave(std::move(ret));
+					break;
+				}
+
+				if (this->frames.size() > this->maxDepth)
+					throw std::runtime_error("Maximum recursion depth exceeded");
+
+				// The arguments become the first slots of the callee's frame
+				if (callee->params.size() > n)
+					throw std::runtime_error("Too few arguments");
+				if (callee->inOrder && callee->params.size() == n) {
+					stack.resize(args + callee->slots, Value::unbound());
+				} else {
+					this->args.assign(std::make_move_iterator(stack.begin() + args), std::make_move_iterator(stack.end()));
+					stack.resize(args);
+					stack.resize(args + callee->slots, Value::unbound());
+					for (std::size_t i = 0; i < callee->params.size(); i++)
+						stack[args + callee->params[i]] = std::move(this->args[i]);
+					this->args.clear();
+				}
+
+				MemoCache::Key key;
+				auto memo = func->getMemo();
+				if (memo && !MemoCache::makeKey(ctx(args), callee->params, key))
+					memo = nullptr;
+				if (memo) {
+					Value hit;
+					if (memo->find(key, hit)) {
+						stack.resize(args);
+						stack.push_back(std::move(hit));
+						break;
+					}
+				}
+
+				// Numeric functions run unboxed when the argument types allow it
+				Value ret;
+				if (Specializer::call(func, ctx(args), ret)) {
+					if (memo)
+						memo->insert(std::move(key), ret.copy());
+					stack.resize(args);
+					stack.push_back(std::move(ret));
+					break;
+				}
+
+				frame->ip = ip;
+				this->frames.push_back({ callee, 0, args, memo, std::move(key) });
+				frame = &this->frames.back();
+				chunk = callee;
+				ip = 0;
+				break;
+			}
+
+			case OP_RETURN:
+				leave(pop());
+				break;
+
+			case OP_HALT: {
+				auto v = pop();
+				stack.resize(frame->base);
+				this->frames.pop_back();
+				return v;
+			}
+
+			case OP_THROW:
+				throw std::runtime_error(chunk->names[chunk->readOperand(ip)]);
+
+			case OP_FOR_INIT: {
+				auto& s = stack[stack.size() - 2];
+				s = s.copy();
+				if (!s.isNumber() || !stack.back().isNumber())
+					throw std::runtime_error("LoopForAST: start and end must be numeric");
+				break;
+			}
+
+			case OP_FOR_TEST: {
+				const auto& s = stack[stack.size() - 2];
+				if (!(s <= stack.back())) {
+					ip = chunk->readOperand(ip + 4);
+					break;
+				}
+				slot(chunk->readOperand(ip)) = s;
+				ip += 8;
+				break;
+			}
+
+			case OP_FOR_STEP: {
+				// Back to the test, or past it once an integer reached the
+				// end, as the next step could be past the largest integer
+				auto head = chunk->readOperand(ip);
+				auto& s = stack[stack.size() - 2];
+				const auto& e = stack.back();
+				if (s.isInt() && e.isInt() && s.getInt() == e.getInt()) {
+					ip = chunk->readOperand(head + 5);
+					break;
+				}
+				++s;
+				ip = head;
+				break;
+			}
+
+			case OP_TIMES_INIT: {
+				if (!stack.back().isInt())
+					throw std::runtime_error("DOTIMES: times must be an integer");
+				auto terminate = std::move(stack.back());
+				stack.back() = Value(std::int64_t(0));
+				stack.push_back(std::move(terminate));
+				break;
+			}
+
+			case OP_TIMES_TEST: {
+				auto i = stack[stack.size() - 2].getInt();
+				auto n = stack.back().getInt();
+				if (i >= n) {
+					ip = chunk->readOperand(ip + 4);
+					break;
+				}
+				slot(chunk->readOperand(ip)) = Value(i);
+				ip += 8;
+				break;
+			}
+
+			case OP_TIMES_STEP:
+				++stack[stack.size() - 2];
+				ip = chunk->readOperand(ip);
+				break;
+
+			default:
+				throw std::runtime_error("Unexpected error");
+		}
+	}
+}
+
+} // namespace DragonLisp
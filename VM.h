@@ -0,0 +1,67 @@
+#ifndef __DRAGON_LISP_VM_H__
+#define __DRAGON_LISP_VM_H__
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Bytecode.h"
+
+namespace DragonLisp {
+
+/// VM - Operand-stack interpreter for compiled Chunks.
+/// Calls push a Frame instead of recursing on the native stack, so the
+/// depth of recursion is only bounded by `maxDepth` frames. The slots of a
+/// frame are kept on the operand stack, below its operands, so that
+/// neither calls nor counted loops make a Context. Numeric functions are
+/// called through the Specializer, as the tree engine does.
+class VM {
+private:
+	struct Frame {
+		const Chunk* chunk;
+		std::size_t ip;
+
+		// Operand stack index of the first slot of this frame, which its
+		// operands follow
+		std::size_t base;
+
+		// Where the result goes, for calls of memoized functions
+		MemoCache* memo = nullptr;
+		MemoCache::Key key;
+	};
+
+	Context* global;
+
+	// Frame under the global context for the code shared with the tree
+	// engine, pointed at the slots of the VM frame that calls it
+	Context view;
+
+	std::size_t maxDepth;
+
+	BytecodeCompiler compiler;
+
+	// Compiled function bodies. FuncDefASTs live in the parse arena, so an
+	// address is never reused by a redefinition while the VM is alive.
+	std::unordered_map<const FuncDefAST*, std::unique_ptr<Chunk>> funcs;
+
+	std::vector<Value> stack;
+
+	// Arguments of a tail call while the frame is laid out again
+	std::vector<Value> args;
+
+	std::vector<Frame> frames;
+
+	const Chunk* getChunk(const FuncDefAST* func);
+
+	Value run();
+
+public:
+	VM(Context* global, std::size_t maxDepth) : global(global), view(global), maxDepth(maxDepth) {}
+
+	Value execute(const ExprAST* expr);
+};
+
+} // namespace DragonLisp
+
+#endif // __DRAGON_LISP_VM_H__
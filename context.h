@@ -1,68 +1,552 @@
 #ifndef __DRAGON_LISP_CONTEXT_H__
 #define __DRAGON_LISP_CONTEXT_H__
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
 #include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
 #include <utility>
 #include <variant>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "FutureGroup.h"
 #include "value.h"
 
 namespace DragonLisp {
 
 class FuncDefAST;
+class Jit;
+
+/// VarSlot - Lexical address of a variable: parent hops and slot index.
+struct VarSlot {
+	std::uint32_t depth;
+	std::uint32_t index;
+};
+
+/// GlobalCache - Inline cache of a global variable found through a VarRef.
+/// Variables of a global table stay where they are, so the one found is
+/// kept until the table gains a name or is replaced by a copy, either of
+/// which gives it a new epoch. Futures may fill the same cache from several
+/// threads, each with a table of its own: one thread at a time fills it, as
+/// a FuncCache, only ever with a newer epoch, and a reader keeps what it
+/// read only if the epoch did not change meanwhile.
+struct GlobalCache {
+	static constexpr std::uint64_t FILLING = ~std::uint64_t(0);
+
+	std::atomic<std::uint64_t> epoch = 0;
+	std::atomic<Value*> value = nullptr;
+
+	GlobalCache() = default;
+
+	// A copy belongs to another reference, so it starts empty
+	GlobalCache(const GlobalCache&) {}
+
+	GlobalCache& operator=(const GlobalCache&) {
+		this->epoch.store(0, std::memory_order_relaxed);
+		return *this;
+	}
+};
+
+/// VarRef - A variable reference resolved by the Resolver.
+/// Slots are tried innermost first. A slot may still be unbound at runtime
+/// when its scope only assigns the name conditionally, in which case the
+/// next one is tried, and finally the global table if `global` is set.
+struct VarRef {
+	std::vector<VarSlot> slots;
+	bool global = true;
+
+	// Where the global table had the name last time
+	mutable GlobalCache cache;
+
+	/// Whether the reference always hits its single slot.
+	inline bool isDirect() const {
+		return !this->global && this->slots.size() == 1;
+	}
+};
+
+/// FuncTable - Functions visible from a global context and all its children.
+/// Definitions are published while futures may be calling into the table:
+/// they take `lock` to change `funcs`, which lookups take shared, and bump
+/// the epoch after.
+struct FuncTable {
+	std::unordered_map<std::string, FuncDefAST*> funcs;
+	mutable std::shared_mutex lock;
+
+	// Bumped by every definition, invalidates all FuncCaches
+	std::atomic<std::uint64_t> epoch = 0;
+
+	// Held while the Specializer looks up and builds specializations of
+	// the functions once futures run, as those share them
+	mutable std::mutex specializing;
+};
+
+/// FuncCache - Inline cache of a function lookup at a single call site.
+/// Futures may fill the same cache from several threads: a reader that sees
+/// an epoch also sees the table and function stored before it. One thread
+/// at a time fills it, with the epoch set to FILLING meanwhile, so that the
+/// function stored is always the one found for the epoch stored with it.
+struct FuncCache {
+	static constexpr std::uint64_t FILLING = ~std::uint64_t(0);
+
+	std::atomic<const FuncTable*> table = nullptr;
+	std::atomic<std::uint64_t> epoch = 0;
+	std::atomic<FuncDefAST*> func = nullptr;
+
+	FuncCache() = default;
+
+	FuncCache(const FuncCache& rhs) {
+		*this = rhs;
+	}
+
+	FuncCache& operator=(const FuncCache& rhs) {
+		this->table.store(rhs.table.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		this->func.store(rhs.func.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		this->epoch.store(rhs.epoch.load(std::memory_order_acquire), std::memory_order_release);
+		return *this;
+	}
+};
+
+/// Output - Stream a global context prints to, shared with its snapshots.
+/// Futures print from other threads, so every line is written under a lock.
+class Output {
+private:
+	std::ostream* stream;
+	std::mutex lock;
+
+public:
+	explicit Output(std::ostream& s) : stream(&s) {}
+
+	Output(const Output&) = delete;
+
+	Output& operator=(const Output&) = delete;
+
+	/// Standard output, for contexts that were given no other.
+	static Output& standard() {
+		static Output out(std::cout);
+		return out;
+	}
+
+	void write(const std::string& s) {
+		std::lock_guard<std::mutex> guard(this->lock);
+		*this->stream << s << std::flush;
+	}
+};
+
+/// Globals - Variables of a global context. A snapshot shares them with
+/// the context it was taken from until either side assigns one, which
+/// then gets a copy of its own, so taking one costs nothing up front.
+struct Globals {
+	// Hands out every epoch once, to whichever table comes first
+	static inline std::atomic<std::uint64_t> epochs = 1;
+
+	std::unordered_map<std::string, Value> variables;
+
+	// Names defined by defconstant
+	std::unordered_set<std::string> constants;
+
+	// Taken anew by every name added, invalidates all GlobalCaches
+	std::uint64_t epoch = epochs.fetch_add(1, std::memory_order_relaxed);
+
+	// Global contexts sharing the table. A context lets go of it with a
+	// release, so that whichever is left last sees what the others read.
+	std::atomic<std::size_t> holders = 1;
+
+	/// The variable `name`, added unbound if it is not there yet.
+	Value& define(const std::string& name) {
+		auto [it, added] = this->variables.try_emplace(name);
+		if (added)
+			this->epoch = epochs.fetch_add(1, std::memory_order_relaxed);
+		return it->second;
+	}
+
+	/// The variable `name`, or nullptr, found through `cache`.
+	Value* find(const std::string& name, GlobalCache& cache) {
+		auto epoch = cache.epoch.load(std::memory_order_acquire);
+		if (epoch == this->epoch) {
+			auto value = cache.value.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (cache.epoch.load(std::memory_order_relaxed) == epoch)
+				return value;
+		}
+		auto it = this->variables.find(name);
+		if (it == this->variables.end())
+			return nullptr;
+		if (epoch < this->epoch && cache.epoch.compare_exchange_strong(epoch, GlobalCache::FILLING, std::memory_order_relaxed)) {
+			std::atomic_thread_fence(std::memory_order_release);
+			cache.value.store(&it->second, std::memory_order_relaxed);
+			cache.epoch.store(this->epoch, std::memory_order_release);
+		}
+		return &it->second;
+	}
+};
+
+/// FrameStack - Slot storage shared by every frame under a global context.
+/// Frames are carved out of large blocks that are kept around for reuse, so
+/// entering a function or a loop does not allocate once the stack has grown
+/// deep enough. Free slots are always unbound.
+class FrameStack {
+public:
+	struct Mark {
+		std::size_t block;
+		std::size_t used;
+
+		inline bool operator<(const Mark& rhs) const {
+			return this->block < rhs.block || (this->block == rhs.block && this->used < rhs.used);
+		}
+	};
+
+private:
+	static constexpr std::size_t BLOCK_SIZE = 4096;
+
+	struct Block {
+		std::unique_ptr<Value[]> data;
+		std::size_t size;
+	};
+	std::vector<Block> blocks;
+
+	// Top of the stack
+	Mark top{ 0, 0 };
+
+public:
+	FrameStack() = default;
+
+	FrameStack(const FrameStack&) = delete;
+
+	FrameStack& operator=(const FrameStack&) = delete;
+
+	/// Reserve n slots on top of the stack. `mark` receives the previous top.
+	Value* push(std::size_t n, Mark& mark) {
+		mark = this->top;
+		while (this->top.block == this->blocks.size() || this->top.used + n > this->blocks[this->top.block].size) {
+			if (this->top.block == this->blocks.size()) {
+				auto size = n > BLOCK_SIZE ? n : BLOCK_SIZE;
+				this->blocks.push_back({ std::make_unique<Value[]>(size), size });
+				std::fill_n(this->blocks.back().data.get(), size, Value::unbound());
+			} else {
+				this->top.block++;
+				this->top.used = 0;
+			}
+		}
+		Value* ret = this->blocks[this->top.block].data.get() + this->top.used;
+		this->top.used += n;
+		return ret;
+	}
+
+	/// Release a frame returned by push. Frames that are released out of
+	/// order, such as when a VM unwinds after an error, are still cleared.
+	void pop(const Mark& mark, Value* slots, std::size_t n) {
+		std::fill_n(slots, n, Value::unbound());
+		if (mark < this->top)
+			this->top = mark;
+	}
+};
 
 class Context {
 private:
-	std::unordered_map<std::string, std::shared_ptr<Value>> variables;
+	// Name-keyed table of a frame assigning a name it does not bind
+	std::unordered_map<std::string, Value> variables;
+
+	// Owned by a global context, possibly shared with its snapshots
+	std::shared_ptr<Globals> globals;
+
+	// Frame of a function call or counted loop, laid out by the Resolver
+	Value* slots = nullptr;
+	std::size_t size = 0;
+	FrameStack::Mark mark{};
 
 	Context* parent = nullptr;
 
-	std::unordered_map<std::string, std::shared_ptr<FuncDefAST>>* funcs = nullptr;
+	Context* root = nullptr;
+
+	FuncTable* funcs = nullptr;
+
+	FrameStack* frames = nullptr;
+
+	// Owned by a global context, the functions shared with its snapshots
+	std::shared_ptr<FuncTable> funcTable;
+	std::unique_ptr<FrameStack> frameStack;
+
+	// Native code of the global context, if enabled
+	Jit* jit = nullptr;
+
+	// Where the global context prints, standard output if null
+	Output* output = nullptr;
+
+	// Futures made under the global context, the standard group if null
+	FutureGroup* futures = nullptr;
+
+	// A global context on the given globals and functions, printing and
+	// making futures as `from` does, see snapshot
+	Context(std::shared_ptr<Globals> globals, std::shared_ptr<FuncTable> funcs, const Context* from)
+		: globals(std::move(globals)), root(this), funcTable(std::move(funcs)), frameStack(std::make_unique<FrameStack>()),
+		jit(from->jit), output(from->output), futures(from->futures) {
+		this->globals->holders.fetch_add(1, std::memory_order_relaxed);
+		this->funcs = this->funcTable.get();
+		this->frames = this->frameStack.get();
+	}
+
+	// Let go of the globals of a global context
+	void dropGlobals() {
+		if (this->globals)
+			this->globals->holders.fetch_sub(1, std::memory_order_release);
+		this->globals.reset();
+	}
 
 public:
-	explicit Context(Context* p = nullptr) : parent(p) {
-		this->funcs = p ? p->funcs : new std::unordered_map<std::string, std::shared_ptr<FuncDefAST>>;
+	explicit Context(Context* p = nullptr, std::size_t slots = 0) : parent(p) {
+		this->root = p ? p->root : this;
+		if (!p) {
+			this->globals = std::make_shared<Globals>();
+			this->funcTable = std::make_shared<FuncTable>();
+			this->frameStack = std::make_unique<FrameStack>();
+		}
+		this->funcs = p ? p->funcs : this->funcTable.get();
+		this->frames = p ? p->frames : this->frameStack.get();
+		if (slots) {
+			this->slots = this->frames->push(slots, this->mark);
+			this->size = slots;
+		}
 	}
 
+	/// A frame on a stack of its own, for another thread running code under
+	/// the same global context.
+	Context(Context* p, std::size_t slots, FrameStack* frames) : parent(p), root(p->root), funcs(p->funcs), frames(frames) {
+		if (slots) {
+			this->slots = this->frames->push(slots, this->mark);
+			this->size = slots;
+		}
+	}
+
+	Context(const Context&) = delete;
+
+	Context& operator=(const Context&) = delete;
+
 	~Context() {
+		if (this->size)
+			this->frames->pop(this->mark, this->slots, this->size);
 		if (!this->parent)
-			delete this->funcs;
+			this->dropGlobals();
 	}
 
-	std::shared_ptr<Value> getVariable(const std::string& name) const {
-		if (this->variables.contains(name))
-			return this->variables.at(name);
+	/// A global context seeing the variables of the one `ctx` runs under as
+	/// they are now and sharing its functions, for a future to run on
+	/// another thread.
+	static std::unique_ptr<Context> snapshot(const Context* ctx) {
+		auto from = ctx->root;
+		return std::unique_ptr<Context>(new Context(from->globals, from->funcTable, from));
+	}
+
+	const Value* getVariable(const std::string& name) const {
+		auto& table = this->parent ? this->variables : this->globals->variables;
+		auto it = table.find(name);
+		if (it != table.end())
+			return &it->second;
 		if (this->parent)
 			return this->parent->getVariable(name);
 		return nullptr;
 	}
 
-	void setVariable(const std::string& name, std::shared_ptr<Value> value) {
-		this->variables[name] = std::move(value);
+	void setVariable(const std::string& name, Value value) {
+		if (this->isConstant(name))
+			throw std::runtime_error("Cannot modify constant: " + name);
+		if (this->parent)
+			this->variables[name] = std::move(value);
+		else
+			this->ownGlobals().define(name) = std::move(value);
 	}
 
 	bool hasVariable(const std::string& name) const {
-		if (this->variables.contains(name))
-			return true;
-		if (this->parent)
-			return this->parent->hasVariable(name);
-		return false;
+		return this->getVariable(name) != nullptr;
+	}
+
+	/// Replace every slot by n unbound ones. Only for the frame on top of
+	/// the stack, such as a function frame making a tail call.
+	void reframe(std::size_t n) {
+		if (this->size)
+			this->frames->pop(this->mark, this->slots, this->size);
+		this->slots = n ? this->frames->push(n, this->mark) : nullptr;
+		this->size = n;
+	}
+
+	/// Point a frame made without slots at slots kept elsewhere, such as
+	/// on the operand stack of the VM. The frame never releases them.
+	void borrow(Value* s) {
+		this->slots = s;
+	}
+
+	inline Value& getSlot(VarSlot s) {
+		auto ctx = this;
+		for (auto d = s.depth; d; --d)
+			ctx = ctx->parent;
+		return ctx->slots[s.index];
+	}
+
+	inline void setSlot(std::uint32_t index, Value value) {
+		this->slots[index] = std::move(value);
+	}
+
+	const Value* getVariable(const std::string& name, const VarRef& ref) {
+		for (const auto& s : ref.slots) {
+			auto& v = this->getSlot(s);
+			if (!v.isUnbound())
+				return &v;
+		}
+		if (!ref.global)
+			return nullptr;
+		return this->root->globals->find(name, ref.cache);
+	}
+
+	/// As getVariable, for changing the value in place, such as storing
+	/// into an array it holds.
+	Value* getMutableVariable(const std::string& name, const VarRef& ref) {
+		for (const auto& s : ref.slots) {
+			auto& v = this->getSlot(s);
+			if (!v.isUnbound())
+				return &v;
+		}
+		if (!ref.global)
+			return nullptr;
+		return this->root->ownGlobals().find(name, ref.cache);
+	}
+
+	/// Store through a reference produced by Resolver::store, which is either
+	/// a slot of this frame or, at top level, the global table.
+	void setVariable(const std::string& name, const VarRef& ref, Value value) {
+		if (!ref.slots.empty()) {
+			this->getSlot(ref.slots.front()) = std::move(value);
+			return;
+		}
+		if (this->parent || this->isConstant(name)) {
+			this->setVariable(name, std::move(value));
+			return;
+		}
+		auto& globals = this->ownGlobals();
+		if (auto var = globals.find(name, ref.cache))
+			*var = std::move(value);
+		else
+			globals.define(name) = std::move(value);
+	}
+
+	bool hasVariable(const std::string& name, const VarRef& ref) {
+		return this->getVariable(name, ref) != nullptr;
+	}
+
+	bool isConstant(const std::string& name) const {
+		auto& constants = this->root->globals->constants;
+		return !constants.empty() && constants.contains(name);
+	}
+
+	/// Value of a global constant, or nullptr if the name is not one.
+	const Value* getConstant(const std::string& name) const {
+		if (!this->isConstant(name))
+			return nullptr;
+		return &this->root->globals->variables.at(name);
+	}
+
+	/// Define a global constant. Defining it again is only allowed with an
+	/// equal value.
+	void defineConstant(const std::string& name, Value value) {
+		auto c = this->getConstant(name);
+		if (c) {
+			if (!(*c == value))
+				throw std::runtime_error("Cannot redefine constant: " + name);
+			return;
+		}
+		auto& globals = this->root->ownGlobals();
+		globals.define(name) = std::move(value);
+		globals.constants.insert(name);
 	}
 
-	std::shared_ptr<FuncDefAST> getFunc(const std::string& name) const {
-		if (this->funcs->contains(name))
-			return (*this->funcs)[name];
+	FuncDefAST* getFunc(const std::string& name) const {
+		std::shared_lock<std::shared_mutex> guard(this->funcs->lock);
+		auto it = this->funcs->funcs.find(name);
+		if (it != this->funcs->funcs.end())
+			return it->second;
 		return nullptr;
 	}
 
-	void setFunc(const std::string& name, std::shared_ptr<FuncDefAST> value) {
-		(*this->funcs)[name] = std::move(value);
+	/// Look up a function through the call site's cache, which stays valid
+	/// until the next definition in the same function table.
+	FuncDefAST* getFunc(const std::string& name, FuncCache& cache) const {
+		auto epoch = cache.epoch.load(std::memory_order_acquire);
+		auto current = this->funcs->epoch.load(std::memory_order_acquire);
+		if (cache.table.load(std::memory_order_relaxed) != this->funcs || epoch != current) {
+			// Found after the epoch was read, so at worst newer than it
+			auto func = this->getFunc(name);
+			if (epoch != FuncCache::FILLING && cache.epoch.compare_exchange_strong(epoch, FuncCache::FILLING, std::memory_order_acquire)) {
+				cache.table.store(this->funcs, std::memory_order_relaxed);
+				cache.func.store(func, std::memory_order_relaxed);
+				cache.epoch.store(current, std::memory_order_release);
+			}
+			return func;
+		}
+		return cache.func.load(std::memory_order_relaxed);
+	}
+
+	const FuncTable* getFuncTable() const {
+		return this->funcs;
+	}
+
+	void setFunc(const std::string& name, FuncDefAST* value) {
+		{
+			std::unique_lock<std::shared_mutex> guard(this->funcs->lock);
+			this->funcs->funcs[name] = value;
+		}
+		this->funcs->epoch.fetch_add(1, std::memory_order_release);
+	}
+
+	/// The globals of this global context, copied first if a snapshot
+	/// still shares them.
+	Globals& ownGlobals() {
+		if (this->globals->holders.load(std::memory_order_acquire) > 1) {
+			auto copy = std::make_shared<Globals>();
+			copy->variables = this->globals->variables;
+			copy->constants = this->globals->constants;
+			this->dropGlobals();
+			this->globals = std::move(copy);
+		}
+		return *this->globals;
 	}
 
 	Context* getParent() const {
 		return this->parent;
 	}
+
+	Context* getRoot() const {
+		return this->root;
+	}
+
+	Jit* getJit() const {
+		return this->root->jit;
+	}
+
+	void setJit(Jit* j) {
+		this->root->jit = j;
+	}
+
+	Output* getOutput() const {
+		return this->root->output ? this->root->output : &Output::standard();
+	}
+
+	void setOutput(Output* o) {
+		this->root->output = o;
+	}
+
+	FutureGroup* getFutures() const {
+		return this->root->futures ? this->root->futures : &FutureGroup::standard();
+	}
+
+	void setFutures(FutureGroup* f) {
+		this->root->futures = f;
+	}
 };
 
 }
@@ -1,10 +1,70 @@
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
+#include "Batch.h"
 #include "DragonLispDriver.h"
 
 int main(int argc, char** argv) {
+	auto engine = DragonLisp::ENGINE_TREE;
+	bool jit = false, emitCpp = false, memoStats = false, pipeline = false;
+	std::size_t maxDepth = DragonLisp::EvalStack::DEFAULT_DEPTH;
+	unsigned jobs = 0;
+	const char* file = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--engine=vm")
+			engine = DragonLisp::ENGINE_VM;
+		else if (arg == "--engine=tree")
+			engine = DragonLisp::ENGINE_TREE;
+		else if (arg == "--jit")
+			jit = true;
+		else if (arg == "--emit-cpp")
+			emitCpp = true;
+		else if (arg == "--memo-stats")
+			memoStats = true;
+		else if (arg == "--pipeline")
+			pipeline = true;
+		else if (arg.starts_with("--max-depth=")) {
+			maxDepth = std::strtoull(arg.c_str() + 12, nullptr, 10);
+			if (!maxDepth || maxDepth > DragonLisp::EvalStack::MAX_DEPTH) {
+				std::cerr << "Invalid depth: " << arg << std::endl;
+				return 1;
+			}
+		}
+		else if (arg.starts_with("--jobs=")) {
+			jobs = std::strtoul(arg.c_str() + 7, nullptr, 10);
+			if (!jobs) {
+				std::cerr << "Invalid jobs: " << arg << std::endl;
+				return 1;
+			}
+		}
+		else if (arg.starts_with("--")) {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 1;
+		} else
+			file = argv[i];
+	}
+
+	auto setup = [&](DragonLisp::DLDriver& driver) {
+		driver.setEngine(engine);
+		driver.setJit(jit);
+		driver.setEmitCpp(emitCpp);
+		driver.setMemoStats(memoStats);
+		driver.setMaxDepth(maxDepth);
+		driver.setPipeline(pipeline);
+	};
+	if (jobs) {
+		if (!file) {
+			std::cerr << "--jobs needs a directory" << std::endl;
+			return 1;
+		}
+		return DragonLisp::Batch(jobs, setup).run(file, std::cout, std::cerr);
+	}
+
 	DragonLisp::DLDriver driver;
-	if (argc <= 1)
+	setup(driver);
+	if (!file)
 		return driver.parse(std::cin);
-	return driver.parse(argv[1]);
+	return driver.parse(file);
 }
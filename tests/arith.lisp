@@ -0,0 +1,34 @@
+(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(print (fib 20))
+(defvar total 0)
+(dotimes (i 1000) (setq total (+ total (* i i))))
+(print total)
+(defvar fl 0.5)
+(loop for i from 1 to 10 do (setq fl (* fl 1.5)))
+(print fl)
+(defvar arr (make-array 100))
+(dotimes (i 100) (setf (aref arr i) (* i 3)))
+(defun asum (n) (defvar acc 0) (dotimes (i n) (incf acc (aref arr i))) acc)
+(print (asum 100))
+(defun collatz (n) (defvar steps 0) (loop (if (= n 1) (return steps)) (if (= (mod n 2) 0) (setq n (/ n 2)) (setq n (+ (* 3 n) 1))) (incf steps 1)))
+(print (collatz 27))
+(defvar big 140737488355328)
+(print big)
+(print (* big 2))
+(print (+ big big big))
+(print (- 0 big big))
+(print (* 9223372036854775807 1))
+(print -9223372036854775807)
+(defvar bigarr (make-array 2))
+(setf (aref bigarr 0) (* big 1000))
+(print (aref bigarr 0))
+(print bigarr)
+(setf (aref bigarr 1) 2.5)
+(print bigarr)
+(setf (aref bigarr 1) "s")
+(print bigarr)
+(print (logxor big 1))
+(print (= big 140737488355328))
+(print (< big (+ big 1)))
+(defvar x 5)
+(print (if2 x))
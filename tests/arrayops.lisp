@@ -0,0 +1,30 @@
+(defvar a (make-array 11))
+(defvar b (make-array 11))
+(dotimes (i 11) (setf (aref a i) (- i 5)) (setf (aref b i) (* i 2)))
+(print (array-sum a))
+(print (array-dot a b))
+(print (array-max a))
+(print (array-min a))
+(print (array-add a b))
+(print (array-mul a b))
+(print (array-scale a 3))
+(print (array-scale a 0.5))
+(print (array-fill a 7))
+(print (array-fill a nil))
+(defvar f (array-scale b 1.5))
+(print (array-sum f))
+(print (array-max f))
+(print (array-min f))
+(print (array-dot f a))
+(print (array-add f a))
+(defvar g (make-array 3))
+(setf (aref g 0) 1)
+(setf (aref g 1) 2.5)
+(setf (aref g 2) 3)
+(print (array-sum g))
+(print (array-max g))
+(print (array-scale g 2))
+(print (array-sum (make-array 0)))
+(print a)
+(print (array-sum (array-fill (make-array 5) 9223372036854775807)))
+(print (array-sum a b))
@@ -0,0 +1,35 @@
+(defvar ch (make-channel 64))
+(defun produce (n) (dotimes (i n) (channel-send ch (* i i))) (channel-close ch))
+(defvar p (future (produce 1000)))
+(defvar sum 0)
+(defvar v (channel-recv ch -1))
+(loop (if (= v -1) (return sum)) (setq sum (+ sum v)) (setq v (channel-recv ch -1)))
+(print sum)
+(defvar c1 (make-channel 2 "spin"))
+(defvar c2 (make-channel 2))
+(defun stage (n) (dotimes (i n) (channel-send c2 (+ 1 (channel-recv c1)))) (channel-close c2))
+(defun feed (n) (dotimes (i n) (channel-send c1 i)) (channel-close c1))
+(defun drain (n) (if (= n 0) 0 (+ (channel-recv c2) (drain (- n 1)))))
+(defvar s (future (stage 100)))
+(defvar q (future (feed 100)))
+(print (drain 100))
+(print (channel-recv c2))
+(defvar d (make-channel 4 "drop"))
+(print (channel-send d 1))
+(channel-close d)
+(print (channel-recv d))
+(print (channel-recv d))
+(defvar d1 (make-channel 1 "drop"))
+(print (channel-send d1 1))
+(print (channel-send d1 2))
+(print (channel-recv d1))
+(print (channel-send d1 3))
+(defvar d3 (make-channel 3 "drop"))
+(defun sent (ok) (if ok 1 0))
+(defun fill3 (n) (if (= n 0) 0 (+ (sent (channel-send d3 n)) (fill3 (- n 1)))))
+(print (fill3 5))
+(defvar n (make-channel 2))
+(channel-send n nil)
+(channel-close n)
+(print (channel-recv n "end"))
+(print (channel-recv n "end"))
@@ -0,0 +1,24 @@
+(defconstant lim (+ 1505 -1495))
+(print lim)
+(defconstant half (/ lim 4.0))
+(print half)
+(defun f (n) (if (> lim 5) (return-from f (* n lim))) 0)
+(print (f 3))
+(defun g (x) (if (< lim 5) (print 999)) x)
+(print (g 4))
+(defun h (x) 5 (if nil 3))
+(print (h 1))
+(defun k (x) 5 (if t 3))
+(print (k 1))
+(loop for i from (- lim 8) to (+ 1 lim -9) do (print i))
+(dotimes (i (+ 1 2)) (if (= lim 10) (print (* i lim))))
+(dotimes (i 3) (if (< lim 0) (print 0) (print (+ i lim))))
+(print (not nil))
+(print (and 1 2 lim))
+(print (max 1 lim 2.5))
+(defconstant lim 10)
+(defun lim2 (lim) (* lim 2))
+(print (lim2 7))
+(defvar v (* lim lim))
+(print v)
+(dotimes (i 4) (if (> i 1) (return i)) (if t (print i)))
@@ -0,0 +1,19 @@
+(defvar a (make-array 4))
+(dotimes (i 4) (setf (aref a i) (* i i)))
+(defun clobber (arr) (setf (aref arr 0) 42) (print arr) arr)
+(defvar c (clobber a))
+(print a)
+(print c)
+(defvar b a)
+(setf (aref b 1) 7)
+(print a)
+(print b)
+(setf d a)
+(incf (aref d 2) 1)
+(print a)
+(print d)
+(print (setf (aref c 3) 5))
+(print c)
+(print a)
+(dotimes (i 2) (defvar a2 a) (setf (aref a2 i) -1) (print a2))
+(print a)
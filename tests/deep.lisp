@@ -0,0 +1,4 @@
+(defun depth (n) (if (= n 0) 0 (+ 1 (depth (- n 1)))))
+(print (depth 100000))
+(defun countdown (n acc) (if (= n 0) acc (countdown (- n 1) (+ acc 1))))
+(print (countdown 1000000 0))
@@ -0,0 +1,6 @@
+(defvar ch (make-channel 1))
+(defvar f (future (channel-recv ch)))
+(defun g () 1)
+(channel-send ch 42)
+(print (touch f))
+(print (g))
@@ -0,0 +1,21 @@
+(defvar m -9223372036854775807)
+(setq m (- m 1))
+(print m)
+(print (/ m -1))
+(print (mod m -1))
+(print (rem m -1))
+(print (/ m 1 -1))
+(print (/ -9223372036854775807 -1))
+(defun q (x y) (/ x y))
+(defun r (x y) (mod x y))
+(defun qq (n) (if (= n 0) 0 (+ (q m -1) (r m -1) (qq (- n 1)))))
+(print (qq 2000))
+(print (q m -1))
+(print (r m -1))
+(print (q 7 -1))
+(print (r 7 -2))
+(print (q -7 2))
+(defconstant mn (- -9223372036854775807 1))
+(print (/ mn -1))
+(print (mod mn -1))
+(print (rem mn -1))
@@ -0,0 +1,2 @@
+(defvar a (make-array 3))
+(print (aref a 3))
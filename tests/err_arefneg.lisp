@@ -0,0 +1,2 @@
+(defvar a (make-array 3))
+(setf (aref a -1) 3)
@@ -0,0 +1,3 @@
+(defvar a (make-array 2))
+(defvar b (make-array 2))
+(setf (aref a 0) b)
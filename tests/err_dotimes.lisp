@@ -0,0 +1 @@
+(dotimes (i 2.5) (print i))
@@ -0,0 +1,3 @@
+(defun f (x y) (+ x y))
+(print (f 1 2 3))
+(print (f 1))
@@ -0,0 +1,2 @@
+(defvar a (make-array 2))
+(incf (aref a 0) 1)
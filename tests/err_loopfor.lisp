@@ -0,0 +1 @@
+(loop for i from "a" to 3 do (print i))
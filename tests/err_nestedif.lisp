@@ -0,0 +1,2 @@
+(defun f (x) (if x (if x 1 2) 3))
+(print (f t))
@@ -0,0 +1 @@
+(print (nofunc (print 1)))
@@ -0,0 +1,4 @@
+(defvar c (make-channel 1))
+(print 1)
+(channel-recv c)
+(print 2)
@@ -0,0 +1,2 @@
+(defun f (x) (print x) (return-from g 5))
+(print (f 3))
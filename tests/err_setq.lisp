@@ -0,0 +1 @@
+(setq undefinedvar (print 5))
@@ -0,0 +1,21 @@
+(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(defvar a (future (fib 20)))
+(defvar b (future (fib 21)))
+(print (+ (touch a) (touch b)))
+(defvar g 10)
+(defun bump () (setq g 20) g)
+(defvar c (future (bump)))
+(print (touch c))
+(print g)
+(print (touch 5))
+(defvar arr (make-array 3))
+(setf (aref arr 0) 1)
+(defun poke () (setf (aref arr 0) 2) (aref arr 0))
+(defvar d (future (poke)))
+(print (touch d))
+(print (aref arr 0))
+(defun spawn (n) (future (* n n)))
+(defvar fs (make-array 10))
+(dotimes (i 10) (setf (aref fs i) (spawn i)))
+(defun sumfs (i n) (if (= i n) 0 (+ (touch (aref fs i)) (sumfs (+ i 1) n))))
+(print (sumfs 0 10))
@@ -0,0 +1,21 @@
+(defun sq (x) (* x x))
+(defun add3 (a b d) (+ a b d))
+(defun getv (v i) (aref v i))
+(defun user (n) (+ (sq n) (add3 n 1 2)))
+(print (user 5))
+(defvar arr (make-array 3))
+(setf (aref arr 1) 7)
+(defun useArr (k) (getv arr k))
+(print (useArr 1))
+(defun looper (n) (defvar s 0) (dotimes (i n) (setq s (+ s (sq i)))) s)
+(print (looper 10))
+(dotimes (i 3) (print (sq i)))
+(defun sq (x) (+ x 1000))
+(print (user 5))
+(print (looper 3))
+(defun twice (x x) (+ x x))
+(defun usetwice (n) (twice n (+ n 1)))
+(print (usetwice 3))
+(defun gone (x) (nothere x))
+(defun callgone (n) (if (> n 100) (gone n) n))
+(print (callgone 5))
@@ -0,0 +1,27 @@
+(defvar w 3)
+(defvar h 4)
+(defvar arr (make-array 5))
+(loop for i from 0 to 4 do (setf (aref arr i) (* i w)))
+(loop for i from 0 to 4 do (print (+ (aref arr 2) (* w h) i)))
+(loop for i from 0 to 4 do (setf (aref arr 2) (+ (aref arr 2) (* w h))) (print (aref arr 2)))
+(defun bump (k) (setf (aref arr 1) (+ (aref arr 1) k)) k)
+(dotimes (i 3) (bump 5) (print (aref arr 1)) (print (* w h)))
+(dotimes (i 0) (print (aref undef 9)))
+(dotimes (i 3) (if (> i 5) (print (aref undef 9))) (print (* h h)))
+(defun area (a b) (print (* a b)) (print (+ (* a b) 1)) (* a b))
+(print (area 6 7))
+(defun dp (n) (+ (aref arr n) (aref arr n) (* (aref arr n) 2)))
+(print (dp 3))
+(defun shadow (w) (dotimes (j 2) (print (* w h))) (* w h))
+(print (shadow 10))
+(defun upd (x) (print (* x 2)) (setq x 5) (print (* x 2)) x)
+(print (upd 1))
+(dotimes (i 2) (dotimes (j 3) (print (+ (* w h) (* i 10) j))))
+(dotimes (i 2) (loop for j from 1 to 2 do (print (* i w)) (print (+ j (* i w)))))
+(defun ff (n) (dotimes (i 3) (print (* n n)) (print (* n i))) (* n n))
+(print (ff 4))
+(dotimes (i 3) (print (array-sum arr)) (setf (aref arr 0) i))
+(dotimes (i 2) (print (/ 10 (- w 3) 1.0)))
+(defvar z 2)
+(dotimes (i 3) (print (* z 100)) (defvar z 7) (print (* z 100)))
+(dotimes (i 3) (print (+ i (* w 2))) (if (= i 1) (return (* w h))))
@@ -0,0 +1,3 @@
+(loop for i from 9223372036854775805 to 9223372036854775807 do (print i))
+(defun last (s) (loop for i from s to 9223372036854775807 do (if (= i 9223372036854775807) (return i))))
+(print (last 9223372036854775800))
@@ -0,0 +1,15 @@
+(defvar cnt 0)
+(loop for i from 1 to 5 do (incf cnt 1))
+(print cnt)
+(loop for i from 1 to 3 do (dotimes (j 2) (print (+ i j))))
+(loop for i from 1.5 to 4 do (print i))
+(loop for i from 1 to 3.5 do (print i))
+(loop for i from 3 to 1 do (print i))
+(dotimes (k 3) (setq cnt k))
+(print cnt)
+(dotimes (k 4) (if (> k 1) (return k)) (print k))
+(defun f (n) (loop for i from 1 to n do (if (= i 3) (return-from f (* i 100)))) 7)
+(print (f 5))
+(print (f 2))
+(dotimes (k 3) (loop for m from 0 to 1 do (print k)))
+(loop for i from 140737488355325 to 140737488355327 do (print i))
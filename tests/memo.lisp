@@ -0,0 +1,7 @@
+(declaim (memoize fib))
+(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(print (fib 80))
+(declaim (memoize small 2))
+(defvar calls 0)
+(defun small (n) (* n 10))
+(print (+ (small 1) (small 2) (small 1) (small 3) (small 1)))
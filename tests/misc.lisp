@@ -0,0 +1,36 @@
+(defun f (n) (loop for i from 1 to n do (if (= i 3) (return-from f (* i 100)))))
+(print (f 10))
+(print (f 2))
+(defun g (n) (dotimes (i n) (if (= i 3) (return i))) 7)
+(print (g 10))
+(defun h (n) (if (> n 0) (return-from h "pos") (return-from h "neg")))
+(print (h 1))
+(print (h -1))
+(defun w (n) (loop (if (<= n 0) (return-from w 0)) (decf n 1)))
+(print (w 5))
+(print (dotimes (i 3) (print i)))
+(print (loop for i from 1 to 0 do (print i)))
+(defvar a (make-array 4))
+(dotimes (i 4) (setf (aref a i) (* i 1.5)))
+(print a)
+(defvar b (make-array 2))
+(setf (aref b 0) 1)
+(incf (aref b 0) 41)
+(decf (aref b 0) 2)
+(print b)
+(defvar k 0)
+(defvar c (make-array 5))
+(dotimes (i 5) (setf (aref c i) 0))
+(incf (aref c (incf k 1)) 5)
+(print c)
+(print k)
+(print (+ (incf k 10) 1))
+(print k)
+(defun deep (n) (if (= n 0) 0 (+ 1 (deep (- n 1)))))
+(print (deep 500))
+(defun args3 (a b c) (list3 c b a))
+(defun list3 (x y z) (+ (* x 100) (* y 10) z))
+(print (args3 1 2 3))
+(print (logior 1 2 4))
+(print (logeqv 1 2))
+(print (and))
@@ -0,0 +1,30 @@
+(defvar x 5)
+(defun sx () (setq x 10) x)
+(print (sx))
+(print x)
+(defun dx () (defvar x 20) x)
+(print (dx))
+(print x)
+(defun fx () (setf x 30) x)
+(print (fx))
+(print x)
+(loop for i from 1 to 2 do (defvar x 100) (print x))
+(print x)
+(defvar cnt 0)
+(print (loop (setq cnt (+ cnt 1)) (if (> cnt 3) (return cnt))))
+(print cnt)
+(defun outer (n) (dotimes (i n) (print (inner i))))
+(defun inner (i) (* i i))
+(outer 4)
+(print (max 1.5 1.5))
+(print (min 2 2.0))
+(print (/= 1))
+(print (= 1))
+(print (logand 6 3))
+(print (* 2 3 4))
+(print (- 1.5 0.5 0.25))
+(print (/ 1 3.0))
+(print (< 1 1.5))
+(print (> 2.5 1))
+(print (mod -7 3))
+(print (mod 7 -3))
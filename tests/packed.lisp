@@ -0,0 +1,15 @@
+(defvar a (make-array 5))
+(print a)
+(setf (aref a 1) 3)
+(print a)
+(setf (aref a 2) 140737488355330)
+(setf (aref a 3) -9223372036854775807)
+(print a)
+(setf (aref a 1) nil)
+(print a)
+(setf (aref a 4) 2.5)
+(print a)
+(print (+ (aref a 2) 1))
+(defvar f (make-array 3))
+(setf (aref f 0) 1.5)
+(incf (aref f 1) 1)
@@ -0,0 +1,16 @@
+(defvar f (make-array 3))
+(setf (aref f 0) 1.5)
+(setf (aref f 2) -0.0)
+(print f)
+(setf (aref f 1) "s")
+(print f)
+(print (aref f 2))
+(defvar g (make-array 2))
+(setf (aref g 0) t)
+(print g)
+(defvar h (make-array 3))
+(dotimes (i 3) (setf (aref h i) (* 1.0 i)))
+(print h)
+(setf (aref h 1) 7)
+(print h)
+(print (aref h 0))
@@ -0,0 +1,8 @@
+(defvar ch (make-channel 1))
+(defvar f (future (channel-recv ch)))
+(defvar full (make-channel 2))
+(channel-send full 1)
+(channel-send full 2)
+(defvar g (future (channel-send full 3)))
+(defun done () "done")
+(print (done))
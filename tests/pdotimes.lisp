@@ -0,0 +1,6 @@
+(defvar a (make-array 100000))
+(pdotimes (i 100000) (setf (aref a i) (* i i)))
+(print (array-sum a))
+(defvar b (make-array 10))
+(pdotimes (i 10) (setf (aref b i) (+ i 1)))
+(print b)
@@ -0,0 +1,301 @@
+(print (+ 9007199254740993))
+(print (max 2.5))
+(print (min (print 4)))
+(print (logxor 2 -7 2 (print 4)))
+(print (logxor 9007199254740993))
+(print (min -7))
+(print (= 1 (print 1.5) (print 1.5) -1.5 1))
+(print (* -1.5 3 (print 4)))
+(print (max (print 1.5)))
+(print (min 2))
+(print (max 3 140737488355327 2.5 3))
+(print (logeqv -7))
+(print (logxor 9007199254740993 100000 2 3))
+(print (logeqv (print 4) 0 3 9007199254740993))
+(print (logxor 3 2))
+(print (min 0 0))
+(print (+ -1.5 (print 4)))
+(print (= -1.5 -1.5 -1.5 -1.5 2))
+(print (logeqv 1 -7 2 -7))
+(print (min 2))
+(print (+ 3 (print 4) 2 2.5 (print 1.5)))
+(print (+ 9007199254740993))
+(print (min 100000 2 2))
+(print (logeqv 100000 100000 0 2))
+(print (* 1 -7 (print 4) 2.5 3))
+(print (- (print 4) 2.5 3))
+(print (logior (print 4) (print 4)))
+(print (/ 9007199254740993 -1.5))
+(print (/= -7 (print 4)))
+(print (- 2 -7))
+(print (= -1.5))
+(print (/= 100000 3))
+(print (* 3 1))
+(print (max 1 1))
+(print (/= (print 4)))
+(print (/= -1.5 9007199254740993))
+(print (/ (print 4) -7 140737488355327))
+(print (min 0 (print 4) -1.5))
+(print (logxor 3 (print 4) 3 (print 4) (print 4)))
+(print (+ 140737488355327 3 (print 1.5) 1))
+(print (* 3 100000))
+(print (min (print 4)))
+(print (max 140737488355327 140737488355327 2 (print 4)))
+(print (+ -7 0))
+(print (+ (print 4)))
+(print (logeqv (print 4) 140737488355327 100000 (print 4) -7))
+(print (/= 0 (print 4) -7 9007199254740993 100000))
+(print (* 2 -1.5 100000 2.5))
+(print (- -1.5 2))
+(print (/ 140737488355327 2 140737488355327))
+(print (* 3 0 3))
+(print (* (print 4) -1.5 2.5 -1.5))
+(print (logand 1 140737488355327 3))
+(print (= -1.5 3 (print 4)))
+(print (+ -1.5 2))
+(print (- 2 (print 1.5) 9007199254740993))
+(print (- 1 2.5 (print 4) -1.5))
+(print (- 0 1))
+(print (logand 140737488355327 -7 0 100000 (print 4)))
+(print (= 0 2.5))
+(print (+ 1 1 1))
+(print (/= (print 4) -7 (print 4) 100000 -7))
+(print (/ -1.5 2.5))
+(print (+ 1 2))
+(print (= -1.5 3 1))
+(print (+ 3 3 0 100000))
+(print (+ 2.5 2.5 (print 4)))
+(print (logior 1 0))
+(print (/ 3 1 2.5))
+(print (logxor 100000))
+(print (+ 0))
+(print (- -1.5 (print 1.5)))
+(print (* 9007199254740993))
+(print (max (print 4) 140737488355327))
+(print (max 9007199254740993 9007199254740993 140737488355327 1 9007199254740993))
+(print (- 9007199254740993 100000 (print 4) 1))
+(print (max 100000 0))
+(print (/= 0 140737488355327 2 9007199254740993))
+(print (= 140737488355327 1 (print 1.5)))
+(print (= 2 (print 1.5)))
+(print (/= (print 1.5) (print 1.5) 3))
+(print (logand 0 100000 100000 100000 140737488355327))
+(print (- -7 0 2 100000 1))
+(print (logand 2 9007199254740993 (print 4) 100000))
+(print (/= 0 2.5 2))
+(print (logxor 9007199254740993 1 0))
+(print (/= 100000 (print 1.5) 140737488355327 3))
+(print (= 100000 1 (print 4)))
+(print (* 100000 -1.5))
+(print (* 2 -7))
+(print (max (print 4) -7 100000 2.5))
+(print (logeqv 3 (print 4) -7 -7))
+(print (- 2.5 (print 4)))
+(print (- -7 2.5 0))
+(print (logand 3))
+(print (min 1 2 -1.5 9007199254740993))
+(print (max 100000 -7 140737488355327 2))
+(print (/ 3 (print 4)))
+(print (= 9007199254740993))
+(print (/= 2 (print 4) 140737488355327 1))
+(print (+ -7 (print 1.5)))
+(print (- (print 4) (print 1.5) -7))
+(print (+ (print 4)))
+(print (/ (print 4) -7 (print 4) -7))
+(print (logxor -7 100000 1))
+(print (= -7 1 140737488355327 0))
+(print (/= 2 -7 100000 -7 0))
+(print (/ 100000 -7))
+(print (min -7 100000))
+(print (* 1 -7 1 (print 1.5)))
+(print (- 2.5 -7))
+(print (/= 9007199254740993 2.5 2.5 100000))
+(print (* 1))
+(print (- 2 2.5 -1.5))
+(print (- 140737488355327 -7 -1.5 2.5 140737488355327))
+(print (/ (print 4) 100000 -7))
+(print (+ 2 140737488355327 1 0))
+(print (min 1))
+(print (/= 140737488355327 -1.5 140737488355327 0))
+(print (logxor 3 100000 3 1))
+(print (* -7 2.5 9007199254740993 2.5 100000))
+(print (* -1.5 2))
+(print (= 100000))
+(print (max 2.5 3 -1.5 2 2))
+(print (/= 3 -7 3 -1.5))
+(print (= 140737488355327))
+(print (logeqv 3 -7))
+(print (/ 0 (print 1.5)))
+(print (/ 2 -1.5 0))
+(print (= 1 2 1 100000))
+(print (/ 2.5 1 0 -7))
+(print (min -7 2 2.5 (print 4) 9007199254740993))
+(print (* (print 1.5) 0 140737488355327 140737488355327))
+(print (= 2))
+(print (logior 3 1 -7))
+(print (/= 9007199254740993 1))
+(print (logand -7))
+(print (+ (print 4) 100000 2 -1.5))
+(print (= -1.5 1 0))
+(print (/= 2.5 -1.5 -1.5 1 9007199254740993))
+(print (* 2 9007199254740993 2 -1.5))
+(print (min 100000 140737488355327 3))
+(print (* 1))
+(print (* 0 3 (print 4)))
+(print (* 2))
+(print (logxor 140737488355327 140737488355327 140737488355327 140737488355327))
+(print (/ 3 9007199254740993 1))
+(print (/ -1.5 (print 1.5) 9007199254740993 -7 9007199254740993))
+(print (+ (print 4) 3 -1.5 2.5))
+(print (logxor 100000 (print 4) 100000))
+(print (* 1))
+(print (min 100000 -7 100000 140737488355327))
+(print (min 9007199254740993 3 140737488355327 100000))
+(print (logxor 2))
+(print (* -1.5 2.5 2))
+(print (= 1 9007199254740993))
+(print (* 0 140737488355327 140737488355327 3))
+(print (= 2 9007199254740993))
+(print (logand 3 0 (print 4) 100000))
+(print (/ 0 (print 1.5) (print 4) -7 2.5))
+(print (logior 3 140737488355327 140737488355327 0))
+(print (+ 9007199254740993 (print 4) 0))
+(print (+ 3 0))
+(print (min -1.5 (print 4) 2.5 1))
+(print (+ 1))
+(print (min 0 2 (print 4)))
+(print (* 2.5 (print 1.5)))
+(print (logeqv 3 1))
+(print (/ 100000 2))
+(print (logand 140737488355327 0 1 1))
+(print (+ (print 4)))
+(print (+ 3 -7 3 1))
+(print (max 3 -1.5))
+(print (logxor 3 (print 4) 0 2 0))
+(print (= 3 -7 2 0))
+(print (max 3))
+(print (/ 2.5 (print 1.5) -7 -1.5))
+(print (+ -1.5))
+(print (/= (print 1.5) 0))
+(print (/ (print 1.5) (print 1.5) 2 (print 1.5)))
+(print (* 1 1))
+(print (+ 3))
+(print (min -7 9007199254740993 9007199254740993))
+(print (max 9007199254740993))
+(print (/= 2 -7 -7 -7))
+(print (= 9007199254740993))
+(print (= 100000 2 3))
+(print (- 0 2.5))
+(print (max 2.5))
+(print (logeqv (print 4)))
+(print (- 9007199254740993 0 3 -1.5 1))
+(print (max 0 140737488355327))
+(print (+ 2.5))
+(print (logeqv 100000))
+(print (/= 100000 (print 1.5)))
+(print (>= 3 2))
+(print (rem 140737488355327 2))
+(print (mod 140737488355327 2))
+(print (rem 2.5 2.5))
+(print (< -1.5 -1.5))
+(print (rem 2 -1.5))
+(print (rem 1 2.5))
+(print (<= 0 0))
+(print (>= (print 4) (print 4)))
+(print (<= 100000 3))
+(print (mod (print 1.5) 140737488355327))
+(print (rem 140737488355327 (print 1.5)))
+(print (rem 1 2.5))
+(print (mod 2.5 (print 4)))
+(print (<= 9007199254740993 9007199254740993))
+(print (rem 2.5 3))
+(print (<= 3 2.5))
+(print (<= (print 4) -7))
+(print (> 0 140737488355327))
+(print (rem 9007199254740993 9007199254740993))
+(print (> (print 1.5) (print 4)))
+(print (> 3 -7))
+(print (> -7 0))
+(print (rem 2 3))
+(print (rem 2 -7))
+(print (>= 3 3))
+(print (> -1.5 0))
+(print (< 0 -7))
+(print (>= 100000 1))
+(print (< -1.5 9007199254740993))
+(print (> 100000 1))
+(print (<= 0 (print 1.5)))
+(print (rem -1.5 1))
+(print (rem -7 9007199254740993))
+(print (>= 9007199254740993 -7))
+(print (mod 9007199254740993 -7))
+(print (< 100000 -1.5))
+(print (rem 2 -1.5))
+(print (<= 140737488355327 -1.5))
+(print (<= 0 9007199254740993))
+(print (>= 100000 100000))
+(print (< (print 1.5) 9007199254740993))
+(print (rem 9007199254740993 3))
+(print (rem 2.5 140737488355327))
+(print (< -1.5 9007199254740993))
+(print (>= 2 1))
+(print (> (print 4) -7))
+(print (<= (print 4) 2.5))
+(print (< 9007199254740993 (print 1.5)))
+(print (>= (print 4) -7))
+(print (rem 100000 (print 4)))
+(print (<= -1.5 (print 4)))
+(print (< 0 0))
+(print (>= -1.5 1))
+(print (< 2 -1.5))
+(print (rem 2.5 (print 1.5)))
+(print (> 2 -7))
+(print (mod -7 140737488355327))
+(print (>= 100000 -7))
+(print (<= 3 140737488355327))
+(print (< 140737488355327 140737488355327))
+(print (rem -7 100000))
+(print (<= 9007199254740993 3))
+(print (lognor 9007199254740993 140737488355327))
+(print (> 140737488355327 (print 4)))
+(print (rem 3 140737488355327))
+(print (lognor 9007199254740993 -7))
+(print (rem 0 -1.5))
+(print (rem 3 100000))
+(print (> 100000 100000))
+(print (<= 0 9007199254740993))
+(print (>= 1 2))
+(print (lognor 3 (print 4)))
+(print (< -7 2))
+(print (mod 2 (print 1.5)))
+(print (<= 9007199254740993 -7))
+(print (<= 140737488355327 100000))
+(print (> 140737488355327 3))
+(print (<= -1.5 140737488355327))
+(print (mod 3 (print 1.5)))
+(print (rem (print 1.5) 140737488355327))
+(print (> -7 100000))
+(print (rem -7 (print 4)))
+(print (>= -7 9007199254740993))
+(print (<= 100000 100000))
+(print (mod 1 100000))
+(print (>= -7 100000))
+(print (<= (print 4) (print 1.5)))
+(print (<= 9007199254740993 2.5))
+(print (< 1 (print 1.5)))
+(print (> 140737488355327 2))
+(print (mod 100000 100000))
+(defun f (a b c) (print (+ a b c)) (print (* a b)) (print (< a b)) (print (max a b c)) (print (= a b)) (print (logand a b)))
+(f 1 2 3)
+(f 2 1 2.0)
+(f 1 7 3)
+(f 7 1 2.0)
+(f 3 2 3)
+(f 2 3 2.0)
+(f 3 7 3)
+(f 7 3 2.0)
+(f 4 2 3)
+(f 2 4 2.0)
+(f 4 7 3)
+(f 7 4 2.0)
+(dotimes (i 5) (print (+ i 1 2)) (print (/ 10 (+ i 1) 1.0)) (print (* i 0.5 i)))
@@ -0,0 +1,8 @@
+(defun g (x) (* x 2))
+(defun f (x) (g x))
+(print (f 3))
+(defun g (x) (* x 10))
+(print (f 3))
+(dotimes (i 3) (print (f i)))
+(defun g (x) (+ x 1))
+(print (f 3))
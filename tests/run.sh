@@ -0,0 +1,87 @@
+#!/bin/sh
+# Conformance corpus, run by `make test`.
+#
+# Every tests/NAME.lisp is run by each engine and must print exactly
+# tests/NAME.out. If tests/NAME.err exists, the program must fail with an
+# error message containing its line instead. The corpus is also run as a
+# batch with --jobs, and, when RUNTIME names the archive of `make runtime`,
+# every program is translated with --emit-cpp, compiled and run as well,
+# but for those with syntax errors, which are not translated.
+#
+# usage: tests/run.sh [DragonLisp.exe]
+
+EXE=${1:-./DragonLisp.exe}
+DIR=$(dirname "$0")
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2 -Wall -ffast-math -fomit-frame-pointer -std=c++20}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+failed=0
+total=0
+
+fail() {
+	echo "FAIL $1"
+	failed=$((failed + 1))
+}
+
+# check NAME LABEL: compare $TMP/out, $TMP/err and $TMP/status with the
+# expectations of NAME
+check() {
+	total=$((total + 1))
+	if ! cmp -s "$TMP/out" "$DIR/$1.out"; then
+		fail "$1 [$2]"
+		diff "$TMP/out" "$DIR/$1.out" | head -5
+	elif [ -f "$DIR/$1.err" ]; then
+		if [ "$(cat "$TMP/status")" = 0 ] || ! grep -qF -- "$(cat "$DIR/$1.err")" "$TMP/err"; then
+			fail "$1 [$2]: expected error $(cat "$DIR/$1.err")"
+			head -3 "$TMP/err"
+		fi
+	elif [ "$(cat "$TMP/status")" != 0 ]; then
+		fail "$1 [$2]: exit status $(cat "$TMP/status")"
+		head -3 "$TMP/err"
+	fi
+}
+
+for f in "$DIR"/*.lisp; do
+	name=$(basename "$f" .lisp)
+	for opts in "" "--engine=vm" "--jit" "--pipeline" "--engine=vm --pipeline"; do
+		timeout 60 "$EXE" $opts "$f" > "$TMP/out" 2> "$TMP/err"
+		echo $? > "$TMP/status"
+		check "$name" "${opts:-tree}"
+	done
+done
+
+# Scripts of a batch print under a header each, in the order of their names
+total=$((total + 1))
+: > "$TMP/expected"
+for f in "$DIR"/*.lisp; do
+	echo "==> $f <==" >> "$TMP/expected"
+	cat "$DIR/$(basename "$f" .lisp).out" >> "$TMP/expected"
+done
+timeout 300 "$EXE" --jobs=4 "$DIR" > "$TMP/out" 2> /dev/null
+if ! cmp -s "$TMP/out" "$TMP/expected"; then
+	fail "corpus [--jobs=4]"
+	diff "$TMP/out" "$TMP/expected" | head -5
+fi
+
+if [ -n "$RUNTIME" ]; then
+	for f in "$DIR"/*.lisp; do
+		name=$(basename "$f" .lisp)
+		if ! "$EXE" --emit-cpp "$f" > "$TMP/prog.cpp" 2> "$TMP/err"; then
+			grep -q "^Error: syntax error" "$TMP/err" && continue
+		fi
+		if ! $CXX $CXXFLAGS -I"$DIR/.." -o "$TMP/prog" "$TMP/prog.cpp" "$RUNTIME" -pthread 2> "$TMP/err"; then
+			total=$((total + 1))
+			fail "$name [--emit-cpp]: not translated"
+			head -3 "$TMP/err"
+			continue
+		fi
+		timeout 60 "$TMP/prog" > "$TMP/out" 2> "$TMP/err"
+		echo $? > "$TMP/status"
+		check "$name" "--emit-cpp"
+	done
+fi
+
+echo "$((total - failed))/$total passed"
+[ $failed = 0 ]
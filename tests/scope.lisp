@@ -0,0 +1,18 @@
+(defvar g 10)
+(defun f (a) (if (> a 0) (defvar x 1)) (print x) (setq g 5) (print g) a)
+(defvar x 99)
+(f 1)
+(f 0)
+(print g)
+(dotimes (i 3) (print i) (if (= i 1) (defvar y i)) (print y))
+(defvar y 7)
+(dotimes (i 3) (if (= i 1) (defvar y 100)) (print y))
+(print y)
+(defun h (n) (loop for k from 1 to n do (incf n 1) (print n) (if (> k 2) (return k))))
+(print (h 2))
+(defun dup (a a) a)
+(print (dup 1 2))
+(defun arr () (defvar q (make-array 3)) (dotimes (i 3) (setf (aref q i) i)) q)
+(print (arr))
+(defun bad () (setq zz 1))
+(bad)
@@ -0,0 +1,12 @@
+(defvar y 7)
+(dotimes (i 3) (if (= i 1) (defvar y 100)) (print y))
+(print y)
+(defun h (n) (loop for k from 1 to n do (incf n 1) (print n) (if (> k 2) (return k))))
+(print (h 2))
+(defun dup (a a) a)
+(print (dup 1 2))
+(defun arr () (defvar q (make-array 3)) (dotimes (i 3) (setf (aref q i) i)) q)
+(print (arr))
+(dotimes (i 2) (dotimes (j 2) (print (+ i j)) (setq i 5)) (print i))
+(defun bad () (setq zz 1))
+(bad)
@@ -0,0 +1,70 @@
+(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(print (fib 15))
+(print (fib 10.5))
+(defun mix (a b) (+ a b 0.5))
+(print (mix 1 2))
+(print (mix 1.5 2))
+(defun cmp (a b) (< a b))
+(print (cmp 1 2))
+(print (cmp 3 2.5))
+(defun ext (a b d) (max a b d))
+(print (ext 1 5 3))
+(print (ext 1.5 0.5 2.5))
+(defun eqq (a b) (= a b))
+(print (eqq 1 1))
+(print (eqq 1 1.0))
+(print (eqq 2 3))
+(defun neq (a b) (/= a b 1))
+(print (neq 1 1))
+(defun nt (a) (not a))
+(print (nt 1))
+(print (nt nil))
+(print (nt t))
+(defun md (a b) (mod a b))
+(print (md 7 3))
+(print (md 7.5 2))
+(defun bits (a b) (logand a b))
+(print (bits 12 10))
+(defvar g 10)
+(defun useg (x) (+ x g))
+(print (useg 1))
+(setq g 2.5)
+(print (useg 1))
+(setq g 7)
+(print (useg 1))
+(defvar arr (make-array 4))
+(setf (aref arr 0) 1)
+(setf (aref arr 1) 2)
+(setf (aref arr 2) 3)
+(setf (aref arr 3) 4)
+(defun sumto (v n) (if (< n 0) 0 (+ (aref v n) (sumto v (- n 1)))))
+(print (sumto arr 3))
+(defun gsum (n) (if (< n 0) 0 (+ (aref arr n) (gsum (- n 1)))))
+(print (gsum 3))
+(setf (aref arr 2) 1.5)
+(print (sumto arr 3))
+(print (gsum 3))
+(defun early (n) (if (< n 0) (return-from early 0)) (* n 2))
+(print (early 5))
+(print (early -5))
+(defun maybe (n) (if (> n 0) t))
+(print (maybe 1))
+(print (maybe -1))
+(defun ao (a b) (and a b))
+(print (ao 1 2))
+(defun oo (a b) (or a b))
+(print (oo 1 2))
+(defun sq (x) (* x x))
+(defun hyp (a b) (+ (sq a) (sq b)))
+(print (hyp 3 4))
+(defun sq (x) (* x x x))
+(print (hyp 3 4))
+(defun dv (a b) (/ a b))
+(print (dv 7 2))
+(print (dv 7.0 2))
+(defun big (a) (* a a a))
+(print (big 1000000))
+(defun many (a b) (+ a b))
+(print (many 1 2 3))
+(defun twice (x x) (+ x x))
+(print (twice 1 5))
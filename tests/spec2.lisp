@@ -0,0 +1,36 @@
+(defun isqrt (x) (loop for i from 0 to x do (if (> (* i i) x) (return-from isqrt (- i 1)))))
+(print (isqrt 10))
+(print (isqrt 1))
+(print (isqrt 1.5))
+(defun firstover (n) (dotimes (i n) (setf sq (* i i)) (if (> sq 50) (return-from firstover i))))
+(print (firstover 100))
+(print (firstover 3))
+(defun bump (x) (setq x (+ x 1)) (* x 2))
+(print (bump 3))
+(print (bump 1.5))
+(defun clamp (x) (setf y (* x x)) (if (> y 10) (setf y 0)) y)
+(print (clamp 2))
+(print (clamp 5))
+(defun scale (x) (setf y 0.5) (setf y (* y x)) (loop for j from 1 to 3 do (setf z (* y j))) y)
+(print (scale 3))
+(defun steps (n) (setf c 0) (dotimes (i n) (incf c 2) (decf c 1) (if (> c 5) (return-from steps c))))
+(print (steps 10))
+(print (steps 3))
+(defun retype (x) (setf y 1) (setf y 1.5) y)
+(print (retype 1))
+(defun over () (loop for i from 9223372036854775806 to 9223372036854775807 do (setf k i)))
+(print (over))
+(defvar acc (make-array 1))
+(setf (aref acc 0) 0)
+(dotimes (k 3000) (setf (aref acc 0) (+ (aref acc 0) (isqrt (+ k 2)) (firstover (+ k 20)) (steps 10))))
+(print (aref acc 0))
+(defun upto (a b) (loop for i from a to b do (if (= i 9223372036854775807) (return-from upto i))))
+(dotimes (k 2000) (upto 1 3))
+(print (upto 9223372036854775800 9223372036854775807))
+(print (upto 5 4))
+(defun long (n) (setf s 0) (dotimes (i n) (setf s i)) 1)
+(print (long 5000))
+(defun down (x) (setq x (- x 1)) (if (> x 0) (/ 1 (- x x))) x)
+(dotimes (k 3000) (down 1))
+(print (down 1))
+(print (down 2))
@@ -0,0 +1,22 @@
+(defun sum (n acc) (if (= n 0) acc (sum (- n 1) (+ acc n))))
+(print (sum 1000000 0))
+(defun sumf (n acc) (if (<= n 0.0) acc (sumf (- n 1.0) (+ acc n))))
+(print (sumf 1000000.0 0.0))
+(defun cnt (n) (if (> n 0) (return-from cnt (cnt (- n 1)))) (print "done") n)
+(print (cnt 300000))
+(defun ev (n) (if (= n 0) t (od (- n 1))))
+(defun od (n) (if (= n 0) nil (ev (- n 1))))
+(print (ev 1000001))
+(defun gs (n acc) (if (= n 0) acc (gs (- n 1) (+ acc "x"))))
+(defvar arr (make-array 3))
+(setf (aref arr 0) 5)
+(defun walk (a n acc) (if (= n 0) acc (walk a (- n 1) (+ acc (aref a 0)))))
+(print (walk arr 500000 0))
+(defun f3 (a b c) (if (= a 0) (+ b c) (f3 (- a 1) c b)))
+(print (f3 500001 1 2))
+(defun nt (n) (if (= n 0) 0 (+ 1 (nt (- n 1)))))
+(print (nt 1000))
+(defun mixed (n) (if (= n 0) "str" (mixed (- n 1))))
+(print (mixed 400000))
+(defun loc (n) (defvar tmp (* n 2)) (if (= n 0) tmp (loc (- n 1))))
+(print (loc 200000))
@@ -54,6 +54,23 @@ enum Token {
 	RETURN_FROM,
 	MAKE_ARRAY,
 	DEFCONSTANT,
+	ARRAY_SUM,
+	ARRAY_DOT,
+	ARRAY_FILL,
+	ARRAY_MAX,
+	ARRAY_MIN,
+	ARRAY_ADD,
+	ARRAY_MUL,
+	ARRAY_SCALE,
+	DECLAIM,
+	MEMOIZE,
+	PDOTIMES,
+	FUTURE,
+	TOUCH,
+	MAKE_CHANNEL,
+	CHANNEL_SEND,
+	CHANNEL_RECV,
+	CHANNEL_CLOSE,
 };
 
 }
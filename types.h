@@ -10,6 +10,8 @@ enum ValueType {
 	TYPE_ARRAY,
 	TYPE_T,		// has no value
 	TYPE_NIL,	// has no value
+	TYPE_FUTURE,
+	TYPE_CHANNEL,
 };
 
 } // namespace DragonLisp
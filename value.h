@@ -1,262 +1,572 @@
 #ifndef __DRAGON_LISP_VALUE_H__
 #define __DRAGON_LISP_VALUE_H__
 
-#include <variant>
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "types.h"
 
 namespace DragonLisp {
 
-using ValueVariant = std::variant<std::monostate, std::int64_t, double, std::string>;
+/// Object - Reference counted heap payload of a Value.
+/// Strings, arrays, integers outside of the immediate range, futures and
+/// channels live here.
+/// Counts are atomic, so threads of a parallel loop may share payloads.
+class Object {
+private:
+	const ValueType type;
+
+	std::atomic<std::uint32_t> refs = 0;
+
+	friend class Value;
+
+protected:
+	explicit Object(ValueType t) : type(t) {}
 
-class Value {
 public:
-	virtual bool isArray() const = 0;
+	Object(const Object& rhs) : type(rhs.type), refs(0) {}
+
+	Object& operator=(const Object&) = delete;
+
+	virtual ~Object() = default;
 
-	virtual std::shared_ptr<Value> copy() const = 0;
+	ValueType getType() const {
+		return this->type;
+	}
 
 	virtual std::string toString() const = 0;
 };
 
-class SingleValue : public Value {
+class StringObject : public Object {
 private:
-	ValueType type;
+	std::string value;
+
+public:
+	explicit StringObject(std::string v) : Object(TYPE_STRING), value(std::move(v)) {}
+
+	const std::string& get() const {
+		return this->value;
+	}
 
-	ValueVariant value;
+	std::string toString() const override final {
+		return this->value;
+	}
+};
 
-	explicit SingleValue(ValueType t) : type(t), value() {}
+class IntObject : public Object {
+private:
+	std::int64_t value;
 
 public:
-	explicit SingleValue(std::int64_t v) : value(v), type(TYPE_INTEGER) {}
+	explicit IntObject(std::int64_t v) : Object(TYPE_INTEGER), value(v) {}
+
+	std::int64_t get() const {
+		return this->value;
+	}
 
-	explicit SingleValue(double v) : value(v), type(TYPE_FLOAT) {}
+	std::string toString() const override final {
+		return std::to_string(this->value);
+	}
+};
+
+class ArrayValue;
+
+/// Value - 64-bit NaN-boxed value.
+///
+/// Doubles are stored as their IEEE-754 bits, with NaNs canonicalised so that
+/// the upper 16 bits never exceed 0xFFF8. Everything else is tagged in the
+/// remaining quiet-NaN space:
+///   0xFFF9 | int48	integer in [-2^47, 2^47)
+///   0xFFFA | 0 / 1	NIL / T
+///   0xFFFA | 2	unbound frame slot, never visible to programs
+///   0xFFFB | ptr48	Object*
+class Value {
+private:
+	std::uint64_t bits;
 
-	explicit SingleValue(std::string v) : value(std::move(v)), type(TYPE_STRING) {}
+	static constexpr std::uint64_t TAG_SHIFT = 48;
+	static constexpr std::uint64_t PAYLOAD_MASK = (std::uint64_t(1) << TAG_SHIFT) - 1;
+	static constexpr std::uint64_t TAG_INT = 0xFFF9;
+	static constexpr std::uint64_t TAG_CONST = 0xFFFA;
+	static constexpr std::uint64_t TAG_OBJECT = 0xFFFB;
 
-	explicit SingleValue(bool v) : type(v ? TYPE_T : TYPE_NIL), value() {}
+	static constexpr std::uint64_t NIL_BITS = TAG_CONST << TAG_SHIFT;
+	static constexpr std::uint64_t T_BITS = (TAG_CONST << TAG_SHIFT) | 1;
+	static constexpr std::uint64_t UNBOUND_BITS = (TAG_CONST << TAG_SHIFT) | 2;
 
-	SingleValue() : SingleValue(ValueType::TYPE_NIL) {}
+	static constexpr std::int64_t INT_MIN48 = -(std::int64_t(1) << 47);
+	static constexpr std::int64_t INT_MAX48 = (std::int64_t(1) << 47) - 1;
 
-	bool isArray() const override final {
-		return false;
+	inline std::uint64_t tag() const {
+		return this->bits >> TAG_SHIFT;
 	}
 
-	ValueType getType() const {
-		return this->type;
+	inline Object* object() const {
+		return reinterpret_cast<Object*>(this->bits & PAYLOAD_MASK);
 	}
 
-	bool isT() const {
-		return this->type == ValueType::TYPE_T;
+	inline void retain() const {
+		if (this->isObject())
+			this->object()->refs.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	bool isNil() const {
-		return this->type == ValueType::TYPE_NIL;
+	inline void release() {
+		if (this->isObject() && this->object()->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this->object();
 	}
 
-	bool isInt() const {
-		return std::holds_alternative<std::int64_t>(this->value);
+	inline bool isObjectOf(ValueType t) const {
+		return this->isObject() && this->object()->type == t;
 	}
 
-	bool isFloat() const {
-		return std::holds_alternative<double>(this->value);
+public:
+	Value() : bits(NIL_BITS) {}
+
+	explicit Value(bool v) : bits(v ? T_BITS : NIL_BITS) {}
+
+	explicit Value(std::int64_t v) {
+		if (v >= INT_MIN48 && v <= INT_MAX48)
+			this->bits = (TAG_INT << TAG_SHIFT) | (static_cast<std::uint64_t>(v) & PAYLOAD_MASK);
+		else
+			this->bits = Value(new IntObject(v)).steal();
 	}
 
-	bool isString() const {
-		return std::holds_alternative<std::string>(this->value);
+	explicit Value(double v) {
+		std::memcpy(&this->bits, &v, sizeof(double));
+		// Bit test instead of std::isnan, which -ffast-math folds away
+		if ((this->bits & 0x7FF0000000000000ull) == 0x7FF0000000000000ull && (this->bits & 0x000FFFFFFFFFFFFFull))
+			this->bits = (this->bits & 0x8000000000000000ull) | 0x7FF8000000000000ull;
 	}
 
-	std::int64_t getInt() const {
-		return std::get<std::int64_t>(this->value);
+	explicit Value(std::string v) : Value(new StringObject(std::move(v))) {}
+
+	explicit Value(Object* obj) : bits((TAG_OBJECT << TAG_SHIFT) | reinterpret_cast<std::uint64_t>(obj)) {
+		this->retain();
 	}
 
-	double getFloat() const {
-		return std::get<double>(this->value);
+	Value(const Value& rhs) : bits(rhs.bits) {
+		this->retain();
 	}
 
-	std::string getString() const {
-		return std::get<std::string>(this->value);
+	Value(Value&& rhs) noexcept : bits(rhs.bits) {
+		rhs.bits = NIL_BITS;
 	}
 
-	ValueVariant getValue() const {
-		return this->value;
+	Value& operator=(const Value& rhs) {
+		rhs.retain();
+		this->release();
+		this->bits = rhs.bits;
+		return *this;
+	}
+
+	Value& operator=(Value&& rhs) noexcept {
+		if (this != &rhs) {
+			this->release();
+			this->bits = rhs.bits;
+			rhs.bits = NIL_BITS;
+		}
+		return *this;
 	}
 
-	void setValue(ValueVariant v) {
-		this->value = std::move(v);
+	~Value() {
+		this->release();
 	}
 
-	std::shared_ptr<Value> copy() const override final {
-		return std::make_shared<SingleValue>(*this);
+	/// Marker for a Context slot whose variable has not been assigned yet.
+	static Value unbound() {
+		Value v;
+		v.bits = UNBOUND_BITS;
+		return v;
 	}
 
-	std::string toString() const override final {
-		if (this->isInt())
-			return std::to_string(this->getInt());
+	/// Give up ownership of the payload and return the raw bits.
+	std::uint64_t steal() {
+		auto b = this->bits;
+		this->bits = NIL_BITS;
+		return b;
+	}
+
+	inline bool isObject() const {
+		return this->tag() == TAG_OBJECT;
+	}
+
+	inline bool isFloat() const {
+		return this->tag() < TAG_INT;
+	}
+
+	inline bool isSmallInt() const {
+		return this->tag() == TAG_INT;
+	}
+
+	inline bool isInt() const {
+		return this->isSmallInt() || this->isObjectOf(TYPE_INTEGER);
+	}
+
+	inline bool isNumber() const {
+		return this->isFloat() || this->isInt();
+	}
+
+	inline bool isString() const {
+		return this->isObjectOf(TYPE_STRING);
+	}
+
+	inline bool isFuture() const {
+		return this->isObjectOf(TYPE_FUTURE);
+	}
+
+	inline bool isChannel() const {
+		return this->isObjectOf(TYPE_CHANNEL);
+	}
+
+	inline bool isArray() const {
+		return this->isObjectOf(TYPE_ARRAY);
+	}
+
+	inline bool isT() const {
+		return this->bits == T_BITS;
+	}
+
+	inline bool isNil() const {
+		return this->bits == NIL_BITS;
+	}
+
+	inline bool isUnbound() const {
+		return this->bits == UNBOUND_BITS;
+	}
+
+	ValueType getType() const {
 		if (this->isFloat())
-			return std::to_string(this->getFloat());
-		if (this->isString())
-			return this->getString();
-		if (this->isT())
-			return "T";
-		return "NIL";
+			return TYPE_FLOAT;
+		if (this->isSmallInt())
+			return TYPE_INTEGER;
+		if (this->isObject())
+			return this->object()->type;
+		return this->isT() ? TYPE_T : TYPE_NIL;
+	}
+
+	inline std::int64_t getInt() const {
+		if (this->isSmallInt())
+			return static_cast<std::int64_t>(this->bits << 16) >> 16;
+		return static_cast<IntObject*>(this->object())->get();
+	}
+
+	inline double getFloat() const {
+		double d;
+		std::memcpy(&d, &this->bits, sizeof(double));
+		return d;
+	}
+
+	/// Numeric value as double, for mixed int / float arithmetic.
+	inline double getNumber() const {
+		return this->isFloat() ? this->getFloat() : static_cast<double>(this->getInt());
+	}
+
+	const std::string& getString() const {
+		return static_cast<StringObject*>(this->object())->get();
+	}
+
+	inline ArrayValue* getArray() const;
+
+	/// Payload of a future or a channel, see Future.h and Channel.h.
+	inline Object* getObject() const {
+		return this->object();
 	}
 
-	bool operator==(const SingleValue& rhs) const {
-		return type == rhs.type && value == rhs.value;
+	/// Array payload for writing. Storage shared with other Values is
+	/// detached first, so writes are never visible through another copy.
+	inline ArrayValue* getMutableArray();
+
+	/// Value semantics. Arrays are shared copy-on-write, everything else is
+	/// immutable, so this never duplicates storage.
+	Value copy() const {
+		return *this;
 	}
 
-	bool operator<(const SingleValue& rhs) const {
-		if ((!this->isInt() && !this->isFloat()) || (!rhs.isInt() && !rhs.isFloat()))
+	std::string toString() const {
+		if (this->isFloat())
+			return std::to_string(this->getFloat());
+		if (this->isSmallInt())
+			return std::to_string(this->getInt());
+		if (this->isObject())
+			return this->object()->toString();
+		return this->isT() ? "T" : "NIL";
+	}
+
+	bool operator==(const Value& rhs) const {
+		if (this->bits == rhs.bits)
+			return !this->isFloat() || this->getFloat() == rhs.getFloat();
+		auto type = this->getType();
+		if (type != rhs.getType())
+			return false;
+		switch (type) {
+			case TYPE_INTEGER:
+				return this->getInt() == rhs.getInt();
+			case TYPE_FLOAT:
+				return this->getFloat() == rhs.getFloat();
+			case TYPE_STRING:
+				return this->getString() == rhs.getString();
+			default:
+				return false;
+		}
+	}
+
+	bool operator<(const Value& rhs) const {
+		if (!this->isNumber() || !rhs.isNumber())
 			throw std::runtime_error("Cannot compare non-numeric values");
 		if (this->isInt() && rhs.isInt())
 			return this->getInt() < rhs.getInt();
-		if (this->isInt())
-			return this->getInt() < rhs.getFloat();
-		if (rhs.isInt())
-			return this->getFloat() < rhs.getInt();
-		return this->getFloat() < rhs.getFloat();
+		return this->getNumber() < rhs.getNumber();
 	}
 
-	bool operator<=(const SingleValue& rhs) const {
-		if ((!this->isInt() && !this->isFloat()) || (!rhs.isInt() && !rhs.isFloat()))
+	bool operator<=(const Value& rhs) const {
+		if (!this->isNumber() || !rhs.isNumber())
 			throw std::runtime_error("Cannot compare non-numeric values");
 		if (this->isInt() && rhs.isInt())
 			return this->getInt() <= rhs.getInt();
-		if (this->isInt())
-			return this->getInt() <= rhs.getFloat();
-		if (rhs.isInt())
-			return this->getFloat() <= rhs.getInt();
-		return this->getFloat() <= rhs.getFloat();
+		return this->getNumber() <= rhs.getNumber();
 	}
 
-	SingleValue& operator++() {
+	Value& operator++() {
 		if (this->isInt())
-			this->value = this->getInt() + 1;
+			*this = Value(this->getInt() + 1);
 		else if (this->isFloat())
-			this->value = this->getFloat() + 1;
+			*this = Value(this->getFloat() + 1);
 		else
 			throw std::runtime_error("Cannot increment non-numeric value");
 		return *this;
 	}
 
-	SingleValue& operator--() {
+	Value& operator--() {
 		if (this->isInt())
-			this->value = this->getInt() - 1;
+			*this = Value(this->getInt() - 1);
 		else if (this->isFloat())
-			this->value = this->getFloat() - 1;
+			*this = Value(this->getFloat() - 1);
 		else
 			throw std::runtime_error("Cannot decrement non-numeric value");
 		return *this;
 	}
+};
 
-	SingleValue operator++(int) {
-		SingleValue tmp(*this);
-		operator++();
-		return tmp;
-	}
-
-	SingleValue operator--(int) {
-		SingleValue tmp(*this);
-		operator--();
-		return tmp;
-	}
+enum ArrayKind {
+	ARRAY_EMPTY,	// nothing stored yet, every element is NIL
+	ARRAY_INT,	// packed int64_t
+	ARRAY_FLOAT,	// packed double
+	ARRAY_GENERIC,	// boxed Values
 };
 
-class ArrayValue : public Value {
+/// ArrayValue - Fixed size array with packed storage for homogeneous data.
+///
+/// Elements that were never set are holes and read as NIL. The first
+/// element stored picks the kind; storing an element of a different type
+/// later converts the array to ARRAY_GENERIC for good.
+class ArrayValue : public Object {
 private:
-	std::vector<SingleValue> values;
+	ArrayKind kind = ARRAY_EMPTY;
 
 	std::size_t size;
 
-public:
-	ArrayValue() = delete;
+	// Unset elements of packed storage
+	std::size_t holes;
 
-	explicit ArrayValue(std::size_t s) : values(s), size(s) {}
+	std::vector<std::int64_t> ints;
+	std::vector<double> floats;
+	std::vector<Value> values;
 
-	explicit ArrayValue(std::vector<SingleValue> v) : values(std::move(v)), size(this->values.size()) {}
+	// Hole markers. Canonicalised doubles never carry a signalling NaN,
+	// and storing INT_HOLE itself falls back to generic storage.
+	static constexpr std::int64_t INT_HOLE = INT64_MIN;
+	static constexpr std::uint64_t FLOAT_HOLE_BITS = 0x7FF4000000000000ull;
 
-	bool isArray() const override final {
-		return true;
+	static inline bool isHole(double d) {
+		std::uint64_t b;
+		std::memcpy(&b, &d, sizeof(double));
+		return b == FLOAT_HOLE_BITS;
 	}
 
-	std::size_t getSize() const {
-		return this->size;
+	static inline double floatHole() {
+		double d;
+		std::memcpy(&d, &FLOAT_HOLE_BITS, sizeof(double));
+		return d;
 	}
 
-	SingleValue operator[](std::size_t i) const {
-		return this->values[i];
+	void toGeneric() {
+		this->values.resize(this->size);
+		for (std::size_t i = 0; i < this->size; ++i)
+			this->values[i] = this->get(i);
+		this->ints = {};
+		this->floats = {};
+		this->kind = ARRAY_GENERIC;
 	}
 
-	void set(std::size_t i, SingleValue v) {
-		this->values[i] = std::move(v);
-	}
+public:
+	ArrayValue() = delete;
 
-	std::vector<SingleValue>& getValues() {
-		return this->values;
+	explicit ArrayValue(std::size_t s) : Object(TYPE_ARRAY), size(s), holes(s) {}
+
+	/// Dense packed arrays, as produced by the array primitives.
+	explicit ArrayValue(std::vector<std::int64_t> v) : Object(TYPE_ARRAY), kind(ARRAY_INT), size(v.size()), holes(0), ints(std::move(v)) {
+		// INT_HOLE is a legitimate result of packed arithmetic
+		if (std::find(this->ints.begin(), this->ints.end(), INT_HOLE) == this->ints.end())
+			return;
+		this->values.reserve(this->size);
+		for (auto i : this->ints)
+			this->values.emplace_back(i);
+		this->ints = {};
+		this->kind = ARRAY_GENERIC;
 	}
 
-	const std::vector<SingleValue>& getValues() const {
-		return this->values;
+	explicit ArrayValue(std::vector<double> v) : Object(TYPE_ARRAY), kind(ARRAY_FLOAT), size(v.size()), holes(0), floats(std::move(v)) {}
+
+	std::size_t getSize() const {
+		return this->size;
 	}
 
-	std::shared_ptr<Value> copy() const override final {
-		return std::make_shared<ArrayValue>(*this);
+	ArrayKind getKind() const {
+		return this->kind;
+	}
+
+	/// Packed storage without holes, ready for bulk kernels.
+	bool isDense() const {
+		return (this->kind == ARRAY_INT || this->kind == ARRAY_FLOAT) && !this->holes;
+	}
+
+	const std::int64_t* intData() const {
+		return this->ints.data();
+	}
+
+	const double* floatData() const {
+		return this->floats.data();
+	}
+
+	inline Value get(std::size_t i) const {
+		switch (this->kind) {
+			case ARRAY_INT:
+				return this->ints[i] == INT_HOLE ? Value() : Value(this->ints[i]);
+			case ARRAY_FLOAT:
+				return isHole(this->floats[i]) ? Value() : Value(this->floats[i]);
+			case ARRAY_GENERIC:
+				return this->values[i];
+			default:
+				return Value();
+		}
+	}
+
+	inline void set(std::size_t i, const Value& v) {
+		if (this->kind == ARRAY_EMPTY) {
+			if (v.isNil())
+				return;
+			if (v.isInt() && v.getInt() != INT_HOLE) {
+				this->ints.assign(this->size, INT_HOLE);
+				this->kind = ARRAY_INT;
+			} else if (v.isFloat()) {
+				this->floats.assign(this->size, floatHole());
+				this->kind = ARRAY_FLOAT;
+			} else {
+				this->values.resize(this->size);
+				this->kind = ARRAY_GENERIC;
+			}
+		}
+
+		switch (this->kind) {
+			case ARRAY_INT:
+				if (v.isInt() && v.getInt() != INT_HOLE) {
+					this->holes -= this->ints[i] == INT_HOLE;
+					this->ints[i] = v.getInt();
+					return;
+				}
+				if (v.isNil()) {
+					this->holes += this->ints[i] != INT_HOLE;
+					this->ints[i] = INT_HOLE;
+					return;
+				}
+				break;
+			case ARRAY_FLOAT:
+				if (v.isFloat()) {
+					this->holes -= isHole(this->floats[i]);
+					this->floats[i] = v.getFloat();
+					return;
+				}
+				if (v.isNil()) {
+					this->holes += !isHole(this->floats[i]);
+					this->floats[i] = floatHole();
+					return;
+				}
+				break;
+			default:
+				break;
+		}
+
+		if (this->kind != ARRAY_GENERIC)
+			this->toGeneric();
+		this->values[i] = v;
+	}
+
+	/// Store without changing the storage kind, for threads writing distinct
+	/// elements at once. Returns false if `v` needs another kind. The change
+	/// in unset elements is added to `holes` instead, see addHoles.
+	inline bool setInPlace(std::size_t i, const Value& v, std::ptrdiff_t& holes) {
+		switch (this->kind) {
+			case ARRAY_INT:
+				if (v.isInt() && v.getInt() != INT_HOLE) {
+					holes -= this->ints[i] == INT_HOLE;
+					this->ints[i] = v.getInt();
+					return true;
+				}
+				if (v.isNil()) {
+					holes += this->ints[i] != INT_HOLE;
+					this->ints[i] = INT_HOLE;
+					return true;
+				}
+				return false;
+			case ARRAY_FLOAT:
+				if (v.isFloat()) {
+					holes -= isHole(this->floats[i]);
+					this->floats[i] = v.getFloat();
+					return true;
+				}
+				if (v.isNil()) {
+					holes += !isHole(this->floats[i]);
+					this->floats[i] = floatHole();
+					return true;
+				}
+				return false;
+			case ARRAY_GENERIC:
+				this->values[i] = v;
+				return true;
+			default:
+				return v.isNil();
+		}
+	}
+
+	void addHoles(std::ptrdiff_t n) {
+		this->holes += n;
 	}
 
 	std::string toString() const override final {
 		std::string result = "[";
-		for (const auto& i : this->values)
-			result.append(i.toString()).append(", ");
+		for (std::size_t i = 0; i < this->size; ++i)
+			result.append(this->get(i).toString()).append(", ");
 		result.pop_back();
 		result.back() = ']';
 		return result;
 	}
 };
 
-class _Unused_Variable {
-protected:
-	std::string name;
-
-	std::variant<ArrayValue, SingleValue> val;
-
-public:
-	_Unused_Variable() = delete;
-
-	_Unused_Variable(std::string n, SingleValue v) : name(std::move(n)), val(std::move(v)) {}
-
-	_Unused_Variable(std::string n, ArrayValue v) : name(std::move(n)), val(std::move(v)) {}
-
-	std::string getName() const {
-		return this->name;
-	}
-
-	bool isArray() const {
-		return std::holds_alternative<ArrayValue>(this->val);
-	}
-
-	bool isValue() const {
-		return std::holds_alternative<SingleValue>(this->val);
-	}
-
-	ArrayValue getArray() const {
-		return std::get<ArrayValue>(this->val);
-	}
-
-	SingleValue getValue() const {
-		return std::get<SingleValue>(this->val);
-	}
-
-	void set(SingleValue v) {
-		this->val = std::move(v);
-	}
+inline ArrayValue* Value::getArray() const {
+	return static_cast<ArrayValue*>(this->object());
+}
 
-	void set(ArrayValue v) {
-		this->val = std::move(v);
-	}
-};
+inline ArrayValue* Value::getMutableArray() {
+	if (this->object()->refs.load(std::memory_order_acquire) > 1)
+		*this = Value(new ArrayValue(*this->getArray()));
+	return this->getArray();
+}
 
 }
 